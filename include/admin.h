@@ -0,0 +1,28 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+#include <sys/types.h>
+
+// ============================================================
+// Admin control socket (UNIX domain, mode 0600)
+//
+// Line based, for operators:
+//     sudo socat - UNIX-CONNECT:/var/lib/fileserver/admin-<port>.sock
+//
+// Commands: sessions, transfers, kill <pid>, drain <pid>,
+//           stats, locks, quota [<user> <size>|off], help, quit
+//
+// Environment:
+//   FILESERVER_ADMIN   socket path (default ADMIN_DIR/admin-<port>.sock),
+//                      "off" disables it
+// ============================================================
+
+#define ADMIN_DIR  "/var/lib/fileserver"   // Created 0700 if missing
+
+// Create the listening socket. Returns -1 if disabled or on error.
+int  adminOpen(int serverPort);
+
+// Serve operators until SIGTERM or until parentPid exits (never returns)
+void adminServe(int listenFd, pid_t parentPid);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+// ============================================================
+// Streamed directory archive (upload -r / download -r)
+//
+// The whole tree travels as one stream of blocks over the payload
+// layer: int blockLen + blockLen bytes (at most ARCHIVE_BLOCK_SIZE).
+// Inside the blocks: ArchiveEntryHeader + path + file content, for
+// every entry, terminated by an ARCHIVE_END entry.
+// Small files are packed into the same block, so a tree of many
+// small files costs a few large sends instead of one round trip
+// per file. Nothing is stored on disk as a temporary archive.
+// ============================================================
+
+#define ARCHIVE_BLOCK_SIZE (64 * 1024)
+
+// Entry types
+#define ARCHIVE_DIR   1
+#define ARCHIVE_FILE  2
+#define ARCHIVE_END   3
+
+typedef struct {
+    int       type;      // ARCHIVE_*
+    int       mode;      // Permission bits (0777)
+    long long size;      // File content bytes that follow the path
+    int       pathLen;   // Relative path bytes that follow (no NUL)
+    int       status;    // ARCHIVE_END: errors on the sending side
+} ArchiveEntryHeader;
+
+// Optional callbacks (server passes its fcntl locks and its quota
+// bracket, the client passes NULL). Any of them may be NULL.
+//   fileBegin: before a received file is written, size = its bytes;
+//              -1 refuses it (content drained, counted as an error)
+//   fileEnd:   after an admitted file, delta = its size change on disk
+typedef struct {
+    int  (*lockRead)(int fd);
+    int  (*lockWrite)(int fd);
+    int  (*unlock)(int fd);
+    int  (*fileBegin)(void *ctx, long long size);
+    void (*fileEnd)(void *ctx, long long delta);
+    void  *ctx;
+} ArchiveHooks;
+
+typedef struct {
+    long long files;     // Regular files sent / written
+    long long dirs;      // Directories sent / created
+    long long bytes;     // File content bytes
+    int       errors;    // Entries that failed (both sides)
+} ArchiveStats;
+
+// Stream directory tree rootPath to sock.
+// Returns 0 when the stream was sent completely, -1 on connection error.
+int archiveSendTree(int sock, const char *rootPath,
+                    const ArchiveHooks *hooks, ArchiveStats *stats);
+
+// Receive a tree from sock and extract it below destRoot.
+// Entries with unsafe paths ("..", absolute, ...) are skipped.
+// Returns 0 when the whole stream was consumed, -1 on stream error.
+int archiveReceiveTree(int sock, const char *destRoot,
+                       const ArchiveHooks *hooks, ArchiveStats *stats);
+
+#endif
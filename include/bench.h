@@ -0,0 +1,85 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+// ============================================================
+// Load generator (bench)
+//
+// Every simulated client is a forked worker process with its own
+// connection, like the server's session processes. Workers record
+// into the same shared ServerStats segment the server uses
+// (stats.h), so latency histograms and percentiles are identical
+// on both sides of the wire.
+//
+// Operations return the final status (STATUS_*), or -1 when the
+// connection was lost.
+// ============================================================
+
+#define BENCH_OPS        9
+#define BENCH_NAME_SIZE  64
+#define BENCH_CREATED    1024       // Files created and not yet deleted
+
+// Operations of the mix
+typedef enum {
+    BENCH_LOGIN = 0,
+    BENCH_CD,
+    BENCH_LIST,
+    BENCH_CREATE,
+    BENCH_WRITE,
+    BENCH_READ,
+    BENCH_UPLOAD,
+    BENCH_DOWNLOAD,
+    BENCH_DELETE
+} BenchOp;
+
+typedef struct {
+    int         sock;               // -1 = not connected
+    int         id;                 // Worker number
+    const char *host;
+    int         port;
+    int         compress;
+    const char *user;
+    char        dir[BENCH_NAME_SIZE];  // Working directory, relative to home
+
+    int         files;              // Pre-written files f0..f<files-1>
+    int         payloadSize;
+    char       *payload;            // Data for write
+    int         uploadFd;           // Upload source (first size bytes sent)
+    int         scratchFd;          // Download target
+
+    int         created[BENCH_CREATED];   // Ring of created file numbers
+    int         createdHead;
+    int         createdCount;
+    int         createdNext;
+} BenchSession;
+
+// Connection: benchNet.c implements network.h for the bench.
+// sendAll/recvAll return -1 instead of exiting and
+// getTrafficCounters() counts the bytes of this worker.
+
+// Single operations (benchOps.c)
+int  benchOpenSession(BenchSession *s);      // connect + compress + login
+void benchCloseSession(BenchSession *s);
+int  benchCd(BenchSession *s, const char *path);
+int  benchList(BenchSession *s);
+int  benchCreate(BenchSession *s, const char *path, int directory);
+int  benchDelete(BenchSession *s, const char *path);
+int  benchWrite(BenchSession *s, const char *path, const char *data, int size);
+int  benchRead(BenchSession *s, const char *path);
+int  benchUpload(BenchSession *s, const char *path, int fd, long long size);
+int  benchDownload(BenchSession *s, const char *path, int fd);
+
+// Run one operation of the mix (picks file names itself)
+int  benchRunOp(BenchSession *s, BenchOp op);
+
+// Mix names and the protocol command each one is recorded as
+const char *benchOpName(BenchOp op);
+int         benchOpCommand(BenchOp op);
+
+// Transfer sweep and build comparison (benchTransfer.c),
+// argv[0] is the subcommand
+int  benchTransferMain(const char *prog, int argc, char *argv[]);
+int  benchCompareMain(const char *prog, int argc, char *argv[]);
+
+#endif
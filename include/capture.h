@@ -0,0 +1,81 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+// ============================================================
+// Protocol traffic capture (replayed with the replay tool)
+//
+// Every session process appends to its own binary file
+// <dir>/capture-<pid>.fcap: one CaptureHeader, then one record per
+// request, written with a single write() when the request ends:
+//
+//     CaptureRecord | arg1 | arg2 | arg3 | inbound bytes
+//
+// Args are stored without their NUL (lengths in the record). The
+// inbound bytes are what the client sent after the ProtocolMessage
+// (write / upload / upload_tree streams), exactly as on the wire,
+// so a replay of a compressed session is byte-identical. They are
+// only kept with FILESERVER_CAPTURE_PAYLOADS, up to that many bytes
+// per request; otherwise only their size (bytesIn) is recorded.
+//
+// Integers are in host byte order; captures are read on the same
+// kind of machine that wrote them.
+//
+// Environment:
+//   FILESERVER_CAPTURE_DIR       enable capture, directory for files
+//   FILESERVER_CAPTURE_PAYLOADS  keep inbound bytes, max per request
+//                                (K / M suffix, e.g. 4M)
+// ============================================================
+
+#define CAPTURE_MAGIC    "FSCAP\0\0\1"
+#define CAPTURE_VERSION  1
+
+// CaptureHeader.flags
+#define CAPTURE_HAS_PAYLOADS  0x1
+
+// CaptureRecord.flags
+#define CAPTURE_REC_TRUNCATED 0x1   // Inbound bytes over the limit, not stored
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t startUnixNs;           // Session start, wall clock
+    int32_t  pid;                   // Session process
+    uint32_t payloadMax;            // Inbound bytes kept per request
+} CaptureHeader;
+
+typedef struct {
+    uint64_t offsetNs;              // Request start, from session start
+    uint64_t durationNs;            // Dispatch time on the server
+    uint64_t bytesIn;               // Received after the message
+    uint64_t bytesOut;              // Sent while handling
+    int32_t  command;
+    int32_t  status;                // Final status (as in the statistics)
+    uint16_t argLen[3];
+    uint16_t flags;
+    uint32_t payloadLen;            // Inbound bytes stored after the args
+    uint32_t reserved;
+} CaptureRecord;
+
+// Non-zero while the current request is being captured
+extern int gCaptureActive;
+
+// Read the environment (main, before forking)
+void captureInit(void);
+
+// Create this session's capture file (session child, before login
+// changes the effective uid)
+void captureSessionStart(void);
+
+// Request boundaries (processCommand)
+void captureRequestStart(const char *arg1, const char *arg2, const char *arg3,
+                         int command);
+void captureRequestEnd(int status, unsigned long long bytesIn,
+                       unsigned long long bytesOut);
+
+// Bytes received while handling the request (recvAll)
+void captureInbound(const void *data, int size);
+
+#endif
@@ -12,9 +12,16 @@ int clientHandleInput(int sock, char *input);
 int clientUpload(int sock, const char *localPath, const char *remotePath);
 int clientDownload(int sock, const char *remotePath, const char *localPath);
 
+// downloadFile() result when the local copy is still current
+#define DOWNLOAD_NOT_MODIFIED 1
+
 // Store server IP and port for background processes.
 void setGlobalServerInfo(const char *ip, int port);
 
+// Negotiate payload compression on a connected socket.
+// Returns 0 if the server accepted it.
+int clientNegotiateCompression(int sock);
+
 // Client-side state, used only for the prompt.
 const char* getCurrentPath();
 const char* getUsername();
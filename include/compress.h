@@ -0,0 +1,18 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+// In-tree LZ77 block codec (LZ4-like format, 64 KB window).
+// Used by the payload layer for on-the-wire compression.
+
+// Worst-case compressed size for srcLen input bytes
+#define LZ_BOUND(srcLen) ((srcLen) + (srcLen) / 255 + 16)
+
+// Compress srcLen bytes into dst (at most dstCap bytes).
+// Returns compressed size, or -1 if the output does not fit.
+int lzCompress(const char *src, int srcLen, char *dst, int dstCap);
+
+// Decompress exactly dstLen bytes from a compressed block.
+// Returns dstLen on success, -1 on corrupt input.
+int lzDecompress(const char *src, int srcLen, char *dst, int dstLen);
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef DU_H
+#define DU_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// ============================================================
+// Disk usage (du command) and its shared aggregate index
+//
+// The index keeps the recursive totals (bytes of regular files,
+// files, subdirectories) of directories that were walked, keyed by
+// path, directory inode and the effective uid of the walking session
+// (the permission rules decide what a user can see).
+//
+// Handlers that change a home bracket the change with
+// duChangeBegin() / duChangeEnd() and report its size delta with
+// duChangeApply(), which adds it to every indexed ancestor. Changes
+// whose delta is not known (directory moves, tree copies, uploaded
+// trees, chmod of a directory) call duChangeDrop() and the home's
+// totals are walked again on the next query.
+//
+// A walk only publishes its totals if no change of the same home was
+// in flight or started while it ran, so a total never misses or counts
+// twice a change that raced the walk. Entries older than DU_MAX_AGE
+// are walked again: changes made outside the server are picked up.
+//
+// Environment:
+//   FILESERVER_DU_INDEX=off   disable the index (every query walks)
+// ============================================================
+
+#define DU_SLOTS        4096
+#define DU_PROBES       8         // Slots tried per directory
+#define DU_HOMES        64        // Change counters (homes hash into them)
+#define DU_INFLIGHT     8         // Concurrent changes tracked per home
+#define DU_MAX_AGE      600       // Seconds
+#define DU_PUBLISH_MAX  1024      // Directories indexed per walk (shallow first)
+
+typedef struct {
+    long long bytes;              // Apparent size of regular files
+    long long files;
+    long long dirs;               // Subdirectories, recursive
+    int       partial;            // Some directories could not be read
+} DuTotals;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t updates;             // Deltas added to indexed directories
+    uint64_t drops;               // Homes whose totals were forgotten
+} DuCounters;
+
+typedef struct {
+    int home;                     // -1 = index off
+    int slot;                     // In-flight slot, -1 = none free
+} DuChange;
+
+// Create the shared index (main, before forking); 1 if on, 0 if
+// disabled, -1 on failure
+int  duIndexInit(void);
+
+// Totals of an indexed directory for this session's uid; -1 on a miss
+int  duLookup(const char *path, const struct stat *st, DuTotals *out);
+
+// Change bracket, homeDir = the home being changed
+void duChangeBegin(DuChange *c, const char *homeDir);
+void duChangeApply(DuChange *c, const char *path, long long bytes,
+                   long long files, long long dirs);
+void duChangeDrop(DuChange *c);
+void duChangeForget(DuChange *c, const char *path);   // Removed directory
+void duChangeEnd(DuChange *c);
+
+// Counters for metrics; 0 if the index is disabled
+int  duIndexCounters(DuCounters *out);
+
+// ------------------------------------------------------------
+// Query
+// ------------------------------------------------------------
+typedef struct {
+    char     name[256];           // Subdirectory, "" = files of the directory itself
+    DuTotals totals;
+} DuRow;
+
+typedef struct {
+    int                rows;      // Subdirectories
+    int                hits;      // Rows answered by the index
+    unsigned long long walked;    // Directories read by the walk
+    int                workers;
+} DuStats;
+
+// Totals of the directory open as dirFd (fullPath is its server path)
+// and of each of its subdirectories. *rows (malloc'ed, caller frees)
+// holds the files of the directory itself first, then one row per
+// subdirectory. Indexed subdirectories are answered from the index,
+// the others are walked in parallel (find's worker pool size).
+// Returns 0, -1 with errno set on failure.
+int  duQuery(int dirFd, const char *fullPath, const char *homeDir,
+             DuTotals *total, DuRow **rows, int *count, DuStats *stats);
+
+// Text report: the top largest subdirectories, the files of the
+// directory itself and the total (sorts rows)
+int  duFormat(const DuTotals *total, DuRow *rows, int count, int top,
+              char *buf, int size);
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// ============================================================
+// Hot file cache (shared by all server processes)
+//
+// Keeps the content and validator of small-to-medium files that are
+// read again and again (READ from offset 0, DOWNLOAD), keyed by
+// device, inode, mtime and size. A hit is served from shared memory:
+// no open, no lock, no read. A file is only stored after its second
+// miss (the first one leaves a key-only "ghost" entry), if its mtime
+// is at least FILECACHE_SETTLE seconds old and it has no holes (the
+// sparse stream of a cached copy must match the file's).
+//
+// Content lives in fixed-size blocks of one arena; the least recently
+// used files are evicted to make room. Entries are changed under a
+// process-shared robust mutex and published under a per-slot sequence
+// counter: readers copy the blocks without the lock and throw the copy
+// away if the slot changed meanwhile.
+//
+// Handlers that change a file's content or remove it call
+// fileCacheInvalidate(); any other change shows in the key (new mtime
+// or size).
+//
+// Environment:
+//   FILESERVER_FILECACHE=off          disable the cache
+//   FILESERVER_FILECACHE_SIZE=64M     arena size (K / M / G)
+//   FILESERVER_FILECACHE_MAX_FILE=1M  largest file kept (at most 1/4 of the arena)
+// ============================================================
+
+#define FILECACHE_SLOTS      1024
+#define FILECACHE_PROBES     8           // Slots tried per file
+#define FILECACHE_BLOCK      16384       // Arena allocation unit
+#define FILECACHE_SIZE       (64LL * 1024 * 1024)
+#define FILECACHE_MAX_FILE   (1024 * 1024)
+#define FILECACHE_SETTLE     1           // Seconds since the last change
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t fills;
+    uint64_t evictions;                 // Files dropped to make room
+    uint64_t invalidations;             // Files dropped by handlers
+    int64_t  bytes;                     // Content currently cached
+    int64_t  capacity;                  // Arena size
+    int      files;
+} FileCacheCounters;
+
+// Create the shared segment (main, before forking); 1 if on, 0 if
+// disabled, -1 on failure
+int  fileCacheInit(void);
+
+// 1 if the cache is on (callers can skip the stat otherwise)
+int  fileCacheEnabled(void);
+
+// File stat'ed as st (regular file) from offset: on a hit *data
+// (malloc'ed, caller frees) holds its len bytes, validator its
+// validator (VALIDATOR_SIZE) and 0 is returned. On a miss returns -1
+// and *wanted tells whether the caller should fileCacheStore() it.
+int  fileCacheLookup(const struct stat *st, long long offset, char **data,
+                     long long *len, char *validator, int *wanted);
+
+// Store the whole content of a file read under its shared lock (call
+// before unlocking, so no writer can change it in between)
+void fileCacheStore(const struct stat *st, const char *data, const char *validator);
+
+// The content of this file changed or the file was removed
+void fileCacheInvalidate(const struct stat *st);
+
+// Counters for metrics; 0 if the cache is disabled
+int  fileCacheCounters(FileCacheCounters *out);
+
+#endif
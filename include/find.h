@@ -0,0 +1,81 @@
+#ifndef FIND_H
+#define FIND_H
+
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// ============================================================
+// Server-side search (find command)
+//
+// The tree below one directory is walked by a small pool of worker
+// threads of the session process (they share its user identity, so
+// the kernel checks every directory they open). Subdirectories are
+// only entered with the same permission bits LIST requires, never
+// through symbolic links.
+//
+// Request: arg1 = directory, arg2 = name glob (empty = any name),
+//          arg3 = filters, space separated:
+//
+//     -type f|d            regular files / directories only
+//     -size [+|-]N[K|M|G]  larger than / smaller than / exactly N bytes
+//     -mtime [+|-]N[s|m|h|d]  modified more / less / exactly N ago
+//                          (days by default, like find(1))
+//     -mindepth N          entries directly in the directory are depth 1
+//     -maxdepth N
+//
+// After the STATUS_OK the server sends batches as they are found:
+// ProtocolResponse { STATUS_OK, n } + n payload bytes of paths, one
+// per line, relative to the directory (directories end in '/'). The
+// order is not defined. An empty batch { STATUS_OK, 0 } ends the
+// stream.
+//
+// Environment:
+//   FILESERVER_FIND_WORKERS=N   worker threads (default FIND_WORKERS)
+// ============================================================
+
+#define FIND_WORKERS      4
+#define FIND_MAX_WORKERS  16
+#define FIND_MAX_OPEN     256       // Queued directories kept open
+#define FIND_BATCH_SIZE   16384     // Payload bytes per batch
+#define FIND_FLUSH_MS     50        // Send a partial batch after this
+
+typedef struct {
+    char      glob[256];            // "" = any name
+    int       type;                 // 0, 'f' or 'd'
+    int       sizeCmp;              // -1 / 0 / +1, 2 = no size filter
+    long long size;
+    int       mtimeCmp;             // -1 / 0 / +1, 2 = no mtime filter
+    long long mtime;                // N, in mtimeUnit
+    long long mtimeUnit;            // Seconds per unit of N
+    int       minDepth;
+    int       maxDepth;             // -1 = unlimited
+} FindQuery;
+
+typedef struct {
+    unsigned long long dirs;        // Directories read
+    unsigned long long entries;     // Entries examined
+    unsigned long long matches;
+    unsigned long long skipped;     // Directories not entered (permissions)
+    unsigned long long batches;
+    int                workers;
+} FindStats;
+
+// Parse arg2 / arg3 of a find request; -1 on a syntax error
+int findParseQuery(const char *glob, const char *filters, FindQuery *q);
+
+// Walk the directory open as dirFd (fullPath is its server path, used
+// for the home / group permission decision) and stream the matches to
+// clientFd: STATUS_OK once the workers run, the batches, the empty
+// batch. Returns 0 when done, 1 if the client connection failed and
+// -1 (nothing sent) if no worker could be started.
+int findRun(int dirFd, const char *fullPath, const char *homeDir,
+            const FindQuery *q, int clientFd, FindStats *stats);
+
+// Shared with the du walk
+int findWorkerCount(void);                      // FILESERVER_FIND_WORKERS
+int findOpenRel(int topFd, const char *rel);    // No symlinks, -1 on failure
+int findMayEnter(const char *fullPath, const char *homeDir, const char *rel,
+                 const struct stat *st);        // LIST permission rule
+
+#endif
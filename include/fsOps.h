@@ -1,6 +1,9 @@
 #ifndef FS_OPS_H
 #define FS_OPS_H
 
+#include <stddef.h>
+#include <sys/stat.h>
+
 #include "session.h"
 
 // File locking (fcntl)
@@ -9,15 +12,44 @@ int lockFileWrite(int fd);    // exclusive lock
 int unlockFile(int fd);       // unlock
 
 // Path handling and sandbox checks
+char *normalize_path(const char *path, char *normalized, size_t size);   // "." and ".." removed
 int resolvePath(Session *s, const char *inputPath, char *outputPath);
 int isInsideRoot(const char *rootDir, const char *fullPath);
 int isInsideHome(const char *homeDir, const char *fullPath);
 
+// Session directories (O_PATH fds for root, home and cwd).
+// Paths from resolvePath() are walked from the deepest of them that
+// contains the path, with openat2(RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS):
+// the kernel re-checks the sandbox during the walk itself. Without
+// session directories (not logged in) plain paths are used.
+int  fsOpenSessionDirs(Session *s);                  // after login
+void fsCloseSessionDirs(Session *s);
+int  fsChdir(Session *s, const char *fullPath);      // cwdFd + currentDir
+
+int  fsOpen(Session *s, const char *fullPath, int flags, mode_t mode);
+int  fsStat(Session *s, const char *fullPath, struct stat *st);   // no symlinks
+int  fsOpenParent(Session *s, const char *fullPath, char *name, size_t size);
+void fsCloseParent(Session *s, int dirFd);
+
 // Filesystem operations (no locking here)
-int fsCreate(const char *path, int permissions, int isDirectory);
-int fsChmod(const char *path, int permissions);
-int fsMove(const char *src, const char *dst);
-int fsReadFile(const char *path, char *buffer, int size, int offset);
-int fsWriteFile(const char *path, const char *data, int size, int offset);
+int fsCreate(Session *s, const char *path, int permissions, int isDirectory);
+int fsChmod(Session *s, const char *path, int permissions);
+int fsMove(Session *s, const char *src, const char *dst);
+int fsCreateTemp(Session *s, const char *path, char *tmpPath, size_t size,
+                 mode_t mode);                       // O_EXCL, unique name
+int fsReplace(Session *s, const char *src, const char *dst);   // dst may exist
+int fsUnlink(Session *s, const char *path);
+int fsRemove(Session *s, const char *path);          // recursive
+int fsCopyData(int srcFd, int dstFd, long long size);
+int fsReadFile(int fd, char *buffer, int size, int offset);
+int fsWriteFile(int fd, const char *data, int size, int offset);
+
+// Validators (size + mtime + content hash, zero hash = not hashed)
+void fsFormatValidator(const struct stat *st, unsigned long long hash,
+                       char *out, size_t outSize);
+int  fsFileValidator(int fd, const struct stat *st, char *out, size_t outSize);
+int  fsValidatorMatchesStat(const char *validator, const struct stat *st);
+int  fsValidatorIsWeak(const char *validator);       // Zero hash: size + mtime only
+int  fsValidatorEqual(const char *sent, const char *current);
 
 #endif
@@ -0,0 +1,65 @@
+#ifndef LOG_H
+#define LOG_H
+
+// ============================================================
+// Server logging
+//
+// Every server process (session children, console watcher) writes
+// log records into its own lock-free ring in a shared segment. One
+// drain process formats them and is the only writer of the log file,
+// so a handler never blocks on the terminal or on other sessions.
+// A full ring drops the record (and counts it) instead of waiting.
+//
+// Levels more verbose than LOG_COMPILE_LEVEL (numerically above it)
+// are compiled out completely, the rest are filtered at runtime with
+// one load and compare.
+//
+// Environment:
+//   FILESERVER_LOG        log file (default "server.log", "-" = stdout)
+//   FILESERVER_LOG_LEVEL  error | warn | info | debug (default info)
+// ============================================================
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN  1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+
+// Debug logs are compiled out unless built with
+// -DLOG_COMPILE_LEVEL=LOG_LEVEL_DEBUG
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Current runtime level (shared by all server processes)
+extern volatile int *gLogLevel;
+
+#define LOG_AT(level, ...) \
+    do { \
+        if ((level) <= LOG_COMPILE_LEVEL && (level) <= *gLogLevel) \
+            logWrite((level), __VA_ARGS__); \
+    } while (0)
+
+#define logError(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define logWarn(...)  LOG_AT(LOG_LEVEL_WARN,  __VA_ARGS__)
+#define logInfo(...)  LOG_AT(LOG_LEVEL_INFO,  __VA_ARGS__)
+#define logDebug(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+// Create shared rings and open the log file (main, before forking)
+int  logInit(void);
+
+// Fork the drain process (after logInit)
+int  logStartDrain(void);
+
+// Flush everything and stop the drain process (main, at shutdown)
+void logShutdown(void);
+
+// Change / parse the runtime level
+void logSetLevel(int level);
+int  logParseLevel(const char *name);   // -1 if unknown
+const char *logLevelName(int level);
+
+// Append one record (use the macros above)
+void logWrite(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef MD_CACHE_H
+#define MD_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// ============================================================
+// Directory metadata cache (shared by all server processes)
+//
+// A listing is the directory's entries with their stat results,
+// packed as MdEntry records. Slots are keyed by the directory
+// inode and the effective uid of the session that filled them
+// (the kernel decided that user may read it), and published under
+// a per-slot sequence counter like the session table.
+//
+// A session that scans a directory stores the listing as PENDING
+// and queues the slot for the watcher process. The watcher puts an
+// inotify watch on the directory, scans it again and marks the slot
+// VALID only if both scans agree, so a change that raced the first
+// scan is never served. Any event on the directory (or a queue
+// overflow) frees the slot.
+//
+// Environment:
+//   FILESERVER_MDCACHE=off   disable the cache
+// ============================================================
+
+#define MDCACHE_SLOTS      256
+#define MDCACHE_DATA_SIZE  16384      // Packed entries per directory
+
+#define MDCACHE_FREE       0
+#define MDCACHE_PENDING    1
+#define MDCACHE_VALID      2
+
+// One directory entry, followed by nameLen name bytes (no NUL),
+// padded to 8 bytes
+typedef struct {
+    int64_t  size;
+    uint32_t mode;
+    uint16_t nameLen;
+    uint16_t reserved;
+} MdEntry;
+
+#define MDCACHE_ENTRY_SIZE(nameLen) \
+    ((sizeof(MdEntry) + (nameLen) + 7) & ~(size_t)7)
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;           // Slots freed by inotify events
+    uint64_t overflows;               // Event queue overflows (all freed)
+} MdCacheCounters;
+
+// Create the shared segment and the watcher queue (main, before
+// forking); 1 if the cache is on, 0 if disabled, -1 on failure
+int  mdCacheInit(void);
+
+// Watcher process body (never returns)
+void mdCacheServe(pid_t parentPid);
+
+// Pack the entries of an open directory into buf, skipping ".", ".."
+// and lock files. Entries that do not fit are only counted in total.
+// Returns the packed length, -1 if the directory cannot be read
+int  mdCacheScan(int dirFd, char *buf, int size, int *total);
+
+// Copy a valid listing of the directory dirSt into buf (at least
+// MDCACHE_DATA_SIZE bytes); returns its length, -1 on a miss
+int  mdCacheLookup(const struct stat *dirSt, char *buf, int *total);
+
+// Publish a listing scanned by this session and queue it for validation
+void mdCacheStore(const char *path, const struct stat *dirSt,
+                  const char *buf, int len, int total);
+
+// Counters for metrics; 0 if the cache is disabled
+int  mdCacheCounters(MdCacheCounters *out);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <sys/types.h>
+
+// ============================================================
+// Metrics endpoint (Prometheus text format, read-only)
+//
+// A separate process serves "GET /metrics" over HTTP/1.0 from the
+// shared statistics segment, so scraping never touches a session.
+//
+// Environment:
+//   FILESERVER_METRICS   unset        127.0.0.1:<server port + 1>
+//                        <port>       127.0.0.1:<port>
+//                        /path/sock   UNIX socket
+//                        off          disabled
+// ============================================================
+
+// Create the listening socket. Returns -1 if disabled or on error.
+int  metricsOpen(int serverPort);
+
+// Serve scrapes until SIGTERM or until parentPid exits (never returns)
+void metricsServe(int listenFd, pid_t parentPid);
+
+#endif
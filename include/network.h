@@ -14,4 +14,7 @@ int connectToServer(const char *ip, int port);
 int sendAll(int sock, const void *buffer, int size);
 int recvAll(int sock, void *buffer, int size);
 
+// Server and bench: bytes sent / received by this process so far
+void getTrafficCounters(unsigned long long *bytesIn, unsigned long long *bytesOut);
+
 #endif
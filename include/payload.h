@@ -0,0 +1,37 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+// ============================================================
+// Payload stream layer
+//
+// Every data block that follows a ProtocolResponse (listings, file
+// contents, cd path) and every upload/write body goes through
+// sendPayload()/recvPayload(). Fixed-size control structures
+// (ProtocolMessage, ProtocolResponse, size ints) always stay raw.
+//
+// When compression is enabled for a socket, payload bytes are sent
+// as chunks: PayloadChunkHeader + (compressed or stored) bytes.
+// The byte stream is independent of call boundaries, so the sender
+// and receiver do not need to use the same call sizes.
+// ============================================================
+
+// Codec name used during negotiation (CMD_COMPRESS arg1)
+#define PAYLOAD_CODEC_LZ "lz"
+
+// Maximum uncompressed size of one chunk
+#define PAYLOAD_CHUNK (64 * 1024)
+
+typedef struct {
+    int rawSize;       // Uncompressed bytes in this chunk
+    int packedSize;    // Compressed bytes that follow, 0 = stored raw
+} PayloadChunkHeader;
+
+// Enable or disable chunked compression for a connected socket
+void setPayloadCompression(int sock, int enabled);
+int  isPayloadCompressed(int sock);
+
+// Send / receive exactly size payload bytes
+int sendPayload(int sock, const void *buffer, int size);
+int recvPayload(int sock, void *buffer, int size);
+
+#endif
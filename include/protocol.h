@@ -1,8 +1,7 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
-// Maximum allowed file size for upload/download (100 MB)
-#define MAX_FILE_SIZE (100 * 1024 * 1024)
+#include <stdint.h>
 
 // ============================================================
 // Command identifiers (client -> server)
@@ -18,18 +17,139 @@
 #define CMD_DELETE          8   // Delete file or directory
 #define CMD_READ            9   // Read file
 #define CMD_WRITE          10   // Write to file
-#define CMD_UPLOAD         11   // Upload file to server
+#define CMD_UPLOAD         11   // Upload file to server (arg2 = file size)
 #define CMD_DOWNLOAD       12   // Download file from server
 
 // Extra command used for testing
 #define CMD_DELETE_USER    14   // Delete user
 
+// Connection options
+#define CMD_COMPRESS       15   // Negotiate payload compression (arg1 = codec)
+
+// Server-side operations
+#define CMD_COPY           16   // Copy file or directory tree (arg1 -> arg2)
+
+// Directory transfers (one streamed archive, see archive.h)
+#define CMD_UPLOAD_TREE    17   // Upload directory tree into arg1
+#define CMD_DOWNLOAD_TREE  18   // Download directory tree arg1
+
+// Monitoring
+#define CMD_STATS          19   // Latency / traffic report (text payload)
+
+// Change notifications (event stream, see watch.h)
+#define CMD_WATCH          20   // Watch directory arg1 (arg2 "-r" = recursive)
+
+// Search (match stream, see find.h)
+#define CMD_FIND           21   // Find in arg1: arg2 = name glob, arg3 = filters
+#define CMD_DU             22   // Disk usage of arg1 per subdirectory (text payload)
+
+// Batched metadata (StatRecord per path, see below)
+#define CMD_STAT_MANY      23   // Stat a list of paths sent after the message
+
+// Compound request (BatchOp list, see below)
+#define CMD_BATCH          24   // Run a list of operations (arg1 = "-s" / "-a")
+
 // ============================================================
 // Server response status codes
 // ============================================================
 #define STATUS_OK     0   // Operation successful
 #define STATUS_ERROR  1   // Generic error
 #define STATUS_DENIED 2   // Permission denied
+#define STATUS_NOT_MODIFIED 3   // Validator matched (read / download)
+#define STATUS_QUOTA  4   // Storage quota exceeded (see quota.h)
+
+// ============================================================
+// Validators (ETag-style) for READ and DOWNLOAD
+// ============================================================
+// Format: "<size>-<mtime sec>.<mtime nsec>-<content hash>" (hex);
+// a zero hash (weak validator, plain READ) stands for size + mtime only
+//
+// Request:  arg3 = if-none-match validator (optional)
+// Response: STATUS_NOT_MODIFIED + dataSize 0 if it still matches,
+//           otherwise STATUS_OK followed by char[VALIDATOR_SIZE]
+//           (raw, NUL-terminated) and then the data payload.
+//           DOWNLOAD sends the data first (sparse stream, see
+//           sparse.h) and the validator after it; an empty validator
+//           means the file could not be read completely.
+#define VALIDATOR_SIZE 64
+
+// ============================================================
+// UPLOAD
+// ============================================================
+// The data follows as a sparse stream (sparse.h). Streams announcing
+// more than the limit (FILESERVER_MAX_UPLOAD) are drained and refused.
+#define MAX_UPLOAD_SIZE (1LL << 40)
+
+// ============================================================
+// STAT_MANY
+// ============================================================
+// Request:  the ProtocolMessage is followed right away (no ack) by
+//           int size + size payload bytes: paths separated by '\0',
+//           absolute from the server root ("/alice/a.txt") or
+//           relative to the current directory.
+// Response: STATUS_OK + dataSize = n * sizeof(StatRecord), one record
+//           per path in request order. A path is only stat'ed if its
+//           directory may be listed (same rule as LIST); symbolic
+//           links are reported, never followed.
+#define STAT_MANY_MAX_BODY   (1024 * 1024)
+#define STAT_MANY_MAX_PATHS  65536
+
+typedef struct {
+    int32_t  error;         // 0, else errno (ENOENT, EACCES, ...)
+    uint32_t mode;          // st_mode: type and permission bits
+    int64_t  size;
+    int64_t  mtimeSec;
+    int32_t  mtimeNsec;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t reserved;
+} StatRecord;
+
+// ============================================================
+// BATCH
+// ============================================================
+// Request:  arg1 = "" (run every operation), "-s" (stop at the first
+//           failure) or "-a" (all-or-nothing: stop and undo the
+//           operations that already ran). The ProtocolMessage is
+//           followed right away (no ack) by int size + size payload
+//           bytes: BatchOp headers, each followed by its path
+//           (pathLen bytes), destination (targetLen) and data (dataLen).
+//           Paths are resolved like the single commands.
+// Response: STATUS_ERROR if the list is malformed (nothing ran),
+//           otherwise STATUS_OK + dataSize = n * sizeof(BatchResult),
+//           one result per operation in request order.
+//
+// All-or-nothing is not isolation: other sessions may see the
+// operations before an undo. A delete only moves the target aside
+// until the whole batch succeeded.
+#define BATCH_MAX_BODY   (4 * 1024 * 1024)
+#define BATCH_MAX_OPS    16384
+#define BATCH_MAX_WRITE  (64 * 1024)    // Data of one BATCH_WRITE
+#define BATCH_MAX_UNDO   (16 * 1024 * 1024)   // -a: old content kept per WRITE
+
+#define BATCH_CREATE     1   // File path with permissions mode
+#define BATCH_MKDIR      2   // Directory path with permissions mode
+#define BATCH_CHMOD      3   // path to mode
+#define BATCH_MOVE       4   // path to target (must not exist)
+#define BATCH_DELETE     5   // path (directories recursively)
+#define BATCH_WRITE      6   // data at offset of path (created if needed)
+
+typedef struct {
+    int32_t  op;            // BATCH_*
+    int32_t  mode;          // CREATE / MKDIR / CHMOD: permissions 0-0777
+    int32_t  offset;        // WRITE
+    uint32_t pathLen;       // 1 .. ARG_SIZE - 1
+    uint32_t targetLen;     // MOVE: 1 .. ARG_SIZE - 1, otherwise 0
+    uint32_t dataLen;       // WRITE: 0 .. BATCH_MAX_WRITE, otherwise 0
+} BatchOp;
+
+#define BATCH_SKIPPED   -1  // Not run: an earlier operation failed (-s / -a)
+#define BATCH_UNDONE    -2  // Ran, then undone because a later one failed (-a)
+
+typedef struct {
+    int32_t  status;        // STATUS_OK / STATUS_ERROR / STATUS_QUOTA / BATCH_*
+    int32_t  value;         // WRITE: bytes written
+} BatchResult;
 
 // Maximum length for command arguments
 #define ARG_SIZE 256
@@ -0,0 +1,88 @@
+#ifndef QUOTA_H
+#define QUOTA_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+// ============================================================
+// Per-user storage quotas
+//
+// A shared ledger keeps, for every user with a limit, the apparent
+// size of the regular files in their home. Nothing is walked on the
+// request path: handlers that change the size of a home bracket the
+// change with quotaBegin() / quotaEnd(). quotaBegin() reserves the
+// growth the change may cause and refuses it if the used bytes plus
+// the reservations of other sessions would pass the limit;
+// quotaApply() books the delta that was measured. Changes whose delta
+// is not known (directory deletes without indexed totals, uploaded
+// trees) call quotaDrop() and the home is walked again shortly.
+//
+// The quota process saves the ledger and reconciles it with the
+// filesystem: every QUOTA_RECONCILE seconds, QUOTA_DIRTY_DELAY after a
+// drop and once after a restart. A walk only replaces the used bytes
+// if no change of that user was in flight or started while it ran.
+//
+// Limits are set through the admin socket: quota <user> <size>|off
+//
+// Environment:
+//   FILESERVER_QUOTA_FILE        ledger (default QUOTA_DIR/<port>.quota),
+//                                "off" disables quotas; its directory must
+//                                not be writable by other users
+//   FILESERVER_QUOTA_RECONCILE   seconds between reconciliations
+// ============================================================
+
+#define QUOTA_DIR          "/var/lib/fileserver"   // Created 0700 if missing
+#define QUOTA_USERS        256
+#define QUOTA_NAME_SIZE    64
+#define QUOTA_INFLIGHT     16        // Concurrent changes tracked per user
+#define QUOTA_RECONCILE    3600      // Seconds
+#define QUOTA_DIRTY_DELAY  2         // Seconds from a drop to its walk
+
+typedef struct {
+    int       user;                  // Ledger row, -1 = no limit
+    int       slot;                  // In-flight slot, -1 = none free
+} QuotaChange;
+
+typedef struct {
+    char      name[QUOTA_NAME_SIZE];
+    long long limit;
+    long long used;                  // -1 = not measured yet
+    long long reserved;              // Growth of changes in flight
+    time_t    reconciledAt;
+} QuotaRow;
+
+typedef struct {
+    uint64_t  rejections;
+    uint64_t  reconciles;
+    uint64_t  corrected;             // Bytes a reconciliation changed
+} QuotaCounters;
+
+// Create the shared ledger and load the saved one (main, before
+// forking); 1 if on, 0 if disabled, -1 on failure
+int  quotaInit(int serverPort);
+
+// Save and reconcile until SIGTERM or until parentPid exits (never returns)
+void quotaServe(pid_t parentPid);
+
+// Change bracket, homeDir = the home being changed. growth = bytes the
+// change may add (0 = does not grow). Returns -1 (no bracket) if the
+// growth does not fit the user's limit.
+int  quotaBegin(QuotaChange *c, const char *homeDir, long long growth);
+void quotaApply(QuotaChange *c, long long bytes);
+void quotaDrop(QuotaChange *c);
+void quotaEnd(QuotaChange *c);
+
+// 1 if the user of homeDir has a limit
+int  quotaLimited(const char *homeDir);
+
+// Admin: set a limit (< 0 removes it); -1 if the ledger is full or off
+int  quotaSet(const char *user, long long limit);
+
+// Ledger rows and counters; -1 if quotas are disabled
+int  quotaSnapshot(QuotaRow *rows, int max, QuotaCounters *counters);
+
+// "10G", "512M", "4096"; -1 on a syntax error
+long long quotaParseSize(const char *s);
+
+#endif
@@ -9,6 +9,11 @@
 // Returns 1 if the client connection should be closed.
 int processCommand(int clientFd, ProtocolMessage *msg, Session *session);
 
+// Test mode for in-process harnesses (handlerbench): seteuid, setegid
+// and initgroups are skipped, handlers run as the calling user.
+// The server itself never sets it.
+extern int gHandlerTestMode;
+
 // ============================================================
 // Authentication / session handling
 // ============================================================
@@ -18,6 +23,16 @@ int handleCreateUser(int clientFd, ProtocolMessage *msg, Session *session);
 // Extra command used for testing
 int handleDeleteUser(int clientFd, ProtocolMessage *msg, Session *session);
 
+// ============================================================
+// Connection options
+// ============================================================
+int handleCompress(int clientFd, ProtocolMessage *msg, Session *session);
+
+// ============================================================
+// Monitoring
+// ============================================================
+int handleStats(int clientFd, ProtocolMessage *msg, Session *session);
+
 // ============================================================
 // File and directory management
 // ============================================================
@@ -25,12 +40,18 @@ int handleCreate(int clientFd, ProtocolMessage *msg, Session *session);
 int handleChmod(int clientFd, ProtocolMessage *msg, Session *session);
 int handleMove(int clientFd, ProtocolMessage *msg, Session *session);
 int handleDelete(int clientFd, ProtocolMessage *msg, Session *session);
+int handleCopy(int clientFd, ProtocolMessage *msg, Session *session);
 
 // ============================================================
 // Directory navigation and listing
 // ============================================================
 int handleCd(int clientFd, ProtocolMessage *msg, Session *session);
 int handleList(int clientFd, ProtocolMessage *msg, Session *session);
+int handleWatch(int clientFd, ProtocolMessage *msg, Session *session);
+int handleFind(int clientFd, ProtocolMessage *msg, Session *session);
+int handleDu(int clientFd, ProtocolMessage *msg, Session *session);
+int handleStatMany(int clientFd, ProtocolMessage *msg, Session *session);
+int handleBatch(int clientFd, ProtocolMessage *msg, Session *session);
 
 // ============================================================
 // File read / write operations
@@ -43,5 +64,7 @@ int handleWrite(int clientFd, ProtocolMessage *msg, Session *session);
 // ============================================================
 int handleUpload(int clientFd, ProtocolMessage *msg, Session *session);
 int handleDownload(int clientFd, ProtocolMessage *msg, Session *session);
+int handleUploadTree(int clientFd, ProtocolMessage *msg, Session *session);
+int handleDownloadTree(int clientFd, ProtocolMessage *msg, Session *session);
 
 #endif
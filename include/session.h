@@ -10,6 +10,12 @@ typedef struct {
     char username[USERNAME_SIZE];    // Username
     char homeDir[PATH_SIZE];         // User home directory
     char currentDir[PATH_SIZE];      // Current directory
+
+    // O_PATH descriptors of rootDir, homeDir and currentDir (-1 = not
+    // open). fsOps walks paths from these with openat2(RESOLVE_BENEATH).
+    int  rootFd;
+    int  homeFd;
+    int  cwdFd;
 } Session;
 
 // Initialize empty session
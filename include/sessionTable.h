@@ -0,0 +1,64 @@
+#ifndef SESSION_TABLE_H
+#define SESSION_TABLE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "session.h"
+
+// ============================================================
+// Live session table (shared by all server processes)
+//
+// Every session process owns one slot and is its only writer.
+// Counters are plain relaxed stores; the text fields (user, cwd,
+// command argument) are published under a per-slot sequence
+// counter, so readers (admin socket) copy a consistent snapshot
+// without ever blocking a session.
+// ============================================================
+
+#define SESSION_TABLE_SLOTS 1024
+#define SESSION_FIELD_SIZE  128
+
+typedef struct {
+    pid_t    pid;                          // 0 = free slot
+    uint32_t seq;                          // Odd while text fields change
+    int      command;                      // Running command, -1 = idle
+    int      drain;                        // Close after the current command
+    char     peer[64];                     // Client address
+    char     user[USERNAME_SIZE];
+    char     cwd[SESSION_FIELD_SIZE];      // Relative to the server root
+    char     arg[SESSION_FIELD_SIZE];      // arg1 of the running command
+    uint64_t startNs;                      // Session start (monotonic)
+    uint64_t commandStartNs;
+    uint64_t lastActiveNs;                 // Last command finished
+    uint64_t commandBase;                  // bytesIn + bytesOut at command start
+    uint64_t commands;                     // Commands handled
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+} SessionSlot;
+
+// Create the shared table (main, before forking)
+int  sessionTableInit(void);
+
+// Session process: claim a slot for getpid()
+void sessionTableJoin(const char *peer);
+
+// Main process: free the slot of a reaped child (signal-safe)
+void sessionTableRelease(pid_t pid);
+
+// Session process updates
+void sessionTableCommandStart(int command, const char *arg);
+void sessionTableCommandEnd(const Session *session);
+void sessionTableTraffic(unsigned long long bytesIn, unsigned long long bytesOut);
+int  sessionTableDraining(void);
+
+// Readers: consistent copies of all used slots, returns count
+int  sessionTableSnapshot(SessionSlot *out, int max);
+
+// Ask a session to close after its current command
+int  sessionTableDrain(pid_t pid);
+
+// Is pid a live session?
+int  sessionTableHas(pid_t pid);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <limits.h>
+
+// ============================================================
+// Sparse file stream (upload / download)
+//
+// Only data is transferred, holes are described by the gaps
+// between extents. Sent over the payload layer:
+//
+//   long long fileSize
+//   { SparseExtent + extent.length data bytes } ...
+//   SparseExtent with length 0 (end)
+//
+// Data extents come from SEEK_DATA/SEEK_HOLE. All-zero blocks inside
+// a data extent are skipped as well (files preallocated by writing
+// zeros). The receiver truncates the file, writes the extents at
+// their offsets and sets the final size, so every gap stays a hole.
+// ============================================================
+
+// Read/write granularity and zero detection block size
+#define SPARSE_IO_SIZE    (256 * 1024)
+#define SPARSE_ZERO_BLOCK 4096
+
+// sparseReceiveFile() without a size limit
+#define SPARSE_NO_LIMIT   LLONG_MAX
+
+typedef struct {
+    long long offset;
+    long long length;    // 0 = end of stream
+} SparseExtent;
+
+typedef struct {
+    long long          fileSize;
+    long long          dataBytes;   // Bytes actually transferred
+    unsigned long long hash;        // Extent hash (sender side)
+} SparseStats;
+
+// Send the first size bytes of fd. stats->hash gets the same value
+// as sparseHashFile() for this file.
+// Returns 0 ok, -1 on read error (the stream still ends cleanly),
+// -2 if the stream was cut (connection error, or a mapped file shrunk
+// while being sent): the connection cannot be used any more.
+int sparseSendFile(int sock, int fd, long long size, SparseStats *stats);
+
+// Send size bytes of data exactly as sparseSendFile() sends a file
+// without holes that holds them (same stream, same hash).
+// Returns 0 ok, -2 if the stream was cut (there are no read errors).
+int sparseSendBuffer(int sock, const char *data, long long size, SparseStats *stats);
+
+// 1 if fd has no holes in [0, size): sparseSendBuffer() of its content
+// then matches sparseSendFile()
+int sparseIsDense(int fd, long long size);
+
+// Receive a stream into fd (truncated first). A stream announcing more
+// than maxSize bytes, or not exactly expected bytes (-1 = any size), is
+// drained without touching fd; stats->fileSize tells its size.
+// Returns 0 ok, 1 on local write error or a refused size (stream fully
+// consumed), -1 on stream error.
+int sparseReceiveFile(int sock, int fd, long long expected, long long maxSize,
+                      SparseStats *stats);
+
+// Content hash over data extents (offset + bytes), holes skipped.
+// Returns 0 ok, -1 on read error.
+int sparseHashFile(int fd, long long size, unsigned long long *hash);
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+// ============================================================
+// Server statistics (shared by all session processes)
+//
+// One MAP_SHARED segment is created in main() before the first
+// fork(), so every child and the console watcher see the same
+// counters. All updates are relaxed atomic adds, no locks.
+//
+// Latency histograms are HDR-style log-linear: 16 sub-buckets per
+// power of two (about 6% precision), from 1 ns up to ~18 minutes.
+// ============================================================
+
+#define STATS_MAX_COMMANDS 32              // Command ids 0..31 (31 = other)
+#define STATS_SUB_BITS     4
+#define STATS_SUB_COUNT    (1 << STATS_SUB_BITS)
+#define STATS_MAX_EXP      40              // 2^40 ns ~ 18 minutes
+#define STATS_BUCKETS      ((STATS_MAX_EXP - STATS_SUB_BITS + 2) * STATS_SUB_COUNT)
+#define STATS_STATUSES     6               // STATUS_OK..STATUS_QUOTA, other
+#define STATS_MIN_TRANSFER (64 * 1024)     // Smaller transfers skip the throughput histogram
+
+#define STATS_LOCK_READ    0
+#define STATS_LOCK_WRITE   1
+#define STATS_LOCK_PATHS   256             // Contended paths tracked
+#define STATS_LOCK_PATH_LEN 160
+#define STATS_LOCK_TOP     20              // Rows in the contended paths table
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[STATS_BUCKETS];
+} StatsHistogram;
+
+typedef struct {
+    uint64_t       count;                  // Dispatches
+    uint64_t       errors;                 // Final status != STATUS_OK
+    uint64_t       statuses[STATS_STATUSES];  // Dispatches by final status
+    uint64_t       bytesIn;                // Bytes received while handling
+    uint64_t       bytesOut;               // Bytes sent while handling
+    StatsHistogram latency;                // Nanoseconds
+    StatsHistogram throughput;             // Bytes per second (transfers only)
+    uint64_t       lockWaits;              // Contended lock acquisitions
+    uint64_t       lockWaitNs;             // Time blocked in them
+} CommandStats;
+
+// Contention on one path (open addressing on the path hash)
+typedef struct {
+    uint64_t key;                          // Path hash, 0 = free slot
+    int      ready;                        // path[] is complete
+    char     path[STATS_LOCK_PATH_LEN];
+    uint64_t waits[2];                     // Contended acquisitions (read, write)
+    uint64_t waitNs[2];
+    uint64_t maxNs;
+    uint64_t heldByWriter;                 // Waits behind an exclusive lock
+} LockPathStats;
+
+typedef struct {
+    uint64_t       startTime;              // Server start (unix seconds)
+    int64_t        activeSessions;         // Session processes alive
+    uint64_t       sessionsTotal;          // Session processes forked
+    StatsHistogram forkLatency;            // fork() as seen by the parent, ns
+    StatsHistogram lockWait[2];            // fcntl lock wait, ns (read, write)
+    uint64_t       lockContended[2];       // Acquisitions that had to wait
+    uint64_t       lockPathsFull;          // Contended paths not tracked
+    LockPathStats  lockPaths[STATS_LOCK_PATHS];
+    CommandStats   commands[STATS_MAX_COMMANDS];
+} ServerStats;
+
+// Create the shared segment (call once, before forking)
+int  statsInit(void);
+
+// Monotonic clock in nanoseconds
+uint64_t statsNow(void);
+
+// Record one dispatched command
+void statsRecordCommand(int command, int status, uint64_t elapsedNs,
+                        uint64_t bytesIn, uint64_t bytesOut);
+
+// Session processes (main process only; Ended is signal-safe)
+void statsSessionStarted(uint64_t forkNs);
+void statsSessionEnded(void);
+
+// Command being handled by this process (lock waits are charged to it)
+void statsCommandStart(int command);
+
+// Time spent waiting for a file lock (STATS_LOCK_READ / STATS_LOCK_WRITE)
+void statsRecordLockWait(int kind, uint64_t waitNs);
+
+// A lock that was held by someone else when requested
+void statsRecordLockContention(int kind, const char *path, uint64_t waitNs,
+                               int heldByWriter);
+
+// Top contended paths and lock wait per command (by total wait)
+int  statsFormatLocks(char *buf, int size, int top);
+
+// Shared segment for exporters (NULL if statistics are disabled)
+const ServerStats *statsShared(void);
+
+// Clear all counters (no concurrent writers allowed)
+void statsReset(void);
+
+// Value at percentile p (0..100) of a live histogram, clamped to max
+uint64_t statsPercentile(const StatsHistogram *h, double p);
+
+// Human-readable report (table with p50/p90/p99/max per command).
+// Returns length written (always NUL-terminated).
+int  statsFormat(char *buf, int size);
+
+// Printable command name
+const char *statsCommandName(int command);
+
+#endif
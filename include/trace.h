@@ -0,0 +1,53 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// ============================================================
+// Request tracing (Chrome / Perfetto JSON trace format)
+//
+// A sampled request records one span for the whole command plus
+// spans for its phases (path resolution, lock wait, file I/O,
+// socket send/recv). Events are buffered in memory and written
+// with one pwrite() when the request ends, into a per-process file
+// <dir>/trace-<pid>.json that is valid JSON after every request.
+// All processes use CLOCK_MONOTONIC, so files can be merged:
+//     jq -s add trace-*.json > all.json
+//
+// Environment:
+//   FILESERVER_TRACE_DIR     enable tracing, directory for trace files
+//   FILESERVER_TRACE_SAMPLE  fraction of requests traced (default 1.0)
+// ============================================================
+
+// Non-zero while the current request is being traced
+extern int gTraceActive;
+
+// Read the environment (main, before forking)
+void traceInit(void);
+
+// Create this session's trace file (session child, before login
+// changes the effective uid)
+void traceSessionStart(void);
+
+// Request boundaries (processCommand)
+void traceRequestStart(int command);
+void traceRequestEnd(const char *arg, int status,
+                     unsigned long long bytesIn, unsigned long long bytesOut);
+
+// Phase spans:
+//     uint64_t t = traceBegin();
+//     ...
+//     traceEnd(t, "lock_read", path, -1);
+// detail may be NULL, bytes < 0 means "no byte count"
+uint64_t traceClock(void);
+void traceSpan(uint64_t start, const char *name, const char *detail, long long bytes);
+
+#define traceBegin() (gTraceActive ? traceClock() : 0)
+
+#define traceEnd(start, name, detail, bytes) \
+    do { \
+        if (start) \
+            traceSpan((start), (name), (detail), (bytes)); \
+    } while (0)
+
+#endif
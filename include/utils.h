@@ -15,10 +15,34 @@ void joinPaths(const char *base, const char *child, char *output);
 // Generate simple random ID
 int generateId();
 
+// 64-bit FNV-1a hash, can be chained over several buffers
+#define HASH_SEED 0xcbf29ce484222325ULL
+unsigned long long hashBytes(unsigned long long h, const void *data, long len);
+
 // Check if file or directory exists
 int fileExists(const char *path);
 
 // Recursively delete file or directory
 int removeRecursive(const char *path);
 
+// Read-only mappings for large sequential reads: reads of at least
+// MAP_READ_MIN bytes are served from the page cache directly instead of
+// being copied into a heap buffer first
+#define MAP_READ_MIN    (1024 * 1024)
+#define MAP_WINDOW      (8 * 1024 * 1024)    // Mapped at a time by long walks
+
+typedef struct {
+    void  *base;                             // NULL = nothing mapped
+    size_t length;
+} FileMap;
+
+// Map [offset, offset + len) of fd, with sequential access and
+// readahead hints; returns the address of offset, NULL on failure
+const char *mapFileRange(int fd, long long offset, long long len, FileMap *map);
+void unmapFileRange(FileMap *map);
+
+// Run fn(ctx); a SIGBUS raised meanwhile by a mapped file shrunk by
+// someone else makes it return -1 instead of killing the process
+int runMapGuarded(int (*fn)(void *ctx), void *ctx);
+
 #endif
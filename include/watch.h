@@ -0,0 +1,54 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+// ============================================================
+// Change notifications (watch command)
+//
+// A session subscribes to one directory (optionally its whole
+// subtree) with its own inotify instance, so the kernel checks the
+// user's read permission on every watched directory.
+//
+// After the STATUS_OK of CMD_WATCH the server sends batches:
+// ProtocolResponse { STATUS_OK, n } + n payload bytes of lines
+//
+//     CREATE <path>            MODIFY <path>        ATTRIB <path>
+//     DELETE <path>            MOVE <from> -> <to>
+//     OVERFLOW                 events were lost, list again
+//
+// Paths are relative to the watched directory, directories end in
+// '/'. Events are coalesced for WATCH_COALESCE_MS after the first
+// one of a batch (repeated writes give one MODIFY, a file created
+// and deleted in the same batch gives nothing). A batch holds at
+// most WATCH_QUEUE_MAX events, more turn into OVERFLOW.
+//
+// Any ProtocolMessage from the client ends the watch; the server
+// answers with a final { STATUS_OK, 0 }. If that message was
+// CMD_EXIT the connection is closed afterwards.
+// ============================================================
+
+#define WATCH_MAX_DIRS     4096   // Watched directories per session
+#define WATCH_QUEUE_MAX    512    // Events per batch
+#define WATCH_COALESCE_MS  100
+
+typedef struct Watch Watch;
+
+typedef struct {
+    unsigned long long events;      // Lines sent
+    unsigned long long batches;
+    unsigned long long overflows;
+    int                dirs;        // Directories watched at the end
+} WatchStats;
+
+// Watch the directory open as dirFd (and every subdirectory if
+// recursive). NULL with errno set on failure (E2BIG: more than
+// WATCH_MAX_DIRS directories).
+Watch *watchOpen(int dirFd, int recursive);
+
+// Stream batches to clientFd until the client sends a message, the
+// watched directory disappears, the session is drained or a signal
+// arrives. Returns 1 if the connection should be closed, 0 otherwise.
+int watchStream(Watch *w, int clientFd, WatchStats *stats);
+
+void watchClose(Watch *w);
+
+#endif
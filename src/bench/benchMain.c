@@ -0,0 +1,455 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "../../include/bench.h"
+#include "../../include/stats.h"
+#include "../../include/protocol.h"
+#include "../../include/network.h"
+
+#define BENCH_MAX_SESSIONS 1024
+#define BENCH_MAX_USERS    64
+#define BENCH_DEFAULT_MIX  "login=1,cd=4,list=15,create=8,write=15," \
+                           "read=25,upload=5,download=15,delete=8"
+
+// ------------------------------------------------------------
+// Configuration
+// ------------------------------------------------------------
+typedef struct {
+    const char *host;
+    int         port;
+    int         sessions;
+    int         seconds;
+    double      rate;                      // Ops/s per session, 0 = closed loop
+    int         weights[BENCH_OPS];
+    int         weightSum;
+    char       *users[BENCH_MAX_USERS];
+    int         userCount;
+    int         payloadSize;
+    int         files;
+    int         compress;
+    int         json;
+    const char *mix;
+} BenchConfig;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -h host       server address (127.0.0.1)\n"
+            "  -p port       server port (8080)\n"
+            "  -c sessions   concurrent sessions (8)\n"
+            "  -d seconds    measured duration (10)\n"
+            "  -r rate       ops/s per session, 0 = as fast as possible (0)\n"
+            "  -m mix        op=weight,... of login cd list create write\n"
+            "                read upload download delete\n"
+            "                (" BENCH_DEFAULT_MIX ")\n"
+            "  -u users      comma separated, existing users (bench)\n"
+            "  -s bytes      write / upload size (4096)\n"
+            "  -f files      files per session for read/write/download (8)\n"
+            "  -z            negotiate payload compression\n"
+            "  -o json|text  report format (json)\n"
+            "\n"
+            "       %s transfer [options]    transfer sweep (sizes x sessions)\n"
+            "       %s compare <a> <b>       compare two transfer reports\n",
+            prog, prog, prog);
+}
+
+static int parseMix(BenchConfig *cfg, const char *mix)
+{
+    char copy[512];
+    snprintf(copy, sizeof(copy), "%s", mix);
+
+    memset(cfg->weights, 0, sizeof(cfg->weights));
+    cfg->weightSum = 0;
+
+    for (char *save = NULL, *item = strtok_r(copy, ",", &save);
+         item; item = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(item, '=');
+        if (!eq)
+            return -1;
+        *eq = '\0';
+
+        int op = -1;
+        for (int i = 0; i < BENCH_OPS; i++) {
+            if (strcmp(item, benchOpName((BenchOp)i)) == 0)
+                op = i;
+        }
+
+        int weight = atoi(eq + 1);
+        if (op < 0 || weight < 0) {
+            fprintf(stderr, "[BENCH] Unknown mix entry '%s'\n", item);
+            return -1;
+        }
+
+        cfg->weights[op] = weight;
+        cfg->weightSum  += weight;
+    }
+
+    return cfg->weightSum > 0 ? 0 : -1;
+}
+
+static int parseUsers(BenchConfig *cfg, char *list)
+{
+    cfg->userCount = 0;
+
+    for (char *save = NULL, *u = strtok_r(list, ",", &save);
+         u && cfg->userCount < BENCH_MAX_USERS; u = strtok_r(NULL, ",", &save))
+        cfg->users[cfg->userCount++] = u;
+
+    return cfg->userCount > 0 ? 0 : -1;
+}
+
+static BenchOp pickOp(const BenchConfig *cfg)
+{
+    int r = rand() % cfg->weightSum;
+
+    for (int i = 0; i < BENCH_OPS; i++) {
+        if (r < cfg->weights[i])
+            return (BenchOp)i;
+        r -= cfg->weights[i];
+    }
+    return BENCH_LIST;
+}
+
+static void sleepUntil(uint64_t deadline)
+{
+    struct timespec ts;
+    ts.tv_sec  = (time_t)(deadline / 1000000000ull);
+    ts.tv_nsec = (long)(deadline % 1000000000ull);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+// ============================================================
+// WORKER
+// ============================================================
+
+// Session directory with its files, not measured
+static int setupSession(BenchSession *s)
+{
+    if (benchOpenSession(s) != STATUS_OK) {
+        fprintf(stderr, "[BENCH] worker %d: cannot log in as '%s'\n", s->id, s->user);
+        return -1;
+    }
+
+    char name[BENCH_NAME_SIZE];
+
+    // Leftover from an interrupted run is fine
+    benchCreate(s, s->dir, 1);
+    if (benchCd(s, s->dir) != STATUS_OK) {
+        fprintf(stderr, "[BENCH] worker %d: cannot use '%s'\n", s->id, s->dir);
+        return -1;
+    }
+
+    for (int i = 0; i < s->files; i++) {
+        snprintf(name, sizeof(name), "f%d", i);
+        if (benchWrite(s, name, s->payload, s->payloadSize) != STATUS_OK) {
+            fprintf(stderr, "[BENCH] worker %d: cannot write '%s'\n", s->id, name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void teardownSession(BenchSession *s)
+{
+    if (s->sock < 0 && benchOpenSession(s) != STATUS_OK)
+        return;
+
+    benchCd(s, "");
+    benchDelete(s, s->dir);
+    benchCloseSession(s);
+}
+
+static int runWorker(const BenchConfig *cfg, int id, int readyFd, int goFd)
+{
+    BenchSession s;
+    memset(&s, 0, sizeof(s));
+
+    s.sock        = -1;
+    s.id          = id;
+    s.host        = cfg->host;
+    s.port        = cfg->port;
+    s.compress    = cfg->compress;
+    s.user        = cfg->users[id % cfg->userCount];
+    s.files       = cfg->files;
+    s.payloadSize = cfg->payloadSize;
+    snprintf(s.dir, sizeof(s.dir), "bench-%d", (int)getpid());
+
+    srand((unsigned)getpid() ^ (unsigned)time(NULL));
+
+    // Printable, mildly compressible data
+    s.payload = malloc(cfg->payloadSize > 0 ? cfg->payloadSize : 1);
+    for (int i = 0; i < cfg->payloadSize; i++)
+        s.payload[i] = (char)('a' + rand() % 16);
+
+    s.uploadFd  = memfd_create("bench-upload", MFD_CLOEXEC);
+    s.scratchFd = memfd_create("bench-download", MFD_CLOEXEC);
+    if (!s.payload || s.uploadFd < 0 || s.scratchFd < 0 ||
+        write(s.uploadFd, s.payload, cfg->payloadSize) != cfg->payloadSize) {
+        perror("[BENCH] worker buffers");
+        return 1;
+    }
+
+    int ok = setupSession(&s) == 0;
+
+    // Report readiness, then wait until every worker is ready
+    char c = ok ? 'y' : 'n';
+    if (write(readyFd, &c, 1) != 1 || !ok)
+        return 1;
+    close(readyFd);
+
+    if (read(goFd, &c, 1) < 0)
+        return 1;
+    close(goFd);
+
+    uint64_t start    = statsNow();
+    uint64_t end      = start + (uint64_t)cfg->seconds * 1000000000ull;
+    uint64_t interval = cfg->rate > 0 ? (uint64_t)(1e9 / cfg->rate) : 0;
+    uint64_t next     = start;
+
+    while (1) {
+        // Open loop: latency counts from the scheduled start, so a
+        // stalled server is not hidden by fewer requests being sent
+        uint64_t t0;
+        if (interval) {
+            if (next >= end)
+                break;
+            sleepUntil(next);
+            t0    = next;
+            next += interval;
+        } else {
+            t0 = statsNow();
+            if (t0 >= end)
+                break;
+        }
+
+        BenchOp op = pickOp(cfg);
+
+        unsigned long long in0, out0, in1, out1;
+        getTrafficCounters(&in0, &out0);
+
+        int rc = benchRunOp(&s, op);
+
+        uint64_t t1 = statsNow();
+        getTrafficCounters(&in1, &out1);
+
+        statsRecordCommand(benchOpCommand(op), rc < 0 ? STATUS_ERROR : rc,
+                           t1 - t0, in1 - in0, out1 - out0);
+
+        // Lost connection: new session, back into our directory
+        if (rc < 0) {
+            if (benchOpenSession(&s) != STATUS_OK || benchCd(&s, s.dir) != STATUS_OK) {
+                fprintf(stderr, "[BENCH] worker %d: connection lost\n", id);
+                return 1;
+            }
+        }
+    }
+
+    teardownSession(&s);
+    return 0;
+}
+
+// ============================================================
+// REPORT
+// ============================================================
+static double us(uint64_t ns)
+{
+    return ns / 1000.0;
+}
+
+static void reportJson(const BenchConfig *cfg, double elapsed, int started, int failed)
+{
+    const ServerStats *st = statsShared();
+    uint64_t totalCount = 0, totalErrors = 0, totalIn = 0, totalOut = 0;
+
+    printf("{\n");
+    printf("  \"config\": {\"host\": \"%s\", \"port\": %d, \"sessions\": %d, "
+           "\"seconds\": %d, \"rate_per_session\": %.3f, \"mix\": \"%s\", "
+           "\"payload_bytes\": %d, \"files\": %d, \"compress\": %s},\n",
+           cfg->host, cfg->port, cfg->sessions, cfg->seconds, cfg->rate, cfg->mix,
+           cfg->payloadSize, cfg->files, cfg->compress ? "true" : "false");
+    printf("  \"elapsed_s\": %.3f,\n", elapsed);
+    printf("  \"sessions_started\": %d,\n", started);
+    printf("  \"sessions_failed\": %d,\n", failed);
+    printf("  \"commands\": [");
+
+    int first = 1;
+    for (int op = 0; op < BENCH_OPS; op++) {
+        const CommandStats *c = &st->commands[benchOpCommand((BenchOp)op)];
+        if (c->count == 0)
+            continue;
+
+        const StatsHistogram *h = &c->latency;
+
+        printf("%s\n    {\"command\": \"%s\", \"count\": %llu, \"errors\": %llu, "
+               "\"ops_per_s\": %.1f, "
+               "\"latency_us\": {\"avg\": %.1f, \"p50\": %.1f, \"p90\": %.1f, "
+               "\"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}, "
+               "\"bytes_sent\": %llu, \"bytes_received\": %llu, \"mb_per_s\": %.3f}",
+               first ? "" : ",", benchOpName((BenchOp)op),
+               (unsigned long long)c->count, (unsigned long long)c->errors,
+               c->count / elapsed,
+               us(h->sum) / (double)h->count,
+               us(statsPercentile(h, 50.0)), us(statsPercentile(h, 90.0)),
+               us(statsPercentile(h, 99.0)), us(statsPercentile(h, 99.9)),
+               us(h->max),
+               (unsigned long long)c->bytesOut, (unsigned long long)c->bytesIn,
+               (c->bytesIn + c->bytesOut) / elapsed / 1e6);
+        first = 0;
+
+        totalCount  += c->count;
+        totalErrors += c->errors;
+        totalIn     += c->bytesIn;
+        totalOut    += c->bytesOut;
+    }
+
+    printf("\n  ],\n");
+    printf("  \"total\": {\"count\": %llu, \"errors\": %llu, \"ops_per_s\": %.1f, "
+           "\"bytes_sent\": %llu, \"bytes_received\": %llu, \"mb_per_s\": %.3f}\n",
+           (unsigned long long)totalCount, (unsigned long long)totalErrors,
+           totalCount / elapsed, (unsigned long long)totalOut,
+           (unsigned long long)totalIn, (totalIn + totalOut) / elapsed / 1e6);
+    printf("}\n");
+}
+
+static void reportText(double elapsed, int started, int failed)
+{
+    static char buf[16384];
+
+    statsFormat(buf, sizeof(buf));
+    printf("%s", buf);
+    printf("Elapsed %.3f s, %d sessions started, %d failed\n", elapsed, started, failed);
+}
+
+// ============================================================
+// MAIN
+// ============================================================
+int main(int argc, char *argv[])
+{
+    static char userList[1024] = "bench";
+
+    // Subcommands (benchTransfer.c)
+    if (argc > 1 && strcmp(argv[1], "transfer") == 0)
+        return benchTransferMain(argv[0], argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "compare") == 0)
+        return benchCompareMain(argv[0], argc - 1, argv + 1);
+
+    BenchConfig cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.host        = "127.0.0.1";
+    cfg.port        = 8080;
+    cfg.sessions    = 8;
+    cfg.seconds     = 10;
+    cfg.payloadSize = 4096;
+    cfg.files       = 8;
+    cfg.json        = 1;
+    cfg.mix         = BENCH_DEFAULT_MIX;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:c:d:r:m:u:s:f:zo:")) != -1) {
+        switch (opt) {
+            case 'h': cfg.host        = optarg;       break;
+            case 'p': cfg.port        = atoi(optarg); break;
+            case 'c': cfg.sessions    = atoi(optarg); break;
+            case 'd': cfg.seconds     = atoi(optarg); break;
+            case 'r': cfg.rate        = atof(optarg); break;
+            case 'm': cfg.mix         = optarg;       break;
+            case 'u': snprintf(userList, sizeof(userList), "%s", optarg); break;
+            case 's': cfg.payloadSize = atoi(optarg); break;
+            case 'f': cfg.files       = atoi(optarg); break;
+            case 'z': cfg.compress    = 1;            break;
+            case 'o': cfg.json        = strcmp(optarg, "text") != 0; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (cfg.sessions < 1 || cfg.sessions > BENCH_MAX_SESSIONS ||
+        cfg.seconds < 1 || cfg.rate < 0 || cfg.payloadSize < 0 || cfg.files < 1 ||
+        parseMix(&cfg, cfg.mix) < 0 || parseUsers(&cfg, userList) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Histograms shared by all workers
+    if (statsInit() < 0)
+        return 1;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int readyPipe[2], goPipe[2];
+    if (pipe(readyPipe) < 0 || pipe(goPipe) < 0) {
+        perror("[BENCH] pipe");
+        return 1;
+    }
+
+    fprintf(stderr, "[BENCH] %d sessions against %s:%d, setting up...\n",
+            cfg.sessions, cfg.host, cfg.port);
+
+    int forked = 0;
+    for (int i = 0; i < cfg.sessions; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("[BENCH] fork");
+            break;
+        }
+        if (pid == 0) {
+            close(readyPipe[0]);
+            close(goPipe[1]);
+            _exit(runWorker(&cfg, i, readyPipe[1], goPipe[0]));
+        }
+        forked++;
+    }
+
+    close(readyPipe[1]);
+    close(goPipe[0]);
+
+    // Every worker answers once (or dies and closes its end)
+    int started = 0, failed = cfg.sessions - forked;
+    char c;
+    while (read(readyPipe[0], &c, 1) == 1) {
+        if (c == 'y')
+            started++;
+        else
+            failed++;
+    }
+    close(readyPipe[0]);
+
+    if (started == 0) {
+        fprintf(stderr, "[BENCH] No session could be set up (users must exist)\n");
+        while (wait(NULL) > 0) {}
+        return 1;
+    }
+
+    fprintf(stderr, "[BENCH] %d sessions ready, running for %d s\n", started, cfg.seconds);
+
+    // Release all workers at once
+    uint64_t t0 = statsNow();
+    close(goPipe[1]);
+
+    int status;
+    while (wait(&status) > 0) {}
+
+    double elapsed = (statsNow() - t0) / 1e9;
+
+    // Teardown is part of the wall time, the configured duration is not
+    if (elapsed > cfg.seconds)
+        elapsed = cfg.seconds;
+
+    if (cfg.json)
+        reportJson(&cfg, elapsed, started, failed);
+    else
+        reportText(elapsed, started, failed);
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+
+#include "../../include/network.h"
+
+// Traffic of this worker (one connection at a time)
+static unsigned long long trafficIn  = 0;
+static unsigned long long trafficOut = 0;
+
+void getTrafficCounters(unsigned long long *bytesIn, unsigned long long *bytesOut)
+{
+    *bytesIn  = trafficIn;
+    *bytesOut = trafficOut;
+}
+
+// ------------------------------------------------------------
+// Connect to server, quietly (a refused connection is a result)
+// ------------------------------------------------------------
+int connectToServer(const char *ip, int port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port);
+
+    if (inet_pton(AF_INET, ip, &addr.sin_addr) <= 0 ||
+        connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    // Small request/response exchanges, do not wait for Nagle
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return sock;
+}
+
+// ------------------------------------------------------------
+// Send exactly size bytes, -1 if the connection is gone
+// ------------------------------------------------------------
+int sendAll(int sock, const void *buffer, int size)
+{
+    int total = 0;
+
+    while (total < size) {
+        int sent = send(sock, (const char *)buffer + total, size - total, MSG_NOSIGNAL);
+
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return -1;
+
+        total += sent;
+    }
+
+    trafficOut += (unsigned long long)total;
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Receive exactly size bytes, -1 on error or EOF
+// ------------------------------------------------------------
+int recvAll(int sock, void *buffer, int size)
+{
+    int total = 0;
+
+    while (total < size) {
+        int r = recv(sock, (char *)buffer + total, size - total, 0);
+
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+
+        total += r;
+    }
+
+    trafficIn += (unsigned long long)total;
+    return 0;
+}
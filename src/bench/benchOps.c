@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../include/bench.h"
+#include "../../include/network.h"
+#include "../../include/protocol.h"
+#include "../../include/payload.h"
+#include "../../include/sparse.h"
+
+// ------------------------------------------------------------
+// Mix names, recorded under the protocol command they issue
+// ------------------------------------------------------------
+static const char *opNames[BENCH_OPS] = {
+    "login", "cd", "list", "create", "write",
+    "read", "upload", "download", "delete"
+};
+
+static const int opCommands[BENCH_OPS] = {
+    CMD_LOGIN, CMD_CD, CMD_LIST, CMD_CREATE, CMD_WRITE,
+    CMD_READ, CMD_UPLOAD, CMD_DOWNLOAD, CMD_DELETE
+};
+
+const char *benchOpName(BenchOp op)
+{
+    return opNames[op];
+}
+
+int benchOpCommand(BenchOp op)
+{
+    return opCommands[op];
+}
+
+// ------------------------------------------------------------
+// Request / response helpers
+// ------------------------------------------------------------
+static int request(BenchSession *s, int command, const char *arg1,
+                   const char *arg2, const char *arg3, ProtocolResponse *res)
+{
+    ProtocolMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.command = command;
+
+    if (arg1) snprintf(msg.arg1, ARG_SIZE, "%s", arg1);
+    if (arg2) snprintf(msg.arg2, ARG_SIZE, "%s", arg2);
+    if (arg3) snprintf(msg.arg3, ARG_SIZE, "%s", arg3);
+
+    if (sendMessage(s->sock, &msg) < 0 || receiveResponse(s->sock, res) < 0)
+        return -1;
+    return 0;
+}
+
+// Receive and throw away a payload of size bytes
+static int drainPayload(int sock, int size)
+{
+    char buf[PAYLOAD_CHUNK];
+
+    while (size > 0) {
+        int n = size < (int)sizeof(buf) ? size : (int)sizeof(buf);
+        if (recvPayload(sock, buf, n) < 0)
+            return -1;
+        size -= n;
+    }
+    return 0;
+}
+
+// ============================================================
+// SESSION
+// ============================================================
+int benchOpenSession(BenchSession *s)
+{
+    benchCloseSession(s);
+
+    s->sock = connectToServer(s->host, s->port);
+    if (s->sock < 0)
+        return -1;
+
+    ProtocolResponse res;
+
+    if (s->compress) {
+        if (request(s, CMD_COMPRESS, PAYLOAD_CODEC_LZ, NULL, NULL, &res) < 0)
+            return -1;
+        if (res.status == STATUS_OK)
+            setPayloadCompression(s->sock, 1);
+    }
+
+    if (request(s, CMD_LOGIN, s->user, NULL, NULL, &res) < 0)
+        return -1;
+    return res.status;
+}
+
+void benchCloseSession(BenchSession *s)
+{
+    if (s->sock < 0)
+        return;
+
+    ProtocolMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.command = CMD_EXIT;
+    sendMessage(s->sock, &msg);
+
+    setPayloadCompression(s->sock, 0);
+    close(s->sock);
+    s->sock = -1;
+}
+
+// ============================================================
+// SINGLE OPERATIONS
+// ============================================================
+int benchCd(BenchSession *s, const char *path)
+{
+    ProtocolResponse res;
+    if (request(s, CMD_CD, path, NULL, NULL, &res) < 0)
+        return -1;
+
+    if (res.status == STATUS_OK && drainPayload(s->sock, res.dataSize) < 0)
+        return -1;
+    return res.status;
+}
+
+int benchList(BenchSession *s)
+{
+    ProtocolResponse res;
+    if (request(s, CMD_LIST, "", NULL, NULL, &res) < 0)
+        return -1;
+
+    if (res.status == STATUS_OK && drainPayload(s->sock, res.dataSize) < 0)
+        return -1;
+    return res.status;
+}
+
+int benchCreate(BenchSession *s, const char *path, int directory)
+{
+    ProtocolResponse res;
+    if (request(s, CMD_CREATE, path, directory ? "755" : "644",
+                directory ? "-d" : "", &res) < 0)
+        return -1;
+    return res.status;
+}
+
+int benchDelete(BenchSession *s, const char *path)
+{
+    ProtocolResponse res;
+    if (request(s, CMD_DELETE, path, NULL, NULL, &res) < 0)
+        return -1;
+    return res.status;
+}
+
+int benchWrite(BenchSession *s, const char *path, const char *data, int size)
+{
+    ProtocolResponse res;
+    if (request(s, CMD_WRITE, path, NULL, NULL, &res) < 0)
+        return -1;
+    if (res.status != STATUS_OK)
+        return res.status;
+
+    if (sendAll(s->sock, &size, sizeof(int)) < 0 ||
+        (size > 0 && sendPayload(s->sock, data, size) < 0) ||
+        receiveResponse(s->sock, &res) < 0)
+        return -1;
+    return res.status;
+}
+
+int benchRead(BenchSession *s, const char *path)
+{
+    ProtocolResponse res;
+    if (request(s, CMD_READ, path, NULL, NULL, &res) < 0)
+        return -1;
+    if (res.status != STATUS_OK)
+        return res.status;
+
+    char validator[VALIDATOR_SIZE];
+    if (recvAll(s->sock, validator, VALIDATOR_SIZE) < 0 ||
+        drainPayload(s->sock, res.dataSize) < 0)
+        return -1;
+    return STATUS_OK;
+}
+
+int benchUpload(BenchSession *s, const char *path, int fd, long long size)
+{
+    ProtocolResponse res;
+    char declared[32];
+    snprintf(declared, sizeof(declared), "%lld", size);
+    if (request(s, CMD_UPLOAD, path, declared, NULL, &res) < 0)
+        return -1;
+    if (res.status != STATUS_OK)
+        return res.status;
+
+    SparseStats stats;
+    if (sparseSendFile(s->sock, fd, size, &stats) < 0 ||
+        receiveResponse(s->sock, &res) < 0)
+        return -1;
+    return res.status;
+}
+
+int benchDownload(BenchSession *s, const char *path, int fd)
+{
+    ProtocolResponse res;
+    if (request(s, CMD_DOWNLOAD, path, NULL, NULL, &res) < 0)
+        return -1;
+    if (res.status != STATUS_OK)
+        return res.status;
+
+    SparseStats stats;
+    char validator[VALIDATOR_SIZE];
+    if (sparseReceiveFile(s->sock, fd, -1, SPARSE_NO_LIMIT, &stats) < 0 ||
+        recvAll(s->sock, validator, VALIDATOR_SIZE) < 0)
+        return -1;
+
+    // Empty validator: the server could not read the whole file
+    return validator[0] ? STATUS_OK : STATUS_ERROR;
+}
+
+// ============================================================
+// MIX
+// ============================================================
+static void fileName(char *buf, size_t size, const char *prefix, int n)
+{
+    snprintf(buf, size, "%s%d", prefix, n);
+}
+
+static int createOne(BenchSession *s)
+{
+    char name[BENCH_NAME_SIZE];
+    int n = s->createdNext++;
+
+    fileName(name, sizeof(name), "c", n);
+    int rc = benchCreate(s, name, 0);
+
+    if (rc == STATUS_OK) {
+        s->created[(s->createdHead + s->createdCount) % BENCH_CREATED] = n;
+        s->createdCount++;
+    }
+    return rc;
+}
+
+static int deleteOne(BenchSession *s)
+{
+    char name[BENCH_NAME_SIZE];
+    int n = s->created[s->createdHead];
+
+    s->createdHead = (s->createdHead + 1) % BENCH_CREATED;
+    s->createdCount--;
+
+    fileName(name, sizeof(name), "c", n);
+    return benchDelete(s, name);
+}
+
+int benchRunOp(BenchSession *s, BenchOp op)
+{
+    char name[BENCH_NAME_SIZE + 4];
+    int k = rand() % s->files;
+
+    switch (op) {
+        case BENCH_LOGIN: {
+            // New connection: new session process on the server
+            int rc = benchOpenSession(s);
+            if (rc == STATUS_OK && benchCd(s, s->dir) != STATUS_OK)
+                return -1;
+            return rc;
+        }
+
+        case BENCH_CD:
+            // Up and back in one request (resolves a ".." component)
+            snprintf(name, sizeof(name), "../%s", s->dir);
+            return benchCd(s, name);
+
+        case BENCH_LIST:
+            return benchList(s);
+
+        case BENCH_CREATE:
+            // Full ring: keep the directory size bounded
+            if (s->createdCount == BENCH_CREATED)
+                return deleteOne(s);
+            return createOne(s);
+
+        case BENCH_DELETE:
+            // Nothing left to delete: delete what we just created
+            if (s->createdCount == 0) {
+                int rc = createOne(s);
+                if (rc != STATUS_OK)
+                    return rc;
+            }
+            return deleteOne(s);
+
+        case BENCH_WRITE:
+            fileName(name, sizeof(name), "f", k);
+            return benchWrite(s, name, s->payload, s->payloadSize);
+
+        case BENCH_READ:
+            fileName(name, sizeof(name), "f", k);
+            return benchRead(s, name);
+
+        case BENCH_UPLOAD:
+            fileName(name, sizeof(name), "u", k);
+            return benchUpload(s, name, s->uploadFd, s->payloadSize);
+
+        case BENCH_DOWNLOAD:
+            fileName(name, sizeof(name), "f", k);
+            return benchDownload(s, name, s->scratchFd);
+    }
+
+    return STATUS_ERROR;
+}
@@ -0,0 +1,834 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "../../include/bench.h"
+#include "../../include/stats.h"
+#include "../../include/protocol.h"
+#include "../../include/network.h"
+
+#define XFER_MAX_LIST     32
+#define XFER_MAX_SESSIONS 1024
+#define XFER_MAX_USERS    64
+#define XFER_LINE_SIZE    1024
+
+#define XFER_DEFAULT_SIZES    "1K,64K,1M,16M,256M"
+#define XFER_DEFAULT_SESSIONS "1,4,16"
+#define XFER_DEFAULT_OPS      "upload,download,write,read"
+
+// ------------------------------------------------------------
+// Configuration
+// ------------------------------------------------------------
+typedef struct {
+    const char *host;
+    int         port;
+    char       *users[XFER_MAX_USERS];
+    int         userCount;
+    long long   sizes[XFER_MAX_LIST];
+    int         sizeCount;
+    int         levels[XFER_MAX_LIST];     // Concurrent sessions per cell
+    int         levelCount;
+    BenchOp     ops[BENCH_OPS];
+    int         opCount;
+    int         reps;                      // Transfers per session per cell
+    long long   budget;                    // Max size * sessions of one cell
+    pid_t       serverPid;                 // 0 = no server side sampling
+    int         json;
+    const char *label;                     // Build name in the report
+
+    int         dataFd;                    // Random data, largest size
+    const char *data;                      // Same, mapped (write)
+} XferConfig;
+
+// One row of the report
+typedef struct {
+    int       ready;                       // Sessions that started
+    int       ok;
+    int       errors;
+    double    seconds;
+    long long bytes;                       // Payload bytes moved
+    double    p50Ms;
+    double    p99Ms;
+    int       sampled;                     // Server session processes seen
+    long      rssAvgKb;                    // Peak RSS per session
+    long      rssMaxKb;
+    double    cpuNsPerByte;                // Server user + system time
+    double    syscallsPerOp;               // Server file I/O syscalls
+} XferResult;
+
+// Server session process counters (/proc)
+typedef struct {
+    pid_t              pid;
+    long               rssKb;
+    unsigned long long cpuNs;
+    unsigned long long syscalls;              // syscr + syscw
+} ProcSample;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s transfer [options]\n"
+            "  -h host       server address (127.0.0.1)\n"
+            "  -p port       server port (8080)\n"
+            "  -u users      comma separated, existing users (bench)\n"
+            "  -S sizes      file sizes, K/M/G suffixes (" XFER_DEFAULT_SIZES ")\n"
+            "  -C sessions   concurrency levels (" XFER_DEFAULT_SESSIONS ")\n"
+            "  -O ops        any of upload,download,write,read (all)\n"
+            "  -n reps       transfers per session per cell (3)\n"
+            "  -L bytes      skip cells where size * sessions exceeds this (8G)\n"
+            "  -P pid        server main pid: sample session RSS, CPU, syscalls\n"
+            "  -l label      build name stored in the report\n"
+            "  -o json|text  report format (text)\n"
+            "\n"
+            "       %s compare <base.json> <new.json>\n",
+            prog, prog);
+}
+
+// ------------------------------------------------------------
+// Parsing helpers
+// ------------------------------------------------------------
+static long long parseSize(const char *s)
+{
+    char *end;
+    long long v = strtoll(s, &end, 10);
+
+    switch (*end) {
+        case 'k': case 'K': v <<= 10; end++; break;
+        case 'm': case 'M': v <<= 20; end++; break;
+        case 'g': case 'G': v <<= 30; end++; break;
+    }
+    return (*end == '\0' && v > 0) ? v : -1;
+}
+
+static void formatSize(long long v, char *buf, size_t size)
+{
+    if (v >= (1ll << 30) && v % (1ll << 30) == 0)
+        snprintf(buf, size, "%lldG", v >> 30);
+    else if (v >= (1ll << 20) && v % (1ll << 20) == 0)
+        snprintf(buf, size, "%lldM", v >> 20);
+    else if (v >= (1ll << 10) && v % (1ll << 10) == 0)
+        snprintf(buf, size, "%lldK", v >> 10);
+    else
+        snprintf(buf, size, "%lld", v);
+}
+
+// Split a comma list in place
+static int splitList(char *list, char **items, int max)
+{
+    int n = 0;
+    for (char *save = NULL, *t = strtok_r(list, ",", &save);
+         t && n < max; t = strtok_r(NULL, ",", &save))
+        items[n++] = t;
+    return n;
+}
+
+static int parseOps(XferConfig *cfg, char *list)
+{
+    char *items[BENCH_OPS];
+    int n = splitList(list, items, BENCH_OPS);
+
+    cfg->opCount = 0;
+    for (int i = 0; i < n; i++) {
+        BenchOp op;
+        if      (strcmp(items[i], "upload") == 0)   op = BENCH_UPLOAD;
+        else if (strcmp(items[i], "download") == 0) op = BENCH_DOWNLOAD;
+        else if (strcmp(items[i], "write") == 0)    op = BENCH_WRITE;
+        else if (strcmp(items[i], "read") == 0)     op = BENCH_READ;
+        else {
+            fprintf(stderr, "[BENCH] Unknown transfer op '%s'\n", items[i]);
+            return -1;
+        }
+        cfg->ops[cfg->opCount++] = op;
+    }
+    return cfg->opCount > 0 ? 0 : -1;
+}
+
+// ============================================================
+// SERVER SIDE SAMPLING (/proc, same host, root or same user)
+// ============================================================
+static int serverChildren(pid_t server, pid_t *pids, int max)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/children", (int)server, (int)server);
+
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    int n = 0, pid;
+    while (n < max && fscanf(f, "%d", &pid) == 1)
+        pids[n++] = (pid_t)pid;
+
+    fclose(f);
+    return n;
+}
+
+static int sampleProcess(pid_t pid, ProcSample *out)
+{
+    char path[64], line[512];
+    memset(out, 0, sizeof(*out));
+    out->pid = pid;
+
+    // Peak resident set
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    while (fgets(line, sizeof(line), f))
+        sscanf(line, "VmHWM: %ld", &out->rssKb);
+    fclose(f);
+
+    // Time on CPU in ns (schedstat), else utime + stime clock ticks
+    snprintf(path, sizeof(path), "/proc/%d/schedstat", (int)pid);
+    f = fopen(path, "r");
+    if (f && fscanf(f, "%llu", &out->cpuNs) == 1) {
+        fclose(f);
+    } else {
+        if (f)
+            fclose(f);
+
+        snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+        f = fopen(path, "r");
+        if (f) {
+            if (fgets(line, sizeof(line), f)) {
+                char *p = strrchr(line, ')');
+                unsigned long long ut = 0, st = 0;
+                if (p && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                                &ut, &st) == 2)
+                    out->cpuNs = (ut + st) * (1000000000ull / (unsigned long long)sysconf(_SC_CLK_TCK));
+            }
+            fclose(f);
+        }
+    }
+
+    // File I/O syscalls (read, pread, write, pwrite, ...);
+    // socket send / recv are not counted by the kernel here
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    f = fopen(path, "r");
+    if (f) {
+        unsigned long long v;
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "syscr: %llu", &v) == 1 || sscanf(line, "syscw: %llu", &v) == 1)
+                out->syscalls += v;
+        }
+        fclose(f);
+    }
+    return 0;
+}
+
+static int contains(const pid_t *pids, int n, pid_t pid)
+{
+    for (int i = 0; i < n; i++) {
+        if (pids[i] == pid)
+            return 1;
+    }
+    return 0;
+}
+
+// ============================================================
+// WORKER
+// ============================================================
+typedef struct {
+    int readyFd;      // Worker -> parent: 'y' / 'n'
+    int goFd;         // Closed by the parent to start
+    int doneFd;       // Worker -> parent: 'd' after the last transfer
+    int releaseFd;    // Closed by the parent after sampling
+} CellPipes;
+
+static void sessionInit(BenchSession *s, const XferConfig *cfg, int index)
+{
+    memset(s, 0, sizeof(*s));
+    s->sock        = -1;
+    s->id          = index;
+    s->host        = cfg->host;
+    s->port        = cfg->port;
+    s->user        = cfg->users[index % cfg->userCount];
+    s->uploadFd    = -1;
+    s->scratchFd   = -1;
+    snprintf(s->dir, sizeof(s->dir), "xfer-%d-%d", (int)getppid(), index);
+}
+
+// Setup runs on its own connection, so it does not show up in the
+// counters of the measured server session
+static int prepareFile(BenchSession *s, const char *name, long long size, int needFile)
+{
+    int rc = benchOpenSession(s);
+    if (rc == STATUS_OK) {
+        benchCreate(s, s->dir, 1);
+        rc = benchCd(s, s->dir);
+    }
+
+    if (rc == STATUS_OK && needFile)
+        rc = benchUpload(s, name, s->uploadFd, size);
+
+    benchCloseSession(s);
+    return rc;
+}
+
+static int runOp(BenchSession *s, const XferConfig *cfg, BenchOp op,
+                 const char *name, long long size)
+{
+    switch (op) {
+        case BENCH_UPLOAD:   return benchUpload(s, name, s->uploadFd, size);
+        case BENCH_DOWNLOAD: return benchDownload(s, name, s->scratchFd);
+        case BENCH_WRITE:    return benchWrite(s, name, cfg->data, (int)size);
+        case BENCH_READ:     return benchRead(s, name);
+        default:             return STATUS_ERROR;
+    }
+}
+
+static int cellWorker(const XferConfig *cfg, BenchOp op, long long size,
+                      int index, int needFile, CellPipes *p)
+{
+    BenchSession s;
+    sessionInit(&s, cfg, index);
+
+    char name[BENCH_NAME_SIZE];
+    snprintf(name, sizeof(name), "s%lld", size);
+
+    // Uploads read the first size bytes of the shared data file through
+    // a private open file (SEEK_DATA moves the offset), downloads are
+    // drained into /dev/null (no local disk or memory)
+    char proc[64];
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", cfg->dataFd);
+    s.uploadFd  = open(proc, O_RDONLY | O_CLOEXEC);
+    s.scratchFd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    int ok = s.uploadFd >= 0 && s.scratchFd >= 0 &&
+             prepareFile(&s, name, size, needFile) == STATUS_OK &&
+         benchOpenSession(&s) == STATUS_OK && benchCd(&s, s.dir) == STATUS_OK;
+
+    char c = ok ? 'y' : 'n';
+    if (write(p->readyFd, &c, 1) != 1 || !ok)
+        return 1;
+    close(p->readyFd);
+
+    if (read(p->goFd, &c, 1) < 0)
+        return 1;
+    close(p->goFd);
+
+    for (int i = 0; i < cfg->reps; i++) {
+        unsigned long long in0, out0, in1, out1;
+        getTrafficCounters(&in0, &out0);
+        uint64_t t0 = statsNow();
+
+        int rc = runOp(&s, cfg, op, name, size);
+
+        uint64_t t1 = statsNow();
+        getTrafficCounters(&in1, &out1);
+        statsRecordCommand(benchOpCommand(op), rc < 0 ? STATUS_ERROR : rc,
+                           t1 - t0, in1 - in0, out1 - out0);
+
+        if (rc < 0)
+            break;
+    }
+
+    // Keep the server session alive until the parent has sampled it
+    c = 'd';
+    if (write(p->doneFd, &c, 1) == 1)
+        (void)read(p->releaseFd, &c, 1);
+
+    benchCloseSession(&s);
+    return 0;
+}
+
+// ============================================================
+// ONE CELL: op x size x sessions
+// ============================================================
+static void runCell(const XferConfig *cfg, BenchOp op, long long size,
+                    int sessions, int haveFiles, XferResult *r)
+{
+    memset(r, 0, sizeof(*r));
+    statsReset();
+
+    // Server processes that are not ours (console, log drain, ...)
+    static pid_t before[XFER_MAX_SESSIONS * 2];
+    int beforeCount = cfg->serverPid ?
+        serverChildren(cfg->serverPid, before, XFER_MAX_SESSIONS * 2) : -1;
+
+    int ready[2], go[2], done[2], release[2];
+    if (pipe(ready) < 0 || pipe(go) < 0 || pipe(done) < 0 || pipe(release) < 0) {
+        perror("[BENCH] pipe");
+        r->errors = sessions;
+        return;
+    }
+
+    for (int i = 0; i < sessions; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("[BENCH] fork");
+            break;
+        }
+        if (pid == 0) {
+            CellPipes p = { ready[1], go[0], done[1], release[0] };
+            close(ready[0]);
+            close(go[1]);
+            close(done[0]);
+            close(release[1]);
+            _exit(cellWorker(cfg, op, size, i, i >= haveFiles, &p));
+        }
+    }
+
+    close(ready[1]);
+    close(go[0]);
+    close(done[1]);
+    close(release[0]);
+
+    char c;
+    while (read(ready[0], &c, 1) == 1) {
+        if (c == 'y')
+            r->ready++;
+    }
+    close(ready[0]);
+
+    // Our sessions: server children that appeared for this cell
+    static pid_t after[XFER_MAX_SESSIONS * 2];
+    static ProcSample base[XFER_MAX_SESSIONS * 2];
+    int afterCount = beforeCount >= 0 ?
+        serverChildren(cfg->serverPid, after, XFER_MAX_SESSIONS * 2) : 0;
+    int sampled = 0;
+
+    for (int i = 0; i < afterCount; i++) {
+        if (!contains(before, beforeCount, after[i]) &&
+            sampleProcess(after[i], &base[sampled]) == 0)
+            sampled++;
+    }
+
+    uint64_t t0 = statsNow();
+    close(go[1]);
+
+    // Every started worker reports once, failed ones exit (EOF)
+    for (int got = 0; got < r->ready && read(done[0], &c, 1) == 1; got++) {}
+    r->seconds = (statsNow() - t0) / 1e9;
+
+    // Sample before the sessions go away
+    unsigned long long cpuNs = 0, syscalls = 0;
+    long rssSum = 0;
+    for (int i = 0; i < sampled; i++) {
+        ProcSample now;
+        if (sampleProcess(base[i].pid, &now) < 0)
+            continue;
+
+        cpuNs    += now.cpuNs - base[i].cpuNs;
+        syscalls += now.syscalls - base[i].syscalls;
+        rssSum   += now.rssKb;
+        if (now.rssKb > r->rssMaxKb)
+            r->rssMaxKb = now.rssKb;
+        r->sampled++;
+    }
+
+    close(release[1]);
+    close(done[0]);
+    while (wait(NULL) > 0) {}
+
+    const CommandStats *cs = &statsShared()->commands[benchOpCommand(op)];
+    r->errors = (int)cs->errors + (sessions - r->ready);
+    r->ok     = (int)(cs->count - cs->errors);
+    r->bytes  = size * r->ok;
+    r->p50Ms  = statsPercentile(&cs->latency, 50.0) / 1e6;
+    r->p99Ms  = statsPercentile(&cs->latency, 99.0) / 1e6;
+
+    if (r->sampled > 0) {
+        r->rssAvgKb      = rssSum / r->sampled;
+        r->cpuNsPerByte  = r->bytes ? (double)cpuNs / (double)r->bytes : 0;
+        r->syscallsPerOp = (r->ok + (int)cs->errors) ?
+                           (double)syscalls / (double)(r->ok + cs->errors) : 0;
+    }
+}
+
+// ============================================================
+// REPORT
+// ============================================================
+static void printHeader(const XferConfig *cfg)
+{
+    if (cfg->json)
+        return;
+
+    printf("%-9s %6s %5s %6s %5s %10s %10s %10s %10s %10s %9s %10s\n",
+           "OP", "SIZE", "SESS", "OK", "ERR", "MB/S", "P50_MS", "P99_MS",
+           "RSS_AVG_KB", "RSS_MAX_KB", "CPU_NS/B", "IO_SYSC/OP");
+}
+
+static void printRow(const XferConfig *cfg, BenchOp op, long long size,
+                     int sessions, const XferResult *r)
+{
+    char sz[32];
+    formatSize(size, sz, sizeof(sz));
+    double mbps = r->seconds > 0 ? r->bytes / r->seconds / 1e6 : 0;
+
+    if (cfg->json) {
+        // One object per line, read back by "bench compare"
+        printf("{\"label\": \"%s\", \"op\": \"%s\", \"size\": %lld, \"sessions\": %d, "
+               "\"reps\": %d, \"ok\": %d, \"errors\": %d, \"seconds\": %.6f, "
+               "\"mb_per_s\": %.3f, \"p50_ms\": %.3f, \"p99_ms\": %.3f, "
+               "\"server_sessions\": %d, \"rss_avg_kb\": %ld, \"rss_max_kb\": %ld, "
+               "\"cpu_ns_per_byte\": %.4f, \"io_syscalls_per_op\": %.1f}\n",
+               cfg->label, benchOpName(op), size, sessions, cfg->reps, r->ok, r->errors,
+               r->seconds, mbps, r->p50Ms, r->p99Ms, r->sampled,
+               r->rssAvgKb, r->rssMaxKb, r->cpuNsPerByte, r->syscallsPerOp);
+    } else if (r->sampled > 0) {
+        printf("%-9s %6s %5d %6d %5d %10.1f %10.2f %10.2f %10ld %10ld %9.3f %10.1f\n",
+               benchOpName(op), sz, sessions, r->ok, r->errors, mbps, r->p50Ms, r->p99Ms,
+               r->rssAvgKb, r->rssMaxKb, r->cpuNsPerByte, r->syscallsPerOp);
+    } else {
+        printf("%-9s %6s %5d %6d %5d %10.1f %10.2f %10.2f %10s %10s %9s %10s\n",
+               benchOpName(op), sz, sessions, r->ok, r->errors, mbps, r->p50Ms, r->p99Ms,
+               "-", "-", "-", "-");
+    }
+    fflush(stdout);
+}
+
+// ------------------------------------------------------------
+// Shared random data for uploads and writes (unlinked temp file)
+// ------------------------------------------------------------
+static int createData(XferConfig *cfg, long long size)
+{
+    const char *tmp = getenv("TMPDIR");
+    char path[512];
+    snprintf(path, sizeof(path), "%s/bench-data-XXXXXX", tmp && tmp[0] ? tmp : "/tmp");
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("[BENCH] mkstemp");
+        return -1;
+    }
+    unlink(path);
+
+    // Incompressible and without zero blocks (the sparse stream skips those)
+    static uint64_t block[(1 << 20) / sizeof(uint64_t)];
+    uint64_t x = 0x9e3779b97f4a7c15ull ^ (uint64_t)getpid();
+
+    for (long long done = 0; done < size; ) {
+        for (size_t i = 0; i < sizeof(block) / sizeof(block[0]); i++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            block[i] = x | 1;
+        }
+
+        long long n = size - done < (long long)sizeof(block) ? size - done : (long long)sizeof(block);
+        if (write(fd, block, n) != n) {
+            perror("[BENCH] data file");
+            close(fd);
+            return -1;
+        }
+        done += n;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("[BENCH] mmap");
+        close(fd);
+        return -1;
+    }
+
+    cfg->dataFd = fd;
+    cfg->data   = map;
+    return 0;
+}
+
+// Remove the xfer-<pid>-<n> directories, one session per user
+static void cleanup(const XferConfig *cfg, int maxSessions)
+{
+    for (int u = 0; u < cfg->userCount && u < maxSessions; u++) {
+        BenchSession s;
+        sessionInit(&s, cfg, u);
+        snprintf(s.dir, sizeof(s.dir), "xfer-%d-%d", (int)getpid(), u);
+
+        if (benchOpenSession(&s) != STATUS_OK)
+            continue;
+
+        for (int i = u; i < maxSessions; i += cfg->userCount) {
+            char dir[BENCH_NAME_SIZE];
+            snprintf(dir, sizeof(dir), "xfer-%d-%d", (int)getpid(), i);
+            benchDelete(&s, dir);
+        }
+        benchCloseSession(&s);
+    }
+}
+
+// ============================================================
+// bench transfer
+// ============================================================
+int benchTransferMain(const char *prog, int argc, char *argv[])
+{
+    static char users[1024] = "bench";
+    static char sizes[512]  = XFER_DEFAULT_SIZES;
+    static char levels[512] = XFER_DEFAULT_SESSIONS;
+    static char ops[128]    = XFER_DEFAULT_OPS;
+
+    XferConfig cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.host   = "127.0.0.1";
+    cfg.port   = 8080;
+    cfg.reps   = 3;
+    cfg.budget = 8ll << 30;
+    cfg.label  = "";
+    cfg.dataFd = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:u:S:C:O:n:L:P:l:o:")) != -1) {
+        switch (opt) {
+            case 'h': cfg.host = optarg; break;
+            case 'p': cfg.port = atoi(optarg); break;
+            case 'u': snprintf(users, sizeof(users), "%s", optarg); break;
+            case 'S': snprintf(sizes, sizeof(sizes), "%s", optarg); break;
+            case 'C': snprintf(levels, sizeof(levels), "%s", optarg); break;
+            case 'O': snprintf(ops, sizeof(ops), "%s", optarg); break;
+            case 'n': cfg.reps = atoi(optarg); break;
+            case 'L': cfg.budget = parseSize(optarg); break;
+            case 'P': cfg.serverPid = (pid_t)atoi(optarg); break;
+            case 'l': cfg.label = optarg; break;
+            case 'o': cfg.json = strcmp(optarg, "text") != 0; break;
+            default:
+                usage(prog);
+                return 1;
+        }
+    }
+
+    char *items[XFER_MAX_LIST];
+    int n;
+
+    cfg.userCount = splitList(users, cfg.users, XFER_MAX_USERS);
+
+    n = splitList(sizes, items, XFER_MAX_LIST);
+    for (int i = 0; i < n; i++) {
+        if ((cfg.sizes[cfg.sizeCount++] = parseSize(items[i])) < 0) {
+            fprintf(stderr, "[BENCH] Bad size '%s'\n", items[i]);
+            return 1;
+        }
+    }
+
+    n = splitList(levels, items, XFER_MAX_LIST);
+    for (int i = 0; i < n; i++) {
+        int v = atoi(items[i]);
+        if (v < 1 || v > XFER_MAX_SESSIONS) {
+            fprintf(stderr, "[BENCH] Bad session count '%s'\n", items[i]);
+            return 1;
+        }
+        cfg.levels[cfg.levelCount++] = v;
+    }
+
+    if (cfg.userCount == 0 || cfg.sizeCount == 0 || cfg.levelCount == 0 ||
+        cfg.reps < 1 || cfg.budget < 0 || parseOps(&cfg, ops) < 0) {
+        usage(prog);
+        return 1;
+    }
+
+    // Data file covers the largest size that will run
+    long long maxSize = 0;
+    int maxSessions = 0;
+    for (int i = 0; i < cfg.sizeCount; i++) {
+        for (int j = 0; j < cfg.levelCount; j++) {
+            if (cfg.sizes[i] * cfg.levels[j] > cfg.budget)
+                continue;
+            if (cfg.sizes[i] > maxSize)
+                maxSize = cfg.sizes[i];
+            if (cfg.levels[j] > maxSessions)
+                maxSessions = cfg.levels[j];
+        }
+    }
+
+    if (maxSize == 0) {
+        fprintf(stderr, "[BENCH] Every cell exceeds the -L budget\n");
+        return 1;
+    }
+
+    if (statsInit() < 0 || createData(&cfg, maxSize) < 0)
+        return 1;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (cfg.serverPid && serverChildren(cfg.serverPid, (pid_t[1]){0}, 1) < 0) {
+        fprintf(stderr, "[BENCH] Cannot read children of pid %d, no server sampling\n",
+                (int)cfg.serverPid);
+        cfg.serverPid = 0;
+    }
+
+    printHeader(&cfg);
+
+    for (int i = 0; i < cfg.sizeCount; i++) {
+        long long size = cfg.sizes[i];
+
+        // Sessions 0..haveFiles-1 already hold s<size> on the server
+        int haveFiles = 0;
+
+        for (int j = 0; j < cfg.levelCount; j++) {
+            int sessions = cfg.levels[j];
+            char sz[32];
+            formatSize(size, sz, sizeof(sz));
+
+            if (size * sessions > cfg.budget) {
+                fprintf(stderr, "[BENCH] skip %s x %d: above the -L budget\n", sz, sessions);
+                continue;
+            }
+
+            for (int k = 0; k < cfg.opCount; k++) {
+                BenchOp op = cfg.ops[k];
+
+                // read / write carry an int size and a whole-file buffer
+                if ((op == BENCH_READ || op == BENCH_WRITE) && size > INT_MAX) {
+                    fprintf(stderr, "[BENCH] skip %s %s: above the read/write limit\n",
+                            benchOpName(op), sz);
+                    continue;
+                }
+
+                XferResult r;
+                runCell(&cfg, op, size, sessions, haveFiles, &r);
+                printRow(&cfg, op, size, sessions, &r);
+
+                // Every session that ran has the file now (setup or the op itself)
+                if (r.ready == sessions && sessions > haveFiles)
+                    haveFiles = sessions;
+            }
+        }
+    }
+
+    cleanup(&cfg, maxSessions);
+    return 0;
+}
+
+// ============================================================
+// bench compare: two JSON reports, matched by op, size, sessions
+// ============================================================
+static int jsonNumber(const char *line, const char *key, double *out)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+
+    const char *p = strstr(line, pattern);
+    if (!p)
+        return -1;
+
+    *out = strtod(p + strlen(pattern), NULL);
+    return 0;
+}
+
+static int jsonString(const char *line, const char *key, char *out, size_t size)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\": \"", key);
+
+    const char *p = strstr(line, pattern);
+    if (!p)
+        return -1;
+
+    p += strlen(pattern);
+    const char *end = strchr(p, '"');
+    if (!end)
+        return -1;
+
+    snprintf(out, size, "%.*s", (int)(end - p), p);
+    return 0;
+}
+
+typedef struct {
+    char   label[64];
+    char   op[16];
+    double size, sessions, mbps, p99, rss, cpu, syscalls, sampled;
+} XferRow;
+
+static int loadReport(const char *path, XferRow **rows)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    int count = 0, cap = 0;
+    char line[XFER_LINE_SIZE];
+    *rows = NULL;
+
+    while (fgets(line, sizeof(line), f)) {
+        XferRow r;
+        memset(&r, 0, sizeof(r));
+
+        if (jsonString(line, "op", r.op, sizeof(r.op)) < 0 ||
+            jsonNumber(line, "size", &r.size) < 0 ||
+            jsonNumber(line, "sessions", &r.sessions) < 0 ||
+            jsonNumber(line, "mb_per_s", &r.mbps) < 0)
+            continue;
+
+        jsonString(line, "label", r.label, sizeof(r.label));
+        jsonNumber(line, "p99_ms", &r.p99);
+        jsonNumber(line, "rss_max_kb", &r.rss);
+        jsonNumber(line, "cpu_ns_per_byte", &r.cpu);
+        jsonNumber(line, "io_syscalls_per_op", &r.syscalls);
+        jsonNumber(line, "server_sessions", &r.sampled);
+
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            XferRow *grown = realloc(*rows, cap * sizeof(XferRow));
+            if (!grown)
+                break;
+            *rows = grown;
+        }
+        (*rows)[count++] = r;
+    }
+
+    fclose(f);
+    return count;
+}
+
+static double change(double base, double now)
+{
+    return base > 0 ? (now - base) * 100.0 / base : 0;
+}
+
+int benchCompareMain(const char *prog, int argc, char *argv[])
+{
+    if (argc != 3) {
+        usage(prog);
+        return 1;
+    }
+
+    XferRow *base, *next;
+    int nb = loadReport(argv[1], &base);
+    int nn = loadReport(argv[2], &next);
+    if (nb < 0 || nn < 0)
+        return 1;
+
+    const char *lb = nb && base[0].label[0] ? base[0].label : "base";
+    const char *ln = nn && next[0].label[0] ? next[0].label : "new";
+
+    printf("MB/s and p99: %s -> %s\n\n", lb, ln);
+    printf("%-9s %6s %5s %10s %10s %8s %9s %9s %11s %11s %9s %9s\n",
+           "OP", "SIZE", "SESS", "MB/S_BASE", "MB/S_NEW", "CHANGE", "P99_BASE", "P99_NEW",
+           "RSS_KB_BASE", "RSS_KB_NEW", "CPU/B_BASE", "CPU/B_NEW");
+
+    for (int i = 0; i < nn; i++) {
+        const XferRow *n = &next[i];
+        const XferRow *b = NULL;
+
+        for (int j = 0; j < nb && !b; j++) {
+            if (strcmp(base[j].op, n->op) == 0 && base[j].size == n->size &&
+                base[j].sessions == n->sessions)
+                b = &base[j];
+        }
+        if (!b)
+            continue;
+
+        char sz[32];
+        formatSize((long long)n->size, sz, sizeof(sz));
+
+        printf("%-9s %6s %5d %10.1f %10.1f %+7.1f%% %9.2f %9.2f",
+               n->op, sz, (int)n->sessions, b->mbps, n->mbps, change(b->mbps, n->mbps),
+               b->p99, n->p99);
+
+        if (b->sampled > 0 && n->sampled > 0)
+            printf(" %11.0f %11.0f %9.3f %9.3f\n", b->rss, n->rss, b->cpu, n->cpu);
+        else
+            printf(" %11s %11s %9s %9s\n", "-", "-", "-", "-");
+    }
+
+    free(base);
+    free(next);
+    return 0;
+}
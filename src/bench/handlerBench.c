@@ -0,0 +1,569 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "../../include/serverCommands.h"
+#include "../../include/protocol.h"
+#include "../../include/network.h"
+#include "../../include/payload.h"
+#include "../../include/session.h"
+#include "../../include/fsOps.h"
+#include "../../include/utils.h"
+#include "../../include/stats.h"
+#include "../../include/log.h"
+#include "../../include/mdCache.h"
+#include "../../include/fileCache.h"
+
+// ============================================================
+// In-process handler benchmarks
+//
+// Links the server objects (all but serverMain.o) and calls
+// processCommand() directly on one end of a socketpair, inside a
+// temporary root. gHandlerTestMode skips the privilege switching,
+// so no root and no system users are needed. Iteration counts are
+// fixed per benchmark (scaled with -n) to keep runs comparable.
+// ============================================================
+
+#define HB_USER       "bench"
+#define HB_MAX_ROUNDS 32
+#define HB_SMALL_DIR  10
+#define HB_STAT_PATHS 1000
+#define HB_BATCH_FILES 100
+
+// serverMain.c is not linked
+const char *gRootDir = NULL;
+
+static int     serverFd = -1;        // Handler side of the socketpair
+static int     clientFd = -1;        // Responses are drained from here
+static Session session;
+static char    rootDir[512];
+static int     entries = 10000;      // Size of the big directory / tree
+static int     json    = 0;
+static int     first   = 1;
+
+// ------------------------------------------------------------
+// Driving handlers
+// ------------------------------------------------------------
+static void drainResponses(int *status)
+{
+    char buf[65536];
+    int  got = 0;
+
+    while (1) {
+        ssize_t n = recv(clientFd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n <= 0)
+            break;
+
+        // The first bytes are the ProtocolResponse of this command
+        if (status && got == 0 && n >= (ssize_t)sizeof(ProtocolResponse))
+            *status = ((ProtocolResponse *)buf)->status;
+        got += (int)n;
+    }
+}
+
+// One command, returns its status; *elapsed += time in processCommand
+static int call(int command, const char *arg1, const char *arg2, const char *arg3,
+                uint64_t *elapsed)
+{
+    ProtocolMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.command = command;
+    if (arg1) snprintf(msg.arg1, ARG_SIZE, "%s", arg1);
+    if (arg2) snprintf(msg.arg2, ARG_SIZE, "%s", arg2);
+    if (arg3) snprintf(msg.arg3, ARG_SIZE, "%s", arg3);
+
+    uint64_t t0 = statsNow();
+    processCommand(serverFd, &msg, &session);
+    if (elapsed)
+        *elapsed += statsNow() - t0;
+
+    int status = STATUS_ERROR;
+    drainResponses(&status);
+    return status;
+}
+
+// ------------------------------------------------------------
+// Fixtures (never timed)
+// ------------------------------------------------------------
+static int makeFile(const char *path, int size)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        return -1;
+
+    char buf[4096];
+    memset(buf, 'x', sizeof(buf));
+    int rc = 0;
+    while (size > 0 && rc == 0) {
+        int n = size < (int)sizeof(buf) ? size : (int)sizeof(buf);
+        rc = write(fd, buf, n) == n ? 0 : -1;
+        size -= n;
+    }
+    close(fd);
+    return rc;
+}
+
+// count files, 100 per subdirectory when nested
+static int makeTree(const char *dir, int count, int nested)
+{
+    char path[PATH_SIZE];
+
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST)
+        return -1;
+
+    for (int i = 0; i < count; i++) {
+        if (nested) {
+            snprintf(path, sizeof(path), "%s/d%d", dir, i / 100);
+            if (i % 100 == 0 && mkdir(path, 0700) < 0 && errno != EEXIST)
+                return -1;
+            snprintf(path, sizeof(path), "%s/d%d/f%d", dir, i / 100, i);
+        } else {
+            snprintf(path, sizeof(path), "%s/file-%06d.txt", dir, i);
+        }
+        if (makeFile(path, 0) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int setupRoot(void)
+{
+    snprintf(rootDir, sizeof(rootDir), "%s/handlerbench-XXXXXX",
+             getenv("TMPDIR") && getenv("TMPDIR")[0] ? getenv("TMPDIR") : "/tmp");
+    if (!mkdtemp(rootDir)) {
+        perror("[HANDLERBENCH] mkdtemp");
+        return -1;
+    }
+    gRootDir = rootDir;
+
+    char path[PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/%s", rootDir, HB_USER);
+    if (mkdir(path, 0700) < 0)
+        return -1;
+
+    snprintf(path, sizeof(path), "%s/%s/docs", rootDir, HB_USER);
+    if (makeTree(path, HB_SMALL_DIR, 0) < 0)
+        return -1;
+
+    // Backdated so that it counts as settled for the hot file cache (-c)
+    snprintf(path, sizeof(path), "%s/%s/docs/report.txt", rootDir, HB_USER);
+    struct timespec old[2] = { { time(NULL) - 60, 0 }, { time(NULL) - 60, 0 } };
+    if (makeFile(path, 4096) < 0 || utimensat(AT_FDCWD, path, old, 0) < 0)
+        return -1;
+
+    snprintf(path, sizeof(path), "%s/%s/big", rootDir, HB_USER);
+    return makeTree(path, entries, 0);
+}
+
+// ============================================================
+// BENCHMARKS
+// Each one runs iterations operations and returns the nanoseconds
+// they took (setup excluded), 0 on failure.
+// ============================================================
+static const char *relPath = "docs/../docs/./report.txt";
+static const char *absPath = "/docs/a/b/c/../../../report.txt";
+static const char *rawPath = "/srv/root/bench/docs/./a/b/../../report.txt";
+
+static uint64_t benchNormalize(long iterations)
+{
+    char out[PATH_SIZE];
+    uint64_t t0 = statsNow();
+    for (long i = 0; i < iterations; i++)
+        normalize_path(rawPath, out, sizeof(out));
+    return statsNow() - t0;
+}
+
+static uint64_t benchResolve(long iterations, const char *input)
+{
+    char out[PATH_SIZE];
+    uint64_t t0 = statsNow();
+    for (long i = 0; i < iterations; i++) {
+        if (resolvePath(&session, input, out) < 0)
+            return 0;
+    }
+    return statsNow() - t0;
+}
+
+static uint64_t benchResolveRelative(long iterations)
+{
+    return benchResolve(iterations, relPath);
+}
+
+static uint64_t benchResolveAbsolute(long iterations)
+{
+    return benchResolve(iterations, absPath);
+}
+
+static uint64_t benchInsideHome(long iterations)
+{
+    char full[PATH_SIZE + 32];
+    snprintf(full, sizeof(full), "%s/docs/report.txt", session.homeDir);
+
+    volatile int sink = 0;
+    uint64_t t0 = statsNow();
+    for (long i = 0; i < iterations; i++)
+        sink += isInsideHome(session.homeDir, full);
+    return statsNow() - t0;
+}
+
+static uint64_t benchCd(long iterations)
+{
+    uint64_t elapsed = 0;
+    for (long i = 0; i < iterations; i++) {
+        if (call(CMD_CD, (i & 1) ? ".." : "docs", NULL, NULL, &elapsed) != STATUS_OK)
+            return 0;
+    }
+    call(CMD_CD, "", NULL, NULL, NULL);
+    return elapsed;
+}
+
+static uint64_t benchList(long iterations, const char *dir)
+{
+    uint64_t elapsed = 0;
+    for (long i = 0; i < iterations; i++) {
+        if (call(CMD_LIST, dir, NULL, NULL, &elapsed) != STATUS_OK)
+            return 0;
+    }
+    return elapsed;
+}
+
+static uint64_t benchListSmall(long iterations)
+{
+    return benchList(iterations, "docs");
+}
+
+static uint64_t benchListBig(long iterations)
+{
+    return benchList(iterations, "big");
+}
+
+static uint64_t benchRead(long iterations)
+{
+    uint64_t elapsed = 0;
+    for (long i = 0; i < iterations; i++) {
+        if (call(CMD_READ, "docs/report.txt", NULL, NULL, &elapsed) != STATUS_OK)
+            return 0;
+    }
+    return elapsed;
+}
+
+// STAT_MANY of up to HB_STAT_PATHS files of the big directory
+static uint64_t benchStatMany(long iterations)
+{
+    int count = entries < HB_STAT_PATHS ? entries : HB_STAT_PATHS;
+    char *body = malloc((size_t)count * 32);
+    if (!body)
+        return 0;
+
+    int size = 0;
+    for (int i = 0; i < count; i++)
+        size += snprintf(body + size, 32, "big/file-%06d.txt", i) + 1;
+
+    ProtocolMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.command = CMD_STAT_MANY;
+
+    uint64_t elapsed = 0;
+    for (long i = 0; i < iterations; i++) {
+        // The path list is queued before the handler runs
+        if (sendAll(clientFd, &size, sizeof(int)) < 0 ||
+            sendPayload(clientFd, body, size) < 0)
+            break;
+
+        uint64_t t0 = statsNow();
+        processCommand(serverFd, &msg, &session);
+        elapsed += statsNow() - t0;
+
+        int status = STATUS_ERROR;
+        drainResponses(&status);
+        if (status != STATUS_OK) {
+            elapsed = 0;
+            break;
+        }
+    }
+    free(body);
+    return elapsed;
+}
+
+static uint64_t benchCreateDelete(long iterations)
+{
+    uint64_t elapsed = 0;
+    for (long i = 0; i < iterations; i++) {
+        if (call(CMD_CREATE, "tmp.txt", "644", "", &elapsed) != STATUS_OK ||
+            call(CMD_DELETE, "tmp.txt", NULL, NULL, &elapsed) != STATUS_OK)
+            return 0;
+    }
+    return elapsed;
+}
+
+static int appendOp(char *body, int size, int op, const char *path)
+{
+    BatchOp hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.op      = op;
+    hdr.mode    = 0644;
+    hdr.pathLen = strlen(path);
+    memcpy(body + size, &hdr, sizeof(hdr));
+    memcpy(body + size + sizeof(hdr), path, hdr.pathLen);
+    return size + (int)sizeof(hdr) + (int)hdr.pathLen;
+}
+
+// create_delete as one BATCH of HB_BATCH_FILES creates and deletes
+static uint64_t benchBatchCreateDelete(long iterations)
+{
+    char *body = malloc(HB_BATCH_FILES * 2 * (sizeof(BatchOp) + 32));
+    if (!body)
+        return 0;
+
+    int size = 0;
+    char path[32];
+    for (int i = 0; i < 2 * HB_BATCH_FILES; i++) {
+        snprintf(path, sizeof(path), "tmp-%03d.txt", i % HB_BATCH_FILES);
+        size = appendOp(body, size, i < HB_BATCH_FILES ? BATCH_CREATE : BATCH_DELETE, path);
+    }
+
+    ProtocolMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.command = CMD_BATCH;
+    snprintf(msg.arg1, ARG_SIZE, "-s");
+
+    uint64_t elapsed = 0;
+    for (long i = 0; i < iterations; i++) {
+        if (sendAll(clientFd, &size, sizeof(int)) < 0 ||
+            sendPayload(clientFd, body, size) < 0)
+            break;
+
+        uint64_t t0 = statsNow();
+        processCommand(serverFd, &msg, &session);
+        elapsed += statsNow() - t0;
+
+        int status = STATUS_ERROR;
+        drainResponses(&status);
+        if (status != STATUS_OK) {
+            elapsed = 0;
+            break;
+        }
+    }
+    free(body);
+    return elapsed;
+}
+
+static uint64_t benchRemoveRecursive(long iterations)
+{
+    char path[PATH_SIZE + 8];
+    snprintf(path, sizeof(path), "%s/tree", session.homeDir);
+
+    uint64_t elapsed = 0;
+    for (long i = 0; i < iterations; i++) {
+        if (makeTree(path, entries, 1) < 0)
+            return 0;
+
+        uint64_t t0 = statsNow();
+        int rc = removeRecursive(path);
+        elapsed += statsNow() - t0;
+
+        if (rc < 0)
+            return 0;
+    }
+    return elapsed;
+}
+
+typedef struct {
+    const char *name;
+    long        iterations;            // Per round, before -n scaling
+    uint64_t  (*run)(long iterations);
+} HandlerBench;
+
+static const HandlerBench benches[] = {
+    { "normalize_path",          200000, benchNormalize },
+    { "resolvePath_relative",    200000, benchResolveRelative },
+    { "resolvePath_absolute",    200000, benchResolveAbsolute },
+    { "isInsideHome",           1000000, benchInsideHome },
+    { "cd",                       20000, benchCd },
+    { "list_small",               20000, benchListSmall },
+    { "list_big",                   200, benchListBig },
+    { "read_4k",                  20000, benchRead },
+    { "stat_many_1000",             200, benchStatMany },
+    { "create_delete",             5000, benchCreateDelete },
+    { "batch_create_delete_100",     50, benchBatchCreateDelete },
+    { "removeRecursive",              1, benchRemoveRecursive },
+};
+
+// ------------------------------------------------------------
+// Rounds and report
+// ------------------------------------------------------------
+static int byValue(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *name, long iterations, int rounds, double *nsPerOp)
+{
+    qsort(nsPerOp, rounds, sizeof(double), byValue);
+    double best   = nsPerOp[0];
+    double median = nsPerOp[rounds / 2];
+
+    if (json) {
+        printf("%s\n    {\"name\": \"%s\", \"iterations\": %ld, \"rounds\": %d, "
+               "\"best_ns\": %.1f, \"median_ns\": %.1f, \"ops_per_s\": %.0f}",
+               first ? "" : ",", name, iterations, rounds, best, median,
+               median > 0 ? 1e9 / median : 0);
+    } else {
+        printf("%-22s %10ld %6d %14.1f %14.1f %14.0f\n",
+               name, iterations, rounds, best, median, median > 0 ? 1e9 / median : 0);
+    }
+    first = 0;
+    fflush(stdout);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [benchmark ...]\n"
+            "  -e entries    files in the big directory / removeRecursive tree (10000)\n"
+            "  -n factor     scale iteration counts (1.0)\n"
+            "  -r rounds     measured rounds, after one warm-up round (5)\n"
+            "  -o json|text  report format (text)\n"
+            "  -m            serve listings from the metadata cache (forks its watcher)\n"
+            "  -c            serve reads from the hot file cache\n"
+            "  -v            keep handler log output\n"
+            "Benchmarks:",
+            prog);
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+        fprintf(stderr, " %s", benches[i].name);
+    fprintf(stderr, "\n");
+}
+
+static int selected(const char *name, int argc, char *argv[])
+{
+    if (optind >= argc)
+        return 1;
+    for (int i = optind; i < argc; i++) {
+        if (strcmp(argv[i], name) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// ============================================================
+// MAIN
+// ============================================================
+int main(int argc, char *argv[])
+{
+    double factor = 1.0;
+    int rounds = 5, verbose = 0, mdCache = 0, fileCache = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "e:n:r:o:mcv")) != -1) {
+        switch (opt) {
+            case 'e': entries = atoi(optarg); break;
+            case 'n': factor  = atof(optarg); break;
+            case 'r': rounds  = atoi(optarg); break;
+            case 'o': json    = strcmp(optarg, "json") == 0; break;
+            case 'm': mdCache = 1; break;
+            case 'c': fileCache = 1; break;
+            case 'v': verbose = 1; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (entries < 1 || factor <= 0 || rounds < 1 || rounds > HB_MAX_ROUNDS) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    gHandlerTestMode = 1;
+    if (!verbose)
+        logSetLevel(LOG_LEVEL_ERROR);
+
+    pid_t watcherPid = -1;
+    if (mdCache) {
+        if (mdCacheInit() <= 0) {
+            fprintf(stderr, "[HANDLERBENCH] Metadata cache unavailable\n");
+            return 1;
+        }
+        pid_t parent = getpid();
+        watcherPid = fork();
+        if (watcherPid == 0)
+            mdCacheServe(parent);
+    }
+
+    if (fileCache && fileCacheInit() <= 0) {
+        fprintf(stderr, "[HANDLERBENCH] File cache unavailable\n");
+        return 1;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("[HANDLERBENCH] socketpair");
+        return 1;
+    }
+    serverFd = sv[0];
+    clientFd = sv[1];
+
+    fprintf(stderr, "[HANDLERBENCH] Building fixtures (%d entries)...\n", entries);
+    if (setupRoot() < 0) {
+        fprintf(stderr, "[HANDLERBENCH] Cannot create fixtures in %s\n", rootDir);
+        return 1;
+    }
+
+    initSession(&session);
+    if (call(CMD_LOGIN, HB_USER, NULL, NULL, NULL) != STATUS_OK) {
+        fprintf(stderr, "[HANDLERBENCH] Login in test mode failed\n");
+        removeRecursive(rootDir);
+        return 1;
+    }
+
+    if (json)
+        printf("{\n  \"entries\": %d,\n  \"benchmarks\": [", entries);
+    else
+        printf("%-22s %10s %6s %14s %14s %14s\n",
+               "BENCHMARK", "ITER", "ROUNDS", "BEST_NS/OP", "MEDIAN_NS/OP", "OPS/S");
+
+    int failed = 0;
+    for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+        const HandlerBench *hb = &benches[b];
+        if (!selected(hb->name, argc, argv))
+            continue;
+
+        long iterations = (long)(hb->iterations * factor);
+        if (iterations < 1)
+            iterations = 1;
+
+        // Warm-up: caches, dentries, allocator
+        hb->run(iterations);
+
+        double nsPerOp[HB_MAX_ROUNDS];
+        int ok = 1;
+        for (int r = 0; r < rounds && ok; r++) {
+            uint64_t ns = hb->run(iterations);
+            ok = ns > 0;
+            nsPerOp[r] = (double)ns / (double)iterations;
+        }
+
+        if (!ok) {
+            fprintf(stderr, "[HANDLERBENCH] %s failed\n", hb->name);
+            failed = 1;
+            continue;
+        }
+        report(hb->name, iterations, rounds, nsPerOp);
+    }
+
+    if (json)
+        printf("\n  ]\n}\n");
+
+    removeRecursive(rootDir);
+    if (watcherPid > 0)
+        kill(watcherPid, SIGTERM);
+    return failed;
+}
@@ -0,0 +1,704 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../../include/capture.h"
+#include "../../include/stats.h"
+#include "../../include/protocol.h"
+#include "../../include/network.h"
+#include "../../include/payload.h"
+#include "../../include/sparse.h"
+#include "../../include/archive.h"
+#include "../../include/utils.h"
+
+#define REPLAY_MAX_FILES 1024
+#define REPLAY_LEAD_NS   (100 * 1000000ull)   // Setup time before the first session
+
+// ------------------------------------------------------------
+// Configuration
+// ------------------------------------------------------------
+typedef struct {
+    const char *host;
+    int         port;
+    double      speed;                     // 1 = original timing, 0 = no waits
+    const char *user;                      // Overrides login names
+    int         json;
+} ReplayConfig;
+
+// One capture file, mapped read-only
+typedef struct {
+    const char          *path;
+    const char          *base;
+    size_t               size;
+    const CaptureHeader *hdr;
+} CaptureFile;
+
+// Per command results, shared by all session workers
+typedef struct {
+    uint64_t count;
+    uint64_t errors;                       // Connection lost during the request
+    uint64_t mismatches;                   // Final status differs from the capture
+    uint64_t synthesized;                  // Payload not captured, generated data sent
+    uint64_t origNs;                       // Sum of captured durations
+    uint64_t origMax;
+} ReplayCommand;
+
+typedef struct {
+    uint64_t      sessions;
+    uint64_t      aborted;                 // Sessions that lost their connection
+    uint64_t      maxLagNs;                // Worst lateness against the schedule
+    ReplayCommand commands[STATS_MAX_COMMANDS];
+} ReplayResults;
+
+static ReplayResults *results = NULL;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] capture-file...\n"
+            "  -h host       server address (127.0.0.1)\n"
+            "  -p port       server port (8080)\n"
+            "  -s speed      1 = original timing, 4 = four times faster,\n"
+            "                0 = as fast as possible (1)\n"
+            "  -u user       log in as this user instead of the captured one\n"
+            "  -o json|text  report format (text)\n"
+            "\n"
+            "       %s -d capture-file...   print the captured requests\n",
+            prog, prog);
+}
+
+static double ms(uint64_t ns)
+{
+    return ns / 1e6;
+}
+
+static int commandSlot(int command)
+{
+    return (command >= 0 && command < STATS_MAX_COMMANDS) ? command : STATS_MAX_COMMANDS - 1;
+}
+
+static void atomicMax(uint64_t *p, uint64_t v)
+{
+    uint64_t cur = __atomic_load_n(p, __ATOMIC_RELAXED);
+    while (v > cur &&
+           !__atomic_compare_exchange_n(p, &cur, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+// ============================================================
+// CAPTURE FILES
+// ============================================================
+static int openCapture(CaptureFile *f, const char *path)
+{
+    memset(f, 0, sizeof(*f));
+    f->path = path;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "[REPLAY] %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(CaptureHeader)) {
+        fprintf(stderr, "[REPLAY] %s: not a capture file\n", path);
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "[REPLAY] %s: mmap: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    f->base = map;
+    f->size = st.st_size;
+    f->hdr  = map;
+
+    if (memcmp(f->hdr->magic, CAPTURE_MAGIC, sizeof(f->hdr->magic)) != 0 ||
+        f->hdr->version != CAPTURE_VERSION) {
+        fprintf(stderr, "[REPLAY] %s: not a capture file (or another version)\n", path);
+        munmap(map, st.st_size);
+        return -1;
+    }
+    return 0;
+}
+
+// Record at *pos: fills args (NUL-terminated) and payload, advances *pos.
+// Returns 0 ok, 1 at the end, -1 on a cut record (session killed mid-write).
+static int nextRecord(const CaptureFile *f, size_t *pos, CaptureRecord *rec,
+                      char args[3][ARG_SIZE], const char **payload)
+{
+    if (*pos == f->size)
+        return 1;
+    if (f->size - *pos < sizeof(*rec))
+        return -1;
+
+    memcpy(rec, f->base + *pos, sizeof(*rec));
+    size_t p = *pos + sizeof(*rec);
+
+    for (int i = 0; i < 3; i++) {
+        if (rec->argLen[i] >= ARG_SIZE || f->size - p < rec->argLen[i])
+            return -1;
+        memcpy(args[i], f->base + p, rec->argLen[i]);
+        args[i][rec->argLen[i]] = '\0';
+        p += rec->argLen[i];
+    }
+
+    if (f->size - p < rec->payloadLen)
+        return -1;
+    *payload = f->base + p;
+    *pos     = p + rec->payloadLen;
+    return 0;
+}
+
+// ------------------------------------------------------------
+// -d: one line per request
+// ------------------------------------------------------------
+static int dumpCapture(const char *path)
+{
+    CaptureFile f;
+    if (openCapture(&f, path) < 0)
+        return -1;
+
+    time_t start = (time_t)(f.hdr->startUnixNs / 1000000000ull);
+    char when[64];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&start));
+
+    printf("# %s: session %d, started %s, payloads %s\n", path, f.hdr->pid, when,
+           (f.hdr->flags & CAPTURE_HAS_PAYLOADS) ? "kept" : "sizes only");
+    printf("%12s %10s %-14s %6s %10s %10s %8s  %s\n",
+           "offset_ms", "dur_ms", "command", "status", "in", "out", "stored", "args");
+
+    size_t pos = sizeof(CaptureHeader);
+    CaptureRecord rec;
+    char args[3][ARG_SIZE];
+    const char *payload;
+    int rc;
+
+    while ((rc = nextRecord(&f, &pos, &rec, args, &payload)) == 0) {
+        printf("%12.3f %10.3f %-14s %6d %10llu %10llu %8s  '%s' '%s' '%s'\n",
+               ms(rec.offsetNs), ms(rec.durationNs), statsCommandName(rec.command),
+               rec.status, (unsigned long long)rec.bytesIn,
+               (unsigned long long)rec.bytesOut,
+               (rec.flags & CAPTURE_REC_TRUNCATED) ? "cut" :
+               rec.payloadLen ? "yes" : "-",
+               args[0], args[1], args[2]);
+    }
+
+    if (rc < 0)
+        printf("# %s: last record incomplete\n", path);
+
+    munmap((void *)f.base, f.size);
+    return 0;
+}
+
+// ============================================================
+// SYNTHESIZED PAYLOADS (captured sizes only)
+// ============================================================
+static int   synthFd   = -1;
+static off_t synthSize = 0;
+static char *synthMap  = NULL;
+
+// Unlinked temp file with at least size bytes of non-zero data
+static int synthData(long long size)
+{
+    if (size <= synthSize)
+        return 0;
+
+    if (synthFd < 0) {
+        const char *tmp = getenv("TMPDIR");
+        char path[512];
+        snprintf(path, sizeof(path), "%s/replay-data-XXXXXX", tmp && tmp[0] ? tmp : "/tmp");
+
+        synthFd = mkstemp(path);
+        if (synthFd < 0)
+            return -1;
+        unlink(path);
+    }
+
+    // No zero blocks: the sparse stream would skip them
+    static char block[64 * 1024];
+    for (size_t i = 0; i < sizeof(block); i++)
+        block[i] = (char)('a' + i % 26);
+
+    for (off_t done = synthSize; done < size; ) {
+        long long n = size - done < (long long)sizeof(block) ? size - done : (long long)sizeof(block);
+        if (pwrite(synthFd, block, n, done) != n)
+            return -1;
+        done += n;
+    }
+
+    if (synthMap)
+        munmap(synthMap, synthSize);
+    synthMap = mmap(NULL, size, PROT_READ, MAP_SHARED, synthFd, 0);
+    if (synthMap == MAP_FAILED) {
+        synthMap  = NULL;
+        synthSize = 0;
+        return -1;
+    }
+
+    synthSize = size;
+    return 0;
+}
+
+// Inbound bytes of one request: captured, or generated with the captured size
+static int sendInbound(int sock, const CaptureRecord *rec, const char *payload,
+                       int *synthesized)
+{
+    if (rec->payloadLen > 0)
+        return sendAll(sock, payload, (int)rec->payloadLen);
+
+    *synthesized = 1;
+    long long size = (long long)rec->bytesIn;
+
+    switch (rec->command) {
+        case CMD_WRITE:
+        case CMD_STAT_MANY:
+        case CMD_BATCH: {
+            // Size prefix, then the data (framing overhead is not subtracted)
+            int n = size > (long long)sizeof(int) ? (int)(size - sizeof(int)) : 0;
+            if (synthData(n) < 0 || sendAll(sock, &n, sizeof(int)) < 0)
+                return -1;
+            return n > 0 ? sendPayload(sock, synthMap, n) : 0;
+        }
+
+        case CMD_UPLOAD: {
+            SparseStats stats;
+            if (synthData(size) < 0)
+                return -1;
+            return sparseSendFile(sock, synthFd, size, &stats);
+        }
+
+        case CMD_UPLOAD_TREE: {
+            // The tree layout is not recorded: send an empty tree
+            char dir[] = "/tmp/replay-tree-XXXXXX";
+            if (!mkdtemp(dir))
+                return -1;
+
+            ArchiveStats stats;
+            memset(&stats, 0, sizeof(stats));
+            int rc = archiveSendTree(sock, dir, NULL, &stats);
+            rmdir(dir);
+            return rc;
+        }
+    }
+    return 0;
+}
+
+// ============================================================
+// REPLAY
+// ============================================================
+static void sleepUntil(uint64_t ns)
+{
+    struct timespec ts = { (time_t)(ns / 1000000000ull), (long)(ns % 1000000000ull) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+// Drain a payload of size bytes
+static int drainPayload(int sock, int size)
+{
+    char buf[PAYLOAD_CHUNK];
+
+    while (size > 0) {
+        int n = size < (int)sizeof(buf) ? size : (int)sizeof(buf);
+        if (recvPayload(sock, buf, n) < 0)
+            return -1;
+        size -= n;
+    }
+    return 0;
+}
+
+// Send one captured request and consume the whole response exchange.
+// Returns the final status, -1 if the connection is gone.
+static int replayRequest(int sock, const ReplayConfig *cfg, const CaptureRecord *rec,
+                         char args[3][ARG_SIZE], const char *payload, int *synthesized)
+{
+    ProtocolMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.command = rec->command;
+
+    // Captured arguments already fit (checked by nextRecord), so does -u
+    if (rec->command == CMD_LOGIN && cfg->user)
+        snprintf(msg.arg1, ARG_SIZE, "%s", cfg->user);
+    else
+        memcpy(msg.arg1, args[0], ARG_SIZE);
+    memcpy(msg.arg2, args[1], ARG_SIZE);
+    memcpy(msg.arg3, args[2], ARG_SIZE);
+
+    // A synthesized upload declares the size it is going to send
+    if (rec->command == CMD_UPLOAD && rec->payloadLen == 0)
+        snprintf(msg.arg2, ARG_SIZE, "%llu", (unsigned long long)rec->bytesIn);
+
+    if (sendMessage(sock, &msg) < 0)
+        return -1;
+
+    // Path and operation lists follow the message without an ack
+    if ((rec->command == CMD_STAT_MANY || rec->command == CMD_BATCH) &&
+        sendInbound(sock, rec, payload, synthesized) < 0)
+        return -1;
+
+    ProtocolResponse res;
+    if (receiveResponse(sock, &res) < 0)
+        return -1;
+    if (res.status != STATUS_OK)
+        return res.status;
+
+    switch (rec->command) {
+        case CMD_CD:
+        case CMD_LIST:
+        case CMD_STATS:
+        case CMD_DU:
+        case CMD_STAT_MANY:
+        case CMD_BATCH:
+            return drainPayload(sock, res.dataSize) < 0 ? -1 : STATUS_OK;
+
+        case CMD_READ: {
+            char validator[VALIDATOR_SIZE];
+            if (recvAll(sock, validator, VALIDATOR_SIZE) < 0 ||
+                drainPayload(sock, res.dataSize) < 0)
+                return -1;
+            return STATUS_OK;
+        }
+
+        case CMD_WRITE:
+        case CMD_UPLOAD:
+        case CMD_UPLOAD_TREE:
+            // Ack received, stream the data and wait for the final status
+            if (sendInbound(sock, rec, payload, synthesized) < 0 ||
+                receiveResponse(sock, &res) < 0)
+                return -1;
+            return res.status;
+
+        case CMD_DOWNLOAD: {
+            static int devNull = -1;
+            if (devNull < 0)
+                devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+            SparseStats stats;
+            char validator[VALIDATOR_SIZE];
+            if (sparseReceiveFile(sock, devNull, -1, SPARSE_NO_LIMIT, &stats) < 0 ||
+                recvAll(sock, validator, VALIDATOR_SIZE) < 0)
+                return -1;
+            return validator[0] ? STATUS_OK : STATUS_ERROR;
+        }
+
+        case CMD_DOWNLOAD_TREE: {
+            char dir[] = "/tmp/replay-tree-XXXXXX";
+            if (!mkdtemp(dir))
+                return -1;
+
+            ArchiveStats stats;
+            memset(&stats, 0, sizeof(stats));
+            int rc = archiveReceiveTree(sock, dir, NULL, &stats);
+            removeRecursive(dir);
+
+            if (rc < 0)
+                return -1;
+            return stats.errors ? STATUS_ERROR : STATUS_OK;
+        }
+
+        case CMD_COMPRESS:
+            // Payloads are compressed from the next request on
+            setPayloadCompression(sock, 1);
+            return STATUS_OK;
+
+        case CMD_WATCH: {
+            // Stop after as long as the original watch lasted, then
+            // consume event batches up to the end of the stream
+            if (cfg->speed > 0)
+                sleepUntil(statsNow() + (uint64_t)(rec->durationNs / cfg->speed));
+
+            memset(&msg, 0, sizeof(msg));
+            msg.command = CMD_WATCH;
+            if (sendMessage(sock, &msg) < 0)
+                return -1;
+
+            do {
+                if (receiveResponse(sock, &res) < 0 ||
+                    drainPayload(sock, res.dataSize) < 0)
+                    return -1;
+            } while (res.dataSize > 0);
+            return STATUS_OK;
+        }
+
+        case CMD_FIND:
+            // Match batches up to the empty one
+            do {
+                if (receiveResponse(sock, &res) < 0 ||
+                    drainPayload(sock, res.dataSize) < 0)
+                    return -1;
+            } while (res.dataSize > 0);
+            return STATUS_OK;
+    }
+
+    return STATUS_OK;
+}
+
+// One capture file on one connection. start: when the session begins (monotonic)
+static int runSession(const ReplayConfig *cfg, const CaptureFile *f, uint64_t start)
+{
+    if (cfg->speed > 0)
+        sleepUntil(start);
+
+    int sock = connectToServer(cfg->host, cfg->port);
+    if (sock < 0) {
+        fprintf(stderr, "[REPLAY] %s: cannot connect\n", f->path);
+        __atomic_add_fetch(&results->aborted, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    __atomic_add_fetch(&results->sessions, 1, __ATOMIC_RELAXED);
+
+    size_t pos = sizeof(CaptureHeader);
+    CaptureRecord rec;
+    char args[3][ARG_SIZE];
+    const char *payload;
+
+    while (nextRecord(f, &pos, &rec, args, &payload) == 0) {
+        if (cfg->speed > 0) {
+            uint64_t due = start + (uint64_t)(rec.offsetNs / cfg->speed);
+            sleepUntil(due);
+            atomicMax(&results->maxLagNs, statsNow() - due);
+        }
+
+        ReplayCommand *c = &results->commands[commandSlot(rec.command)];
+        int synthesized = 0;
+
+        uint64_t t = statsNow();
+        int status = replayRequest(sock, cfg, &rec, args, payload, &synthesized);
+        uint64_t elapsed = statsNow() - t;
+
+        __atomic_add_fetch(&c->count, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&c->origNs, rec.durationNs, __ATOMIC_RELAXED);
+        atomicMax(&c->origMax, rec.durationNs);
+        if (synthesized)
+            __atomic_add_fetch(&c->synthesized, 1, __ATOMIC_RELAXED);
+
+        if (status < 0) {
+            __atomic_add_fetch(&c->errors, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&results->aborted, 1, __ATOMIC_RELAXED);
+            fprintf(stderr, "[REPLAY] %s: connection lost at %s\n",
+                    f->path, statsCommandName(rec.command));
+            break;
+        }
+
+        if (status != rec.status)
+            __atomic_add_fetch(&c->mismatches, 1, __ATOMIC_RELAXED);
+
+        statsRecordCommand(rec.command, status, elapsed, 0, 0);
+    }
+
+    // Exit is handled before dispatch and never captured
+    ProtocolMessage bye;
+    memset(&bye, 0, sizeof(bye));
+    bye.command = CMD_EXIT;
+    sendMessage(sock, &bye);
+
+    setPayloadCompression(sock, 0);
+    close(sock);
+    return 0;
+}
+
+// ============================================================
+// REPORT
+// ============================================================
+static void reportText(double elapsed, double span)
+{
+    const ServerStats *st = statsShared();
+
+    printf("%-14s %7s %6s %8s %6s %10s %10s %10s %10s %8s\n",
+           "command", "count", "errors", "mismatch", "synth",
+           "orig_avg", "orig_max", "avg_ms", "p99_ms", "ratio");
+
+    for (int cmd = 0; cmd < STATS_MAX_COMMANDS; cmd++) {
+        const ReplayCommand *c = &results->commands[cmd];
+        if (c->count == 0)
+            continue;
+
+        const StatsHistogram *h = &st->commands[cmd].latency;
+        double origAvg = ms(c->origNs) / c->count;
+        double avg     = h->count ? ms(h->sum) / h->count : 0.0;
+
+        printf("%-14s %7llu %6llu %8llu %6llu %10.3f %10.3f %10.3f %10.3f %8.2f\n",
+               statsCommandName(cmd), (unsigned long long)c->count,
+               (unsigned long long)c->errors, (unsigned long long)c->mismatches,
+               (unsigned long long)c->synthesized, origAvg, ms(c->origMax),
+               avg, ms(statsPercentile(h, 99.0)),
+               origAvg > 0 ? avg / origAvg : 0.0);
+    }
+
+    printf("\nSessions: %llu replayed, %llu aborted   wall %.3f s (captured %.3f s)"
+           "   max lag %.3f ms\n",
+           (unsigned long long)results->sessions, (unsigned long long)results->aborted,
+           elapsed, span, ms(results->maxLagNs));
+}
+
+static void reportJson(const ReplayConfig *cfg, double elapsed, double span)
+{
+    const ServerStats *st = statsShared();
+
+    printf("{\n");
+    printf("  \"speed\": %g,\n", cfg->speed);
+    printf("  \"elapsed_s\": %.3f,\n", elapsed);
+    printf("  \"captured_s\": %.3f,\n", span);
+    printf("  \"sessions\": %llu,\n", (unsigned long long)results->sessions);
+    printf("  \"sessions_aborted\": %llu,\n", (unsigned long long)results->aborted);
+    printf("  \"max_lag_ms\": %.3f,\n", ms(results->maxLagNs));
+    printf("  \"commands\": [");
+
+    int first = 1;
+    for (int cmd = 0; cmd < STATS_MAX_COMMANDS; cmd++) {
+        const ReplayCommand *c = &results->commands[cmd];
+        if (c->count == 0)
+            continue;
+
+        const StatsHistogram *h = &st->commands[cmd].latency;
+
+        printf("%s\n    {\"command\": \"%s\", \"count\": %llu, \"errors\": %llu, "
+               "\"mismatches\": %llu, \"synthesized\": %llu, "
+               "\"orig_ms\": {\"avg\": %.3f, \"max\": %.3f}, "
+               "\"replay_ms\": {\"avg\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}}",
+               first ? "" : ",", statsCommandName(cmd),
+               (unsigned long long)c->count, (unsigned long long)c->errors,
+               (unsigned long long)c->mismatches, (unsigned long long)c->synthesized,
+               ms(c->origNs) / c->count, ms(c->origMax),
+               h->count ? ms(h->sum) / h->count : 0.0,
+               ms(statsPercentile(h, 50.0)), ms(statsPercentile(h, 99.0)), ms(h->max));
+        first = 0;
+    }
+
+    printf("\n  ]\n}\n");
+}
+
+// ============================================================
+// MAIN
+// ============================================================
+int main(int argc, char *argv[])
+{
+    static CaptureFile files[REPLAY_MAX_FILES];
+
+    ReplayConfig cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.host  = "127.0.0.1";
+    cfg.port  = 8080;
+    cfg.speed = 1.0;
+
+    int dump = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:s:u:o:d")) != -1) {
+        switch (opt) {
+            case 'h': cfg.host  = optarg;       break;
+            case 'p': cfg.port  = atoi(optarg); break;
+            case 's': cfg.speed = atof(optarg); break;
+            case 'u': cfg.user  = optarg;       break;
+            case 'o': cfg.json  = strcmp(optarg, "json") == 0; break;
+            case 'd': dump      = 1;            break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    int count = argc - optind;
+    if (count < 1 || count > REPLAY_MAX_FILES || cfg.speed < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (cfg.user && strlen(cfg.user) >= ARG_SIZE) {
+        fprintf(stderr, "User name too long (max %d characters)\n", ARG_SIZE - 1);
+        return 1;
+    }
+
+    if (dump) {
+        int rc = 0;
+        for (int i = optind; i < argc; i++)
+            rc |= dumpCapture(argv[i]) < 0;
+        return rc;
+    }
+
+    // Sessions keep their relative start times (wall clock of the capture)
+    int loaded = 0;
+    uint64_t first = UINT64_MAX;
+    double span = 0.0;
+
+    for (int i = optind; i < argc; i++) {
+        if (openCapture(&files[loaded], argv[i]) < 0)
+            continue;
+        if (files[loaded].hdr->startUnixNs < first)
+            first = files[loaded].hdr->startUnixNs;
+        loaded++;
+    }
+
+    if (loaded == 0)
+        return 1;
+
+    // Captured time span: last request end of any session
+    for (int i = 0; i < loaded; i++) {
+        size_t pos = sizeof(CaptureHeader);
+        CaptureRecord rec;
+        char args[3][ARG_SIZE];
+        const char *payload;
+
+        while (nextRecord(&files[i], &pos, &rec, args, &payload) == 0) {
+            double end = (files[i].hdr->startUnixNs - first + rec.offsetNs +
+                          rec.durationNs) / 1e9;
+            if (end > span)
+                span = end;
+        }
+    }
+
+    // Replay latency histograms and the per command results, shared by all workers
+    if (statsInit() < 0)
+        return 1;
+
+    results = mmap(NULL, sizeof(*results), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+        perror("[REPLAY] mmap");
+        return 1;
+    }
+    memset(results, 0, sizeof(*results));
+
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "[REPLAY] %d session(s) against %s:%d at %s\n", loaded,
+            cfg.host, cfg.port, cfg.speed > 0 ? "scaled capture timing" : "full speed");
+
+    uint64_t t0 = statsNow() + (cfg.speed > 0 ? REPLAY_LEAD_NS : 0);
+
+    for (int i = 0; i < loaded; i++) {
+        uint64_t offset = files[i].hdr->startUnixNs - first;
+        uint64_t start  = t0 + (cfg.speed > 0 ? (uint64_t)(offset / cfg.speed) : 0);
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("[REPLAY] fork");
+            break;
+        }
+        if (pid == 0)
+            _exit(runSession(&cfg, &files[i], start));
+    }
+
+    while (wait(NULL) > 0) {}
+
+    uint64_t now = statsNow();
+    double elapsed = now > t0 ? (now - t0) / 1e9 : 0.0;
+
+    if (cfg.json)
+        reportJson(&cfg, elapsed, span);
+    else
+        reportText(elapsed, span);
+
+    return results->aborted ? 2 : 0;
+}
@@ -4,11 +4,16 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "../../include/clientCommands.h"
 #include "../../include/protocol.h"
 #include "../../include/network.h"
 #include "../../include/utils.h"
+#include "../../include/payload.h"
 
 // ============================================================
 // ANSI colors for client output
@@ -28,6 +33,8 @@
 // Upload / download helpers (implemented elsewhere)
 extern int uploadFile(int sock, const char *localPath, const char *remotePath);
 extern int downloadFile(int sock, const char *remotePath, const char *localPath);
+extern int uploadTree(int sock, const char *localDir, const char *remoteDir);
+extern int downloadTree(int sock, const char *remoteDir, const char *localDir);
 
 // ============================================================
 // Client state
@@ -36,6 +43,7 @@ static const char *g_ip = NULL;
 static int g_port = 0;
 static char g_username[64] = "";
 static char g_currentPath[PATH_SIZE] = "/";
+static int g_compress = 0;
 
 // Background process tracking
 static pid_t bgPids[128];
@@ -50,6 +58,29 @@ void setGlobalServerInfo(const char *ip, int port)
     g_port = port;
 }
 
+// ============================================================
+// Ask server to compress payloads on this connection
+// Returns 0 if compression is now active
+// ============================================================
+int clientNegotiateCompression(int sock)
+{
+    ProtocolMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.command = CMD_COMPRESS;
+    strncpy(msg.arg1, PAYLOAD_CODEC_LZ, ARG_SIZE);
+
+    sendMessage(sock, &msg);
+
+    ProtocolResponse res;
+    if (receiveResponse(sock, &res) < 0 || res.status != STATUS_OK) {
+        return -1;
+    }
+
+    setPayloadCompression(sock, 1);
+    g_compress = 1;
+    return 0;
+}
+
 const char* getCurrentPath()
 {
     return g_currentPath;
@@ -159,6 +190,52 @@ static void explainCommandError(const char *cmd,
         return;
     }
 
+    if (strcmp(cmd, "watch") == 0) {
+        ERROR("Watch failed.");
+        ERROR(" - Invalid path or permissions");
+        ERROR(" - Too many directories (-r)");
+        SYNTAX("watch [-r] [path]");
+        return;
+    }
+
+    if (strcmp(cmd, "du") == 0) {
+        ERROR("Disk usage failed.");
+        ERROR(" - Invalid path or permissions");
+        SYNTAX("du [path]");
+        return;
+    }
+
+    if (strcmp(cmd, "stat") == 0) {
+        ERROR("Stat failed.");
+        ERROR(" - Not logged in");
+        SYNTAX("stat <path> [path...]");
+        return;
+    }
+
+    if (strcmp(cmd, "batch") == 0) {
+        ERROR("Batch failed, nothing was run.");
+        ERROR(" - Not logged in");
+        ERROR(" - Too many operations");
+        SYNTAX("batch [-s|-a] <script>");
+        return;
+    }
+
+    if (strcmp(cmd, "find") == 0) {
+        ERROR("Find failed.");
+        ERROR(" - Invalid path or permissions");
+        ERROR(" - Invalid filter");
+        SYNTAX("find [path] [-name glob] [-type f|d] [-size [+-]N[KMG]]");
+        SYNTAX("     [-mtime [+-]N[smhd]] [-mindepth N] [-maxdepth N]");
+        return;
+    }
+
+    if (strcmp(cmd, "stats") == 0) {
+        ERROR("Stats failed.");
+        ERROR(" - Not logged in");
+        SYNTAX("stats [locks]");
+        return;
+    }
+
     if (strcmp(cmd, "create") == 0) {
         ERROR("Create failed.");
         ERROR(" - Invalid permissions");
@@ -183,6 +260,15 @@ static void explainCommandError(const char *cmd,
         return;
     }
 
+    if (strcmp(cmd, "copy") == 0) {
+        ERROR("Copy failed.");
+        ERROR(" - Invalid path");
+        ERROR(" - Destination already exists");
+        ERROR(" - Storage quota exceeded");
+        SYNTAX("copy <source> <destination>");
+        return;
+    }
+
     if (strcmp(cmd, "delete") == 0) {
         ERROR("Delete failed.");
         ERROR(" - File/folder does not exist");
@@ -201,6 +287,7 @@ static void explainCommandError(const char *cmd,
     if (strcmp(cmd, "write") == 0) {
         ERROR("Write failed.");
         ERROR(" - Invalid path");
+        ERROR(" - Storage quota exceeded");
         SYNTAX("write <path>");
         SYNTAX("write -offset=N <path>");
         return;
@@ -211,6 +298,7 @@ static void explainCommandError(const char *cmd,
         ERROR(" - Invalid paths");
         SYNTAX("upload <local> <remote>");
         SYNTAX("upload -b <local> <remote>");
+        SYNTAX("upload -r <localDir> <remoteDir>");
         return;
     }
 
@@ -219,6 +307,7 @@ static void explainCommandError(const char *cmd,
         ERROR(" - Invalid paths");
         SYNTAX("download <remote> <local>");
         SYNTAX("download -b <remote> <local>");
+        SYNTAX("download -r <remoteDir> <localDir>");
         return;
     }
 
@@ -260,6 +349,241 @@ static int sendSimpleCommand(int sock, int cmd,
     return (res.status == STATUS_OK ? res.dataSize : -1);
 }
 
+// ============================================================
+// Watch helper: print event batches until ENTER (see watch.h)
+// Returns -1 if the connection was lost
+// ============================================================
+static int streamWatchEvents(int sock)
+{
+    int stopping = 0;
+
+    for (;;) {
+        struct pollfd pfds[2] = {
+            { sock,         POLLIN,                0 },
+            { STDIN_FILENO, stopping ? 0 : POLLIN, 0 },
+        };
+
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        // ENTER (or EOF): any message ends the watch
+        if (!stopping && pfds[1].revents) {
+            char line[256];
+            if (!fgets(line, sizeof(line), stdin))
+                clearerr(stdin);
+
+            ProtocolMessage stop;
+            memset(&stop, 0, sizeof(stop));
+            stop.command = CMD_WATCH;
+            sendMessage(sock, &stop);
+            stopping = 1;
+        }
+
+        if (!pfds[0].revents)
+            continue;
+
+        ProtocolResponse res;
+        if (receiveResponse(sock, &res) < 0 || res.status != STATUS_OK)
+            return -1;
+
+        // Empty batch: end of the stream
+        if (res.dataSize == 0)
+            return 0;
+
+        char *buffer = malloc(res.dataSize + 1);
+        if (!buffer || recvPayload(sock, buffer, res.dataSize) < 0) {
+            free(buffer);
+            return -1;
+        }
+        buffer[res.dataSize] = '\0';
+
+        // "<EVENT> <path>" lines, event name highlighted
+        for (char *line = strtok(buffer, "\n"); line; line = strtok(NULL, "\n")) {
+            char *space = strchr(line, ' ');
+            if (space)
+                *space = '\0';
+            printf(CYAN "%-8s" RESET " %s\n", line, space ? space + 1 : "");
+        }
+        fflush(stdout);
+        free(buffer);
+    }
+}
+
+// Find helper: print path batches until the empty one (see find.h)
+static int streamFindMatches(int sock, long *count)
+{
+    for (;;) {
+        ProtocolResponse res;
+        if (receiveResponse(sock, &res) < 0 || res.status != STATUS_OK)
+            return -1;
+
+        // Empty batch: end of the stream
+        if (res.dataSize == 0)
+            return 0;
+
+        char *buffer = malloc(res.dataSize + 1);
+        if (!buffer || recvPayload(sock, buffer, res.dataSize) < 0) {
+            free(buffer);
+            return -1;
+        }
+        buffer[res.dataSize] = '\0';
+
+        for (char *line = strtok(buffer, "\n"); line; line = strtok(NULL, "\n")) {
+            printf("%s\n", line);
+            (*count)++;
+        }
+        fflush(stdout);
+        free(buffer);
+    }
+}
+
+// Stat helper: one line per path of a STAT_MANY reply (see protocol.h)
+static void printStatRecord(const char *path, const StatRecord *rec)
+{
+    if (rec->error) {
+        printf("%-40s %s\n", path, strerror(rec->error));
+        return;
+    }
+
+    char perms[11] = "----------";
+    mode_t mode = (mode_t)rec->mode;
+    perms[0] = S_ISDIR(mode) ? 'd' : S_ISLNK(mode) ? 'l' : S_ISREG(mode) ? '-' : '?';
+    const char *rwx = "rwxrwxrwx";
+    for (int i = 0; i < 9; i++)
+        if (mode & (0400 >> i))
+            perms[i + 1] = rwx[i];
+
+    char when[32];
+    time_t t = (time_t)rec->mtimeSec;
+    struct tm tm;
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm));
+
+    printf("%-40s %s %12lld  %s\n", path, perms, (long long)rec->size, when);
+}
+
+// ============================================================
+// Batch helpers: a local script, one operation per line
+//   mkdir <path> <perm>     create <path> <perm>    chmod <path> <perm>
+//   move <src> <dst>        delete <path>           write <path> <text>
+// Empty lines and lines starting with '#' are skipped.
+// ============================================================
+typedef struct {
+    char *data;
+    int   size;
+    int   max;
+} BatchBody;
+
+static int appendBatch(BatchBody *b, const void *src, int len)
+{
+    if (b->size + len > b->max) {
+        int max = b->max ? b->max : 4096;
+        while (max < b->size + len)
+            max *= 2;
+        char *grown = realloc(b->data, max);
+        if (!grown)
+            return -1;
+        b->data = grown;
+        b->max  = max;
+    }
+    memcpy(b->data + b->size, src, len);
+    b->size += len;
+    return 0;
+}
+
+// Parse one script line into the body; -1 on a syntax error
+static int appendBatchLine(BatchBody *b, char *line)
+{
+    char *verb = strtok(line, " \t");
+    char *path = strtok(NULL, " \t");
+    char *rest = strtok(NULL, "");
+
+    static const struct { const char *name; int op; } verbs[] = {
+        { "create", BATCH_CREATE }, { "mkdir", BATCH_MKDIR }, { "chmod", BATCH_CHMOD },
+        { "move",   BATCH_MOVE },   { "delete", BATCH_DELETE }, { "write", BATCH_WRITE },
+    };
+
+    BatchOp op;
+    memset(&op, 0, sizeof(op));
+    for (int i = 0; verb && i < (int)(sizeof(verbs) / sizeof(verbs[0])); i++)
+        if (strcmp(verb, verbs[i].name) == 0)
+            op.op = verbs[i].op;
+    if (!op.op || !path || strlen(path) >= ARG_SIZE)
+        return -1;
+
+    const char *target = "", *data = "";
+    if (op.op == BATCH_CREATE || op.op == BATCH_MKDIR || op.op == BATCH_CHMOD) {
+        char *end;
+        long perms = rest ? strtol(rest, &end, 8) : -1;
+        if (!rest || *end != '\0' || perms < 0 || perms > 0777)
+            return -1;
+        op.mode = (int)perms;
+    } else if (op.op == BATCH_MOVE) {
+        if (!rest || strchr(rest, ' ') || strlen(rest) >= ARG_SIZE)
+            return -1;
+        target = rest;
+    } else if (op.op == BATCH_WRITE) {
+        data = rest ? rest : "";
+        if (strlen(data) > BATCH_MAX_WRITE)
+            return -1;
+    } else if (rest) {
+        return -1;
+    }
+
+    op.pathLen   = strlen(path);
+    op.targetLen = strlen(target);
+    op.dataLen   = strlen(data);
+    if (appendBatch(b, &op, sizeof(op)) < 0 ||
+        appendBatch(b, path, op.pathLen) < 0 ||
+        appendBatch(b, target, op.targetLen) < 0 ||
+        appendBatch(b, data, op.dataLen) < 0)
+        return -1;
+    return 0;
+}
+
+// Read the script; operation count, -1 on error (*lines: script line
+// of each operation, malloc'ed)
+static int loadBatchScript(const char *file, BatchBody *b, int **lines)
+{
+    FILE *f = fopen(file, "r");
+    if (!f) {
+        ERROR("Cannot open %s", file);
+        return -1;
+    }
+
+    char line[BATCH_MAX_WRITE + 2 * ARG_SIZE];
+    int count = 0, lineNo = 0, max = 0;
+    *lines = NULL;
+
+    while (fgets(line, sizeof(line), f)) {
+        lineNo++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        if (count == BATCH_MAX_OPS || appendBatchLine(b, line) < 0) {
+            ERROR("%s:%d: invalid operation", file, lineNo);
+            fclose(f);
+            return -1;
+        }
+        if (count == max) {
+            max = max ? max * 2 : 64;
+            int *grown = realloc(*lines, sizeof(int) * max);
+            if (!grown) {
+                fclose(f);
+                return -1;
+            }
+            *lines = grown;
+        }
+        (*lines)[count++] = lineNo;
+    }
+
+    fclose(f);
+    return count;
+}
+
 // ============================================================
 // Login helper for background processes
 // ============================================================
@@ -289,7 +613,7 @@ static int backgroundLogin(int bgSock)
 // ============================================================
 // Start upload in background process
 // ============================================================
-static void startBackgroundUpload(const char *local, const char *remote)
+static void startBackgroundUpload(const char *local, const char *remote, int tree)
 {
     pid_t pid = fork();
     if (pid < 0) {
@@ -322,6 +646,12 @@ static void startBackgroundUpload(const char *local, const char *remote)
         _exit(1);
     }
 
+    // Same payload compression as the main connection
+    if (g_compress && clientNegotiateCompression(bgSock) < 0) {
+        close(bgSock);
+        _exit(1);
+    }
+
     // Authenticate
     if (backgroundLogin(bgSock) < 0) {
         close(bgSock);
@@ -329,7 +659,8 @@ static void startBackgroundUpload(const char *local, const char *remote)
     }
 
     // Run upload
-    int result = uploadFile(bgSock, local, remote);
+    int result = tree ? uploadTree(bgSock, local, remote)
+                      : uploadFile(bgSock, local, remote);
     close(bgSock);
 
     // Print result
@@ -346,7 +677,7 @@ static void startBackgroundUpload(const char *local, const char *remote)
 // ============================================================
 // Start download in background process
 // ============================================================
-static void startBackgroundDownload(const char *remote, const char *local)
+static void startBackgroundDownload(const char *remote, const char *local, int tree)
 {
     pid_t pid = fork();
     if (pid < 0) {
@@ -379,6 +710,12 @@ static void startBackgroundDownload(const char *remote, const char *local)
         _exit(1);
     }
 
+    // Same payload compression as the main connection
+    if (g_compress && clientNegotiateCompression(bgSock) < 0) {
+        close(bgSock);
+        _exit(1);
+    }
+
     // Authenticate
     if (backgroundLogin(bgSock) < 0) {
         close(bgSock);
@@ -386,11 +723,12 @@ static void startBackgroundDownload(const char *remote, const char *local)
     }
 
     // Run download
-    int result = downloadFile(bgSock, remote, local);
+    int result = tree ? downloadTree(bgSock, remote, local)
+                      : downloadFile(bgSock, remote, local);
     close(bgSock);
 
     // Print result
-    if (result == 0) {
+    if (result >= 0) {
         printf(YELLOW "[Background] Command: download %s %s concluded\n" RESET, remote, local);
     } else {
         printf(YELLOW "[Background] Command: download %s %s FAILED\n" RESET, remote, local);
@@ -400,13 +738,35 @@ static void startBackgroundDownload(const char *remote, const char *local)
     _exit(0);
 }
 
+// ============================================================
+// Parse upload/download flags (-b background, -r directory tree).
+// Returns index of the first path token, -1 on unknown flag.
+// ============================================================
+static int parseTransferFlags(char **tokens, int n, int *bg, int *tree)
+{
+    int i = 1;
+    *bg   = 0;
+    *tree = 0;
+
+    while (i < n && tokens[i][0] == '-') {
+        if (strcmp(tokens[i], "-b") == 0)
+            *bg = 1;
+        else if (strcmp(tokens[i], "-r") == 0)
+            *tree = 1;
+        else
+            return -1;
+        i++;
+    }
+    return i;
+}
+
 // ============================================================
 // Main client command handler
 // ============================================================
 int clientHandleInput(int sock, char *input)
 {
-    char *tokens[10];
-    int n = tokenize(input, tokens, 10);
+    char *tokens[16];
+    int n = tokenize(input, tokens, 16);
     if (n == 0) return 0;
 
     char *cmd = tokens[0];
@@ -495,7 +855,7 @@ int clientHandleInput(int sock, char *input)
         if (res.dataSize > 0) {
             char newPath[PATH_SIZE];
             if (res.dataSize < PATH_SIZE) {
-                recvAll(sock, newPath, res.dataSize);
+                recvPayload(sock, newPath, res.dataSize);
                 newPath[res.dataSize] = '\0';
                 updateCurrentPath(newPath);
             }
@@ -517,7 +877,259 @@ int clientHandleInput(int sock, char *input)
         }
 
         char *buffer = malloc(dataSize + 1);
-        recvAll(sock, buffer, dataSize);
+        recvPayload(sock, buffer, dataSize);
+        buffer[dataSize] = '\0';
+
+        printf("%s", buffer);
+        free(buffer);
+
+        return 0;
+    }
+
+    // ----------------------------
+    // WATCH (change notifications)
+    // ----------------------------
+    if (strcmp(cmd, "watch") == 0) {
+        const char *path = "";
+        int recursive = 0;
+
+        for (int i = 1; i < n; i++) {
+            if (strcmp(tokens[i], "-r") == 0)
+                recursive = 1;
+            else
+                path = tokens[i];
+        }
+
+        if (n > 3) {
+            SYNTAX("Syntax: watch [-r] [path]");
+            return 0;
+        }
+
+        if (sendSimpleCommand(sock, CMD_WATCH, path, recursive ? "-r" : NULL, NULL) < 0) {
+            explainCommandError("watch", path, NULL, NULL);
+            return 0;
+        }
+
+        printf("Watching %s%s, press ENTER to stop\n",
+               path[0] ? path : "current directory", recursive ? " (recursive)" : "");
+        fflush(stdout);
+
+        if (streamWatchEvents(sock) < 0) {
+            ERROR("Connection lost while watching");
+            return 1;
+        }
+
+        SUCCESS("Watch stopped");
+        return 0;
+    }
+
+    // ----------------------------
+    // DU (disk usage per subdirectory)
+    // ----------------------------
+    if (strcmp(cmd, "du") == 0) {
+        if (n > 2) {
+            SYNTAX("Syntax: du [path]");
+            return 0;
+        }
+        const char *path = (n == 2 ? tokens[1] : "");
+
+        int dataSize = sendSimpleCommand(sock, CMD_DU, path, NULL, NULL);
+        if (dataSize < 0) {
+            explainCommandError("du", path, NULL, NULL);
+            return 0;
+        }
+
+        char *buffer = malloc(dataSize + 1);
+        recvPayload(sock, buffer, dataSize);
+        buffer[dataSize] = '\0';
+
+        printf("%s", buffer);
+        free(buffer);
+
+        return 0;
+    }
+
+    // ----------------------------
+    // STAT (metadata of several paths, one request)
+    // ----------------------------
+    if (strcmp(cmd, "stat") == 0) {
+        if (n < 2) {
+            SYNTAX("Syntax: stat <path> [path...]");
+            return 0;
+        }
+
+        // NUL-separated path list, sent after the message
+        char body[16 * ARG_SIZE];
+        int size = 0;
+        for (int i = 1; i < n; i++) {
+            int len = (int)strlen(tokens[i]) + 1;
+            memcpy(body + size, tokens[i], len);
+            size += len;
+        }
+
+        ProtocolMessage msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.command = CMD_STAT_MANY;
+
+        ProtocolResponse res;
+        if (sendMessage(sock, &msg) < 0 ||
+            sendAll(sock, &size, sizeof(int)) < 0 ||
+            sendPayload(sock, body, size) < 0 ||
+            receiveResponse(sock, &res) < 0) {
+            ERROR("No response from server");
+            return 1;
+        }
+        if (res.status != STATUS_OK ||
+            res.dataSize != (n - 1) * (int)sizeof(StatRecord)) {
+            explainCommandError("stat", NULL, NULL, NULL);
+            return 0;
+        }
+
+        StatRecord records[16];
+        if (recvPayload(sock, records, res.dataSize) < 0) {
+            ERROR("Connection lost");
+            return 1;
+        }
+        for (int i = 1; i < n; i++)
+            printStatRecord(tokens[i], &records[i - 1]);
+
+        return 0;
+    }
+
+    // ----------------------------
+    // BATCH (operations of a local script, one request)
+    // ----------------------------
+    if (strcmp(cmd, "batch") == 0) {
+        const char *flag = (n == 3 ? tokens[1] : "");
+        if (n < 2 || n > 3 ||
+            (n == 3 && strcmp(flag, "-s") != 0 && strcmp(flag, "-a") != 0)) {
+            SYNTAX("Syntax: batch [-s|-a] <script>");
+            return 0;
+        }
+
+        BatchBody body = { NULL, 0, 0 };
+        int *lines = NULL;
+        int count = loadBatchScript(tokens[n - 1], &body, &lines);
+        if (count < 0 || body.size > BATCH_MAX_BODY) {
+            if (count >= 0)
+                ERROR("Script too large (max %d bytes)", BATCH_MAX_BODY);
+            free(body.data);
+            free(lines);
+            return 0;
+        }
+
+        ProtocolMessage msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.command = CMD_BATCH;
+        strncpy(msg.arg1, flag, ARG_SIZE - 1);
+
+        ProtocolResponse res;
+        BatchResult *results = malloc(sizeof(BatchResult) * (count ? count : 1));
+        int rc = !results ||
+                 sendMessage(sock, &msg) < 0 ||
+                 sendAll(sock, &body.size, sizeof(int)) < 0 ||
+                 (body.size > 0 && sendPayload(sock, body.data, body.size) < 0) ||
+                 receiveResponse(sock, &res) < 0;
+        free(body.data);
+
+        if (rc) {
+            ERROR("No response from server");
+            free(results);
+            free(lines);
+            return 1;
+        }
+        if (res.status != STATUS_OK || res.dataSize != count * (int)sizeof(BatchResult)) {
+            explainCommandError("batch", NULL, NULL, NULL);
+            free(results);
+            free(lines);
+            return 0;
+        }
+        if (res.dataSize > 0 && recvPayload(sock, results, res.dataSize) < 0) {
+            ERROR("Connection lost");
+            free(results);
+            free(lines);
+            return 1;
+        }
+
+        int ok = 0, failed = 0, skipped = 0, undone = 0;
+        for (int i = 0; i < count; i++) {
+            switch (results[i].status) {
+                case STATUS_OK:     ok++;      break;
+                case BATCH_SKIPPED: skipped++; break;
+                case BATCH_UNDONE:  undone++;  break;
+                default:
+                    failed++;
+                    ERROR("line %d: %s", lines[i],
+                          results[i].status == STATUS_QUOTA ? "storage quota exceeded" : "failed");
+            }
+        }
+
+        printf("%d operation(s): %d ok, %d failed, %d skipped, %d undone\n",
+               count, ok, failed, skipped, undone);
+        free(results);
+        free(lines);
+        return 0;
+    }
+
+    // ----------------------------
+    // FIND (server-side search)
+    // ----------------------------
+    if (strcmp(cmd, "find") == 0) {
+        const char *path = "";
+        const char *glob = "";
+        char filters[ARG_SIZE] = "";
+        int i = 1;
+
+        if (i < n && tokens[i][0] != '-')
+            path = tokens[i++];
+
+        // Options come in pairs; everything but -name is checked by the server
+        for (; i + 1 < n; i += 2) {
+            if (strcmp(tokens[i], "-name") == 0)
+                glob = tokens[i + 1];
+            else
+                snprintf(filters + strlen(filters), sizeof(filters) - strlen(filters),
+                         "%s%s %s", filters[0] ? " " : "", tokens[i], tokens[i + 1]);
+        }
+
+        if (i != n) {
+            SYNTAX("Syntax: find [path] [-name glob] [-type f|d] [-size [+-]N[KMG]]");
+            SYNTAX("             [-mtime [+-]N[smhd]] [-mindepth N] [-maxdepth N]");
+            return 0;
+        }
+
+        if (sendSimpleCommand(sock, CMD_FIND, path, glob, filters) < 0) {
+            explainCommandError("find", path, NULL, NULL);
+            return 0;
+        }
+
+        long count = 0;
+        if (streamFindMatches(sock, &count) < 0) {
+            ERROR("Connection lost during find");
+            return 1;
+        }
+
+        SUCCESS("%ld match(es)", count);
+        return 0;
+    }
+
+    // ----------------------------
+    // STATS (server latency report)
+    // ----------------------------
+    if (strcmp(cmd, "stats") == 0) {
+        if (n > 2 || (n == 2 && strcmp(tokens[1], "locks") != 0)) {
+            SYNTAX("Syntax: stats [locks]");
+            return 0;
+        }
+
+        int dataSize = sendSimpleCommand(sock, CMD_STATS, n == 2 ? tokens[1] : NULL, NULL, NULL);
+        if (dataSize < 0) {
+            explainCommandError("stats", NULL, NULL, NULL);
+            return 0;
+        }
+
+        char *buffer = malloc(dataSize + 1);
+        recvPayload(sock, buffer, dataSize);
         buffer[dataSize] = '\0';
 
         printf("%s", buffer);
@@ -593,6 +1205,26 @@ int clientHandleInput(int sock, char *input)
         return 0;
     }
 
+    // -----------------------------------------------------------
+    // COPY command (server-side, no data goes through the client)
+    // -----------------------------------------------------------
+    if (strcmp(cmd, "copy") == 0) {
+        // Validate arguments
+        if (n < 3) {
+            SYNTAX("Syntax: copy <src> <dst>");
+            return 0;
+        }
+
+        // Send COPY request
+        int files = sendSimpleCommand(sock, CMD_COPY, tokens[1], tokens[2], NULL);
+        if (files < 0)
+            explainCommandError("copy", tokens[1], tokens[2], NULL);
+        else
+            SUCCESS("Copied (%d file(s))", files);
+
+        return 0;
+    }
+
     // -----------------------------------------------------------
     // DELETE command
     // -----------------------------------------------------------
@@ -646,10 +1278,14 @@ int clientHandleInput(int sock, char *input)
             return 0;
         }
 
+        // Validator comes first (not shown, read has no local cache)
+        char validator[VALIDATOR_SIZE];
+        recvAll(sock, validator, VALIDATOR_SIZE);
+
         // Receive file content
         int size = res.dataSize;
         char *buffer = malloc(size + 1);
-        recvAll(sock, buffer, size);
+        recvPayload(sock, buffer, size);
         buffer[size] = '\0';
 
         printf("%s\n", buffer);
@@ -721,7 +1357,7 @@ int clientHandleInput(int sock, char *input)
         int size = total;
         sendAll(sock, &size, sizeof(int));
         if (size > 0)
-            sendAll(sock, buffer, size);
+            sendPayload(sock, buffer, size);
 
         free(buffer);
 
@@ -731,6 +1367,8 @@ int clientHandleInput(int sock, char *input)
 
         if (fin.status == STATUS_OK)
             SUCCESS("Wrote %d bytes", fin.dataSize);
+        else if (fin.status == STATUS_QUOTA)
+            ERROR("Write refused: storage quota exceeded.");
         else
             explainCommandError("write", msg.arg1, msg.arg2, NULL);
 
@@ -741,23 +1379,31 @@ int clientHandleInput(int sock, char *input)
     // UPLOAD command (foreground and background)
     // -----------------------------------------------------------
     if (strcmp(cmd, "upload") == 0) {
-        // Background upload
-        if (n == 4 && strcmp(tokens[1], "-b") == 0) {
-            startBackgroundUpload(tokens[2], tokens[3]);
+        int bg, tree;
+        int first = parseTransferFlags(tokens, n, &bg, &tree);
+
+        if (first < 0 || n - first != 2) {
+            SYNTAX("Syntax: upload [-b] [-r] <local> <remote>");
             return 0;
         }
 
-        // Foreground upload
-        if (n == 3) {
-            if (uploadFile(sock, tokens[1], tokens[2]) < 0) {
-                explainCommandError("upload", tokens[1], tokens[2], NULL);
-            } else {
-                SUCCESS("Upload completed: %s -> %s", tokens[1], tokens[2]);
-            }
+        const char *local  = tokens[first];
+        const char *remote = tokens[first + 1];
+
+        // Background upload
+        if (bg) {
+            startBackgroundUpload(local, remote, tree);
             return 0;
         }
 
-        SYNTAX("Syntax: upload <local> <remote> OR upload -b <local> <remote>");
+        // Foreground upload
+        int r = tree ? uploadTree(sock, local, remote)
+                     : uploadFile(sock, local, remote);
+        if (r < 0) {
+            explainCommandError("upload", local, remote, NULL);
+        } else {
+            SUCCESS("Upload completed: %s -> %s", local, remote);
+        }
         return 0;
     }
 
@@ -765,24 +1411,33 @@ int clientHandleInput(int sock, char *input)
     // DOWNLOAD command (foreground and background)
     // -----------------------------------------------------------
     if (strcmp(cmd, "download") == 0) {
-        // Background download
-        if (n == 4 && strcmp(tokens[1], "-b") == 0) {
-            startBackgroundDownload(tokens[2], tokens[3]);
+        int bg, tree;
+        int first = parseTransferFlags(tokens, n, &bg, &tree);
+
+        if (first < 0 || n - first != 2) {
+            SYNTAX("Syntax: download [-b] [-r] <remote> <local>");
             return 0;
         }
 
-        // Foreground download
-        if (n == 3) {
-            if (downloadFile(sock, tokens[1], tokens[2]) < 0) {
-                explainCommandError("download", tokens[1], tokens[2], NULL);
-            } else {
-                SUCCESS("Download completed: %s -> %s", tokens[1], tokens[2]);
-            }
+        const char *remote = tokens[first];
+        const char *local  = tokens[first + 1];
+
+        // Background download
+        if (bg) {
+            startBackgroundDownload(remote, local, tree);
             return 0;
         }
 
-        // Invalid syntax
-        SYNTAX("Syntax: download <remote> <local> OR download -b <remote> <local>");
+        // Foreground download
+        int r = tree ? downloadTree(sock, remote, local)
+                     : downloadFile(sock, remote, local);
+        if (r < 0) {
+            explainCommandError("download", remote, local, NULL);
+        } else if (r == DOWNLOAD_NOT_MODIFIED) {
+            SUCCESS("Not modified, local copy is up to date: %s", local);
+        } else {
+            SUCCESS("Download completed: %s -> %s", remote, local);
+        }
         return 0;
     }
 
@@ -80,14 +80,21 @@ void printHelp()
     printf("  " GREEN "delete_user" RESET " " CYAN "<username>" RESET "                - Delete user\n");
     printf("  " GREEN "cd" RESET " " CYAN "<directory>" RESET "                        - Change directory\n");
     printf("  " GREEN "list" RESET " " CYAN "[path]" RESET "                           - List directory\n");
+    printf("  " GREEN "watch" RESET " " YELLOW "[-r]" RESET " " CYAN "[path]" RESET "                     - Stream changes until ENTER\n");
+    printf("  " GREEN "find" RESET " " CYAN "[path]" RESET " " YELLOW "[-name glob] [filters]" RESET "    - Search the tree on the server\n");
+    printf("  " GREEN "du" RESET " " CYAN "[path]" RESET "                             - Disk usage per subdirectory\n");
+    printf("  " GREEN "stat" RESET " " CYAN "<path> [path...]" RESET "                 - Type, permissions, size and mtime\n");
+    printf("  " GREEN "batch" RESET " " YELLOW "[-s|-a]" RESET " " CYAN "<script>" RESET "                - Run a script of create/chmod/move/... at once\n");
     printf("  " GREEN "create" RESET " " CYAN "<path> <perm>" RESET " " YELLOW "[-d]" RESET "             - Create file/directory\n");
     printf("  " GREEN "chmod" RESET " " CYAN "<path> <permissions>" RESET "            - Change permissions\n");
     printf("  " GREEN "move" RESET " " CYAN "<src> <dst>" RESET "                      - Move/rename\n");
+    printf("  " GREEN "copy" RESET " " CYAN "<src> <dst>" RESET "                      - Copy file/directory\n");
     printf("  " GREEN "delete" RESET " " CYAN "<path>" RESET "                         - Delete\n");
     printf("  " GREEN "read" RESET " " YELLOW "[-offset=N]" RESET " " CYAN "<path>" RESET "               - Read file\n");
     printf("  " GREEN "write" RESET " " YELLOW "[-offset=N]" RESET " " CYAN "<path>" RESET "              - Write to file\n");
-    printf("  " GREEN "upload" RESET " " YELLOW "[-b]" RESET " " CYAN "<local> <remote>" RESET "          - Upload\n");
-    printf("  " GREEN "download" RESET " " YELLOW "[-b]" RESET " " CYAN "<remote> <local>" RESET "        - Download\n");
+    printf("  " GREEN "upload" RESET " " YELLOW "[-b] [-r]" RESET " " CYAN "<local> <remote>" RESET "     - Upload (-r: directory)\n");
+    printf("  " GREEN "download" RESET " " YELLOW "[-b] [-r]" RESET " " CYAN "<remote> <local>" RESET "   - Download (-r: directory)\n");
+    printf("  " GREEN "stats" RESET " " YELLOW "[locks]" RESET "                         - Server latency / lock contention statistics\n");
     printf("  " GREEN "exit" RESET "                                  - Exit client\n");
     printf("  " GREEN "help" RESET "                                  - Show this help\n\n");
 }
@@ -104,10 +111,18 @@ int main(int argc, char *argv[])
     sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
     sigaction(SIGCHLD, &sa, NULL);
 
-    // ./client  (default)  ili  ./client <ip> <port>
+    // ./client [-c]  (default)  ili  ./client [-c] <ip> <port>
     const char *ip = "127.0.0.1";
     int port = 8080;
 
+    // -c: ask the server to compress payloads on this connection
+    int useCompression = 0;
+    if (argc >= 2 && strcmp(argv[1], "-c") == 0) {
+        useCompression = 1;
+        argv++;
+        argc--;
+    }
+
     if (argc == 1) {
         // default ip/port
     }
@@ -116,7 +131,7 @@ int main(int argc, char *argv[])
         struct in_addr tmp;
         if (inet_pton(AF_INET, argv[1], &tmp) != 1) {
             printf(RED "[X] Invalid IP address: %s\n" RESET, argv[1]);
-            printf(YELLOW "[!] Usage: ./client [<ip> <port>]\n" RESET);
+            printf(YELLOW "[!] Usage: ./client [-c] [<ip> <port>]\n" RESET);
             return 1;
         }
 
@@ -134,7 +149,7 @@ int main(int argc, char *argv[])
     }
     else {
         printf(RED "[X] Invalid arguments\n" RESET);
-        printf(YELLOW "[!] Usage: ./client [<ip> <port>]\n" RESET);
+        printf(YELLOW "[!] Usage: ./client [-c] [<ip> <port>]\n" RESET);
         return 1;
     }
 
@@ -151,6 +166,14 @@ int main(int argc, char *argv[])
     // Startup messages
     printClientInfo(ip, port);
     printf("Connected to " GREEN "%s:%d" RESET "\n", ip, port);
+
+    // Negotiate compression before any other command
+    if (useCompression) {
+        if (clientNegotiateCompression(sock) == 0)
+            printf("Payload compression " GREEN "enabled" RESET "\n");
+        else
+            printf(YELLOW "[!] Server refused compression, using raw transfers\n" RESET);
+    }
     printf("Type " YELLOW "'help'" RESET " for commands\n\n");
 
     char input[INPUT_SIZE];
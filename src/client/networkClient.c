@@ -5,9 +5,19 @@
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "../../include/network.h"
 #include "../../include/protocol.h"
+#include "../../include/payload.h"
+#include "../../include/archive.h"
+#include "../../include/sparse.h"
+#include "../../include/clientCommands.h"
+#include "../../include/session.h"
+
+// Validator cache file kept next to each downloaded file
+#define VALIDATOR_CACHE_SUFFIX ".etag"
 
 // ------------------------------------------------------------
 // Connect to server (client side)
@@ -97,99 +107,152 @@ int recvAll(int sock, void *buffer, int size)
 
 // ------------------------------------------------------------
 // Upload file to server
+// Only data extents are sent, holes are recreated remotely
 // ------------------------------------------------------------
 int uploadFile(int sock, const char *localPath, const char *remotePath)
 {
-    FILE *f = fopen(localPath, "rb");
-    if (!f) {
-        perror("fopen");
+    int fd = open(localPath, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
         return -1;
     }
 
-    // Get file size
-    fseek(f, 0, SEEK_END);
-    long fsize = ftell(f);
-    fseek(f, 0, SEEK_SET);
-
-    if (fsize < 0) {
-        perror("ftell");
-        fclose(f);
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        printf("[UPLOAD] '%s' is not a regular file\n", localPath);
+        close(fd);
         return -1;
     }
 
-    // Limit upload size
-    if (fsize > MAX_FILE_SIZE) {
-        printf("[UPLOAD] File too large (%ld bytes)\n", fsize);
-        fclose(f);
-        return -1;
-    }
-
-    int size = (int)fsize;
-
     // Send upload request
     ProtocolMessage msg;
     memset(&msg, 0, sizeof(msg));
     msg.command = CMD_UPLOAD;
     strncpy(msg.arg1, remotePath, sizeof(msg.arg1));
-    snprintf(msg.arg2, sizeof(msg.arg2), "%d", size);
+    snprintf(msg.arg2, sizeof(msg.arg2), "%lld", (long long)st.st_size);
 
     sendAll(sock, &msg, sizeof(msg));
 
     // Server response
     ProtocolResponse res;
     recvAll(sock, &res, sizeof(res));
+    if (res.status == STATUS_QUOTA) {
+        printf("[UPLOAD] Refused: storage quota exceeded\n");
+        close(fd);
+        return -1;
+    }
     if (res.status != STATUS_OK) {
         printf("[UPLOAD] Server refused upload\n");
-        fclose(f);
+        close(fd);
         return -1;
     }
 
-    // Read file into buffer
-    char *buffer = NULL;
-    if (size > 0) {
-        buffer = malloc(size);
-        if (!buffer) {
-            printf("[UPLOAD] Out of memory\n");
-            fclose(f);
-            return -1;
-        }
+    // Stream file data
+    SparseStats stats;
+    int rc = sparseSendFile(sock, fd, (long long)st.st_size, &stats);
+    close(fd);
 
-        int readBytes = (int)fread(buffer, 1, size, f);
-        if (readBytes != size) {
-            printf("[UPLOAD] Read error\n");
-            free(buffer);
-            fclose(f);
-            return -1;
-        }
-    }
-    fclose(f);
-
-    // Send file data
-    if (size > 0) {
-        sendAll(sock, buffer, size);
-        free(buffer);
-    }
+    if (rc < 0)
+        printf("[UPLOAD] Read error\n");
 
     // Final confirmation
     recvAll(sock, &res, sizeof(res));
-    if (res.status != STATUS_OK) {
+    if (rc < 0 || res.status != STATUS_OK) {
         printf("[UPLOAD] Upload failed\n");
         return -1;
     }
 
+    if (stats.dataBytes < stats.fileSize)
+        printf("[UPLOAD] Sparse file: sent %lld of %lld bytes\n",
+               stats.dataBytes, stats.fileSize);
+
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Validator cache: "<localPath>.etag"
+// Line 1: server validator
+// Line 2: size and mtime of the local file when it was written,
+//         so a locally modified copy is never treated as current
+// ------------------------------------------------------------
+static void validatorCachePath(const char *localPath, char *out)
+{
+    snprintf(out, PATH_SIZE, "%s%s", localPath, VALIDATOR_CACHE_SUFFIX);
+}
+
+// Load cached validator if the local file is unchanged since download
+static int loadValidatorCache(const char *localPath, char *validator)
+{
+    char cachePath[PATH_SIZE];
+    validatorCachePath(localPath, cachePath);
+
+    struct stat st;
+    if (stat(localPath, &st) < 0)
+        return -1;
+
+    FILE *f = fopen(cachePath, "r");
+    if (!f)
+        return -1;
+
+    char line[VALIDATOR_SIZE + 2];
+    long long size = -1, sec = -1;
+    long nsec = -1;
+    int ok = (fgets(line, sizeof(line), f) != NULL &&
+              fscanf(f, "%lld %lld %ld", &size, &sec, &nsec) == 3);
+    fclose(f);
+
+    if (!ok)
+        return -1;
+
+    size_t len = strcspn(line, "\n");
+    line[len] = '\0';
+
+    if (len >= VALIDATOR_SIZE ||
+        size != (long long)st.st_size ||
+        sec  != (long long)st.st_mtim.tv_sec ||
+        nsec != (long)st.st_mtim.tv_nsec)
+        return -1;
+
+    memcpy(validator, line, len + 1);
     return 0;
 }
 
+// Remember validator together with the local file state
+static void saveValidatorCache(const char *localPath, const char *validator)
+{
+    char cachePath[PATH_SIZE];
+    validatorCachePath(localPath, cachePath);
+
+    struct stat st;
+    if (validator[0] == '\0' || stat(localPath, &st) < 0) {
+        unlink(cachePath);
+        return;
+    }
+
+    FILE *f = fopen(cachePath, "w");
+    if (!f)
+        return;
+
+    fprintf(f, "%s\n%lld %lld %ld\n", validator,
+            (long long)st.st_size,
+            (long long)st.st_mtim.tv_sec,
+            (long)st.st_mtim.tv_nsec);
+    fclose(f);
+}
+
 // ------------------------------------------------------------
 // Download file from server
+// Returns 0 on success, DOWNLOAD_NOT_MODIFIED if the local copy
+// is still current, -1 on error
 // ------------------------------------------------------------
 int downloadFile(int sock, const char *remotePath, const char *localPath)
 {
-    // Send download request
+    // Send download request (with cached validator, if any)
     ProtocolMessage msg;
     memset(&msg, 0, sizeof(msg));
     msg.command = CMD_DOWNLOAD;
     strncpy(msg.arg1, remotePath, sizeof(msg.arg1));
+    loadValidatorCache(localPath, msg.arg3);
 
     sendAll(sock, &msg, sizeof(msg));
 
@@ -197,54 +260,160 @@ int downloadFile(int sock, const char *remotePath, const char *localPath)
     ProtocolResponse res;
     recvAll(sock, &res, sizeof(res));
 
+    if (res.status == STATUS_NOT_MODIFIED) {
+        return DOWNLOAD_NOT_MODIFIED;
+    }
+
     if (res.status != STATUS_OK) {
         printf("[DOWNLOAD] Server refused download\n");
         return -1;
     }
 
-    int size = res.dataSize;
+    // A local open error must not stop us from draining the stream
+    int fd = open(localPath, O_WRONLY | O_CREAT, 0666);
+    if (fd < 0)
+        perror("open");
+
+    SparseStats stats;
+    int rc = sparseReceiveFile(sock, fd, -1, SPARSE_NO_LIMIT, &stats);
+    if (fd >= 0)
+        close(fd);
 
-    // Check received size
-    if (size < 0 || size > MAX_FILE_SIZE) {
-        printf("[DOWNLOAD] Invalid file size (%d bytes)\n", size);
+    if (rc < 0)
+        return -1;
+
+    // Validator follows the data, empty if the server hit a read error
+    char validator[VALIDATOR_SIZE];
+    recvAll(sock, validator, VALIDATOR_SIZE);
+    validator[VALIDATOR_SIZE - 1] = '\0';
+
+    if (fd < 0 || rc > 0) {
+        printf("[DOWNLOAD] Write error\n");
+        saveValidatorCache(localPath, "");
         return -1;
     }
 
-    // Empty file
-    if (size == 0) {
-        FILE *fempty = fopen(localPath, "wb");
-        if (!fempty) {
-            perror("fopen");
-            return -1;
-        }
-        fclose(fempty);
-        return 0;
+    if (validator[0] == '\0') {
+        printf("[DOWNLOAD] Server could not read the whole file\n");
+        saveValidatorCache(localPath, "");
+        return -1;
     }
 
-    // Receive file data
-    char *buffer = malloc(size);
-    if (!buffer) {
-        printf("[DOWNLOAD] Out of memory\n");
+    if (stats.dataBytes < stats.fileSize)
+        printf("[DOWNLOAD] Sparse file: received %lld of %lld bytes\n",
+               stats.dataBytes, stats.fileSize);
+
+    // Only a complete copy may be revalidated later
+    saveValidatorCache(localPath, validator);
+
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Upload directory tree (streamed archive, upload -r)
+// ------------------------------------------------------------
+int uploadTree(int sock, const char *localDir, const char *remoteDir)
+{
+    struct stat st;
+    if (stat(localDir, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        printf("[UPLOAD] '%s' is not a directory\n", localDir);
         return -1;
     }
 
-    recvAll(sock, buffer, size);
+    // Send upload request
+    ProtocolMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.command = CMD_UPLOAD_TREE;
+    strncpy(msg.arg1, remoteDir, sizeof(msg.arg1) - 1);
+
+    sendAll(sock, &msg, sizeof(msg));
 
-    // Write to disk
-    FILE *f = fopen(localPath, "wb");
-    if (!f) {
-        perror("fopen");
-        free(buffer);
+    // Server response
+    ProtocolResponse res;
+    recvAll(sock, &res, sizeof(res));
+    if (res.status == STATUS_QUOTA) {
+        printf("[UPLOAD] Refused: storage quota exceeded\n");
         return -1;
     }
+    if (res.status != STATUS_OK) {
+        printf("[UPLOAD] Server refused upload\n");
+        return -1;
+    }
+
+    // Stream the whole tree
+    ArchiveStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    if (archiveSendTree(sock, localDir, NULL, &stats) < 0)
+        return -1;
 
-    int written = (int)fwrite(buffer, 1, size, f);
-    if (written != size) {
-        printf("[DOWNLOAD] Write error (%d/%d)\n", written, size);
+    // Final confirmation (dataSize = files written by the server);
+    // a server that lost the stream closes the connection instead
+    if (recvAll(sock, &res, sizeof(res)) < 0) {
+        printf("[UPLOAD] Connection lost, upload incomplete\n");
+        return -1;
+    }
+    if (res.status == STATUS_QUOTA) {
+        printf("[UPLOAD] Storage quota exceeded: only %d file(s) written\n",
+               res.dataSize);
+        return -1;
+    }
+    if (res.status != STATUS_OK) {
+        printf("[UPLOAD] Upload failed (%d file(s) written, %d local error(s))\n",
+               res.dataSize, stats.errors);
+        return -1;
     }
 
-    fclose(f);
-    free(buffer);
+    printf("[UPLOAD] %lld file(s), %lld dir(s), %lld bytes\n",
+           stats.files, stats.dirs, stats.bytes);
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Download directory tree (streamed archive, download -r)
+// ------------------------------------------------------------
+int downloadTree(int sock, const char *remoteDir, const char *localDir)
+{
+    // Local target must be a directory if it exists
+    struct stat st;
+    int exists = (stat(localDir, &st) == 0);
+    if (exists && !S_ISDIR(st.st_mode)) {
+        printf("[DOWNLOAD] '%s' is not a directory\n", localDir);
+        return -1;
+    }
+
+    // Send download request
+    ProtocolMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.command = CMD_DOWNLOAD_TREE;
+    strncpy(msg.arg1, remoteDir, sizeof(msg.arg1) - 1);
+
+    sendAll(sock, &msg, sizeof(msg));
 
+    // Server response
+    ProtocolResponse res;
+    recvAll(sock, &res, sizeof(res));
+    if (res.status != STATUS_OK)
+        return -1;
+
+    // Created only once the server accepted, the stream must still be drained
+    if (!exists && mkdir(localDir, 0755) < 0)
+        perror("mkdir");
+
+    // Extract the stream (errors include the server's own)
+    ArchiveStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    if (archiveReceiveTree(sock, localDir, NULL, &stats) < 0)
+        return -1;
+
+    if (stats.errors > 0) {
+        printf("[DOWNLOAD] %d entr%s failed\n",
+               stats.errors, stats.errors == 1 ? "y" : "ies");
+        return -1;
+    }
+
+    printf("[DOWNLOAD] %lld file(s), %lld dir(s), %lld bytes\n",
+           stats.files, stats.dirs, stats.bytes);
     return 0;
-}
\ No newline at end of file
+}
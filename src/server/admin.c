@@ -0,0 +1,509 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../../include/admin.h"
+#include "../../include/sessionTable.h"
+#include "../../include/stats.h"
+#include "../../include/quota.h"
+
+#define ADMIN_MAX_CLIENTS  8
+#define ADMIN_LINE_SIZE    512
+#define ADMIN_OUT_SIZE     (256 * 1024)
+#define ADMIN_IO_TIMEOUT   2             // Seconds per send to an operator
+
+typedef struct {
+    int  fd;                             // -1 = free
+    int  len;
+    char line[ADMIN_LINE_SIZE];
+} AdminClient;
+
+static char adminPath[sizeof(((struct sockaddr_un *)0)->sun_path)] = "";
+static int  adminPrivate = 0;            // Default path, in root's directory
+
+static volatile sig_atomic_t adminStop = 0;
+
+// ============================================================
+// LISTENING SOCKET
+// ============================================================
+// The default socket lives in ADMIN_DIR, handled as root (the server
+// drops its euid after startup): nobody else can plant or swap it there
+static uid_t enterPrivate(void)
+{
+    uid_t euid = geteuid();
+    if (adminPrivate && getuid() == 0)
+        (void)!seteuid(0);
+    return euid;
+}
+
+static void leavePrivate(uid_t euid)
+{
+    if (adminPrivate && getuid() == 0)
+        (void)!seteuid(euid);
+}
+
+// Owned by root (or the server user without sudo), closed to others
+static int checkAdminDir(void)
+{
+    if (mkdir(ADMIN_DIR, 0700) < 0 && errno != EEXIST)
+        return -1;
+
+    struct stat st;
+    if (lstat(ADMIN_DIR, &st) < 0 || !S_ISDIR(st.st_mode) || (st.st_mode & 077) ||
+        (st.st_uid != 0 && st.st_uid != getuid())) {
+        fprintf(stderr, "[ADMIN] '%s' must be a directory only its owner can use\n",
+                ADMIN_DIR);
+        return -1;
+    }
+    return 0;
+}
+
+int adminOpen(int serverPort)
+{
+    const char *path = getenv("FILESERVER_ADMIN");
+    char defaultPath[64];
+
+    if (path && strcmp(path, "off") == 0)
+        return -1;
+
+    if (!path || !path[0]) {
+        snprintf(defaultPath, sizeof(defaultPath), ADMIN_DIR "/admin-%d.sock", serverPort);
+        path = defaultPath;
+        adminPrivate = 1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "[ADMIN] Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("[ADMIN] socket");
+        return -1;
+    }
+
+    uid_t euid = enterPrivate();
+    if (adminPrivate && checkAdminDir() < 0) {
+        leavePrivate(euid);
+        fprintf(stderr, "[ADMIN] No socket (set FILESERVER_ADMIN to pick a path)\n");
+        close(fd);
+        adminPrivate = 0;
+        return -1;
+    }
+
+    // Stale socket from a previous run
+    unlink(path);
+
+    // Owner only: the socket can kill sessions. The server runs with
+    // umask 000, so create it 0600 rather than chmod it after the fact.
+    mode_t oldMask = umask(077);
+    int rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(oldMask);
+
+    if (rc < 0) {
+        perror("[ADMIN] bind");
+        leavePrivate(euid);
+        close(fd);
+        adminPrivate = 0;
+        return -1;
+    }
+
+    if (listen(fd, 4) < 0) {
+        perror("[ADMIN] listen");
+        unlink(path);
+        leavePrivate(euid);
+        close(fd);
+        adminPrivate = 0;
+        return -1;
+    }
+    leavePrivate(euid);
+
+    strcpy(adminPath, path);
+    printf("[ADMIN] Control socket %s\n", path);
+    return fd;
+}
+
+// ============================================================
+// COMMANDS
+// ============================================================
+typedef struct {
+    char *buf;
+    int   len;
+} Out;
+
+static void put(Out *o, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void put(Out *o, const char *fmt, ...)
+{
+    if (o->len >= ADMIN_OUT_SIZE - 1)
+        return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(o->buf + o->len, ADMIN_OUT_SIZE - o->len, fmt, ap);
+    va_end(ap);
+
+    if (n > 0)
+        o->len += (n < ADMIN_OUT_SIZE - o->len) ? n : ADMIN_OUT_SIZE - 1 - o->len;
+}
+
+static SessionSlot *takeSnapshot(int *count)
+{
+    SessionSlot *slots = malloc(sizeof(SessionSlot) * SESSION_TABLE_SLOTS);
+    *count = slots ? sessionTableSnapshot(slots, SESSION_TABLE_SLOTS) : 0;
+    return slots;
+}
+
+static void cmdSessions(Out *o)
+{
+    int count;
+    SessionSlot *slots = takeSnapshot(&count);
+    uint64_t now = statsNow();
+
+    put(o, "%-7s %-12s %-21s %-7s %-7s %6s %12s %12s  %-20s %s\n",
+        "PID", "USER", "PEER", "AGE_S", "IDLE_S", "CMDS", "BYTES_IN", "BYTES_OUT",
+        "STATE", "CWD");
+
+    for (int i = 0; i < count; i++) {
+        const SessionSlot *s = &slots[i];
+        char state[SESSION_FIELD_SIZE + 32];
+
+        if (s->command < 0)
+            snprintf(state, sizeof(state), "%s", s->drain ? "idle,draining" : "idle");
+        else
+            snprintf(state, sizeof(state), "%s%s %s", statsCommandName(s->command),
+                     s->drain ? ",draining" : "", s->arg);
+
+        double idle = (s->command < 0) ? (now - s->lastActiveNs) / 1e9 : 0.0;
+
+        put(o, "%-7d %-12s %-21s %-7.0f %-7.0f %6llu %12llu %12llu  %-20s %s\n",
+            (int)s->pid, s->user[0] ? s->user : "-", s->peer,
+            (now - s->startNs) / 1e9, idle,
+            (unsigned long long)s->commands,
+            (unsigned long long)s->bytesIn, (unsigned long long)s->bytesOut,
+            state, s->cwd[0] ? s->cwd : "-");
+    }
+
+    put(o, "%d session(s)\n", count);
+    free(slots);
+}
+
+static void cmdTransfers(Out *o)
+{
+    int count, active = 0;
+    SessionSlot *slots = takeSnapshot(&count);
+    uint64_t now = statsNow();
+
+    put(o, "%-7s %-12s %-14s %14s %10s %12s  %s\n",
+        "PID", "USER", "COMMAND", "BYTES", "ELAPSED_S", "MB/S", "ARG");
+
+    for (int i = 0; i < count; i++) {
+        const SessionSlot *s = &slots[i];
+        if (s->command < 0)
+            continue;
+
+        uint64_t bytes   = s->bytesIn + s->bytesOut - s->commandBase;
+        double   elapsed = (now - s->commandStartNs) / 1e9;
+
+        put(o, "%-7d %-12s %-14s %14llu %10.1f %12.2f  %s\n",
+            (int)s->pid, s->user[0] ? s->user : "-", statsCommandName(s->command),
+            (unsigned long long)bytes, elapsed,
+            elapsed > 0 ? bytes / elapsed / (1024.0 * 1024.0) : 0.0, s->arg);
+        active++;
+    }
+
+    put(o, "%d command(s) in flight\n", active);
+    free(slots);
+}
+
+static pid_t parsePid(const char *arg)
+{
+    char *end;
+    long v = strtol(arg, &end, 10);
+    return (arg[0] && *end == '\0' && v > 0) ? (pid_t)v : -1;
+}
+
+static void cmdKill(Out *o, const char *arg)
+{
+    pid_t pid = parsePid(arg);
+
+    // Only session processes, never an arbitrary pid
+    if (pid < 0 || !sessionTableHas(pid)) {
+        put(o, "ERROR no session with pid '%s'\n", arg);
+        return;
+    }
+
+    if (kill(pid, SIGKILL) < 0)
+        put(o, "ERROR kill %d: %s\n", (int)pid, strerror(errno));
+    else
+        put(o, "OK session %d killed\n", (int)pid);
+}
+
+static void cmdDrain(Out *o, const char *arg)
+{
+    pid_t pid = parsePid(arg);
+
+    if (pid < 0 || sessionTableDrain(pid) < 0)
+        put(o, "ERROR no session with pid '%s'\n", arg);
+    else
+        put(o, "OK session %d closes after its current command\n", (int)pid);
+}
+
+static void cmdQuota(Out *o, const char *user, const char *size)
+{
+    if (user && size) {
+        long long limit = strcmp(size, "off") == 0 ? -1 : quotaParseSize(size);
+        if (limit < 0 && strcmp(size, "off") != 0)
+            put(o, "ERROR bad size '%s' (e.g. 500M, 10G, off)\n", size);
+        else if (quotaSet(user, limit) < 0)
+            put(o, "ERROR quotas disabled or ledger full\n");
+        else if (limit < 0)
+            put(o, "OK no limit for '%s'\n", user);
+        else
+            put(o, "OK limit of '%s' set to %lld bytes\n", user, limit);
+        return;
+    }
+    if (user) {
+        put(o, "ERROR usage: quota [<user> <size>|off]\n");
+        return;
+    }
+
+    QuotaRow *rows = malloc(sizeof(QuotaRow) * QUOTA_USERS);
+    QuotaCounters counters;
+    int count = rows ? quotaSnapshot(rows, QUOTA_USERS, &counters) : -1;
+    if (count < 0) {
+        put(o, "ERROR quotas disabled\n");
+        free(rows);
+        return;
+    }
+
+    time_t now = time(NULL);
+    put(o, "%-12s %14s %14s %14s %6s %14s\n",
+        "USER", "LIMIT", "USED", "RESERVED", "USE%", "RECONCILED_S");
+    for (int i = 0; i < count; i++) {
+        const QuotaRow *r = &rows[i];
+        char used[24], pct[16], age[24];
+        snprintf(used, sizeof(used), r->used < 0 ? "?" : "%lld", r->used);
+        snprintf(pct, sizeof(pct), r->used < 0 || r->limit == 0 ? "-" : "%.1f",
+                 r->limit ? 100.0 * r->used / r->limit : 0.0);
+        snprintf(age, sizeof(age), r->reconciledAt ? "%lld" : "never",
+                 (long long)(now - r->reconciledAt));
+        put(o, "%-12s %14lld %14s %14lld %6s %14s\n",
+            r->name, r->limit, used, r->reserved, pct, age);
+    }
+    put(o, "%d user(s), %llu write(s) refused, %llu reconciliation(s)\n", count,
+        (unsigned long long)counters.rejections, (unsigned long long)counters.reconciles);
+    free(rows);
+}
+
+// Returns 1 when the operator wants to disconnect
+static int runCommand(Out *o, char *line)
+{
+    char *cmd = strtok(line, " \t");
+    char *arg = strtok(NULL, " \t");
+    char *arg2 = strtok(NULL, " \t");
+
+    if (!cmd)
+        return 0;
+
+    if (strcmp(cmd, "sessions") == 0) {
+        cmdSessions(o);
+    } else if (strcmp(cmd, "transfers") == 0) {
+        cmdTransfers(o);
+    } else if (strcmp(cmd, "kill") == 0) {
+        cmdKill(o, arg ? arg : "");
+    } else if (strcmp(cmd, "drain") == 0) {
+        cmdDrain(o, arg ? arg : "");
+    } else if (strcmp(cmd, "stats") == 0) {
+        o->len += statsFormat(o->buf + o->len, ADMIN_OUT_SIZE - o->len);
+    } else if (strcmp(cmd, "locks") == 0) {
+        o->len += statsFormatLocks(o->buf + o->len, ADMIN_OUT_SIZE - o->len, STATS_LOCK_TOP);
+    } else if (strcmp(cmd, "quota") == 0) {
+        cmdQuota(o, arg, arg2);
+    } else if (strcmp(cmd, "quit") == 0 || strcmp(cmd, "exit") == 0) {
+        return 1;
+    } else if (strcmp(cmd, "help") == 0) {
+        put(o, "sessions        list sessions (user, cwd, state, traffic)\n"
+               "transfers       commands in flight with bytes and rate\n"
+               "kill <pid>      terminate a session immediately\n"
+               "drain <pid>     close a session after its current command\n"
+               "stats           latency statistics\n"
+               "locks           lock contention\n"
+               "quota           storage quotas and usage\n"
+               "quota <user> <size>|off  set or remove a limit (500M, 10G)\n"
+               "quit            close this connection\n");
+    } else {
+        put(o, "ERROR unknown command '%s' (try 'help')\n", cmd);
+    }
+
+    return 0;
+}
+
+// ============================================================
+// CONNECTIONS
+// ============================================================
+static int sendText(int fd, const char *buf, int len)
+{
+    while (len > 0) {
+        ssize_t w = send(fd, buf, len, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += w;
+        len -= (int)w;
+    }
+    return 0;
+}
+
+static void dropClient(AdminClient *c)
+{
+    close(c->fd);
+    c->fd  = -1;
+    c->len = 0;
+}
+
+// Read what is available and run every complete line
+static void serviceClient(AdminClient *c, char *outBuf)
+{
+    ssize_t r = recv(c->fd, c->line + c->len, ADMIN_LINE_SIZE - 1 - c->len, 0);
+    if (r <= 0) {
+        dropClient(c);
+        return;
+    }
+    c->len += (int)r;
+
+    char *nl;
+    while (c->fd >= 0 && (nl = memchr(c->line, '\n', c->len)) != NULL) {
+        *nl = '\0';
+        int lineLen = (int)(nl - c->line) + 1;
+        if (nl > c->line && nl[-1] == '\r')
+            nl[-1] = '\0';
+
+        Out o = { outBuf, 0 };
+        int quit = runCommand(&o, c->line);
+
+        if (sendText(c->fd, o.buf, o.len) < 0 || quit) {
+            dropClient(c);
+            return;
+        }
+
+        memmove(c->line, c->line + lineLen, c->len - lineLen);
+        c->len -= lineLen;
+    }
+
+    // Line longer than the buffer
+    if (c->fd >= 0 && c->len >= ADMIN_LINE_SIZE - 1) {
+        sendText(c->fd, "ERROR line too long\n", 20);
+        dropClient(c);
+    }
+}
+
+static void acceptOperator(int listenFd, AdminClient *clients)
+{
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd < 0)
+        return;
+
+    for (int i = 0; i < ADMIN_MAX_CLIENTS; i++) {
+        if (clients[i].fd < 0) {
+            struct timeval tv = { ADMIN_IO_TIMEOUT, 0 };
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+            clients[i].fd  = fd;
+            clients[i].len = 0;
+            return;
+        }
+    }
+
+    sendText(fd, "ERROR too many operators\n", 25);
+    close(fd);
+}
+
+static void handleAdminStop(int sig)
+{
+    (void)sig;
+    adminStop = 1;
+}
+
+void adminServe(int listenFd, pid_t parentPid)
+{
+    // CTRL+C goes to the whole group, the main process stops us
+    signal(SIGINT, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleAdminStop;
+    sigaction(SIGTERM, &sa, NULL);
+
+    char *outBuf = malloc(ADMIN_OUT_SIZE);
+    if (!outBuf)
+        _exit(1);
+
+    AdminClient clients[ADMIN_MAX_CLIENTS];
+    for (int i = 0; i < ADMIN_MAX_CLIENTS; i++)
+        clients[i].fd = -1;
+
+    while (!adminStop && getppid() == parentPid) {
+        struct pollfd pfds[ADMIN_MAX_CLIENTS + 1];
+        int map[ADMIN_MAX_CLIENTS + 1];
+        int n = 0;
+
+        pfds[n].fd = listenFd;
+        pfds[n].events = POLLIN;
+        map[n++] = -1;
+
+        for (int i = 0; i < ADMIN_MAX_CLIENTS; i++) {
+            if (clients[i].fd >= 0) {
+                pfds[n].fd = clients[i].fd;
+                pfds[n].events = POLLIN;
+                map[n++] = i;
+            }
+        }
+
+        if (poll(pfds, n, 1000) <= 0)
+            continue;
+
+        for (int k = 0; k < n; k++) {
+            if (!(pfds[k].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+
+            if (map[k] < 0)
+                acceptOperator(listenFd, clients);
+            else
+                serviceClient(&clients[map[k]], outBuf);
+        }
+    }
+
+    for (int i = 0; i < ADMIN_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0)
+            close(clients[i].fd);
+    }
+
+    if (adminPath[0]) {
+        uid_t euid = enterPrivate();
+        unlink(adminPath);
+        leavePrivate(euid);
+    }
+
+    free(outBuf);
+    _exit(0);
+}
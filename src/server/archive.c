@@ -0,0 +1,523 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "../../include/archive.h"
+#include "../../include/payload.h"
+#include "../../include/session.h"
+
+// ============================================================
+// WRITER (sending side)
+// ============================================================
+typedef struct {
+    int  sock;
+    int  len;                         // Bytes used in buf
+    char buf[ARCHIVE_BLOCK_SIZE];
+    const ArchiveHooks *hooks;
+    ArchiveStats *stats;
+} ArchiveWriter;
+
+// Send the current block
+static int writerFlush(ArchiveWriter *w)
+{
+    if (w->len == 0)
+        return 0;
+
+    if (sendPayload(w->sock, &w->len, sizeof(int)) < 0 ||
+        sendPayload(w->sock, w->buf, w->len) < 0)
+        return -1;
+
+    w->len = 0;
+    return 0;
+}
+
+// Append bytes to the stream
+static int writerPut(ArchiveWriter *w, const void *data, long long n)
+{
+    const char *p = (const char *)data;
+
+    while (n > 0) {
+        if (w->len == ARCHIVE_BLOCK_SIZE && writerFlush(w) < 0)
+            return -1;
+
+        int space = ARCHIVE_BLOCK_SIZE - w->len;
+        int k = (n < space) ? (int)n : space;
+
+        memcpy(w->buf + w->len, p, k);
+        w->len += k;
+        p += k;
+        n -= k;
+    }
+    return 0;
+}
+
+static int writerHeader(ArchiveWriter *w, int type, int mode,
+                        long long size, const char *relPath, int status)
+{
+    ArchiveEntryHeader h;
+    memset(&h, 0, sizeof(h));
+    h.type    = type;
+    h.mode    = mode & 0777;
+    h.size    = size;
+    h.pathLen = (int)strlen(relPath);
+    h.status  = status;
+
+    if (writerPut(w, &h, sizeof(h)) < 0 ||
+        writerPut(w, relPath, h.pathLen) < 0)
+        return -1;
+    return 0;
+}
+
+// Read file content straight into the block buffer.
+// Returns 0 ok, 1 if the file was shorter than announced
+// (padded with zeros to keep the stream in sync), -1 on send error.
+static int writerFileData(ArchiveWriter *w, int fd, long long size)
+{
+    long long left = size;
+    int padded = 0;
+
+    while (left > 0) {
+        if (w->len == ARCHIVE_BLOCK_SIZE && writerFlush(w) < 0)
+            return -1;
+
+        int space = ARCHIVE_BLOCK_SIZE - w->len;
+        int want  = (left < space) ? (int)left : space;
+
+        ssize_t r = read(fd, w->buf + w->len, want);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0) {
+            memset(w->buf + w->len, 0, want);
+            r = want;
+            padded = 1;
+        }
+
+        w->len += (int)r;
+        left   -= r;
+    }
+
+    return padded;
+}
+
+// Send one file or directory (recursively)
+static int sendEntry(ArchiveWriter *w, const char *absPath, const char *relPath)
+{
+    struct stat st;
+    if (lstat(absPath, &st) < 0) {
+        w->stats->errors++;
+        return 0;
+    }
+
+    // Regular file: header + content under a shared lock
+    if (S_ISREG(st.st_mode)) {
+        int fd = open(absPath, O_RDONLY);
+        if (fd < 0) {
+            w->stats->errors++;
+            return 0;
+        }
+
+        if (w->hooks && w->hooks->lockRead && w->hooks->lockRead(fd) < 0) {
+            close(fd);
+            w->stats->errors++;
+            return 0;
+        }
+
+        int rc = 0;
+        if (fstat(fd, &st) < 0) {
+            w->stats->errors++;
+        } else if (writerHeader(w, ARCHIVE_FILE, st.st_mode, st.st_size, relPath, 0) < 0) {
+            rc = -1;
+        } else {
+            rc = writerFileData(w, fd, st.st_size);
+            if (rc > 0) {
+                w->stats->errors++;
+                rc = 0;
+            } else if (rc == 0) {
+                w->stats->files++;
+                w->stats->bytes += st.st_size;
+            }
+        }
+
+        if (w->hooks && w->hooks->unlock)
+            w->hooks->unlock(fd);
+        close(fd);
+        return rc;
+    }
+
+    // Symlinks, devices, ... are never sent
+    if (!S_ISDIR(st.st_mode))
+        return 0;
+
+    // Directory entry (the root itself has no entry)
+    if (relPath[0] != '\0') {
+        if (writerHeader(w, ARCHIVE_DIR, st.st_mode, 0, relPath, 0) < 0)
+            return -1;
+        w->stats->dirs++;
+    }
+
+    DIR *dir = opendir(absPath);
+    if (!dir) {
+        w->stats->errors++;
+        return 0;
+    }
+
+    struct dirent *entry;
+    int rc = 0;
+
+    while (rc == 0 && (entry = readdir(dir)) != NULL) {
+        // Skip ".", ".." and internal ".lock" files
+        if (!strcmp(entry->d_name, ".") ||
+            !strcmp(entry->d_name, "..") ||
+            strstr(entry->d_name, ".lock") != NULL)
+            continue;
+
+        char childAbs[PATH_SIZE], childRel[PATH_SIZE];
+        int tooLong =
+            snprintf(childAbs, PATH_SIZE, "%s/%s", absPath, entry->d_name) >= PATH_SIZE ||
+            (relPath[0] == '\0'
+                ? snprintf(childRel, PATH_SIZE, "%s", entry->d_name)
+                : snprintf(childRel, PATH_SIZE, "%s/%s", relPath, entry->d_name)) >= PATH_SIZE;
+
+        if (tooLong) {
+            w->stats->errors++;
+            continue;
+        }
+
+        rc = sendEntry(w, childAbs, childRel);
+    }
+
+    closedir(dir);
+    return rc;
+}
+
+// ============================================================
+// SEND TREE
+// ============================================================
+int archiveSendTree(int sock, const char *rootPath,
+                    const ArchiveHooks *hooks, ArchiveStats *stats)
+{
+    ArchiveWriter *w = malloc(sizeof(ArchiveWriter));
+    if (!w)
+        return -1;
+
+    w->sock  = sock;
+    w->len   = 0;
+    w->hooks = hooks;
+    w->stats = stats;
+
+    int rc = 0;
+    struct stat st;
+
+    // A missing root still ends with a valid stream (END with errors)
+    if (lstat(rootPath, &st) < 0 || !S_ISDIR(st.st_mode))
+        stats->errors++;
+    else
+        rc = sendEntry(w, rootPath, "");
+
+    if (rc == 0)
+        rc = writerHeader(w, ARCHIVE_END, 0, 0, "", stats->errors);
+    if (rc == 0)
+        rc = writerFlush(w);
+
+    free(w);
+    return rc;
+}
+
+// ============================================================
+// READER (receiving side)
+// ============================================================
+typedef struct {
+    int  sock;
+    int  len;                         // Bytes in current block
+    int  pos;                         // Bytes already consumed
+    char buf[ARCHIVE_BLOCK_SIZE];
+} ArchiveReader;
+
+// Receive next block
+static int readerFill(ArchiveReader *r)
+{
+    int len;
+    if (recvPayload(r->sock, &len, sizeof(int)) < 0)
+        return -1;
+
+    if (len <= 0 || len > ARCHIVE_BLOCK_SIZE) {
+        fprintf(stderr, "archive: corrupt block length %d\n", len);
+        return -1;
+    }
+
+    if (recvPayload(r->sock, r->buf, len) < 0)
+        return -1;
+
+    r->len = len;
+    r->pos = 0;
+    return 0;
+}
+
+// Copy n bytes out of the stream
+static int readerGet(ArchiveReader *r, void *dst, long long n)
+{
+    char *p = (char *)dst;
+
+    while (n > 0) {
+        if (r->pos == r->len && readerFill(r) < 0)
+            return -1;
+
+        int k = r->len - r->pos;
+        if (k > n)
+            k = (int)n;
+
+        memcpy(p, r->buf + r->pos, k);
+        r->pos += k;
+        p += k;
+        n -= k;
+    }
+    return 0;
+}
+
+// Write n content bytes to fd (fd < 0: discard them).
+// Returns 0 ok, 1 on write error (content still consumed), -1 on stream error.
+static int readerToFile(ArchiveReader *r, int fd, long long n)
+{
+    int failed = (fd < 0);
+
+    while (n > 0) {
+        if (r->pos == r->len && readerFill(r) < 0)
+            return -1;
+
+        int k = r->len - r->pos;
+        if (k > n)
+            k = (int)n;
+
+        int done = 0;
+        while (!failed && done < k) {
+            ssize_t wr = write(fd, r->buf + r->pos + done, k - done);
+            if (wr < 0) {
+                if (errno == EINTR)
+                    continue;
+                failed = 1;
+                break;
+            }
+            done += (int)wr;
+        }
+
+        r->pos += k;
+        n -= k;
+    }
+
+    return failed ? 1 : 0;
+}
+
+// Relative path without "", ".", ".." components and not absolute
+static int isSafeRelPath(const char *p)
+{
+    if (p[0] == '\0' || p[0] == '/')
+        return 0;
+
+    while (*p) {
+        const char *end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+
+        if (len == 0 ||
+            (len == 1 && p[0] == '.') ||
+            (len == 2 && p[0] == '.' && p[1] == '.'))
+            return 0;
+
+        p += len;
+        if (*p == '/')
+            p++;
+    }
+    return 1;
+}
+
+// New file next to path under a name nobody else holds (O_EXCL, a
+// clash tries a fresh name); its name goes into tmpPath
+static int createTemp(const char *path, char *tmpPath, mode_t mode)
+{
+    static unsigned counter = 0;
+
+    for (int tries = 0; tries < 64; tries++) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        unsigned tag = (unsigned)ts.tv_nsec ^ (++counter * 2654435761u);
+
+        if (snprintf(tmpPath, PATH_SIZE, "%s.tmp-%d-%08x", path, (int)getpid(), tag)
+            >= PATH_SIZE)
+            return -1;
+
+        int fd = open(tmpPath, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, mode);
+        if (fd >= 0 || errno != EEXIST)
+            return fd;
+    }
+    return -1;
+}
+
+// Rename the finished temp file over absPath. An existing file must be
+// a regular file; it is write-locked across the rename so a writer in
+// progress finishes first. *oldSize = size of what was replaced.
+static int replaceFile(const ArchiveHooks *hooks, const char *tmpPath,
+                       const char *absPath, long long *oldSize)
+{
+    *oldSize = 0;
+
+    // Never follows a symlink, never blocks on a FIFO
+    int oldFd = open(absPath, O_WRONLY | O_NONBLOCK | O_NOFOLLOW | O_CLOEXEC);
+    if (oldFd < 0 && errno != ENOENT)
+        return -1;
+
+    struct stat st;
+    if (oldFd >= 0 && (fstat(oldFd, &st) < 0 || !S_ISREG(st.st_mode) ||
+                       (hooks && hooks->lockWrite && hooks->lockWrite(oldFd) < 0))) {
+        close(oldFd);
+        return -1;
+    }
+    if (oldFd >= 0)
+        *oldSize = st.st_size;
+
+    int rc = rename(tmpPath, absPath);
+
+    if (oldFd >= 0) {
+        if (hooks && hooks->unlock)
+            hooks->unlock(oldFd);
+        close(oldFd);
+    }
+    return rc;
+}
+
+// Create / overwrite one file from the stream. The content goes into a
+// temp file renamed over the target once complete: a broken stream
+// leaves an existing file as it was.
+static int receiveFile(ArchiveReader *r, const ArchiveHooks *hooks,
+                       const char *absPath, int pathOk,
+                       const ArchiveEntryHeader *h, ArchiveStats *stats)
+{
+    int fd = -1;
+    char tmpPath[PATH_SIZE];
+    struct stat st;
+
+    // Anything but a regular file (directory, FIFO, symlink, ...) is
+    // never replaced; an existing file keeps its permissions
+    int exists = pathOk && lstat(absPath, &st) == 0;
+    if (exists && !S_ISREG(st.st_mode))
+        pathOk = 0;
+
+    // Admitted before anything is written (quota)
+    int admitted = pathOk &&
+                   (!hooks || !hooks->fileBegin || hooks->fileBegin(hooks->ctx, h->size) == 0);
+
+    if (admitted) {
+        fd = createTemp(absPath, tmpPath, exists ? st.st_mode & 07777 : h->mode & 0777);
+        if (fd >= 0 && exists && fchmod(fd, st.st_mode & 07777) < 0) {
+            close(fd);
+            unlink(tmpPath);
+            fd = -1;
+        }
+    }
+
+    int rc = readerToFile(r, fd, h->size);
+
+    long long delta = 0;
+    if (fd >= 0) {
+        long long newSize = fstat(fd, &st) == 0 ? (long long)st.st_size : 0;
+        close(fd);
+
+        long long oldSize;
+        if (rc == 0 && replaceFile(hooks, tmpPath, absPath, &oldSize) == 0) {
+            delta = newSize - oldSize;
+        } else {
+            unlink(tmpPath);
+            if (rc == 0)
+                rc = 1;
+        }
+    }
+
+    if (admitted && hooks && hooks->fileEnd)
+        hooks->fileEnd(hooks->ctx, delta);
+
+    if (rc < 0)
+        return -1;
+
+    if (fd < 0 || rc > 0) {
+        stats->errors++;
+    } else {
+        stats->files++;
+        stats->bytes += h->size;
+    }
+    return 0;
+}
+
+// ============================================================
+// RECEIVE TREE
+// ============================================================
+int archiveReceiveTree(int sock, const char *destRoot,
+                       const ArchiveHooks *hooks, ArchiveStats *stats)
+{
+    ArchiveReader *r = malloc(sizeof(ArchiveReader));
+    if (!r)
+        return -1;
+
+    r->sock = sock;
+    r->len  = 0;
+    r->pos  = 0;
+
+    int rc = -1;
+
+    while (1) {
+        ArchiveEntryHeader h;
+        char relPath[PATH_SIZE];
+
+        if (readerGet(r, &h, sizeof(h)) < 0)
+            break;
+
+        if (h.pathLen < 0 || h.pathLen >= PATH_SIZE || h.size < 0) {
+            fprintf(stderr, "archive: corrupt entry header\n");
+            break;
+        }
+
+        if (readerGet(r, relPath, h.pathLen) < 0)
+            break;
+        relPath[h.pathLen] = '\0';
+
+        if (h.type == ARCHIVE_END) {
+            stats->errors += h.status;
+            rc = 0;
+            break;
+        }
+
+        // Everything is created strictly below destRoot
+        char absPath[PATH_SIZE];
+        int pathOk = isSafeRelPath(relPath) &&
+                     snprintf(absPath, PATH_SIZE, "%s/%s", destRoot, relPath) < PATH_SIZE;
+
+        if (h.type == ARCHIVE_DIR) {
+            // Owner always keeps rwx, otherwise children could not be created
+            if (!pathOk ||
+                (mkdir(absPath, (h.mode & 0777) | S_IRWXU) < 0 && errno != EEXIST))
+                stats->errors++;
+            else
+                stats->dirs++;
+
+            if (h.size > 0 && readerToFile(r, -1, h.size) < 0)
+                break;
+            continue;
+        }
+
+        if (h.type == ARCHIVE_FILE) {
+            if (receiveFile(r, hooks, absPath, pathOk, &h, stats) < 0)
+                break;
+            continue;
+        }
+
+        // Unknown entry type: stream is out of sync
+        fprintf(stderr, "archive: unknown entry type %d\n", h.type);
+        break;
+    }
+
+    free(r);
+    return rc;
+}
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include "../../include/capture.h"
+#include "../../include/stats.h"
+#include "../../include/log.h"
+
+#define CAPTURE_PATH_SIZE   4096
+#define CAPTURE_PAYLOAD_CAP (64 * 1024 * 1024)   // Largest per-request limit
+
+int gCaptureActive = 0;
+
+// Configuration (main process, inherited)
+static int    captureEnabled = 0;
+static size_t payloadMax     = 0;
+static char   captureDir[CAPTURE_PATH_SIZE];
+
+// Per session process
+static int           captureFd    = -1;
+static uint64_t      sessionStart = 0;
+static CaptureRecord rec;
+static char          args[3][256];
+static char         *payload      = NULL;
+static size_t        payloadLen   = 0;
+
+// "4M", "512K", "65536"
+static size_t parseSize(const char *s)
+{
+    char *end;
+    double v = strtod(s, &end);
+
+    if (*end == 'k' || *end == 'K') v *= 1024;
+    if (*end == 'm' || *end == 'M') v *= 1024 * 1024;
+
+    if (v < 0)
+        return 0;
+    return v > CAPTURE_PAYLOAD_CAP ? CAPTURE_PAYLOAD_CAP : (size_t)v;
+}
+
+// ------------------------------------------------------------
+// Setup
+// ------------------------------------------------------------
+void captureInit(void)
+{
+    const char *dir = getenv("FILESERVER_CAPTURE_DIR");
+    if (!dir || !dir[0])
+        return;
+
+    const char *max = getenv("FILESERVER_CAPTURE_PAYLOADS");
+    if (max && max[0])
+        payloadMax = parseSize(max);
+
+    snprintf(captureDir, sizeof(captureDir), "%s", dir);
+    captureEnabled = 1;
+
+    if (payloadMax)
+        printf("[CAPTURE] Capturing requests and up to %zu payload bytes each "
+               "into %s/capture-<pid>.fcap\n", payloadMax, captureDir);
+    else
+        printf("[CAPTURE] Capturing requests (payload sizes only) into "
+               "%s/capture-<pid>.fcap\n", captureDir);
+}
+
+void captureSessionStart(void)
+{
+    if (!captureEnabled)
+        return;
+
+    char path[CAPTURE_PATH_SIZE + 32];
+    snprintf(path, sizeof(path), "%s/capture-%d.fcap", captureDir, (int)getpid());
+
+    // Paths and file contents: readable by the server owner only
+    captureFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+    if (payloadMax && captureFd >= 0)
+        payload = malloc(payloadMax);
+
+    if (captureFd < 0 || (payloadMax && !payload)) {
+        logWarn("[CAPTURE] Cannot create '%s', capture off for this session", path);
+        if (captureFd >= 0)
+            close(captureFd);
+        captureFd = -1;
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    CaptureHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic));
+    hdr.version     = CAPTURE_VERSION;
+    hdr.flags       = payloadMax ? CAPTURE_HAS_PAYLOADS : 0;
+    hdr.startUnixNs = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+    hdr.pid         = (int32_t)getpid();
+    hdr.payloadMax  = (uint32_t)payloadMax;
+
+    if (write(captureFd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) {
+        close(captureFd);
+        captureFd = -1;
+        return;
+    }
+
+    sessionStart = statsNow();
+}
+
+// ------------------------------------------------------------
+// Request boundaries
+// ------------------------------------------------------------
+void captureRequestStart(const char *arg1, const char *arg2, const char *arg3,
+                         int command)
+{
+    if (captureFd < 0)
+        return;
+
+    const char *in[3] = { arg1, arg2, arg3 };
+
+    memset(&rec, 0, sizeof(rec));
+    rec.offsetNs = statsNow() - sessionStart;
+    rec.command  = command;
+
+    for (int i = 0; i < 3; i++) {
+        size_t n = strnlen(in[i], sizeof(args[i]) - 1);
+        memcpy(args[i], in[i], n);
+        rec.argLen[i] = (uint16_t)n;
+    }
+
+    payloadLen     = 0;
+    gCaptureActive = 1;
+}
+
+void captureInbound(const void *data, int size)
+{
+    if (!gCaptureActive || size <= 0 || !payload)
+        return;
+
+    if (rec.flags & CAPTURE_REC_TRUNCATED)
+        return;
+
+    // A stream that does not fit is dropped whole: a prefix cannot be replayed
+    if ((size_t)size > payloadMax - payloadLen) {
+        rec.flags |= CAPTURE_REC_TRUNCATED;
+        payloadLen = 0;
+        return;
+    }
+
+    memcpy(payload + payloadLen, data, size);
+    payloadLen += (size_t)size;
+}
+
+void captureRequestEnd(int status, unsigned long long bytesIn,
+                       unsigned long long bytesOut)
+{
+    if (!gCaptureActive)
+        return;
+
+    gCaptureActive = 0;
+
+    rec.durationNs = statsNow() - sessionStart - rec.offsetNs;
+    rec.status     = status;
+    rec.bytesIn    = bytesIn;
+    rec.bytesOut   = bytesOut;
+    rec.payloadLen = (uint32_t)payloadLen;
+
+    struct iovec iov[5] = {
+        { &rec,    sizeof(rec) },
+        { args[0], rec.argLen[0] },
+        { args[1], rec.argLen[1] },
+        { args[2], rec.argLen[2] },
+        { payload, payloadLen },
+    };
+
+    // O_APPEND + one writev: a record is never split
+    ssize_t want = (ssize_t)(sizeof(rec) + rec.argLen[0] + rec.argLen[1] +
+                             rec.argLen[2] + payloadLen);
+
+    if (writev(captureFd, iov, 5) != want) {
+        logWarn("[CAPTURE] Write failed, capture off for this session");
+        close(captureFd);
+        captureFd = -1;
+    }
+}
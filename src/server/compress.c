@@ -0,0 +1,217 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "../../include/compress.h"
+
+// ============================================================
+// Block format (one compressed chunk):
+//
+//   sequence = token [literal length bytes] literals
+//              [offset (2 bytes LE)] [match length bytes]
+//
+//   token high nibble = literal length (15 means "more bytes follow")
+//   token low nibble  = match length - 4 (15 means "more bytes follow")
+//
+// The last sequence contains literals only. The decoder knows the
+// decompressed size, so it stops as soon as the output is full.
+// ============================================================
+
+#define LZ_MIN_MATCH   4
+#define LZ_HASH_BITS   12
+#define LZ_HASH_SIZE   (1 << LZ_HASH_BITS)
+#define LZ_MAX_OFFSET  65535
+
+// Skip faster over data that does not produce matches
+#define LZ_SKIP_TRIGGER 6
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash4(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Write extended length (value already reduced by 15)
+static unsigned char *writeLength(unsigned char *op, int len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+// Emit one sequence. matchLen == 0 means "last sequence" (literals only).
+// Returns new output pointer or NULL if it would overflow dst.
+static unsigned char *emitSequence(unsigned char *op, unsigned char *oend,
+                                   const unsigned char *lit, int litLen,
+                                   int offset, int matchLen)
+{
+    // Worst case space needed for this sequence
+    long need = 1 + litLen + litLen / 255 + 1;
+    if (matchLen > 0)
+        need += 2 + matchLen / 255 + 1;
+    if (need > oend - op)
+        return NULL;
+
+    int matchCode = (matchLen > 0) ? matchLen - LZ_MIN_MATCH : 0;
+    unsigned char *token = op++;
+
+    *token = (unsigned char)(((litLen >= 15 ? 15 : litLen) << 4) |
+                             (matchCode >= 15 ? 15 : matchCode));
+
+    if (litLen >= 15)
+        op = writeLength(op, litLen - 15);
+
+    memcpy(op, lit, litLen);
+    op += litLen;
+
+    if (matchLen > 0) {
+        *op++ = (unsigned char)(offset & 0xff);
+        *op++ = (unsigned char)(offset >> 8);
+        if (matchCode >= 15)
+            op = writeLength(op, matchCode - 15);
+    }
+
+    return op;
+}
+
+// ============================================================
+// COMPRESS
+// ============================================================
+int lzCompress(const char *src, int srcLen, char *dst, int dstCap)
+{
+    const unsigned char *base   = (const unsigned char *)src;
+    const unsigned char *ip     = base;
+    const unsigned char *anchor = base;
+    const unsigned char *iend   = base + srcLen;
+    unsigned char *op   = (unsigned char *)dst;
+    unsigned char *oend = op + dstCap;
+
+    // Positions of previously seen 4-byte sequences (-1 = empty)
+    int table[LZ_HASH_SIZE];
+    memset(table, 0xff, sizeof(table));
+
+    int misses = 0;
+
+    while (srcLen >= LZ_MIN_MATCH && ip <= iend - LZ_MIN_MATCH) {
+        uint32_t seq = read32(ip);
+        uint32_t h   = hash4(seq);
+        int ref      = table[h];
+        int pos      = (int)(ip - base);
+
+        table[h] = pos;
+
+        if (ref < 0 || pos - ref > LZ_MAX_OFFSET || read32(base + ref) != seq) {
+            // No match: step grows while data stays incompressible
+            ip += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+            continue;
+        }
+        misses = 0;
+
+        // Extend match as far as possible
+        const unsigned char *match = base + ref;
+        int matchLen = LZ_MIN_MATCH;
+        while (ip + matchLen < iend && ip[matchLen] == match[matchLen])
+            matchLen++;
+
+        op = emitSequence(op, oend, anchor, (int)(ip - anchor),
+                          (int)(ip - match), matchLen);
+        if (!op)
+            return -1;
+
+        ip += matchLen;
+        anchor = ip;
+    }
+
+    // Remaining bytes go out as literals
+    op = emitSequence(op, oend, anchor, (int)(iend - anchor), 0, 0);
+    if (!op)
+        return -1;
+
+    return (int)(op - (unsigned char *)dst);
+}
+
+// ============================================================
+// DECOMPRESS (input is untrusted, every length is checked)
+// ============================================================
+int lzDecompress(const char *src, int srcLen, char *dst, int dstLen)
+{
+    const unsigned char *ip   = (const unsigned char *)src;
+    const unsigned char *iend = ip + srcLen;
+    unsigned char *op   = (unsigned char *)dst;
+    unsigned char *oend = op + dstLen;
+
+    while (1) {
+        if (ip >= iend)
+            return -1;
+
+        int token = *ip++;
+
+        // Literal length
+        long litLen = token >> 4;
+        if (litLen == 15) {
+            int b;
+            do {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                litLen += b;
+            } while (b == 255);
+        }
+
+        if (litLen > iend - ip || litLen > oend - op)
+            return -1;
+
+        memcpy(op, ip, litLen);
+        op += litLen;
+        ip += litLen;
+
+        // Output full: this was the last sequence
+        if (op == oend)
+            break;
+
+        // Match offset
+        if (iend - ip < 2)
+            return -1;
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        if (offset == 0 || offset > op - (unsigned char *)dst)
+            return -1;
+
+        // Match length
+        long matchLen = token & 15;
+        if (matchLen == 15) {
+            int b;
+            do {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                matchLen += b;
+            } while (b == 255);
+        }
+        matchLen += LZ_MIN_MATCH;
+
+        if (matchLen > oend - op)
+            return -1;
+
+        // Byte copy: source and destination may overlap
+        const unsigned char *match = op - offset;
+        for (long i = 0; i < matchLen; i++)
+            op[i] = match[i];
+        op += matchLen;
+    }
+
+    // All input must be consumed
+    if (ip != iend)
+        return -1;
+
+    return dstLen;
+}
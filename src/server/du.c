@@ -0,0 +1,882 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../../include/du.h"
+#include "../../include/find.h"
+#include "../../include/stats.h"
+
+// Global server root directory
+extern const char *gRootDir;
+
+typedef struct {
+    uint64_t hash;                    // Path hash
+    uint64_t dev;
+    uint64_t ino;
+    uint32_t uid;                     // Effective uid of the walking session
+    uint32_t gen;                     // Home generation at fill
+    int      valid;
+    int      partial;
+    int64_t  bytes, files, dirs;
+    uint64_t filledAt;                // statsNow()
+    uint64_t lastUsed;
+} DuEntry;
+
+typedef struct {
+    uint32_t gen;                     // Bumped by duChangeDrop()
+    uint64_t changes;                 // Bumped by duChangeBegin()
+    pid_t    inflight[DU_INFLIGHT];   // Sessions inside a change bracket
+} DuHome;
+
+typedef struct {
+    pthread_mutex_t lock;             // Process-shared, robust
+    uint32_t        gen;              // Any home dropped (server root totals)
+    DuCounters      counters;
+    DuHome          homes[DU_HOMES];
+    DuEntry         entries[DU_SLOTS];
+} DuIndex;
+
+static DuIndex *duIndex = NULL;
+
+// ------------------------------------------------------------
+// Setup
+// ------------------------------------------------------------
+int duIndexInit(void)
+{
+    const char *env = getenv("FILESERVER_DU_INDEX");
+    if (env && strcmp(env, "off") == 0)
+        return 0;
+
+    void *p = mmap(NULL, sizeof(DuIndex), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("[DU] mmap");
+        return -1;
+    }
+
+    DuIndex *idx = p;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    int rc = pthread_mutex_init(&idx->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (rc != 0) {
+        munmap(p, sizeof(DuIndex));
+        return -1;
+    }
+
+    duIndex = idx;
+    return 1;
+}
+
+// A session killed inside the lock leaves it to the next owner; the
+// counters it was updating may be off, so its home is forgotten
+static void lockIndex(void)
+{
+    if (pthread_mutex_lock(&duIndex->lock) == EOWNERDEAD) {
+        duIndex->gen++;
+        for (int i = 0; i < DU_HOMES; i++)
+            duIndex->homes[i].gen++;
+        pthread_mutex_consistent(&duIndex->lock);
+    }
+}
+
+static void unlockIndex(void)
+{
+    pthread_mutex_unlock(&duIndex->lock);
+}
+
+// ------------------------------------------------------------
+// Keys
+// ------------------------------------------------------------
+// Path without trailing slashes
+static void normalizeKey(const char *path, char *out, size_t size)
+{
+    snprintf(out, size, "%s", path);
+    size_t n = strlen(out);
+    while (n > 1 && out[n - 1] == '/')
+        out[--n] = '\0';
+}
+
+static uint64_t hashPath(const char *path)
+{
+    uint64_t h = 1469598103934665603ULL;          // FNV-1a
+    for (; *path; path++)
+        h = (h ^ (unsigned char)*path) * 1099511628211ULL;
+    return h ? h : 1;
+}
+
+// Home counter of a path: its first component below the root.
+// -1 = the root itself, -2 = outside the root
+static int homeOf(const char *path)
+{
+    char root[PATH_MAX];
+    normalizeKey(gRootDir, root, sizeof(root));
+    size_t n = strlen(root);
+
+    if (strncmp(path, root, n) != 0)
+        return -2;
+    path += n;
+    if (*path == '\0')
+        return -1;
+    if (*path != '/')
+        return -2;
+    path++;
+
+    uint64_t h = 1469598103934665603ULL;
+    for (; *path && *path != '/'; path++)
+        h = (h ^ (unsigned char)*path) * 1099511628211ULL;
+    return (int)(h % DU_HOMES);
+}
+
+static uint32_t genOf(int home)
+{
+    return home >= 0 ? duIndex->homes[home].gen : duIndex->gen;
+}
+
+static int entryFresh(const DuEntry *e, int home, uint64_t now)
+{
+    return e->valid && e->gen == genOf(home) &&
+           now - e->filledAt < (uint64_t)DU_MAX_AGE * 1000000000ULL;
+}
+
+// ------------------------------------------------------------
+// Lookup and changes
+// ------------------------------------------------------------
+int duLookup(const char *path, const struct stat *st, DuTotals *out)
+{
+    if (!duIndex)
+        return -1;
+
+    char key[PATH_MAX];
+    normalizeKey(path, key, sizeof(key));
+    uint64_t h   = hashPath(key);
+    int      home = homeOf(key);
+    uint64_t now = statsNow();
+    int      rc  = -1;
+
+    lockIndex();
+    for (int i = 0; i < DU_PROBES; i++) {
+        DuEntry *e = &duIndex->entries[(h + i) % DU_SLOTS];
+        if (e->hash == h && e->uid == (uint32_t)geteuid() &&
+            e->dev == (uint64_t)st->st_dev && e->ino == (uint64_t)st->st_ino &&
+            entryFresh(e, home, now)) {
+            out->bytes   = e->bytes;
+            out->files   = e->files;
+            out->dirs    = e->dirs;
+            out->partial = e->partial;
+            e->lastUsed  = now;
+            rc = 0;
+            break;
+        }
+    }
+    if (rc == 0)
+        duIndex->counters.hits++;
+    else
+        duIndex->counters.misses++;
+    unlockIndex();
+    return rc;
+}
+
+// Forget a session that died inside its bracket
+static void pruneInflight(DuHome *home)
+{
+    for (int i = 0; i < DU_INFLIGHT; i++)
+        if (home->inflight[i] > 0 && kill(home->inflight[i], 0) < 0 && errno == ESRCH)
+            home->inflight[i] = 0;
+}
+
+void duChangeBegin(DuChange *c, const char *homeDir)
+{
+    c->home = -1;
+    c->slot = -1;
+    if (!duIndex)
+        return;
+
+    char key[PATH_MAX];
+    normalizeKey(homeDir, key, sizeof(key));
+    int home = homeOf(key);
+    if (home < 0)
+        return;
+
+    lockIndex();
+    DuHome *H = &duIndex->homes[home];
+    H->changes++;
+    for (int pass = 0; pass < 2 && c->slot < 0; pass++) {
+        if (pass == 1)
+            pruneInflight(H);
+        for (int i = 0; i < DU_INFLIGHT && c->slot < 0; i++) {
+            if (H->inflight[i] == 0) {
+                H->inflight[i] = getpid();
+                c->slot = i;
+            }
+        }
+    }
+    unlockIndex();
+    c->home = home;
+}
+
+// Add the delta to every indexed ancestor of path, the root included
+void duChangeApply(DuChange *c, const char *path, long long bytes,
+                   long long files, long long dirs)
+{
+    if (c->home < 0 || (bytes == 0 && files == 0 && dirs == 0))
+        return;
+
+    char key[PATH_MAX], root[PATH_MAX];
+    normalizeKey(path, key, sizeof(key));
+    normalizeKey(gRootDir, root, sizeof(root));
+    size_t rootLen = strlen(root);
+    uint64_t now = statsNow();
+
+    lockIndex();
+    for (;;) {
+        char *slash = strrchr(key, '/');
+        if (!slash || (size_t)(slash - key) < rootLen)
+            break;
+        *slash = '\0';
+
+        uint64_t h    = hashPath(key);
+        int      home = homeOf(key);
+        for (int i = 0; i < DU_PROBES; i++) {
+            DuEntry *e = &duIndex->entries[(h + i) % DU_SLOTS];
+            if (e->hash != h || !entryFresh(e, home, now))
+                continue;
+
+            // Every user's totals of this directory; a partial total
+            // may not cover the changed path, it is walked again
+            e->bytes += bytes;
+            e->files += files;
+            e->dirs  += dirs;
+            if (e->partial || e->bytes < 0 || e->files < 0 || e->dirs < 0)
+                e->valid = 0;
+            duIndex->counters.updates++;
+        }
+    }
+    unlockIndex();
+}
+
+// Forget the totals of a removed directory: a directory created later
+// at the same path may get its inode back
+void duChangeForget(DuChange *c, const char *path)
+{
+    if (c->home < 0)
+        return;
+
+    char key[PATH_MAX];
+    normalizeKey(path, key, sizeof(key));
+    uint64_t h = hashPath(key);
+
+    lockIndex();
+    for (int i = 0; i < DU_PROBES; i++) {
+        DuEntry *e = &duIndex->entries[(h + i) % DU_SLOTS];
+        if (e->hash == h)
+            e->valid = 0;
+    }
+    unlockIndex();
+}
+
+void duChangeDrop(DuChange *c)
+{
+    if (c->home < 0)
+        return;
+
+    lockIndex();
+    duIndex->homes[c->home].gen++;
+    duIndex->gen++;
+    duIndex->counters.drops++;
+    unlockIndex();
+}
+
+void duChangeEnd(DuChange *c)
+{
+    if (c->home < 0)
+        return;
+
+    // Not tracked: a walk may have raced the change
+    if (c->slot < 0)
+        duChangeDrop(c);
+
+    lockIndex();
+    if (c->slot >= 0)
+        duIndex->homes[c->home].inflight[c->slot] = 0;
+    unlockIndex();
+    c->home = -1;
+}
+
+int duIndexCounters(DuCounters *out)
+{
+    if (!duIndex)
+        return 0;
+
+    lockIndex();
+    *out = duIndex->counters;
+    unlockIndex();
+    return 1;
+}
+
+// ------------------------------------------------------------
+// Publishing walk results
+// ------------------------------------------------------------
+// Changes of the homes below path: their count, 0 if one is in flight
+static int changeMark(int home, uint64_t *mark)
+{
+    int first = home >= 0 ? home : 0;
+    int last  = home >= 0 ? home : DU_HOMES - 1;
+
+    *mark = 0;
+    for (int i = first; i <= last; i++) {
+        DuHome *H = &duIndex->homes[i];
+        pruneInflight(H);
+        for (int j = 0; j < DU_INFLIGHT; j++)
+            if (H->inflight[j])
+                return 0;
+        *mark += H->changes;
+    }
+    return 1;
+}
+
+static void insertEntry(const char *key, const struct stat *st, const DuTotals *t,
+                        uint64_t now)
+{
+    uint64_t h    = hashPath(key);
+    int      home = homeOf(key);
+    uint32_t uid  = (uint32_t)geteuid();
+
+    // Same key, else a free / stale slot, else the least recently used
+    DuEntry *slot = NULL;
+    for (int i = 0; i < DU_PROBES && !slot; i++) {
+        DuEntry *e = &duIndex->entries[(h + i) % DU_SLOTS];
+        if (e->valid && e->hash == h && e->uid == uid)
+            slot = e;
+    }
+    for (int i = 0; i < DU_PROBES && !slot; i++) {
+        DuEntry *e = &duIndex->entries[(h + i) % DU_SLOTS];
+        if (!e->valid || now - e->filledAt >= (uint64_t)DU_MAX_AGE * 1000000000ULL)
+            slot = e;
+    }
+    if (!slot) {
+        slot = &duIndex->entries[h % DU_SLOTS];
+        for (int i = 1; i < DU_PROBES; i++) {
+            DuEntry *e = &duIndex->entries[(h + i) % DU_SLOTS];
+            if (e->lastUsed < slot->lastUsed)
+                slot = e;
+        }
+    }
+
+    slot->hash     = h;
+    slot->dev      = (uint64_t)st->st_dev;
+    slot->ino      = (uint64_t)st->st_ino;
+    slot->uid      = uid;
+    slot->gen      = genOf(home);
+    slot->partial  = t->partial;
+    slot->bytes    = t->bytes;
+    slot->files    = t->files;
+    slot->dirs     = t->dirs;
+    slot->filledAt = now;
+    slot->lastUsed = now;
+    slot->valid    = 1;
+}
+
+// ------------------------------------------------------------
+// Parallel walk: a directory's totals are final once its own scan
+// and all of its subdirectories are done, then they go to its parent
+// ------------------------------------------------------------
+typedef struct DuNode {
+    struct DuNode *parent;
+    struct DuNode *next;              // Job queue
+    int            fd;                // Open directory, -1 = reopen from rel
+    int            depth;
+    int            pending;           // Own scan + unfinished subdirectories
+    int            row;               // Query row of a walk root, -1 otherwise
+    uint64_t       dev, ino;
+    DuTotals       t;
+    char          *rel;               // Relative to the queried directory
+} DuNode;
+
+typedef struct {
+    char    *rel;
+    int      depth;
+    uint64_t dev, ino;
+    DuTotals t;
+} DuDone;
+
+typedef struct {
+    int              topFd;
+    const char      *fullPath;
+    const char      *homeDir;
+
+    pthread_mutex_t  lock;
+    pthread_cond_t   work;
+    DuNode          *jobs;
+    int              openJobs;
+    int              active;          // Queued + running scans
+
+    DuRow           *rows;
+    DuDone          *done;
+    int              doneCount, doneCap;
+    unsigned long long walked;
+} DuWalk;
+
+static DuNode *newNode(DuNode *parent, char *rel, int depth, const struct stat *st, int row)
+{
+    DuNode *n = calloc(1, sizeof(*n));
+    if (!n)
+        return NULL;
+    n->parent  = parent;
+    n->fd      = -1;
+    n->depth   = depth;
+    n->pending = 1;
+    n->row     = row;
+    n->dev     = (uint64_t)st->st_dev;
+    n->ino     = (uint64_t)st->st_ino;
+    n->rel     = rel;
+    return n;
+}
+
+// Queue a scan (lock held by the caller is not required)
+static void pushNode(DuWalk *w, DuNode *n, int parentFd, const char *name)
+{
+    pthread_mutex_lock(&w->lock);
+    int keepOpen = w->openJobs < FIND_MAX_OPEN;
+    if (keepOpen)
+        w->openJobs++;
+    pthread_mutex_unlock(&w->lock);
+
+    if (keepOpen) {
+        n->fd = openat(parentFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (n->fd < 0) {
+            pthread_mutex_lock(&w->lock);
+            w->openJobs--;
+            pthread_mutex_unlock(&w->lock);
+        }
+    }
+
+    pthread_mutex_lock(&w->lock);
+    if (n->parent)
+        n->parent->pending++;
+    n->next = w->jobs;
+    w->jobs = n;
+    w->active++;
+    pthread_cond_signal(&w->work);
+    pthread_mutex_unlock(&w->lock);
+}
+
+// Own scan of n finished with these totals (lock held)
+static void finishNode(DuWalk *w, DuNode *n, const DuTotals *own)
+{
+    n->t.bytes   += own->bytes;
+    n->t.files   += own->files;
+    n->t.dirs    += own->dirs;
+    n->t.partial |= own->partial;
+
+    while (n && --n->pending == 0) {
+        if (w->doneCount == w->doneCap) {
+            int cap = w->doneCap ? w->doneCap * 2 : 256;
+            DuDone *d = realloc(w->done, cap * sizeof(*d));
+            if (d) {
+                w->done    = d;
+                w->doneCap = cap;
+            }
+        }
+        if (w->doneCount < w->doneCap) {
+            DuDone *d = &w->done[w->doneCount++];
+            d->rel   = n->rel;
+            d->depth = n->depth;
+            d->dev   = n->dev;
+            d->ino   = n->ino;
+            d->t     = n->t;
+            n->rel   = NULL;
+        }
+
+        DuNode *parent = n->parent;
+        if (parent) {
+            parent->t.bytes   += n->t.bytes;
+            parent->t.files   += n->t.files;
+            parent->t.dirs    += n->t.dirs;
+            parent->t.partial |= n->t.partial;
+        } else {
+            w->rows[n->row].totals = n->t;
+        }
+        free(n->rel);
+        free(n);
+        n = parent;
+    }
+}
+
+static void scanNode(DuWalk *w, DuNode *n)
+{
+    DuTotals own;
+    memset(&own, 0, sizeof(own));
+
+    int fd = n->fd >= 0 ? n->fd : findOpenRel(w->topFd, n->rel);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        if (fd >= 0)
+            close(fd);
+        own.partial = 1;
+    }
+
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+
+        // Skip ".", ".." and internal ".lock" files
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            strstr(name, ".lock") != NULL)
+            continue;
+
+        struct stat st;
+        if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            continue;
+
+        if (S_ISREG(st.st_mode)) {
+            own.bytes += st.st_size;
+            own.files++;
+            continue;
+        }
+        if (!S_ISDIR(st.st_mode))
+            continue;
+
+        own.dirs++;
+        size_t len = strlen(n->rel) + strlen(name) + 2;
+        char *rel = malloc(len);
+        if (!rel) {
+            own.partial = 1;
+            continue;
+        }
+        snprintf(rel, len, "%s/%s", n->rel, name);
+
+        DuNode *child;
+        if (!findMayEnter(w->fullPath, w->homeDir, rel, &st) ||
+            !(child = newNode(n, rel, n->depth + 1, &st, -1))) {
+            free(rel);
+            own.partial = 1;
+            continue;
+        }
+        pushNode(w, child, dirfd(dir), name);
+    }
+
+    if (dir)
+        closedir(dir);
+
+    pthread_mutex_lock(&w->lock);
+    w->walked += dir != NULL;
+    finishNode(w, n, &own);
+    if (--w->active == 0)
+        pthread_cond_broadcast(&w->work);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void *walkWorker(void *arg)
+{
+    DuWalk *w = arg;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->jobs && w->active > 0)
+            pthread_cond_wait(&w->work, &w->lock);
+        if (!w->jobs)
+            break;
+
+        DuNode *n = w->jobs;
+        w->jobs = n->next;
+        if (n->fd >= 0)
+            w->openJobs--;
+        pthread_mutex_unlock(&w->lock);
+
+        scanNode(w, n);
+
+        pthread_mutex_lock(&w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+static int runWalk(DuWalk *w)
+{
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    pthread_t threads[FIND_MAX_WORKERS];
+    int count = findWorkerCount();
+    int started = 0;
+    while (started < count && pthread_create(&threads[started], NULL, walkWorker, w) == 0)
+        started++;
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    // No thread: walk here
+    if (started == 0)
+        walkWorker(w);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    return started ? started : 1;
+}
+
+static int byDepth(const void *a, const void *b)
+{
+    return ((const DuDone *)a)->depth - ((const DuDone *)b)->depth;
+}
+
+// ------------------------------------------------------------
+// Query
+// ------------------------------------------------------------
+int duQuery(int dirFd, const char *fullPath, const char *homeDir,
+            DuTotals *total, DuRow **rowsOut, int *countOut, DuStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    memset(total, 0, sizeof(*total));
+
+    char base[PATH_MAX];
+    normalizeKey(fullPath, base, sizeof(base));
+
+    // Changes of the home(s) below, before anything is read
+    uint64_t mark = 0;
+    int publish = 0;
+    if (duIndex) {
+        lockIndex();
+        publish = changeMark(homeOf(base), &mark);
+        unlockIndex();
+    }
+
+    int fd = fcntl(dirFd, F_DUPFD_CLOEXEC, 0);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    DuWalk w;
+    memset(&w, 0, sizeof(w));
+    w.topFd    = dirFd;
+    w.fullPath = fullPath;
+    w.homeDir  = homeDir;
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.work, NULL);
+
+    // Row 0: files of the directory itself
+    int count = 1, cap = 64;
+    DuRow *rows = calloc(cap, sizeof(*rows));
+    DuNode *roots = NULL;
+    int failed = rows == NULL;
+
+    struct dirent *entry;
+    while (!failed && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+
+        // Skip ".", ".." and internal ".lock" files
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            strstr(name, ".lock") != NULL)
+            continue;
+
+        struct stat st;
+        if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            continue;
+
+        if (S_ISREG(st.st_mode)) {
+            rows[0].totals.bytes += st.st_size;
+            rows[0].totals.files++;
+            continue;
+        }
+        if (!S_ISDIR(st.st_mode) || strlen(name) >= sizeof(rows->name))
+            continue;
+
+        if (count == cap) {
+            DuRow *r = realloc(rows, 2 * cap * sizeof(*rows));
+            if (!r) {
+                failed = 1;
+                break;
+            }
+            memset(r + cap, 0, cap * sizeof(*rows));
+            rows = r;
+            cap *= 2;
+        }
+        DuRow *row = &rows[count];
+        strcpy(row->name, name);
+        stats->rows++;
+
+        char path[PATH_MAX];
+        int  keyed = snprintf(path, sizeof(path), "%s/%s", base, name) < (int)sizeof(path);
+
+        char *rel;
+        DuNode *n;
+        if (!findMayEnter(fullPath, homeDir, name, &st)) {
+            row->totals.partial = 1;
+        } else if (keyed && duLookup(path, &st, &row->totals) == 0) {
+            stats->hits++;
+        } else if (!(rel = strdup(name)) || !(n = newNode(NULL, rel, 1, &st, count))) {
+            free(rel);
+            row->totals.partial = 1;
+        } else {
+            // Opened now, queued once all roots are known
+            n->fd   = openat(dirfd(dir), name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            n->next = roots;
+            roots   = n;
+        }
+        count++;
+    }
+    closedir(dir);
+
+    // Walk the subdirectories the duIndex did not know
+    w.rows = rows;
+    while (roots) {
+        DuNode *n = roots;
+        roots = n->next;
+        if (failed) {
+            if (n->fd >= 0)
+                close(n->fd);
+            free(n->rel);
+            free(n);
+            continue;
+        }
+        n->next = w.jobs;
+        w.jobs  = n;
+        w.active++;
+    }
+    if (w.jobs)
+        stats->workers = runWalk(&w);
+    stats->walked = w.walked;
+
+    pthread_cond_destroy(&w.work);
+    pthread_mutex_destroy(&w.lock);
+
+    if (failed) {
+        for (int i = 0; i < w.doneCount; i++)
+            free(w.done[i].rel);
+        free(w.done);
+        free(rows);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        total->bytes   += rows[i].totals.bytes;
+        total->files   += rows[i].totals.files;
+        total->dirs    += rows[i].totals.dirs + (i > 0);
+        total->partial |= rows[i].totals.partial;
+    }
+
+    // Publish the totals (shallow directories first) unless a change of
+    // these homes overlapped the query
+    uint64_t now = statsNow();
+    struct stat top;
+    if (publish && fstat(dirFd, &top) == 0) {
+        lockIndex();
+        uint64_t again;
+        if (changeMark(homeOf(base), &again) && again == mark) {
+            insertEntry(base, &top, total, now);
+
+            qsort(w.done, w.doneCount, sizeof(*w.done), byDepth);
+            for (int i = 0; i < w.doneCount && i < DU_PUBLISH_MAX; i++) {
+                char key[PATH_MAX];
+                struct stat st;
+                if (snprintf(key, sizeof(key), "%s/%s", base, w.done[i].rel) >= (int)sizeof(key))
+                    continue;
+                st.st_dev = (dev_t)w.done[i].dev;
+                st.st_ino = (ino_t)w.done[i].ino;
+                insertEntry(key, &st, &w.done[i].t, now);
+            }
+        }
+        unlockIndex();
+    }
+
+    for (int i = 0; i < w.doneCount; i++)
+        free(w.done[i].rel);
+    free(w.done);
+
+    *rowsOut  = rows;
+    *countOut = count;
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Report
+// ------------------------------------------------------------
+static void formatSize(long long bytes, char *out, size_t size)
+{
+    static const char *units[] = { "B", "KB", "MB", "GB", "TB" };
+    double v = (double)bytes;
+    int u = 0;
+    while (v >= 1024.0 && u < 4) {
+        v /= 1024.0;
+        u++;
+    }
+    if (u == 0)
+        snprintf(out, size, "%lld B", bytes);
+    else
+        snprintf(out, size, "%.1f %s", v, units[u]);
+}
+
+static int byBytesDesc(const void *a, const void *b)
+{
+    const DuRow *x = a, *y = b;
+    if (x->totals.bytes != y->totals.bytes)
+        return (x->totals.bytes < y->totals.bytes) - (x->totals.bytes > y->totals.bytes);
+    return strcmp(x->name, y->name);
+}
+
+int duFormat(const DuTotals *total, DuRow *rows, int count, int top,
+             char *buf, int size)
+{
+    int len = 0;
+    char sz[32];
+
+#define APPEND(...) \
+    do { \
+        if (len < size) \
+            len += snprintf(buf + len, size - len, __VA_ARGS__); \
+    } while (0)
+
+    if (size <= 0)
+        return 0;
+    buf[0] = '\0';
+
+    // Largest subdirectories first, the directory's own files last
+    if (count > 1)
+        qsort(rows + 1, count - 1, sizeof(*rows), byBytesDesc);
+
+    APPEND("============================================================\n");
+    APPEND("                        DISK USAGE                          \n");
+    APPEND("------------------------------------------------------------\n");
+    APPEND(" %12s %10s %8s   %s\n", "SIZE", "FILES", "DIRS", "NAME");
+    APPEND("------------------------------------------------------------\n");
+
+    for (int i = 1; i < count && i <= top; i++) {
+        formatSize(rows[i].totals.bytes, sz, sizeof(sz));
+        APPEND(" %12s %10lld %8lld   %s/%s\n", sz, rows[i].totals.files,
+               rows[i].totals.dirs, rows[i].name, rows[i].totals.partial ? " *" : "");
+    }
+    if (count - 1 > top)
+        APPEND(" ... %d more director%s\n", count - 1 - top,
+               count - 1 - top == 1 ? "y" : "ies");
+
+    formatSize(rows[0].totals.bytes, sz, sizeof(sz));
+    APPEND(" %12s %10lld %8s   (files here)\n", sz, rows[0].totals.files, "-");
+
+    APPEND("------------------------------------------------------------\n");
+    formatSize(total->bytes, sz, sizeof(sz));
+    APPEND(" %12s %10lld %8lld   Total%s\n", sz, total->files, total->dirs,
+           total->partial ? " *" : "");
+    if (total->partial)
+        APPEND(" * some directories could not be read\n");
+    APPEND("============================================================\n");
+
+#undef APPEND
+
+    return len < size ? len : size - 1;
+}
@@ -0,0 +1,436 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../../include/fileCache.h"
+#include "../../include/protocol.h"
+#include "../../include/stats.h"
+
+#define SLOT_FREE   0
+#define SLOT_GHOST  1                 // Key only: missed once
+#define SLOT_VALID  2
+
+typedef struct {
+    uint32_t seq;                     // Odd while the slot changes
+    int32_t  state;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t  mtimeSec;
+    int64_t  mtimeNsec;
+    int64_t  size;
+    int32_t  first;                   // First block, -1 = none
+    int32_t  blocks;
+    uint64_t lastUsed;                // statsNow()
+    char     validator[VALIDATOR_SIZE];
+} FileSlot;
+
+typedef struct {
+    pthread_mutex_t   lock;           // Process-shared, robust
+    FileCacheCounters counters;
+    long long         maxFile;
+    int32_t           nBlocks;
+    int32_t           freeHead;       // Free blocks, linked through next[]
+    int32_t           freeCount;
+    FileSlot          slots[FILECACHE_SLOTS];
+} FileCacheHeader;
+
+static FileCacheHeader *cache = NULL;
+static int32_t         *next  = NULL;     // Block chains (files and free list)
+static char            *arena = NULL;
+
+// ------------------------------------------------------------
+// Setup
+// ------------------------------------------------------------
+static long long parseSize(const char *s, long long def)
+{
+    if (!s || !s[0])
+        return def;
+
+    char *end;
+    double v = strtod(s, &end);
+    if (*end == 'k' || *end == 'K') v *= 1024;
+    if (*end == 'm' || *end == 'M') v *= 1024 * 1024;
+    if (*end == 'g' || *end == 'G') v *= 1024.0 * 1024 * 1024;
+
+    return v > 0 ? (long long)v : def;
+}
+
+static size_t pageAlign(size_t n)
+{
+    return (n + 4095) & ~(size_t)4095;
+}
+
+static void resetBlocks(void)
+{
+    for (int32_t i = 0; i < cache->nBlocks; i++)
+        next[i] = i + 1 < cache->nBlocks ? i + 1 : -1;
+    cache->freeHead  = cache->nBlocks ? 0 : -1;
+    cache->freeCount = cache->nBlocks;
+}
+
+int fileCacheInit(void)
+{
+    const char *env = getenv("FILESERVER_FILECACHE");
+    if (env && strcmp(env, "off") == 0)
+        return 0;
+
+    long long size = parseSize(getenv("FILESERVER_FILECACHE_SIZE"), FILECACHE_SIZE);
+    long long nBlocks = size / FILECACHE_BLOCK;
+    if (nBlocks < 4 || nBlocks > INT32_MAX / 2) {
+        fprintf(stderr, "[FILECACHE] Invalid FILESERVER_FILECACHE_SIZE\n");
+        return -1;
+    }
+
+    long long maxFile = parseSize(getenv("FILESERVER_FILECACHE_MAX_FILE"), FILECACHE_MAX_FILE);
+    if (maxFile > nBlocks * FILECACHE_BLOCK / 4)
+        maxFile = nBlocks * FILECACHE_BLOCK / 4;
+
+    size_t headerSize = pageAlign(sizeof(FileCacheHeader));
+    size_t nextSize   = pageAlign(sizeof(int32_t) * (size_t)nBlocks);
+    size_t total      = headerSize + nextSize + (size_t)nBlocks * FILECACHE_BLOCK;
+
+    void *p = mmap(NULL, total, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("[FILECACHE] mmap");
+        return -1;
+    }
+
+    FileCacheHeader *hdr = p;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    int rc = pthread_mutex_init(&hdr->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (rc != 0) {
+        munmap(p, total);
+        return -1;
+    }
+
+    cache = hdr;
+    next  = (int32_t *)((char *)p + headerSize);
+    arena = (char *)p + headerSize + nextSize;
+
+    cache->nBlocks            = (int32_t)nBlocks;
+    cache->maxFile            = maxFile;
+    cache->counters.capacity  = nBlocks * FILECACHE_BLOCK;
+    for (int i = 0; i < FILECACHE_SLOTS; i++)
+        cache->slots[i].first = -1;
+    resetBlocks();
+    return 1;
+}
+
+// A session killed inside the lock may have left a chain half
+// linked: start over with an empty cache
+static void lockCache(void)
+{
+    if (pthread_mutex_lock(&cache->lock) != EOWNERDEAD)
+        return;
+
+    for (int i = 0; i < FILECACHE_SLOTS; i++) {
+        FileSlot *s = &cache->slots[i];
+        __atomic_store_n(&s->seq, (s->seq | 1) + 1, __ATOMIC_RELEASE);
+        s->state  = SLOT_FREE;
+        s->first  = -1;
+        s->blocks = 0;
+    }
+    resetBlocks();
+    cache->counters.bytes = 0;
+    cache->counters.files = 0;
+    pthread_mutex_consistent(&cache->lock);
+}
+
+static void unlockCache(void)
+{
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// ------------------------------------------------------------
+// Slots (called with the lock held)
+// ------------------------------------------------------------
+static unsigned slotHash(const struct stat *st)
+{
+    uint64_t h = (uint64_t)st->st_ino * 0x9e3779b97f4a7c15ULL ^ (uint64_t)st->st_dev;
+    return (unsigned)(h ^ (h >> 29));
+}
+
+static int sameFile(const FileSlot *s, const struct stat *st)
+{
+    return s->state != SLOT_FREE &&
+           s->dev == (uint64_t)st->st_dev && s->ino == (uint64_t)st->st_ino;
+}
+
+static int sameVersion(const FileSlot *s, const struct stat *st)
+{
+    return s->mtimeSec == (int64_t)st->st_mtim.tv_sec &&
+           s->mtimeNsec == (int64_t)st->st_mtim.tv_nsec &&
+           s->size == (int64_t)st->st_size;
+}
+
+static FileSlot *findSlot(const struct stat *st)
+{
+    unsigned h = slotHash(st);
+    for (int p = 0; p < FILECACHE_PROBES; p++) {
+        FileSlot *s = &cache->slots[(h + p) % FILECACHE_SLOTS];
+        if (sameFile(s, st))
+            return s;
+    }
+    return NULL;
+}
+
+// Return a slot's blocks to the free list and forget it
+static void clearSlot(FileSlot *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (s->state == SLOT_VALID) {
+        int32_t b = s->first;
+        for (int i = 0; i < s->blocks && b >= 0; i++) {
+            int32_t n = next[b];
+            next[b] = cache->freeHead;
+            cache->freeHead = b;
+            cache->freeCount++;
+            b = n;
+        }
+        cache->counters.bytes -= s->size;
+        cache->counters.files--;
+    }
+    s->state  = SLOT_FREE;
+    s->first  = -1;
+    s->blocks = 0;
+
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void setKey(FileSlot *s, const struct stat *st, int state)
+{
+    s->state     = state;
+    s->dev       = (uint64_t)st->st_dev;
+    s->ino       = (uint64_t)st->st_ino;
+    s->mtimeSec  = (int64_t)st->st_mtim.tv_sec;
+    s->mtimeNsec = (int64_t)st->st_mtim.tv_nsec;
+    s->size      = (int64_t)st->st_size;
+    s->lastUsed  = statsNow();
+}
+
+// Remember a missed file: a free probe slot, else the least recently used
+static void addGhost(const struct stat *st)
+{
+    unsigned h = slotHash(st);
+    FileSlot *victim = NULL;
+
+    for (int p = 0; p < FILECACHE_PROBES; p++) {
+        FileSlot *s = &cache->slots[(h + p) % FILECACHE_SLOTS];
+        if (s->state == SLOT_FREE) {
+            victim = s;
+            break;
+        }
+        if (!victim || s->lastUsed < victim->lastUsed)
+            victim = s;
+    }
+
+    if (victim->state == SLOT_VALID)
+        cache->counters.evictions++;
+    clearSlot(victim);
+    setKey(victim, st, SLOT_GHOST);
+}
+
+// Free blocks until need are available, least recently used files first
+static int makeRoom(int need, const FileSlot *keep)
+{
+    while (cache->freeCount < need) {
+        FileSlot *lru = NULL;
+        for (int i = 0; i < FILECACHE_SLOTS; i++) {
+            FileSlot *s = &cache->slots[i];
+            if (s != keep && s->state == SLOT_VALID &&
+                (!lru || s->lastUsed < lru->lastUsed))
+                lru = s;
+        }
+        if (!lru)
+            return -1;
+        clearSlot(lru);
+        cache->counters.evictions++;
+    }
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Lookup / store / invalidate
+// ------------------------------------------------------------
+static int cacheable(const struct stat *st)
+{
+    return S_ISREG(st->st_mode) && st->st_size > 0 && st->st_size <= cache->maxFile;
+}
+
+// Copy [offset, offset + len) of a slot's chain, read without the lock
+static int copyBlocks(int32_t first, int blocks, long long offset, char *out, long long len)
+{
+    int32_t b = first;
+    int skip = (int)(offset / FILECACHE_BLOCK);
+
+    for (int i = 0; i < skip; i++) {
+        if (b < 0 || b >= cache->nBlocks)
+            return -1;
+        b = __atomic_load_n(&next[b], __ATOMIC_RELAXED);
+    }
+
+    long long done = 0;
+    long long at = offset % FILECACHE_BLOCK;
+    for (int i = skip; done < len; i++) {
+        if (i >= blocks || b < 0 || b >= cache->nBlocks)
+            return -1;
+        long long n = FILECACHE_BLOCK - at < len - done ? FILECACHE_BLOCK - at : len - done;
+        memcpy(out + done, arena + (size_t)b * FILECACHE_BLOCK + at, n);
+        done += n;
+        at = 0;
+        b = __atomic_load_n(&next[b], __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+int fileCacheEnabled(void)
+{
+    return cache != NULL;
+}
+
+int fileCacheLookup(const struct stat *st, long long offset, char **data,
+                    long long *len, char *validator, int *wanted)
+{
+    *wanted = 0;
+    if (!cache || !cacheable(st))
+        return -1;
+
+    lockCache();
+    FileSlot *s = findSlot(st);
+
+    if (!s || !sameVersion(s, st) || s->state != SLOT_VALID) {
+        // Second miss of the same version: worth storing once it settled
+        if (s && s->state == SLOT_GHOST && sameVersion(s, st)) {
+            *wanted = time(NULL) - st->st_mtim.tv_sec >= FILECACHE_SETTLE;
+            s->lastUsed = statsNow();
+        } else if (s) {
+            // Another version: forget it, remember this one
+            if (s->state == SLOT_VALID)
+                cache->counters.invalidations++;
+            clearSlot(s);
+            setKey(s, st, SLOT_GHOST);
+        } else {
+            addGhost(st);
+        }
+        unlockCache();
+        __atomic_fetch_add(&cache->counters.misses, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    s->lastUsed = statsNow();
+    uint32_t seq    = s->seq;
+    int32_t  first  = s->first;
+    int      blocks = s->blocks;
+    memcpy(validator, s->validator, VALIDATOR_SIZE);
+    unlockCache();
+
+    if (offset > st->st_size)
+        offset = st->st_size;
+    *len  = st->st_size - offset;
+    *data = malloc(*len > 0 ? (size_t)*len : 1);
+
+    // The slot may be evicted while we copy: then the copy is discarded
+    int rc = *data ? copyBlocks(first, blocks, offset, *data, *len) : -1;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (rc < 0 || __atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq) {
+        free(*data);
+        *data = NULL;
+        __atomic_fetch_add(&cache->counters.misses, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    __atomic_fetch_add(&cache->counters.hits, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void fileCacheStore(const struct stat *st, const char *data, const char *validator)
+{
+    if (!cache || !cacheable(st))
+        return;
+
+    int need = (int)((st->st_size + FILECACHE_BLOCK - 1) / FILECACHE_BLOCK);
+
+    lockCache();
+
+    // Only the ghost of this version is filled (not invalidated since)
+    FileSlot *s = findSlot(st);
+    if (!s || s->state != SLOT_GHOST || !sameVersion(s, st) ||
+        makeRoom(need, s) < 0) {
+        unlockCache();
+        return;
+    }
+
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    // Take need blocks off the free list, in order
+    int32_t *link = &s->first;
+    long long done = 0;
+    for (int i = 0; i < need; i++) {
+        int32_t b = cache->freeHead;
+        cache->freeHead = next[b];
+        cache->freeCount--;
+
+        long long n = st->st_size - done < FILECACHE_BLOCK ? st->st_size - done : FILECACHE_BLOCK;
+        memcpy(arena + (size_t)b * FILECACHE_BLOCK, data + done, n);
+        done += n;
+
+        *link = b;
+        link  = &next[b];
+    }
+    *link = -1;
+
+    s->blocks = need;
+    s->state  = SLOT_VALID;
+    memcpy(s->validator, validator, VALIDATOR_SIZE);
+    s->lastUsed = statsNow();
+
+    cache->counters.bytes += st->st_size;
+    cache->counters.files++;
+    cache->counters.fills++;
+
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+    unlockCache();
+}
+
+void fileCacheInvalidate(const struct stat *st)
+{
+    if (!cache)
+        return;
+
+    lockCache();
+    FileSlot *s = findSlot(st);
+    if (s) {
+        if (s->state == SLOT_VALID)
+            cache->counters.invalidations++;
+        clearSlot(s);
+    }
+    unlockCache();
+}
+
+int fileCacheCounters(FileCacheCounters *out)
+{
+    if (!cache)
+        return 0;
+
+    lockCache();
+    *out = cache->counters;
+    unlockCache();
+
+    out->hits   = __atomic_load_n(&cache->counters.hits, __ATOMIC_RELAXED);
+    out->misses = __atomic_load_n(&cache->counters.misses, __ATOMIC_RELAXED);
+    return 1;
+}
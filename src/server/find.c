@@ -0,0 +1,516 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "../../include/find.h"
+#include "../../include/fsOps.h"
+#include "../../include/protocol.h"
+#include "../../include/payload.h"
+
+#define LINE_BUFFER  4096             // Per-worker matches before they are shared
+
+typedef struct FindJob {
+    struct FindJob *next;
+    int             fd;               // Open directory, -1 = reopen from rel
+    int             depth;            // Depth of the directory itself
+    char           *rel;              // Relative to the search directory, "" = top
+} FindJob;
+
+typedef struct {
+    const FindQuery *q;
+    int              topFd;
+    const char      *fullPath;
+    const char      *homeDir;
+    time_t           now;
+
+    pthread_mutex_t  lock;
+    pthread_cond_t   work;            // Jobs queued or walk finished
+    pthread_cond_t   ready;           // Output for the sender
+    pthread_cond_t   space;           // Output buffer drained
+
+    FindJob         *jobs;            // LIFO: depth first keeps the queue short
+    int              openJobs;        // Queued jobs holding a descriptor
+    int              active;          // Queued + running jobs, 0 = done
+    int              stop;            // Client gone
+
+    char             out[FIND_BATCH_SIZE];
+    int              outLen;
+
+    FindStats        stats;
+} FindWalk;
+
+// ------------------------------------------------------------
+// Query
+// ------------------------------------------------------------
+// "[+|-]N[suffix]": cmp = +1 / -1 / 0, value = N * multiplier
+static int parseBound(const char *tok, const char *suffixes, const long long *mult,
+                      long long defMult, int *cmp, long long *value, long long *unit)
+{
+    *cmp = 0;
+    if (*tok == '+' || *tok == '-')
+        *cmp = *tok++ == '+' ? 1 : -1;
+
+    char *end;
+    errno = 0;
+    long long n = strtoll(tok, &end, 10);
+    if (end == tok || errno || n < 0)
+        return -1;
+
+    long long m = defMult;
+    if (*end) {
+        const char *s = strchr(suffixes, *end);
+        if (!s || end[1])
+            return -1;
+        m = mult[s - suffixes];
+    }
+
+    *value = n;
+    *unit  = m;
+    return 0;
+}
+
+int findParseQuery(const char *glob, const char *filters, FindQuery *q)
+{
+    static const long long sizeMult[] = { 1024LL, 1024LL * 1024, 1024LL * 1024 * 1024 };
+    static const long long timeMult[] = { 1, 60, 3600, 86400 };
+
+    memset(q, 0, sizeof(*q));
+    q->sizeCmp  = 2;
+    q->mtimeCmp = 2;
+    q->maxDepth = -1;
+
+    if (strlen(glob) >= sizeof(q->glob))
+        return -1;
+    strcpy(q->glob, glob);
+
+    char copy[ARG_SIZE];
+    snprintf(copy, sizeof(copy), "%s", filters);
+
+    char *save = NULL;
+    for (char *opt = strtok_r(copy, " ", &save); opt; opt = strtok_r(NULL, " ", &save)) {
+        char *val = strtok_r(NULL, " ", &save);
+        if (!val)
+            return -1;
+
+        long long unit;
+        if (strcmp(opt, "-type") == 0) {
+            if (strcmp(val, "f") != 0 && strcmp(val, "d") != 0)
+                return -1;
+            q->type = val[0];
+        }
+        else if (strcmp(opt, "-size") == 0) {
+            if (parseBound(val, "KMG", sizeMult, 1, &q->sizeCmp, &q->size, &unit) < 0)
+                return -1;
+            q->size *= unit;
+        }
+        else if (strcmp(opt, "-mtime") == 0) {
+            if (parseBound(val, "smhd", timeMult, 86400,
+                           &q->mtimeCmp, &q->mtime, &q->mtimeUnit) < 0)
+                return -1;
+        }
+        else if (strcmp(opt, "-mindepth") == 0 || strcmp(opt, "-maxdepth") == 0) {
+            char *end;
+            long n = strtol(val, &end, 10);
+            if (end == val || *end || n < 0 || n > PATH_MAX)
+                return -1;
+            if (opt[2] == 'i')
+                q->minDepth = (int)n;
+            else
+                q->maxDepth = (int)n;
+        }
+        else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int matches(const FindWalk *w, const char *name, const struct stat *st, int depth)
+{
+    const FindQuery *q = w->q;
+
+    if (depth < q->minDepth)
+        return 0;
+    if (q->type == 'f' && !S_ISREG(st->st_mode))
+        return 0;
+    if (q->type == 'd' && !S_ISDIR(st->st_mode))
+        return 0;
+    if (q->glob[0] && fnmatch(q->glob, name, 0) != 0)
+        return 0;
+
+    if (q->sizeCmp != 2) {
+        long long size = st->st_size;
+        if (((size > q->size) - (size < q->size)) != q->sizeCmp)
+            return 0;
+    }
+
+    // Like find(1): the age is counted in whole units
+    if (q->mtimeCmp != 2) {
+        long long age = (long long)(w->now - st->st_mtime);
+        long long n   = age < 0 ? 0 : age / q->mtimeUnit;
+        if (((n > q->mtime) - (n < q->mtime)) != q->mtimeCmp)
+            return 0;
+    }
+    return 1;
+}
+
+// ------------------------------------------------------------
+// Jobs
+// ------------------------------------------------------------
+static char *joinRel(const char *dir, const char *name)
+{
+    size_t n = strlen(dir) + strlen(name) + 2;
+    char *p = malloc(n);
+    if (p)
+        snprintf(p, n, "%s%s%s", dir, dir[0] ? "/" : "", name);
+    return p;
+}
+
+// Queued directories beyond FIND_MAX_OPEN are opened again from the
+// top, one component at a time and never through a symbolic link
+int findOpenRel(int topFd, const char *rel)
+{
+    int fd = fcntl(topFd, F_DUPFD_CLOEXEC, 0);
+    char part[NAME_MAX + 1];
+
+    while (fd >= 0 && *rel) {
+        size_t n = strcspn(rel, "/");
+        if (n >= sizeof(part)) {
+            close(fd);
+            return -1;
+        }
+        memcpy(part, rel, n);
+        part[n] = '\0';
+        rel += n + (rel[n] == '/');
+
+        int next = openat(fd, part, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        close(fd);
+        fd = next;
+    }
+    return fd;
+}
+
+// Same rule as LIST: owner r+x inside the user's home, group r+x elsewhere
+int findMayEnter(const char *fullPath, const char *homeDir, const char *rel,
+                 const struct stat *st)
+{
+    size_t n = strlen(fullPath);
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s%s", fullPath,
+             n && fullPath[n - 1] == '/' ? "" : "/", rel);
+
+    if (isInsideHome(homeDir, path))
+        return (st->st_mode & S_IRUSR) && (st->st_mode & S_IXUSR);
+    return (st->st_mode & S_IRGRP) && (st->st_mode & S_IXGRP);
+}
+
+static void pushDir(FindWalk *w, int parentFd, const char *name, char *rel, int depth)
+{
+    FindJob *job = malloc(sizeof(*job));
+    if (!job) {
+        free(rel);
+        return;
+    }
+    job->rel   = rel;
+    job->depth = depth;
+    job->fd    = -1;
+
+    pthread_mutex_lock(&w->lock);
+    int keepOpen = w->openJobs < FIND_MAX_OPEN;
+    if (keepOpen)
+        w->openJobs++;
+    pthread_mutex_unlock(&w->lock);
+
+    if (keepOpen) {
+        job->fd = openat(parentFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (job->fd < 0) {
+            pthread_mutex_lock(&w->lock);
+            w->openJobs--;
+            pthread_mutex_unlock(&w->lock);
+        }
+    }
+
+    pthread_mutex_lock(&w->lock);
+    job->next = w->jobs;
+    w->jobs   = job;
+    w->active++;
+    pthread_cond_signal(&w->work);
+    pthread_mutex_unlock(&w->lock);
+}
+
+// Hand a worker's lines to the sender, waiting while its buffer is full
+static void flushLines(FindWalk *w, const char *lines, int len)
+{
+    pthread_mutex_lock(&w->lock);
+    while (!w->stop && w->outLen + len > FIND_BATCH_SIZE) {
+        pthread_cond_signal(&w->ready);
+        pthread_cond_wait(&w->space, &w->lock);
+    }
+    if (!w->stop) {
+        memcpy(w->out + w->outLen, lines, len);
+        w->outLen += len;
+        if (w->outLen >= FIND_BATCH_SIZE / 2)
+            pthread_cond_signal(&w->ready);
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+// ------------------------------------------------------------
+// Workers
+// ------------------------------------------------------------
+static void walkDir(FindWalk *w, FindJob *job, FindStats *local)
+{
+    int fd = job->fd >= 0 ? job->fd : findOpenRel(w->topFd, job->rel);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        if (fd >= 0)
+            close(fd);
+        local->skipped++;
+        return;
+    }
+    local->dirs++;
+
+    char lines[LINE_BUFFER];
+    int  len = 0;
+    int  depth = job->depth + 1;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL &&
+           !__atomic_load_n(&w->stop, __ATOMIC_RELAXED)) {
+        const char *name = entry->d_name;
+
+        // Skip ".", ".." and internal ".lock" files
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            strstr(name, ".lock") != NULL)
+            continue;
+
+        struct stat st;
+        if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            continue;
+        local->entries++;
+
+        int isDir = S_ISDIR(st.st_mode);
+        char *rel = joinRel(job->rel, name);
+        if (!rel)
+            continue;
+
+        if (matches(w, name, &st, depth)) {
+            int need = (int)strlen(rel) + 2;
+            if (len + need > (int)sizeof(lines)) {
+                flushLines(w, lines, len);
+                len = 0;
+            }
+            // A path longer than the line buffer is left out
+            if (need <= (int)sizeof(lines)) {
+                len += snprintf(lines + len, sizeof(lines) - len, "%s%s\n",
+                                rel, isDir ? "/" : "");
+                local->matches++;
+            }
+        }
+
+        if (isDir && (w->q->maxDepth < 0 || depth < w->q->maxDepth)) {
+            if (findMayEnter(w->fullPath, w->homeDir, rel, &st)) {
+                pushDir(w, dirfd(dir), name, rel, depth);
+                rel = NULL;
+            } else {
+                local->skipped++;
+            }
+        }
+        free(rel);
+    }
+
+    if (len > 0)
+        flushLines(w, lines, len);
+    closedir(dir);
+}
+
+static void *workerMain(void *arg)
+{
+    FindWalk *w = arg;
+    FindStats local;
+    memset(&local, 0, sizeof(local));
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->jobs && w->active > 0 && !w->stop)
+            pthread_cond_wait(&w->work, &w->lock);
+        if (!w->jobs || w->stop)
+            break;
+
+        FindJob *job = w->jobs;
+        w->jobs = job->next;
+        if (job->fd >= 0)
+            w->openJobs--;
+        pthread_mutex_unlock(&w->lock);
+
+        walkDir(w, job, &local);
+        free(job->rel);
+        free(job);
+
+        pthread_mutex_lock(&w->lock);
+        if (--w->active == 0) {
+            pthread_cond_broadcast(&w->work);
+            pthread_cond_signal(&w->ready);
+        }
+    }
+
+    w->stats.dirs    += local.dirs;
+    w->stats.entries += local.entries;
+    w->stats.matches += local.matches;
+    w->stats.skipped += local.skipped;
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+int findWorkerCount(void)
+{
+    const char *env = getenv("FILESERVER_FIND_WORKERS");
+    int n = env ? atoi(env) : FIND_WORKERS;
+    if (n < 1)
+        n = 1;
+    return n > FIND_MAX_WORKERS ? FIND_MAX_WORKERS : n;
+}
+
+// ------------------------------------------------------------
+// Public
+// ------------------------------------------------------------
+static int sendBatch(int clientFd, const char *data, int len)
+{
+    ProtocolResponse res = { STATUS_OK, len };
+    if (sendResponse(clientFd, &res) < 0)
+        return -1;
+    return len > 0 ? sendPayload(clientFd, data, len) : 0;
+}
+
+int findRun(int dirFd, const char *fullPath, const char *homeDir,
+            const FindQuery *q, int clientFd, FindStats *stats)
+{
+    FindWalk *w = calloc(1, sizeof(*w));
+    FindJob *top = malloc(sizeof(*top));
+    char *batch = malloc(FIND_BATCH_SIZE);
+    if (!w || !top || !batch) {
+        free(w);
+        free(top);
+        free(batch);
+        return -1;
+    }
+
+    w->q        = q;
+    w->topFd    = dirFd;
+    w->fullPath = fullPath;
+    w->homeDir  = homeDir;
+    w->now      = time(NULL);
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->work, NULL);
+    pthread_cond_init(&w->ready, NULL);
+    pthread_cond_init(&w->space, NULL);
+
+    top->next  = NULL;
+    top->fd    = -1;
+    top->depth = 0;
+    top->rel   = strdup("");
+    w->jobs    = top;
+    w->active  = 1;
+
+    // Signals stay with the session thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    pthread_t threads[FIND_MAX_WORKERS];
+    int count = findWorkerCount();
+    int started = 0;
+    while (started < count && pthread_create(&threads[started], NULL, workerMain, w) == 0)
+        started++;
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    int rc = 0;
+    if (started == 0) {
+        rc = -1;
+        w->stop = 1;
+    } else if (sendBatch(clientFd, NULL, 0) < 0) {
+        rc = 1;
+    }
+
+    // Send what the workers found: full batches at once, partial ones
+    // after FIND_FLUSH_MS
+    pthread_mutex_lock(&w->lock);
+    while (rc == 0) {
+        int timedOut = 0;
+        if (w->active > 0 && w->outLen < FIND_BATCH_SIZE / 2) {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += FIND_FLUSH_MS * 1000000L;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            timedOut = pthread_cond_timedwait(&w->ready, &w->lock, &until) == ETIMEDOUT;
+        }
+
+        if (w->outLen > 0 &&
+            (timedOut || w->active == 0 || w->outLen >= FIND_BATCH_SIZE / 2)) {
+            int len = w->outLen;
+            memcpy(batch, w->out, len);
+            w->outLen = 0;
+            pthread_cond_broadcast(&w->space);
+            pthread_mutex_unlock(&w->lock);
+
+            if (sendBatch(clientFd, batch, len) < 0)
+                rc = 1;
+            else
+                w->stats.batches++;
+
+            pthread_mutex_lock(&w->lock);
+            continue;
+        }
+
+        if (w->active == 0)
+            break;
+    }
+
+    if (rc != 0) {
+        w->stop = 1;
+        pthread_cond_broadcast(&w->work);
+        pthread_cond_broadcast(&w->space);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    // End of the stream
+    if (rc == 0 && sendBatch(clientFd, NULL, 0) < 0)
+        rc = 1;
+
+    while (w->jobs) {
+        FindJob *job = w->jobs;
+        w->jobs = job->next;
+        if (job->fd >= 0)
+            close(job->fd);
+        free(job->rel);
+        free(job);
+    }
+
+    *stats = w->stats;
+    stats->workers = started;
+
+    pthread_cond_destroy(&w->work);
+    pthread_cond_destroy(&w->ready);
+    pthread_cond_destroy(&w->space);
+    pthread_mutex_destroy(&w->lock);
+    free(batch);
+    free(w);
+    return rc;
+}
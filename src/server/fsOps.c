@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,9 +10,28 @@
 #include <limits.h>
 #include <libgen.h>
 #include <sys/file.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/openat2.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <time.h>
 
 #include "../../include/fsOps.h"
 #include "../../include/utils.h"
+#include "../../include/protocol.h"
+#include "../../include/sparse.h"
+#include "../../include/stats.h"
+#include "../../include/trace.h"
+#include "../../include/log.h"
+
+// Lock waits at least this long are logged
+#define LOCK_SLOW_MS_DEFAULT 100
+
+// Room for "<size>-<sec>.<nsec>-" part of a validator
+#define VALIDATOR_PREFIX_SIZE 64
+#define VALIDATOR_WEAK_HASH   "-0000000000000000"
+#define VALIDATOR_WEAK_LEN    17
 
 // Global root directory
 extern const char *gRootDir;
@@ -19,32 +40,94 @@ extern const char *gRootDir;
 // LOCKING — fcntl()
 // ============================================================
 
-// Acquire shared (read) lock on entire file
-int lockFileRead(int fd)
+// Waits longer than this are logged (FILESERVER_LOCK_SLOW_MS)
+static uint64_t slowLockNs(void)
+{
+    static long long slowMs = -1;
+
+    if (slowMs < 0) {
+        const char *env = getenv("FILESERVER_LOCK_SLOW_MS");
+        slowMs = (env && env[0]) ? atoll(env) : LOCK_SLOW_MS_DEFAULT;
+        if (slowMs < 0)
+            slowMs = 0;
+    }
+    return (uint64_t)slowMs * 1000000ull;
+}
+
+// Path of an open descriptor, for contention reports
+static void fdPath(int fd, char *out, size_t size)
+{
+    char link[64];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+
+    ssize_t n = readlink(link, out, size - 1);
+    if (n < 0)
+        n = snprintf(out, size, "fd %d", fd);
+    out[n] = '\0';
+}
+
+// Lock on the whole file. Try without blocking first: only a lock
+// that is actually held by someone else is timed and attributed
+// to its path and to the current command.
+static int lockWhole(int fd, short type, int kind)
 {
     struct flock fl;
     memset(&fl, 0, sizeof(fl));
-    fl.l_type   = F_RDLCK;      // Shared lock
+    fl.l_type   = type;
     fl.l_whence = SEEK_SET;
     fl.l_start  = 0;
     fl.l_len    = 0;        // Lock whole file
 
+    uint64_t start = statsNow();
+    uint64_t t = traceBegin();
+    const char *name = (kind == STATS_LOCK_READ) ? "lock_read" : "lock_write";
+
+    if (fcntl(fd, F_SETLK, &fl) == 0) {
+        statsRecordLockWait(kind, statsNow() - start);
+        traceEnd(t, name, NULL, -1);
+        return 0;
+    }
+
+    if (errno != EACCES && errno != EAGAIN)
+        return -1;
+
+    // Who holds it (may already be gone, then l_type is F_UNLCK)
+    struct flock holder = fl;
+    if (fcntl(fd, F_GETLK, &holder) < 0)
+        holder.l_type = F_UNLCK;
+
     // Blocking call until lock is acquired
-    return fcntl(fd, F_SETLKW, &fl);
+    int rc = fcntl(fd, F_SETLKW, &fl);
+
+    uint64_t waited = statsNow() - start;
+    char path[PATH_SIZE];
+    fdPath(fd, path, sizeof(path));
+
+    statsRecordLockWait(kind, waited);
+    statsRecordLockContention(kind, path, waited, holder.l_type == F_WRLCK);
+    traceEnd(t, name, path, -1);
+
+    if (waited >= slowLockNs()) {
+        logWarn("[LOCK] Slow %s lock on '%s': waited %.1f ms behind %s lock of pid %d",
+                kind == STATS_LOCK_READ ? "read" : "write", path, waited / 1e6,
+                holder.l_type == F_WRLCK ? "a write" :
+                holder.l_type == F_RDLCK ? "a read" : "a released",
+                (int)holder.l_pid);
+    }
+
+    return rc;
+}
+
+// Acquire shared (read) lock on entire file
+int lockFileRead(int fd)
+{
+    return lockWhole(fd, F_RDLCK, STATS_LOCK_READ);
 }
 
 // Acquire exclusive (write) lock on entire file
 int lockFileWrite(int fd)
 {
-    struct flock fl;
-    memset(&fl, 0, sizeof(fl));
-    fl.l_type   = F_WRLCK;          // Exclusive lock
-    fl.l_whence = SEEK_SET;
-    fl.l_start  = 0;
-    fl.l_len    = 0;
-
-    // Blocking call until lock is acquired
-    return fcntl(fd, F_SETLKW, &fl);
+    return lockWhole(fd, F_WRLCK, STATS_LOCK_WRITE);
 }
 
 // Release any lock held on file
@@ -64,7 +147,7 @@ int unlockFile(int fd)
 // PATH HANDLING HELPERS
 // ============================================================
 
-static char* normalize_path(const char *path, char *normalized, size_t size)
+char* normalize_path(const char *path, char *normalized, size_t size)
 {
     if (!path || !normalized || size == 0)
         return NULL;
@@ -116,7 +199,7 @@ static char* normalize_path(const char *path, char *normalized, size_t size)
 // ============================================================
 // Resolves user input path into an absolute server-side path
 // ============================================================
-int resolvePath(Session *s, const char *inputPath, char *outputPath)
+static int resolvePathUntraced(Session *s, const char *inputPath, char *outputPath)
 {
     // Basic argument validation
     if (!s || !inputPath || !outputPath) {
@@ -197,6 +280,14 @@ int resolvePath(Session *s, const char *inputPath, char *outputPath)
     return 0;
 }
 
+int resolvePath(Session *s, const char *inputPath, char *outputPath)
+{
+    uint64_t t = traceBegin();
+    int rc = resolvePathUntraced(s, inputPath, outputPath);
+    traceEnd(t, "resolvePath", inputPath, -1);
+    return rc;
+}
+
 // ============================================================
 // Checks if fullPath is inside rootDir
 // ============================================================
@@ -255,118 +346,588 @@ int isInsideHome(const char *homeDir, const char *fullPath)
     return 0;
 }
 
+// ============================================================
+// SESSION DIRECTORIES (openat2 RESOLVE_BENEATH)
+// ============================================================
+
+// 1 = openat2() works, -1 = kernel without it (< 5.6), 0 = not tried yet
+static int haveOpenat2 = 0;
+
+// Open rel below dirFd; the walk may not leave dirFd or cross a symlink
+static int openBeneath(int dirFd, const char *rel, int flags, mode_t mode)
+{
+    if (haveOpenat2 >= 0) {
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags   = (uint64_t)(flags | O_CLOEXEC);
+        how.mode    = (flags & O_CREAT) ? mode : 0;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+
+        int fd;
+        do {
+            // EAGAIN: a concurrent rename raced with the walk, retry
+            fd = (int)syscall(SYS_openat2, dirFd, rel, &how, sizeof(how));
+        } while (fd < 0 && errno == EAGAIN);
+
+        if (fd >= 0 || errno != ENOSYS) {
+            haveOpenat2 = 1;
+            return fd;
+        }
+
+        haveOpenat2 = -1;
+        logWarn("[FS] openat2() not available, symlinks are only refused "
+                "in the last path component");
+    }
+
+    // Paths are normalized (no ".." left), so only symlinks could escape
+    return openat(dirFd, rel, flags | O_CLOEXEC | O_NOFOLLOW, mode);
+}
+
+// Part of path below dir: "." for dir itself, NULL if outside
+static const char *below(const char *dir, const char *path)
+{
+    size_t n = strlen(dir);
+
+    if (n == 0 || strncmp(dir, path, n) != 0)
+        return NULL;
+    if (path[n] == '\0')
+        return ".";
+    if (path[n] == '/' && path[n + 1] != '\0')
+        return path + n + 1;
+    return NULL;
+}
+
+// Deepest session directory containing fullPath (fewest components to
+// walk). self = 0: the directory itself does not count (callers that
+// need the parent). Returns -1 if there is none.
+static int baseFor(Session *s, const char *fullPath, const char **rel, int self)
+{
+    if (!s)
+        return -1;
+
+    const int   fds[3]  = { s->cwdFd, s->homeFd, s->rootFd };
+    const char *dirs[3] = { s->currentDir, s->homeDir, gRootDir };
+
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] < 0)
+            continue;
+
+        const char *r = below(dirs[i], fullPath);
+        if (r && (self || strcmp(r, ".") != 0)) {
+            *rel = r;
+            return fds[i];
+        }
+    }
+    return -1;
+}
+
+int fsOpenSessionDirs(Session *s)
+{
+    fsCloseSessionDirs(s);
+
+    s->rootFd = open(gRootDir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (s->rootFd < 0)
+        return -1;
+
+    // Home is below root: the same rules apply from the start
+    const char *rel = below(gRootDir, s->homeDir);
+    s->homeFd = rel ? openBeneath(s->rootFd, rel, O_PATH | O_DIRECTORY, 0) : -1;
+    s->cwdFd  = s->homeFd >= 0 ? dup(s->homeFd) : -1;
+
+    if (s->homeFd < 0 || s->cwdFd < 0) {
+        fsCloseSessionDirs(s);
+        return -1;
+    }
+    return 0;
+}
+
+void fsCloseSessionDirs(Session *s)
+{
+    int *fds[3] = { &s->rootFd, &s->homeFd, &s->cwdFd };
+
+    for (int i = 0; i < 3; i++) {
+        if (*fds[i] >= 0)
+            close(*fds[i]);
+        *fds[i] = -1;
+    }
+}
+
+// ============================================================
+// Change current directory (must be an existing directory)
+// ============================================================
+int fsChdir(Session *s, const char *fullPath)
+{
+    if (s->cwdFd < 0) {
+        struct stat st;
+        if (stat(fullPath, &st) < 0 || !S_ISDIR(st.st_mode))
+            return -1;
+    } else {
+        int fd = fsOpen(s, fullPath, O_PATH | O_DIRECTORY, 0);
+        if (fd < 0)
+            return -1;
+
+        close(s->cwdFd);
+        s->cwdFd = fd;
+    }
+
+    if (fullPath != s->currentDir)
+        snprintf(s->currentDir, PATH_SIZE, "%s", fullPath);
+    return 0;
+}
+
+// ============================================================
+// Open / stat / parent directory of a resolved path
+// ============================================================
+int fsOpen(Session *s, const char *fullPath, int flags, mode_t mode)
+{
+    const char *rel;
+    int dirFd = baseFor(s, fullPath, &rel, 1);
+
+    if (dirFd < 0)
+        return open(fullPath, flags | O_CLOEXEC, mode);
+    return openBeneath(dirFd, rel, flags, mode);
+}
+
+int fsStat(Session *s, const char *fullPath, struct stat *st)
+{
+    const char *rel;
+    int dirFd = baseFor(s, fullPath, &rel, 1);
+
+    if (dirFd < 0)
+        return lstat(fullPath, st);
+
+    // Last component only: nothing to walk through
+    if (!strchr(rel, '/'))
+        return fstatat(dirFd, rel, st, AT_SYMLINK_NOFOLLOW);
+
+    // lstat() semantics at any depth: the walk to the parent refuses
+    // symlinks like every open, a symlink at the end is reported as one
+    char name[NAME_MAX + 1];
+    int parentFd = fsOpenParent(s, fullPath, name, sizeof(name));
+    if (parentFd < 0)
+        return -1;
+
+    int rc = fstatat(parentFd, name, st, AT_SYMLINK_NOFOLLOW);
+    fsCloseParent(s, parentFd);
+    return rc;
+}
+
+// Directory fd for the parent of fullPath, last component into name.
+// Release with fsCloseParent() (session directories are only borrowed).
+int fsOpenParent(Session *s, const char *fullPath, char *name, size_t size)
+{
+    const char *rel;
+    int dirFd = baseFor(s, fullPath, &rel, 0);
+
+    // No session directory above it: plain path of the parent
+    if (dirFd < 0) {
+        dirFd = AT_FDCWD;
+        rel   = fullPath;
+    }
+
+    const char *slash = strrchr(rel, '/');
+    const char *last  = slash ? slash + 1 : rel;
+
+    if (last[0] == '\0' || strlen(last) >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    snprintf(name, size, "%s", last);
+
+    if (!slash)
+        return dirFd;
+
+    char dir[PATH_SIZE];
+    size_t len = slash == rel ? 1 : (size_t)(slash - rel);   // "/name": parent is "/"
+    memcpy(dir, rel, len);
+    dir[len] = '\0';
+
+    if (dirFd == AT_FDCWD)
+        return open(dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    return openBeneath(dirFd, dir, O_PATH | O_DIRECTORY, 0);
+}
+
+void fsCloseParent(Session *s, int dirFd)
+{
+    if (dirFd < 0 || dirFd == s->rootFd || dirFd == s->homeFd || dirFd == s->cwdFd)
+        return;
+    close(dirFd);
+}
+
 // ============================================================
 // CREATE file or directory
 // ============================================================
-int fsCreate(const char *path, int permissions, int isDirectory)
+int fsCreate(Session *s, const char *path, int permissions, int isDirectory)
 {
+    char name[NAME_MAX + 1];
+    int dirFd = fsOpenParent(s, path, name, sizeof(name));
+    if (dirFd < 0 && dirFd != AT_FDCWD)
+        return -1;
+
+    int rc = 0;
+
     // Create directory
     if (isDirectory) {
-        if (mkdir(path, permissions) < 0)
-            return -1;
+        rc = mkdirat(dirFd, name, permissions);
     }
     // Create regular file
     else {
-        int fd = open(path, O_CREAT | O_EXCL, permissions);
+        int fd = openat(dirFd, name, O_CREAT | O_EXCL | O_CLOEXEC, permissions);
         if (fd < 0)
-            return -1;
-        close(fd);
+            rc = -1;
+        else
+            close(fd);
     }
-    return 0;
+
+    fsCloseParent(s, dirFd);
+    return rc;
 }
 
 // ============================================================
 // CHMOD
 // ============================================================
-int fsChmod(const char *path, int permissions)
+int fsChmod(Session *s, const char *path, int permissions)
+{
+    char name[NAME_MAX + 1];
+    int dirFd = fsOpenParent(s, path, name, sizeof(name));
+    if (dirFd < 0 && dirFd != AT_FDCWD)
+        return -1;
+
+    // Never through a symlink. fchmodat(AT_SYMLINK_NOFOLLOW) fails with
+    // ENOTSUP before glibc 2.32, so change the inode an O_PATH descriptor
+    // holds, through its /proc link
+    int rc = -1;
+    int fd = openat(dirFd, name, O_PATH | O_NOFOLLOW | O_CLOEXEC);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            if (S_ISLNK(st.st_mode)) {
+                errno = ELOOP;
+            } else {
+                char link[64];
+                snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+                rc = chmod(link, permissions);
+            }
+        }
+        close(fd);
+    }
+
+    fsCloseParent(s, dirFd);
+    return rc;
+}
+
+// ============================================================
+// MOVE / RENAME (never replaces an existing destination)
+// ============================================================
+int fsMove(Session *s, const char *src, const char *dst)
+{
+    char srcName[NAME_MAX + 1], dstName[NAME_MAX + 1];
+
+    int srcDir = fsOpenParent(s, src, srcName, sizeof(srcName));
+    if (srcDir < 0 && srcDir != AT_FDCWD)
+        return -1;
+
+    int dstDir = fsOpenParent(s, dst, dstName, sizeof(dstName));
+    if (dstDir < 0 && dstDir != AT_FDCWD) {
+        fsCloseParent(s, srcDir);
+        return -1;
+    }
+
+    int rc = renameat2(srcDir, srcName, dstDir, dstName, RENAME_NOREPLACE);
+
+    // Filesystems without RENAME_NOREPLACE: the caller checked dst already
+    if (rc < 0 && errno == EINVAL)
+        rc = renameat(srcDir, srcName, dstDir, dstName);
+
+    fsCloseParent(s, dstDir);
+    fsCloseParent(s, srcDir);
+    return rc;
+}
+
+// ============================================================
+// TEMP: new file next to path, under a name nobody else holds
+// ============================================================
+int fsCreateTemp(Session *s, const char *path, char *tmpPath, size_t size, mode_t mode)
+{
+    static unsigned counter = 0;
+
+    // O_EXCL: an existing name (ours or anyone's) is never reused,
+    // only a fresh one is tried
+    for (int tries = 0; tries < 64; tries++) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        unsigned tag = (unsigned)ts.tv_nsec ^ (++counter * 2654435761u);
+
+        if (snprintf(tmpPath, size, "%s.tmp-%d-%08x", path, (int)getpid(), tag)
+            >= (int)size) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+
+        int fd = fsOpen(s, tmpPath, O_WRONLY | O_CREAT | O_EXCL, mode);
+        if (fd >= 0 || errno != EEXIST)
+            return fd;
+    }
+    return -1;
+}
+
+// ============================================================
+// REPLACE: rename src over dst (finished uploads)
+// ============================================================
+int fsReplace(Session *s, const char *src, const char *dst)
 {
-    return chmod(path, permissions);
+    char srcName[NAME_MAX + 1], dstName[NAME_MAX + 1];
+
+    int srcDir = fsOpenParent(s, src, srcName, sizeof(srcName));
+    if (srcDir < 0 && srcDir != AT_FDCWD)
+        return -1;
+
+    int dstDir = fsOpenParent(s, dst, dstName, sizeof(dstName));
+    if (dstDir < 0 && dstDir != AT_FDCWD) {
+        fsCloseParent(s, srcDir);
+        return -1;
+    }
+
+    int rc = renameat(srcDir, srcName, dstDir, dstName);
+
+    fsCloseParent(s, dstDir);
+    fsCloseParent(s, srcDir);
+    return rc;
 }
 
 // ============================================================
-// MOVE / RENAME
+// UNLINK one file
 // ============================================================
-int fsMove(const char *src, const char *dst)
+int fsUnlink(Session *s, const char *path)
 {
-    return rename(src, dst);
+    char name[NAME_MAX + 1];
+    int dirFd = fsOpenParent(s, path, name, sizeof(name));
+    if (dirFd < 0 && dirFd != AT_FDCWD)
+        return -1;
+
+    int rc = unlinkat(dirFd, name, 0);
+
+    fsCloseParent(s, dirFd);
+    return rc;
 }
 
 // ============================================================
-// READ file
+// REMOVE file or directory tree
 // ============================================================
-int fsReadFile(const char *path, char *buffer, int size, int offset)
+
+// type: d_type from readdir, DT_UNKNOWN = look it up
+static int removeAt(int dirFd, const char *name, unsigned char type)
 {
-    // Open file for reading
-    int fd = open(path, O_RDONLY);
+    if (type == DT_UNKNOWN) {
+        struct stat st;
+        if (fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            return -1;
+        type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+    }
+
+    if (type != DT_DIR)
+        return unlinkat(dirFd, name, 0);
+
+    int fd = openat(dirFd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
     if (fd < 0)
         return -1;
 
-    // Moveing to requested offset
-    if (lseek(fd, offset, SEEK_SET) < 0) {
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
         close(fd);
         return -1;
     }
 
-    // Read data
-    int r = read(fd, buffer, size);
+    // Entries that fail are left behind, rmdir below reports it
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+        removeAt(fd, entry->d_name, entry->d_type);
+    }
 
-    // Cleanup
-    close(fd);
+    closedir(dir);
+    return unlinkat(dirFd, name, AT_REMOVEDIR);
+}
 
-    return r;
+int fsRemove(Session *s, const char *path)
+{
+    char name[NAME_MAX + 1];
+    int dirFd = fsOpenParent(s, path, name, sizeof(name));
+    if (dirFd < 0 && dirFd != AT_FDCWD)
+        return -1;
+
+    // Leftover "<name>.lock" from older versions (see removeRecursive)
+    char lockName[NAME_MAX + 6];
+    snprintf(lockName, sizeof(lockName), "%s.lock", name);
+    unlinkat(dirFd, lockName, 0);
+
+    int rc = removeAt(dirFd, name, DT_UNKNOWN);
+
+    fsCloseParent(s, dirFd);
+    return rc;
 }
 
 // ============================================================
-// WRITE file
+// COPY file data between two open files
+// Tries the cheapest method first:
+//   1) FICLONE reflink (btrfs, xfs, ...) - shares extents, no copy
+//   2) copy_file_range() - copy inside the kernel, no user buffers
+//   3) plain read/write loop (other filesystems, old kernels)
 // ============================================================
-int fsWriteFile(const char *path, const char *data, int size, int offset)
+int fsCopyData(int srcFd, int dstFd, long long size)
 {
-    int fd;
-    fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0700);
+    if (ioctl(dstFd, FICLONE, srcFd) == 0)
+        return 0;
 
-    if (fd >= 0) {
-        // I am changeing permissions again because for some reason if I don't I get 660 permission!
-        // It is said that it's done because of umask of the system!
-        if (fchmod(fd, 0700) < 0) {
-            close(fd);
+    loff_t inOff = 0, outOff = 0;
+    long long left = size;
+
+    while (left > 0) {
+        ssize_t n = copy_file_range(srcFd, &inOff, dstFd, &outOff, left, 0);
+
+        if (n < 0) {
+            // Not supported here: fall back, but only if nothing was copied yet
+            if (inOff == 0 && (errno == EXDEV || errno == ENOSYS ||
+                               errno == EINVAL || errno == EOPNOTSUPP))
+                break;
             return -1;
         }
-    } else {
-        // File already exists
-        if (errno != EEXIST)
-            return -1;
+        if (n == 0)
+            return 0;   // Source got shorter, done
 
-        fd = open(path, O_WRONLY);
-        if (fd < 0)
-            return -1;
+        left -= n;
     }
-    
-    // This is just used for overwriting a file (that's if we don't specify a offset)  
-    if (offset == 0) {
-        if (ftruncate(fd, 0) < 0) {
-            close(fd);
+
+    if (left == 0)
+        return 0;
+
+    // Fallback: user-space copy
+    char buf[65536];
+    while (1) {
+        ssize_t r = pread(srcFd, buf, sizeof(buf), inOff);
+        if (r < 0)
             return -1;
+        if (r == 0)
+            break;
+
+        ssize_t done = 0;
+        while (done < r) {
+            ssize_t w = pwrite(dstFd, buf + done, r - done, outOff + done);
+            if (w < 0)
+                return -1;
+            done += w;
         }
+
+        inOff  += r;
+        outOff += r;
     }
 
-    // Move to requested offset
-    if (lseek(fd, offset, SEEK_SET) < 0) {
-        close(fd);
-        return -1;
+    return 0;
+}
+
+// ============================================================
+// READ file (open descriptor, positioned read)
+// ============================================================
+int fsReadFile(int fd, char *buffer, int size, int offset)
+{
+    uint64_t t = traceBegin();
+
+    int r = (int)pread(fd, buffer, size, offset);
+
+    traceEnd(t, "fsReadFile", NULL, r);
+    return r;
+}
+
+// ============================================================
+// WRITE file (open descriptor, positioned write)
+// ============================================================
+int fsWriteFile(int fd, const char *data, int size, int offset)
+{
+    uint64_t t = traceBegin();
+
+    // This is just used for overwriting a file (that's if we don't specify a offset)
+    if (offset == 0) {
+        if (ftruncate(fd, 0) < 0)
+            return -1;
     }
 
     // Write data
     int written = 0;
     if (size > 0) {
-        written = write(fd, data, size);
-        if (written < 0) {
-            close(fd);
+        written = (int)pwrite(fd, data, size, offset);
+        if (written < 0)
             return -1;
-        }
     }
 
-    // Cleanup
-    close(fd);
-
+    traceEnd(t, "fsWriteFile", NULL, written);
     return written;
-}
\ No newline at end of file
+}
+
+// ============================================================
+// VALIDATORS
+// ============================================================
+
+// Build validator string from file metadata and content hash
+void fsFormatValidator(const struct stat *st, unsigned long long hash,
+                       char *out, size_t outSize)
+{
+    snprintf(out, outSize, "%llx-%llx.%09ld-%016llx",
+             (unsigned long long)st->st_size,
+             (unsigned long long)st->st_mtim.tv_sec,
+             (long)st->st_mtim.tv_nsec,
+             hash);
+}
+
+// Hash file content (data extents only) and build its validator
+// (caller holds at least a read lock on fd)
+int fsFileValidator(int fd, const struct stat *st, char *out, size_t outSize)
+{
+    unsigned long long h;
+
+    uint64_t t = traceBegin();
+    int rc = sparseHashFile(fd, (long long)st->st_size, &h);
+    traceEnd(t, "fsFileValidator", NULL, (long long)st->st_size);
+
+    if (rc < 0)
+        return -1;
+
+    fsFormatValidator(st, h, out, outSize);
+    return 0;
+}
+
+// Cheap pre-check: do size and mtime in the validator match st?
+// Only if they do is it worth hashing the content.
+int fsValidatorMatchesStat(const char *validator, const struct stat *st)
+{
+    char prefix[VALIDATOR_PREFIX_SIZE];
+    snprintf(prefix, sizeof(prefix), "%llx-%llx.%09ld-",
+             (unsigned long long)st->st_size,
+             (unsigned long long)st->st_mtim.tv_sec,
+             (long)st->st_mtim.tv_nsec);
+
+    return strncmp(validator, prefix, strlen(prefix)) == 0;
+}
+
+// No content hash (hash part zero, from a plain READ): the validator
+// stands for size and mtime alone
+int fsValidatorIsWeak(const char *validator)
+{
+    size_t n = strlen(validator);
+    return n > VALIDATOR_WEAK_LEN &&
+           strcmp(validator + n - VALIDATOR_WEAK_LEN, VALIDATOR_WEAK_HASH) == 0;
+}
+
+// Does the validator a client sent still match the current one?
+// A weak one only has to agree on size and mtime.
+int fsValidatorEqual(const char *sent, const char *current)
+{
+    if (strcmp(sent, current) == 0)
+        return 1;
+    if (!fsValidatorIsWeak(sent))
+        return 0;
+
+    size_t n = strlen(sent);
+    return strlen(current) == n &&
+           strncmp(sent, current, n - VALIDATOR_WEAK_LEN + 1) == 0;
+}
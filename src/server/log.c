@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "../../include/log.h"
+
+#define LOG_RINGS          64             // Processes with their own ring
+#define LOG_RING_SIZE      (64 * 1024)    // Bytes per ring (power of two)
+#define LOG_LINE_MAX       1024           // Longest message
+#define LOG_DRAIN_IDLE_US  10000          // Drain sleep when nothing arrived
+#define LOG_OUT_SIZE       (64 * 1024)    // Drain write buffer
+
+// One record in a ring, followed by len text bytes (padded to 8)
+typedef struct {
+    uint64_t timeNs;                      // CLOCK_REALTIME
+    uint32_t len;
+    uint32_t level;
+} LogRecord;
+
+// Single producer (owner process), single consumer (drain)
+typedef struct {
+    uint64_t head __attribute__((aligned(64)));   // Written by producer
+    uint64_t dropped;
+    uint64_t tail __attribute__((aligned(64)));   // Written by drain
+    pid_t    owner __attribute__((aligned(64)));  // 0 = free
+    char     data[LOG_RING_SIZE];
+} LogRing;
+
+typedef struct {
+    int     level;
+    LogRing rings[LOG_RINGS];
+} LogShared;
+
+static int defaultLevel = LOG_LEVEL_INFO;
+volatile int *gLogLevel = &defaultLevel;
+
+static LogShared *shared  = NULL;
+static LogRing   *myRing  = NULL;        // Ring claimed by this process
+static int        noRing  = 0;           // All rings taken, write directly
+static int        logFd   = STDOUT_FILENO;
+static pid_t      drainPid = -1;
+
+static volatile sig_atomic_t drainStop = 0;
+
+static const char *levelNames[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+
+// ------------------------------------------------------------
+// Levels
+// ------------------------------------------------------------
+const char *logLevelName(int level)
+{
+    if (level < LOG_LEVEL_ERROR || level > LOG_LEVEL_DEBUG)
+        return "?";
+    return levelNames[level];
+}
+
+int logParseLevel(const char *name)
+{
+    for (int i = LOG_LEVEL_ERROR; i <= LOG_LEVEL_DEBUG; i++) {
+        if (strcasecmp(name, levelNames[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void logSetLevel(int level)
+{
+    if (level >= LOG_LEVEL_ERROR && level <= LOG_LEVEL_DEBUG)
+        *gLogLevel = level;
+}
+
+// ------------------------------------------------------------
+// Record formatting (drain, and direct writes without a ring)
+// ------------------------------------------------------------
+static int formatRecord(char *out, int size, const LogRecord *rec,
+                        pid_t pid, const char *text)
+{
+    // strftime only when the second changes
+    static time_t cachedSec = -1;
+    static char   cachedTime[32];
+
+    time_t sec = (time_t)(rec->timeNs / 1000000000ull);
+    if (sec != cachedSec) {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        strftime(cachedTime, sizeof(cachedTime), "%Y-%m-%d %H:%M:%S", &tm);
+        cachedSec = sec;
+    }
+
+    int n = snprintf(out, size, "%s.%03u [%d] %-5s %.*s\n",
+                     cachedTime,
+                     (unsigned)(rec->timeNs % 1000000000ull / 1000000u),
+                     (int)pid, logLevelName((int)rec->level),
+                     (int)rec->len, text);
+
+    return (n < size) ? n : size - 1;
+}
+
+static void writeFully(const char *buf, int len)
+{
+    while (len > 0) {
+        ssize_t w = write(logFd, buf, len);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        buf += w;
+        len -= (int)w;
+    }
+}
+
+// ------------------------------------------------------------
+// Ring access (positions grow forever, masked on access)
+// ------------------------------------------------------------
+static void ringPut(LogRing *r, uint64_t pos, const void *src, uint32_t n)
+{
+    uint32_t off   = (uint32_t)(pos & (LOG_RING_SIZE - 1));
+    uint32_t first = (n < LOG_RING_SIZE - off) ? n : LOG_RING_SIZE - off;
+
+    memcpy(r->data + off, src, first);
+    memcpy(r->data, (const char *)src + first, n - first);
+}
+
+static void ringGet(const LogRing *r, uint64_t pos, void *dst, uint32_t n)
+{
+    uint32_t off   = (uint32_t)(pos & (LOG_RING_SIZE - 1));
+    uint32_t first = (n < LOG_RING_SIZE - off) ? n : LOG_RING_SIZE - off;
+
+    memcpy(dst, r->data + off, first);
+    memcpy((char *)dst + first, r->data, n - first);
+}
+
+static uint64_t recordSize(uint32_t len)
+{
+    return sizeof(LogRecord) + ((len + 7u) & ~7u);
+}
+
+// A forked child must not write into its parent's ring
+static void resetAfterFork(void)
+{
+    myRing = NULL;
+    noRing = 0;
+}
+
+static LogRing *claimRing(void)
+{
+    if (myRing || noRing || !shared)
+        return myRing;
+
+    pid_t self = getpid();
+
+    for (int i = 0; i < LOG_RINGS; i++) {
+        pid_t expected = 0;
+        if (__atomic_compare_exchange_n(&shared->rings[i].owner, &expected, self, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            myRing = &shared->rings[i];
+            return myRing;
+        }
+    }
+
+    noRing = 1;
+    return NULL;
+}
+
+// ============================================================
+// PRODUCER
+// ============================================================
+void logWrite(int level, const char *fmt, ...)
+{
+    char text[LOG_LINE_MAX];
+
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+
+    if (len < 0)
+        return;
+    if (len >= LOG_LINE_MAX)
+        len = LOG_LINE_MAX - 1;
+    while (len > 0 && text[len - 1] == '\n')
+        len--;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    LogRecord rec;
+    rec.timeNs = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    rec.len    = (uint32_t)len;
+    rec.level  = (uint32_t)level;
+
+    LogRing *ring = claimRing();
+
+    // No ring (not initialized or all taken): synchronous write
+    if (!ring) {
+        char line[LOG_LINE_MAX + 64];
+        int n = formatRecord(line, sizeof(line), &rec, getpid(), text);
+        writeFully(line, n);
+        return;
+    }
+
+    uint64_t need = recordSize(rec.len);
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    // Never wait for the drain: drop and count
+    if (LOG_RING_SIZE - (head - tail) < need) {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    ringPut(ring, head, &rec, sizeof(rec));
+    ringPut(ring, head + sizeof(rec), text, rec.len);
+
+    __atomic_store_n(&ring->head, head + need, __ATOMIC_RELEASE);
+}
+
+// ============================================================
+// DRAIN
+// ============================================================
+static char outBuf[LOG_OUT_SIZE];
+static int  outLen = 0;
+
+static void outFlush(void)
+{
+    writeFully(outBuf, outLen);
+    outLen = 0;
+}
+
+static void outRecord(const LogRecord *rec, pid_t pid, const char *text)
+{
+    if (outLen > LOG_OUT_SIZE - (LOG_LINE_MAX + 64))
+        outFlush();
+    outLen += formatRecord(outBuf + outLen, LOG_OUT_SIZE - outLen, rec, pid, text);
+}
+
+// Copy everything available out of all rings. Returns records moved.
+static int drainRings(void)
+{
+    int moved = 0;
+
+    for (int i = 0; i < LOG_RINGS; i++) {
+        LogRing *r = &shared->rings[i];
+
+        pid_t owner = __atomic_load_n(&r->owner, __ATOMIC_ACQUIRE);
+        if (owner == 0)
+            continue;
+
+        uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = r->tail;
+
+        while (tail < head) {
+            LogRecord rec;
+            char text[LOG_LINE_MAX];
+
+            ringGet(r, tail, &rec, sizeof(rec));
+            if (rec.len >= LOG_LINE_MAX) {
+                // Corrupt ring: skip everything that is there
+                tail = head;
+                break;
+            }
+
+            ringGet(r, tail + sizeof(rec), text, rec.len);
+            outRecord(&rec, owner, text);
+
+            tail += recordSize(rec.len);
+            moved++;
+        }
+
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+        uint64_t dropped = __atomic_exchange_n(&r->dropped, 0, __ATOMIC_RELAXED);
+        if (dropped > 0) {
+            char text[128];
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+
+            LogRecord rec;
+            rec.timeNs = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+            rec.level  = LOG_LEVEL_WARN;
+            rec.len    = (uint32_t)snprintf(text, sizeof(text),
+                                            "[LOG] %llu record(s) dropped, ring full",
+                                            (unsigned long long)dropped);
+            outRecord(&rec, owner, text);
+        }
+
+        // Owner exited and everything is written: free the ring
+        if (tail == head && kill(owner, 0) < 0 && errno == ESRCH) {
+            r->head = 0;
+            r->tail = 0;
+            __atomic_store_n(&r->owner, 0, __ATOMIC_RELEASE);
+        }
+    }
+
+    if (outLen > 0)
+        outFlush();
+
+    return moved;
+}
+
+static void handleDrainStop(int sig)
+{
+    (void)sig;
+    drainStop = 1;
+}
+
+static void runDrain(pid_t parentPid)
+{
+    // CTRL+C on the console must not lose the last records,
+    // the main process stops us explicitly
+    signal(SIGINT, SIG_IGN);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleDrainStop;
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (!drainStop && getppid() == parentPid) {
+        if (drainRings() == 0)
+            usleep(LOG_DRAIN_IDLE_US);
+    }
+
+    drainRings();
+    _exit(0);
+}
+
+// ============================================================
+// SETUP / SHUTDOWN
+// ============================================================
+int logInit(void)
+{
+    const char *path = getenv("FILESERVER_LOG");
+    if (!path || !path[0])
+        path = "server.log";
+
+    if (strcmp(path, "-") != 0) {
+        int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+        if (fd < 0) {
+            perror("[LOG] open");
+            return -1;
+        }
+        logFd = fd;
+    }
+
+    const char *levelEnv = getenv("FILESERVER_LOG_LEVEL");
+    if (levelEnv && levelEnv[0]) {
+        int level = logParseLevel(levelEnv);
+        if (level < 0)
+            fprintf(stderr, "[LOG] Unknown level '%s', using info\n", levelEnv);
+        else
+            defaultLevel = level;
+
+        if (level > LOG_COMPILE_LEVEL)
+            fprintf(stderr, "[LOG] %s messages are compiled out of this build\n",
+                    logLevelName(level));
+    }
+
+    void *p = mmap(NULL, sizeof(LogShared), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("[LOG] mmap");
+        return -1;
+    }
+
+    shared = (LogShared *)p;
+    shared->level = defaultLevel;
+    gLogLevel = &shared->level;
+
+    pthread_atfork(NULL, NULL, resetAfterFork);
+    return 0;
+}
+
+int logStartDrain(void)
+{
+    if (!shared)
+        return -1;
+
+    pid_t parentPid = getpid();
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        perror("[LOG] fork");
+        return -1;
+    }
+
+    if (pid == 0)
+        runDrain(parentPid);
+
+    drainPid = pid;
+    return 0;
+}
+
+void logShutdown(void)
+{
+    if (drainPid <= 0)
+        return;
+
+    kill(drainPid, SIGTERM);
+    waitpid(drainPid, NULL, 0);
+    drainPid = -1;
+
+    // Records written after the drain stopped go out directly
+    shared = NULL;
+    myRing = NULL;
+}
@@ -0,0 +1,549 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+
+#include "../../include/mdCache.h"
+#include "../../include/session.h"
+#include "../../include/stats.h"
+#include "../../include/log.h"
+
+#define MDCACHE_PROBES      4         // Slots tried per directory
+#define MDCACHE_SUBDIRS     64        // Subdirectory watches per listing
+
+// Events on a cached directory (entries created, removed, renamed,
+// written or chmod'ed) and on the directory itself
+#define DIR_EVENTS  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                     IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |              \
+                     IN_DELETE_SELF | IN_MOVE_SELF)
+
+// Events that change the size / mode of a listed subdirectory
+#define SUBDIR_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                       IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct {
+    uint32_t seq;                     // Odd while the slot changes
+    int      state;                   // MDCACHE_FREE / PENDING / VALID
+    uint64_t dev;
+    uint64_t ino;
+    uint32_t uid;                     // Effective uid of the filling session
+    int      total;                   // Entries in the directory
+    int      len;                     // Packed bytes in data
+    int64_t  mtimeSec, mtimeNsec;     // Directory times at fill
+    int64_t  ctimeSec, ctimeNsec;
+    uint64_t lastUsed;
+    char     path[PATH_SIZE];
+    char     data[MDCACHE_DATA_SIZE];
+} MdSlot;
+
+typedef struct {
+    MdCacheCounters counters;
+    int             draining;         // Watcher is applying read events
+    MdSlot          slots[MDCACHE_SLOTS];
+} MdCacheSegment;
+
+static MdCacheSegment *cache = NULL;
+static int queueFd[2] = { -1, -1 };   // Slot indexes to validate
+static int inotifyFd = -1;
+
+static volatile sig_atomic_t mdCacheStop = 0;
+
+// ------------------------------------------------------------
+// Setup
+// ------------------------------------------------------------
+int mdCacheInit(void)
+{
+    const char *env = getenv("FILESERVER_MDCACHE");
+    if (env && strcmp(env, "off") == 0)
+        return 0;
+
+    void *p = mmap(NULL, sizeof(MdCacheSegment), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("[MDCACHE] mmap");
+        return -1;
+    }
+
+    // Sessions must see pending events (see mdCacheLookup), so the
+    // inotify instance is created here and inherited by everyone
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0 || pipe2(queueFd, O_CLOEXEC) < 0) {
+        perror("[MDCACHE] inotify / pipe");
+        if (inotifyFd >= 0)
+            close(inotifyFd);
+        inotifyFd = -1;
+        munmap(p, sizeof(MdCacheSegment));
+        return -1;
+    }
+
+    // A full queue drops the request: the slot simply stays pending
+    fcntl(queueFd[1], F_SETFL, O_NONBLOCK);
+
+    memset(p, 0, sizeof(MdCacheSegment));
+    cache = (MdCacheSegment *)p;
+    return 1;
+}
+
+int mdCacheCounters(MdCacheCounters *out)
+{
+    if (!cache)
+        return 0;
+
+    out->hits          = __atomic_load_n(&cache->counters.hits, __ATOMIC_RELAXED);
+    out->misses        = __atomic_load_n(&cache->counters.misses, __ATOMIC_RELAXED);
+    out->invalidations = __atomic_load_n(&cache->counters.invalidations, __ATOMIC_RELAXED);
+    out->overflows     = __atomic_load_n(&cache->counters.overflows, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// ------------------------------------------------------------
+// Helpers
+// ------------------------------------------------------------
+static int beginWrite(MdSlot *s)
+{
+    uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+    if (seq & 1)
+        return -1;
+
+    if (!__atomic_compare_exchange_n(&s->seq, &seq, seq + 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return -1;
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return 0;
+}
+
+static void endWrite(MdSlot *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+static unsigned firstSlot(uint64_t dev, uint64_t ino, uint32_t uid)
+{
+    uint64_t h = (ino * 0x9E3779B97F4A7C15ull) ^ (dev << 17) ^ uid;
+    return (unsigned)((h ^ (h >> 29)) % MDCACHE_SLOTS);
+}
+
+static int sameKey(const MdSlot *s, const struct stat *st, uint32_t uid)
+{
+    return s->dev == (uint64_t)st->st_dev && s->ino == (uint64_t)st->st_ino &&
+           s->uid == uid;
+}
+
+static int sameTimes(const MdSlot *s, const struct stat *st)
+{
+    return s->mtimeSec == st->st_mtim.tv_sec && s->mtimeNsec == st->st_mtim.tv_nsec &&
+           s->ctimeSec == st->st_ctim.tv_sec && s->ctimeNsec == st->st_ctim.tv_nsec;
+}
+
+// ------------------------------------------------------------
+// Scanning (sessions and watcher)
+// ------------------------------------------------------------
+// Entries past the buffer are only counted: a listing shows fewer
+// lines than MDCACHE_DATA_SIZE holds, the total is always exact
+int mdCacheScan(int dirFd, char *buf, int size, int *total)
+{
+    int dup = fcntl(dirFd, F_DUPFD_CLOEXEC, 0);
+    DIR *dir = dup >= 0 ? fdopendir(dup) : NULL;
+    if (!dir) {
+        if (dup >= 0)
+            close(dup);
+        return -1;
+    }
+
+    struct dirent *entry;
+    struct stat st;
+    int len = 0, count = 0, full = 0;
+
+    while ((entry = readdir(dir)) != NULL) {
+        // Skip ".", ".." and internal ".lock" files
+        if (!strcmp(entry->d_name, ".") ||
+            !strcmp(entry->d_name, "..") ||
+            strstr(entry->d_name, ".lock") != NULL)
+            continue;
+
+        // Stat entry relative to the open directory (one component)
+        if (fstatat(dirFd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            continue;
+
+        count++;
+        if (full)
+            continue;
+
+        size_t nameLen = strlen(entry->d_name);
+        size_t need    = MDCACHE_ENTRY_SIZE(nameLen);
+        if (need > (size_t)(size - len)) {
+            full = 1;
+            continue;
+        }
+
+        // Padding zeroed too: the watcher compares listings bytewise
+        MdEntry *e = (MdEntry *)(buf + len);
+        memset(e, 0, need);
+        e->size    = (int64_t)st.st_size;
+        e->mode    = (uint32_t)st.st_mode;
+        e->nameLen = (uint16_t)nameLen;
+        memcpy(e + 1, entry->d_name, nameLen);
+        len += (int)need;
+    }
+
+    closedir(dir);
+    *total = count;
+    return len;
+}
+
+// ------------------------------------------------------------
+// Session side
+// ------------------------------------------------------------
+int mdCacheLookup(const struct stat *dirSt, char *buf, int *total)
+{
+    if (!cache)
+        return -1;
+
+    // An unread event may be about any cached directory, and one
+    // being applied right now too: both mean "not sure", a miss.
+    // Events are queued by the syscall that changed the directory,
+    // so a client never lists a stale copy after its own change.
+    struct pollfd pfd = { inotifyFd, POLLIN, 0 };
+    if (poll(&pfd, 1, 0) != 0 || __atomic_load_n(&cache->draining, __ATOMIC_SEQ_CST))
+        goto miss;
+
+    uint32_t uid   = (uint32_t)geteuid();
+    unsigned first = firstSlot(dirSt->st_dev, dirSt->st_ino, uid);
+
+    for (int k = 0; k < MDCACHE_PROBES; k++) {
+        MdSlot *s = &cache->slots[(first + k) % MDCACHE_SLOTS];
+
+        uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+
+        if (s->state != MDCACHE_VALID || !sameKey(s, dirSt, uid) || !sameTimes(s, dirSt))
+            continue;
+
+        int len = s->len;
+        int n   = s->total;
+        if (len < 0 || len > MDCACHE_DATA_SIZE)
+            continue;
+        memcpy(buf, s->data, len);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq)
+            continue;
+
+        __atomic_store_n(&s->lastUsed, statsNow(), __ATOMIC_RELAXED);
+        __atomic_fetch_add(&cache->counters.hits, 1, __ATOMIC_RELAXED);
+        *total = n;
+        return len;
+    }
+
+miss:
+    __atomic_fetch_add(&cache->counters.misses, 1, __ATOMIC_RELAXED);
+    return -1;
+}
+
+void mdCacheStore(const char *path, const struct stat *dirSt,
+                  const char *buf, int len, int total)
+{
+    if (!cache || len < 0 || len > MDCACHE_DATA_SIZE || strlen(path) >= PATH_SIZE)
+        return;
+
+    uint32_t uid   = (uint32_t)geteuid();
+    unsigned first = firstSlot(dirSt->st_dev, dirSt->st_ino, uid);
+
+    // Same directory first, then a free slot, then the least recently used
+    int victim = -1, rank = 3;
+    for (int k = 0; k < MDCACHE_PROBES; k++) {
+        int i = (first + k) % MDCACHE_SLOTS;
+        MdSlot *s = &cache->slots[i];
+        int r;
+
+        if (sameKey(s, dirSt, uid))
+            r = 0;
+        else if (s->state == MDCACHE_FREE)
+            r = 1;
+        else
+            r = 2;
+
+        if (r < rank || (r == 2 && rank == 2 &&
+                         s->lastUsed < cache->slots[victim].lastUsed)) {
+            victim = i;
+            rank   = r;
+        }
+    }
+
+    MdSlot *s = &cache->slots[victim];
+
+    // Already queued for the watcher as of the same directory change
+    if (rank == 0 && s->state == MDCACHE_PENDING && sameTimes(s, dirSt))
+        return;
+
+    if (beginWrite(s) < 0)
+        return;                       // Someone else is filling it
+
+    s->state     = MDCACHE_PENDING;
+    s->dev       = (uint64_t)dirSt->st_dev;
+    s->ino       = (uint64_t)dirSt->st_ino;
+    s->uid       = uid;
+    s->total     = total;
+    s->len       = len;
+    s->mtimeSec  = dirSt->st_mtim.tv_sec;
+    s->mtimeNsec = dirSt->st_mtim.tv_nsec;
+    s->ctimeSec  = dirSt->st_ctim.tv_sec;
+    s->ctimeNsec = dirSt->st_ctim.tv_nsec;
+    s->lastUsed  = statsNow();
+    snprintf(s->path, sizeof(s->path), "%s", path);
+    memcpy(s->data, buf, len);
+    endWrite(s);
+
+    // Atomic pipe write; with the queue full the slot is given up
+    if (write(queueFd[1], &victim, sizeof(victim)) < 0 && beginWrite(s) == 0) {
+        s->state = MDCACHE_FREE;
+        endWrite(s);
+    }
+}
+
+// ------------------------------------------------------------
+// Watcher process
+// ------------------------------------------------------------
+typedef struct {
+    int count;
+    int wd[MDCACHE_SUBDIRS + 1];      // Directory, then its subdirectories
+} SlotWatches;
+
+static SlotWatches watches[MDCACHE_SLOTS];
+static char        scratch[MDCACHE_DATA_SIZE];
+static char        filled[MDCACHE_DATA_SIZE];
+
+static void handleMdCacheStop(int sig)
+{
+    (void)sig;
+    mdCacheStop = 1;
+}
+
+static int watchReferenced(int wd)
+{
+    for (int i = 0; i < MDCACHE_SLOTS; i++)
+        for (int j = 0; j < watches[i].count; j++)
+            if (watches[i].wd[j] == wd)
+                return 1;
+    return 0;
+}
+
+// Forget a slot's watches, removing those no other slot uses
+static void releaseWatches(int slot)
+{
+    SlotWatches old = watches[slot];
+    watches[slot].count = 0;
+
+    for (int j = 0; j < old.count; j++)
+        if (!watchReferenced(old.wd[j]))
+            inotify_rm_watch(inotifyFd, old.wd[j]);
+}
+
+static void invalidate(int slot)
+{
+    MdSlot *s = &cache->slots[slot];
+
+    // A slot being refilled is re-validated after this event anyway
+    if (beginWrite(s) == 0) {
+        if (s->state != MDCACHE_FREE)
+            __atomic_fetch_add(&cache->counters.invalidations, 1, __ATOMIC_RELAXED);
+        s->state = MDCACHE_FREE;
+        endWrite(s);
+    }
+
+    releaseWatches(slot);
+}
+
+// Watch through the open descriptor: exactly the inode we checked
+static int addWatch(int fd, uint32_t mask)
+{
+    char proc[64];
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+    return inotify_add_watch(inotifyFd, proc, mask | IN_MASK_ADD | IN_ONLYDIR);
+}
+
+// Watch the directory and its listed subdirectories, scan it again
+// and publish the listing only if nothing changed since the session
+// scanned it
+static void validate(int slot)
+{
+    MdSlot *s = &cache->slots[slot];
+
+    uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if ((seq & 1) || s->state != MDCACHE_PENDING)
+        return;
+
+    char     path[PATH_SIZE];
+    uint64_t dev = s->dev, ino = s->ino;
+    int      len = s->len, total = s->total;
+    int64_t  times[4] = { s->mtimeSec, s->mtimeNsec, s->ctimeSec, s->ctimeNsec };
+
+    if (len < 0 || len > MDCACHE_DATA_SIZE)
+        return;
+    memcpy(path, s->path, sizeof(path));
+    path[PATH_SIZE - 1] = '\0';
+    memcpy(filled, s->data, len);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq)
+        return;                       // Refilled, queued again
+
+    struct stat st;
+    SlotWatches w = { 0, { 0 } };
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    int ok = fd >= 0 && fstat(fd, &st) == 0 && (uint64_t)st.st_dev == dev &&
+             (uint64_t)st.st_ino == ino;
+
+    if (ok)
+        ok = (w.wd[w.count++] = addWatch(fd, DIR_EVENTS)) >= 0;
+
+    // A listed subdirectory's size changes without an event here
+    for (int off = 0; ok && off < len; ) {
+        const MdEntry *e = (const MdEntry *)(filled + off);
+        off += (int)MDCACHE_ENTRY_SIZE(e->nameLen);
+
+        if (!S_ISDIR(e->mode))
+            continue;
+
+        if (w.count > MDCACHE_SUBDIRS) {
+            ok = 0;
+            break;
+        }
+
+        char name[256];
+        memcpy(name, e + 1, e->nameLen);
+        name[e->nameLen] = '\0';
+
+        int sub = openat(fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (sub < 0) {
+            ok = 0;
+            break;
+        }
+        ok = (w.wd[w.count++] = addWatch(sub, SUBDIR_EVENTS)) >= 0;
+        close(sub);
+    }
+
+    // Watches are in place: anything after this scan raises an event
+    int n = 0;
+    if (ok) {
+        ok = fstat(fd, &st) == 0 &&
+             st.st_mtim.tv_sec == times[0] && st.st_mtim.tv_nsec == times[1] &&
+             st.st_ctim.tv_sec == times[2] && st.st_ctim.tv_nsec == times[3] &&
+             mdCacheScan(fd, scratch, sizeof(scratch), &n) == len && n == total &&
+             memcmp(scratch, filled, len) == 0;
+    }
+    if (fd >= 0)
+        close(fd);
+
+    // Publish only if the slot still holds what was checked; a listing
+    // that failed is freed so the next session scan queues it again
+    int published = 0;
+    if (beginWrite(s) == 0) {
+        if (s->seq == seq + 1) {
+            s->state  = ok ? MDCACHE_VALID : MDCACHE_FREE;
+            published = ok;
+        }
+        endWrite(s);
+    }
+
+    if (!published) {
+        // Watches added above that nothing references go away
+        for (int j = 0; j < w.count; j++)
+            if (w.wd[j] >= 0 && !watchReferenced(w.wd[j]))
+                inotify_rm_watch(inotifyFd, w.wd[j]);
+        return;
+    }
+
+    releaseWatches(slot);
+    watches[slot] = w;
+}
+
+static void handleEvents(void)
+{
+    char buf[8192] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    __atomic_store_n(&cache->draining, 1, __ATOMIC_SEQ_CST);
+
+    ssize_t n;
+    while ((n = read(inotifyFd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            p += sizeof(*ev) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                __atomic_fetch_add(&cache->counters.overflows, 1, __ATOMIC_RELAXED);
+                for (int i = 0; i < MDCACHE_SLOTS; i++)
+                    invalidate(i);
+                continue;
+            }
+
+            int used = 0;
+            for (int i = 0; i < MDCACHE_SLOTS; i++) {
+                for (int j = 0; j < watches[i].count; j++) {
+                    if (watches[i].wd[j] == ev->wd) {
+                        invalidate(i);
+                        used = 1;
+                        break;
+                    }
+                }
+            }
+
+            // Stale watch of an evicted listing
+            if (!used && !(ev->mask & IN_IGNORED))
+                inotify_rm_watch(inotifyFd, ev->wd);
+        }
+    }
+
+    __atomic_store_n(&cache->draining, 0, __ATOMIC_SEQ_CST);
+}
+
+void mdCacheServe(pid_t parentPid)
+{
+    // CTRL+C goes to the whole group, the main process stops us
+    signal(SIGINT, SIG_IGN);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleMdCacheStop;
+    sigaction(SIGTERM, &sa, NULL);
+
+    // Validation scans every user's directories
+    if (getuid() == 0 && seteuid(0) != 0)
+        logWarn("[MDCACHE] seteuid(0) failed: %s", strerror(errno));
+
+    close(queueFd[1]);
+
+    struct pollfd pfds[2] = {
+        { inotifyFd, POLLIN, 0 },
+        { queueFd[0], POLLIN, 0 },
+    };
+
+    while (!mdCacheStop && getppid() == parentPid) {
+        if (poll(pfds, 2, 1000) <= 0)
+            continue;
+
+        // Events first: a queued slot may already be out of date
+        if (pfds[0].revents & POLLIN)
+            handleEvents();
+
+        if (pfds[1].revents & POLLIN) {
+            int slots[128];
+            ssize_t n = read(queueFd[0], slots, sizeof(slots));
+            for (ssize_t i = 0; i < n / (ssize_t)sizeof(int); i++)
+                if (slots[i] >= 0 && slots[i] < MDCACHE_SLOTS)
+                    validate(slots[i]);
+        }
+    }
+
+    _exit(0);
+}
@@ -0,0 +1,501 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include "../../include/metrics.h"
+#include "../../include/stats.h"
+#include "../../include/mdCache.h"
+#include "../../include/du.h"
+#include "../../include/quota.h"
+#include "../../include/fileCache.h"
+
+#define METRICS_REQUEST_MAX  4096          // Request head we bother to read
+#define METRICS_BODY_SIZE    (512 * 1024)  // Exposition buffer
+#define METRICS_IO_TIMEOUT   2             // Seconds per scrape socket op
+
+static char unixPath[sizeof(((struct sockaddr_un *)0)->sun_path)] = "";
+
+static volatile sig_atomic_t metricsStop = 0;
+
+static const char *statusNames[STATS_STATUSES] = {
+    "ok", "error", "denied", "not_modified", "quota", "other"
+};
+
+static const double quantiles[] = { 0.5, 0.9, 0.99 };
+
+// ============================================================
+// LISTENING SOCKET
+// ============================================================
+static int openTcp(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("[METRICS] socket");
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    // Loopback only: the endpoint has no authentication
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        perror("[METRICS] bind");
+        close(fd);
+        return -1;
+    }
+
+    printf("[METRICS] Serving http://127.0.0.1:%d/metrics\n", port);
+    return fd;
+}
+
+static int openUnix(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "[METRICS] Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("[METRICS] socket");
+        return -1;
+    }
+
+    // Stale socket from a previous run
+    unlink(path);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        perror("[METRICS] bind");
+        close(fd);
+        return -1;
+    }
+
+    strcpy(unixPath, path);
+    printf("[METRICS] Serving /metrics on UNIX socket %s\n", path);
+    return fd;
+}
+
+int metricsOpen(int serverPort)
+{
+    const char *spec = getenv("FILESERVER_METRICS");
+
+    if (!spec || !spec[0])
+        return (serverPort < 65535) ? openTcp(serverPort + 1) : -1;
+
+    if (strcmp(spec, "off") == 0)
+        return -1;
+
+    if (spec[0] == '/')
+        return openUnix(spec);
+
+    int port = atoi(spec);
+    if (port <= 0 || port > 65535) {
+        fprintf(stderr, "[METRICS] Invalid FILESERVER_METRICS '%s'\n", spec);
+        return -1;
+    }
+    return openTcp(port);
+}
+
+// ============================================================
+// EXPOSITION
+// ============================================================
+typedef struct {
+    char *buf;
+    int   size;
+    int   len;
+} Out;
+
+static void put(Out *o, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void put(Out *o, const char *fmt, ...)
+{
+    if (o->len >= o->size)
+        return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(o->buf + o->len, o->size - o->len, fmt, ap);
+    va_end(ap);
+
+    if (n > 0)
+        o->len += n;
+    if (o->len > o->size)
+        o->len = o->size;
+}
+
+static void family(Out *o, const char *name, const char *type, const char *help)
+{
+    put(o, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Summary samples: quantiles, _sum and _count (values scaled by 'scale')
+static void summary(Out *o, const char *name, const char *labels,
+                    const StatsHistogram *h, double scale)
+{
+    const char *sep = labels[0] ? "," : "";
+
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+        put(o, "%s{%s%squantile=\"%g\"} %.9g\n", name, labels, sep, quantiles[i],
+            statsPercentile(h, quantiles[i] * 100.0) * scale);
+    }
+
+    put(o, "%s_sum%s%s%s %.9g\n", name, labels[0] ? "{" : "", labels, labels[0] ? "}" : "",
+        __atomic_load_n(&h->sum, __ATOMIC_RELAXED) * scale);
+    put(o, "%s_count%s%s%s %llu\n", name, labels[0] ? "{" : "", labels, labels[0] ? "}" : "",
+        (unsigned long long)__atomic_load_n(&h->count, __ATOMIC_RELAXED));
+}
+
+static int commandUsed(const ServerStats *s, int cmd)
+{
+    return __atomic_load_n(&s->commands[cmd].count, __ATOMIC_RELAXED) > 0;
+}
+
+static int formatMetrics(char *buf, int size)
+{
+    Out o = { buf, size, 0 };
+    const ServerStats *s = statsShared();
+    char labels[128];
+
+    if (!s)
+        return 0;
+
+    family(&o, "fileserver_start_time_seconds", "gauge", "Server start time (unix seconds).");
+    put(&o, "fileserver_start_time_seconds %llu\n", (unsigned long long)s->startTime);
+
+    family(&o, "fileserver_sessions_active", "gauge", "Session processes currently alive.");
+    put(&o, "fileserver_sessions_active %lld\n",
+        (long long)__atomic_load_n(&s->activeSessions, __ATOMIC_RELAXED));
+
+    family(&o, "fileserver_sessions_total", "counter", "Session processes forked.");
+    put(&o, "fileserver_sessions_total %llu\n",
+        (unsigned long long)__atomic_load_n(&s->sessionsTotal, __ATOMIC_RELAXED));
+
+    family(&o, "fileserver_fork_duration_seconds", "summary",
+           "Time the accept loop spends in fork() per session.");
+    summary(&o, "fileserver_fork_duration_seconds", "", &s->forkLatency, 1e-9);
+
+    family(&o, "fileserver_lock_wait_seconds", "summary",
+           "Time spent waiting for fcntl file locks.");
+    summary(&o, "fileserver_lock_wait_seconds", "mode=\"read\"",
+            &s->lockWait[STATS_LOCK_READ], 1e-9);
+    summary(&o, "fileserver_lock_wait_seconds", "mode=\"write\"",
+            &s->lockWait[STATS_LOCK_WRITE], 1e-9);
+
+    family(&o, "fileserver_lock_contended_total", "counter",
+           "Lock acquisitions that had to wait for another holder.");
+    put(&o, "fileserver_lock_contended_total{mode=\"read\"} %llu\n",
+        (unsigned long long)__atomic_load_n(&s->lockContended[STATS_LOCK_READ], __ATOMIC_RELAXED));
+    put(&o, "fileserver_lock_contended_total{mode=\"write\"} %llu\n",
+        (unsigned long long)__atomic_load_n(&s->lockContended[STATS_LOCK_WRITE], __ATOMIC_RELAXED));
+
+    family(&o, "fileserver_command_lock_wait_seconds_total", "counter",
+           "Time commands spent blocked on contended file locks.");
+    for (int cmd = 0; cmd < STATS_MAX_COMMANDS; cmd++) {
+        if (commandUsed(s, cmd))
+            put(&o, "fileserver_command_lock_wait_seconds_total{command=\"%s\"} %.9g\n",
+                statsCommandName(cmd),
+                __atomic_load_n(&s->commands[cmd].lockWaitNs, __ATOMIC_RELAXED) * 1e-9);
+    }
+
+    family(&o, "fileserver_commands_total", "counter", "Commands handled, by final status.");
+    for (int cmd = 0; cmd < STATS_MAX_COMMANDS; cmd++) {
+        if (!commandUsed(s, cmd))
+            continue;
+        for (int st = 0; st < STATS_STATUSES; st++) {
+            uint64_t n = __atomic_load_n(&s->commands[cmd].statuses[st], __ATOMIC_RELAXED);
+            if (n > 0)
+                put(&o, "fileserver_commands_total{command=\"%s\",status=\"%s\"} %llu\n",
+                    statsCommandName(cmd), statusNames[st], (unsigned long long)n);
+        }
+    }
+
+    family(&o, "fileserver_command_duration_seconds", "summary", "Command latency.");
+    for (int cmd = 0; cmd < STATS_MAX_COMMANDS; cmd++) {
+        if (!commandUsed(s, cmd))
+            continue;
+        snprintf(labels, sizeof(labels), "command=\"%s\"", statsCommandName(cmd));
+        summary(&o, "fileserver_command_duration_seconds", labels,
+                &s->commands[cmd].latency, 1e-9);
+    }
+
+    family(&o, "fileserver_received_bytes_total", "counter",
+           "Bytes received from clients while handling commands.");
+    for (int cmd = 0; cmd < STATS_MAX_COMMANDS; cmd++) {
+        if (commandUsed(s, cmd))
+            put(&o, "fileserver_received_bytes_total{command=\"%s\"} %llu\n",
+                statsCommandName(cmd),
+                (unsigned long long)__atomic_load_n(&s->commands[cmd].bytesIn, __ATOMIC_RELAXED));
+    }
+
+    family(&o, "fileserver_sent_bytes_total", "counter",
+           "Bytes sent to clients while handling commands.");
+    for (int cmd = 0; cmd < STATS_MAX_COMMANDS; cmd++) {
+        if (commandUsed(s, cmd))
+            put(&o, "fileserver_sent_bytes_total{command=\"%s\"} %llu\n",
+                statsCommandName(cmd),
+                (unsigned long long)__atomic_load_n(&s->commands[cmd].bytesOut, __ATOMIC_RELAXED));
+    }
+
+    family(&o, "fileserver_transfer_throughput_bytes_per_second", "summary",
+           "Throughput of successful uploads and downloads (64 KB and larger).");
+    for (int cmd = 0; cmd < STATS_MAX_COMMANDS; cmd++) {
+        const StatsHistogram *h = &s->commands[cmd].throughput;
+        if (__atomic_load_n(&h->count, __ATOMIC_RELAXED) == 0)
+            continue;
+        snprintf(labels, sizeof(labels), "command=\"%s\"", statsCommandName(cmd));
+        summary(&o, "fileserver_transfer_throughput_bytes_per_second", labels, h, 1.0);
+    }
+
+    MdCacheCounters md;
+    if (mdCacheCounters(&md)) {
+        family(&o, "fileserver_mdcache_lookups_total", "counter",
+               "Directory listings looked up in the metadata cache.");
+        put(&o, "fileserver_mdcache_lookups_total{result=\"hit\"} %llu\n",
+            (unsigned long long)md.hits);
+        put(&o, "fileserver_mdcache_lookups_total{result=\"miss\"} %llu\n",
+            (unsigned long long)md.misses);
+
+        family(&o, "fileserver_mdcache_invalidations_total", "counter",
+               "Cached listings dropped by inotify events.");
+        put(&o, "fileserver_mdcache_invalidations_total %llu\n",
+            (unsigned long long)md.invalidations);
+
+        family(&o, "fileserver_mdcache_overflows_total", "counter",
+               "inotify queue overflows (whole cache dropped).");
+        put(&o, "fileserver_mdcache_overflows_total %llu\n",
+            (unsigned long long)md.overflows);
+    }
+
+    DuCounters du;
+    if (duIndexCounters(&du)) {
+        family(&o, "fileserver_du_lookups_total", "counter",
+               "Directory totals looked up in the disk usage index.");
+        put(&o, "fileserver_du_lookups_total{result=\"hit\"} %llu\n",
+            (unsigned long long)du.hits);
+        put(&o, "fileserver_du_lookups_total{result=\"miss\"} %llu\n",
+            (unsigned long long)du.misses);
+
+        family(&o, "fileserver_du_updates_total", "counter",
+               "Size deltas added to indexed directories by handlers.");
+        put(&o, "fileserver_du_updates_total %llu\n", (unsigned long long)du.updates);
+
+        family(&o, "fileserver_du_drops_total", "counter",
+               "Changes that made a home's totals be walked again.");
+        put(&o, "fileserver_du_drops_total %llu\n", (unsigned long long)du.drops);
+    }
+
+    FileCacheCounters fc;
+    if (fileCacheCounters(&fc)) {
+        family(&o, "fileserver_filecache_lookups_total", "counter",
+               "Reads and downloads looked up in the hot file cache.");
+        put(&o, "fileserver_filecache_lookups_total{result=\"hit\"} %llu\n",
+            (unsigned long long)fc.hits);
+        put(&o, "fileserver_filecache_lookups_total{result=\"miss\"} %llu\n",
+            (unsigned long long)fc.misses);
+
+        family(&o, "fileserver_filecache_fills_total", "counter",
+               "Files stored in the hot file cache.");
+        put(&o, "fileserver_filecache_fills_total %llu\n", (unsigned long long)fc.fills);
+
+        family(&o, "fileserver_filecache_evictions_total", "counter",
+               "Files dropped to make room for others.");
+        put(&o, "fileserver_filecache_evictions_total %llu\n",
+            (unsigned long long)fc.evictions);
+
+        family(&o, "fileserver_filecache_invalidations_total", "counter",
+               "Files dropped because they changed.");
+        put(&o, "fileserver_filecache_invalidations_total %llu\n",
+            (unsigned long long)fc.invalidations);
+
+        family(&o, "fileserver_filecache_bytes", "gauge", "Content held in the hot file cache.");
+        put(&o, "fileserver_filecache_bytes %lld\n", (long long)fc.bytes);
+
+        family(&o, "fileserver_filecache_capacity_bytes", "gauge", "Size of the hot file cache.");
+        put(&o, "fileserver_filecache_capacity_bytes %lld\n", (long long)fc.capacity);
+
+        family(&o, "fileserver_filecache_files", "gauge", "Files held in the hot file cache.");
+        put(&o, "fileserver_filecache_files %d\n", fc.files);
+    }
+
+    QuotaRow rows[QUOTA_USERS];
+    QuotaCounters qc;
+    int quotaUsers = quotaSnapshot(rows, QUOTA_USERS, &qc);
+    if (quotaUsers >= 0) {
+        family(&o, "fileserver_quota_limit_bytes", "gauge", "Storage limit per user.");
+        for (int i = 0; i < quotaUsers; i++)
+            put(&o, "fileserver_quota_limit_bytes{user=\"%s\"} %lld\n",
+                rows[i].name, rows[i].limit);
+
+        family(&o, "fileserver_quota_used_bytes", "gauge",
+               "Bytes used per user according to the ledger.");
+        for (int i = 0; i < quotaUsers; i++)
+            if (rows[i].used >= 0)
+                put(&o, "fileserver_quota_used_bytes{user=\"%s\"} %lld\n",
+                    rows[i].name, rows[i].used);
+
+        family(&o, "fileserver_quota_rejections_total", "counter",
+               "Writes refused because they did not fit the limit.");
+        put(&o, "fileserver_quota_rejections_total %llu\n",
+            (unsigned long long)qc.rejections);
+
+        family(&o, "fileserver_quota_reconciles_total", "counter",
+               "Ledger entries replaced by a walk of the home.");
+        put(&o, "fileserver_quota_reconciles_total %llu\n",
+            (unsigned long long)qc.reconciles);
+
+        family(&o, "fileserver_quota_corrected_bytes_total", "counter",
+               "Bytes the reconciliation walks changed in the ledger.");
+        put(&o, "fileserver_quota_corrected_bytes_total %llu\n",
+            (unsigned long long)qc.corrected);
+    }
+
+    return o.len;
+}
+
+// ============================================================
+// HTTP
+// ============================================================
+static int sendAllPlain(int fd, const char *buf, int len)
+{
+    while (len > 0) {
+        ssize_t w = send(fd, buf, len, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += w;
+        len -= (int)w;
+    }
+    return 0;
+}
+
+// Read the request head (up to the empty line)
+static int readRequest(int fd, char *req, int size)
+{
+    int len = 0;
+
+    while (len < size - 1) {
+        ssize_t r = recv(fd, req + len, size - 1 - len, 0);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+
+        len += (int)r;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+            break;
+    }
+
+    req[len] = '\0';
+    return len;
+}
+
+static void reply(int fd, const char *status, const char *type,
+                  const char *body, int bodyLen)
+{
+    char head[256];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.0 %s\r\n"
+                     "Content-Type: %s\r\n"
+                     "Content-Length: %d\r\n"
+                     "Connection: close\r\n\r\n",
+                     status, type, bodyLen);
+
+    if (sendAllPlain(fd, head, n) == 0)
+        sendAllPlain(fd, body, bodyLen);
+}
+
+static void handleScrape(int fd, char *body)
+{
+    char req[METRICS_REQUEST_MAX];
+
+    struct timeval tv = { METRICS_IO_TIMEOUT, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (readRequest(fd, req, sizeof(req)) <= 0)
+        return;
+
+    if (strncmp(req, "GET ", 4) != 0) {
+        reply(fd, "405 Method Not Allowed", "text/plain", "GET only\n", 9);
+        return;
+    }
+
+    const char *path = req + 4;
+    size_t pathLen = strcspn(path, " \r\n");
+
+    if (!(pathLen == 8 && strncmp(path, "/metrics", 8) == 0) &&
+        !(pathLen == 1 && path[0] == '/')) {
+        reply(fd, "404 Not Found", "text/plain", "Not found\n", 10);
+        return;
+    }
+
+    int len = formatMetrics(body, METRICS_BODY_SIZE);
+    reply(fd, "200 OK", "text/plain; version=0.0.4; charset=utf-8", body, len);
+}
+
+static void handleMetricsStop(int sig)
+{
+    (void)sig;
+    metricsStop = 1;
+}
+
+void metricsServe(int listenFd, pid_t parentPid)
+{
+    // CTRL+C goes to the whole group, the main process stops us
+    signal(SIGINT, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleMetricsStop;
+    sigaction(SIGTERM, &sa, NULL);
+
+    char *body = malloc(METRICS_BODY_SIZE);
+    if (!body)
+        _exit(1);
+
+    struct pollfd pfd = { listenFd, POLLIN, 0 };
+
+    // One scrape at a time: scrapes are rare and cheap
+    while (!metricsStop && getppid() == parentPid) {
+        if (poll(&pfd, 1, 1000) <= 0)
+            continue;
+
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        handleScrape(fd, body);
+        close(fd);
+    }
+
+    if (unixPath[0])
+        unlink(unixPath);
+
+    free(body);
+    _exit(0);
+}
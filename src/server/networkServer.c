@@ -2,9 +2,24 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <arpa/inet.h>
 
 #include "../../include/network.h"
+#include "../../include/log.h"
+#include "../../include/trace.h"
+#include "../../include/capture.h"
+#include "../../include/sessionTable.h"
+
+// Traffic of this process (one session per process)
+static unsigned long long trafficIn  = 0;
+static unsigned long long trafficOut = 0;
+
+void getTrafficCounters(unsigned long long *bytesIn, unsigned long long *bytesOut)
+{
+    *bytesIn  = trafficIn;
+    *bytesOut = trafficOut;
+}
 
 // ------------------------------------------------------------
 // Create listening server socket
@@ -70,7 +85,7 @@ int acceptClient(int serverFd)
     // Accept incoming connection
     int fd = accept(serverFd, (struct sockaddr *)&cliAddr, &len);
     if (fd < 0) {
-        perror("accept");
+        logWarn("[NET] accept: %s", strerror(errno));
         return -1;
     }
 
@@ -83,6 +98,7 @@ int acceptClient(int serverFd)
 // ------------------------------------------------------------
 int sendAll(int sock, const void *buffer, int size)
 {
+    uint64_t t = traceBegin();
     int total = 0;
 
     // Handle partial sends
@@ -90,17 +106,20 @@ int sendAll(int sock, const void *buffer, int size)
         int sent = send(sock, (char *)buffer + total, size - total, 0);
 
         if (sent < 0) {
-            perror("sendAll");
+            logWarn("[NET] sendAll: %s", strerror(errno));
             return -1;
         }
         if (sent == 0) {
-            fprintf(stderr, "sendAll: connection closed unexpectedly\n");
+            logDebug("[NET] sendAll: connection closed unexpectedly");
             return -1;
         }
 
         total += sent;
     }
 
+    trafficOut += (unsigned long long)size;
+    sessionTableTraffic(trafficIn, trafficOut);
+    traceEnd(t, "sendAll", NULL, size);
     return 0;
 }
 
@@ -110,6 +129,7 @@ int sendAll(int sock, const void *buffer, int size)
 // ------------------------------------------------------------
 int recvAll(int sock, void *buffer, int size)
 {
+    uint64_t t = traceBegin();
     int total = 0;
 
     // Handle partial receives
@@ -117,16 +137,21 @@ int recvAll(int sock, void *buffer, int size)
         int r = recv(sock, (char *)buffer + total, size - total, 0);
 
         if (r < 0) {
-            perror("recvAll");
+            logWarn("[NET] recvAll: %s", strerror(errno));
             return -1;
         }
         if (r == 0) {
-            fprintf(stderr, "recvAll: connection closed unexpectedly\n");
+            logDebug("[NET] recvAll: connection closed unexpectedly");
             return -1;
         }
 
         total += r;
     }
 
+    trafficIn += (unsigned long long)size;
+    sessionTableTraffic(trafficIn, trafficOut);
+    if (gCaptureActive)
+        captureInbound(buffer, size);
+    traceEnd(t, "recvAll", NULL, size);
     return 0;
 }
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/payload.h"
+#include "../../include/compress.h"
+#include "../../include/network.h"
+
+// Chunks smaller than this are never worth compressing
+#define PAYLOAD_MIN_COMPRESS 128
+
+// Adaptive bypass: after this many incompressible chunks in a row,
+// stop trying for a while (backoff doubles up to the max)
+#define BYPASS_FAIL_STREAK   4
+#define BYPASS_SKIP_MIN      16
+#define BYPASS_SKIP_MAX      256
+
+// ------------------------------------------------------------
+// Per-process state
+// Every server child and every client process owns exactly one
+// connection, so a single compressed socket is enough.
+// ------------------------------------------------------------
+static int compressedSock = -1;
+
+// Send side
+static char *packBuf   = NULL;   // header + compressed / stored chunk
+static int  failStreak = 0;
+static int  skipChunks = 0;
+static int  skipLength = BYPASS_SKIP_MIN;
+
+// Receive side: decoded bytes not yet consumed by the caller
+static char *unpackBuf = NULL;
+static int  unpackPos  = 0;
+static int  unpackLen  = 0;
+
+// ------------------------------------------------------------
+// Enable / disable compression for a socket
+// ------------------------------------------------------------
+void setPayloadCompression(int sock, int enabled)
+{
+    if (enabled) {
+        if (!packBuf)
+            packBuf = malloc(sizeof(PayloadChunkHeader) + LZ_BOUND(PAYLOAD_CHUNK));
+        if (!unpackBuf)
+            unpackBuf = malloc(PAYLOAD_CHUNK);
+
+        if (!packBuf || !unpackBuf) {
+            fprintf(stderr, "setPayloadCompression: out of memory\n");
+            return;
+        }
+
+        compressedSock = sock;
+    } else if (compressedSock == sock) {
+        compressedSock = -1;
+    }
+
+    // New stream: reset adaptive state and leftovers
+    failStreak = 0;
+    skipChunks = 0;
+    skipLength = BYPASS_SKIP_MIN;
+    unpackPos  = 0;
+    unpackLen  = 0;
+}
+
+int isPayloadCompressed(int sock)
+{
+    return sock >= 0 && sock == compressedSock;
+}
+
+// ------------------------------------------------------------
+// Try to compress one chunk into packBuf (after the header).
+// Returns packed size, or 0 if the chunk should be stored raw.
+// ------------------------------------------------------------
+static int packChunk(const char *data, int n)
+{
+    if (n < PAYLOAD_MIN_COMPRESS)
+        return 0;
+
+    // Still backing off after incompressible data
+    if (skipChunks > 0) {
+        skipChunks--;
+        return 0;
+    }
+
+    // Only worth it if we save at least 1/8 of the chunk
+    char *out = packBuf + sizeof(PayloadChunkHeader);
+    int packed = lzCompress(data, n, out, n - n / 8);
+
+    if (packed > 0) {
+        failStreak = 0;
+        skipLength = BYPASS_SKIP_MIN;
+        return packed;
+    }
+
+    if (++failStreak >= BYPASS_FAIL_STREAK) {
+        failStreak = 0;
+        skipChunks = skipLength;
+        if (skipLength < BYPASS_SKIP_MAX)
+            skipLength *= 2;
+    }
+    return 0;
+}
+
+// ------------------------------------------------------------
+// sendPayload
+// ------------------------------------------------------------
+int sendPayload(int sock, const void *buffer, int size)
+{
+    if (!isPayloadCompressed(sock))
+        return sendAll(sock, buffer, size);
+
+    const char *p = (const char *)buffer;
+
+    while (size > 0) {
+        int n = (size > PAYLOAD_CHUNK) ? PAYLOAD_CHUNK : size;
+        int packed = packChunk(p, n);
+
+        PayloadChunkHeader hdr;
+        hdr.rawSize    = n;
+        hdr.packedSize = packed;
+
+        // Stored chunks are copied behind the header too,
+        // so every chunk leaves in a single send
+        if (packed == 0)
+            memcpy(packBuf + sizeof(hdr), p, n);
+        memcpy(packBuf, &hdr, sizeof(hdr));
+
+        int wire = (int)sizeof(hdr) + (packed > 0 ? packed : n);
+        if (sendAll(sock, packBuf, wire) < 0)
+            return -1;
+
+        p    += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Read and decode the next chunk.
+// Decodes straight into dst when the caller wants the whole chunk,
+// otherwise into unpackBuf. Returns bytes written to dst (0 if the
+// chunk went to unpackBuf), -1 on error.
+// ------------------------------------------------------------
+static int readChunk(int sock, char *dst, int want)
+{
+    PayloadChunkHeader hdr;
+    if (recvAll(sock, &hdr, sizeof(hdr)) < 0)
+        return -1;
+
+    if (hdr.rawSize <= 0 || hdr.rawSize > PAYLOAD_CHUNK ||
+        hdr.packedSize < 0 || hdr.packedSize >= hdr.rawSize) {
+        fprintf(stderr, "recvPayload: corrupt chunk header\n");
+        return -1;
+    }
+
+    int direct = (want >= hdr.rawSize);
+    char *out  = direct ? dst : unpackBuf;
+
+    if (hdr.packedSize == 0) {
+        if (recvAll(sock, out, hdr.rawSize) < 0)
+            return -1;
+    } else {
+        char *in = packBuf + sizeof(PayloadChunkHeader);
+        if (recvAll(sock, in, hdr.packedSize) < 0)
+            return -1;
+        if (lzDecompress(in, hdr.packedSize, out, hdr.rawSize) < 0) {
+            fprintf(stderr, "recvPayload: corrupt chunk data\n");
+            return -1;
+        }
+    }
+
+    if (direct)
+        return hdr.rawSize;
+
+    unpackPos = 0;
+    unpackLen = hdr.rawSize;
+    return 0;
+}
+
+// ------------------------------------------------------------
+// recvPayload
+// ------------------------------------------------------------
+int recvPayload(int sock, void *buffer, int size)
+{
+    if (!isPayloadCompressed(sock))
+        return recvAll(sock, buffer, size);
+
+    char *p = (char *)buffer;
+
+    while (size > 0) {
+        // Serve leftovers from the previous chunk first
+        if (unpackPos < unpackLen) {
+            int n = unpackLen - unpackPos;
+            if (n > size)
+                n = size;
+            memcpy(p, unpackBuf + unpackPos, n);
+            unpackPos += n;
+            p    += n;
+            size -= n;
+            continue;
+        }
+
+        int n = readChunk(sock, p, size);
+        if (n < 0)
+            return -1;
+
+        p    += n;
+        size -= n;
+    }
+
+    return 0;
+}
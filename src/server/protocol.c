@@ -4,6 +4,7 @@
 
 #include "../../include/network.h"   
 #include "../../include/protocol.h"  
+#include "../../include/log.h"
 
 // ------------------------------------------------------------
 // Send a complete ProtocolMessage structure
@@ -11,13 +12,13 @@
 int sendMessage(int sock, ProtocolMessage *msg)
 {
     if (!msg) {
-        fprintf(stderr, "sendMessage: NULL pointer\n");
+        logError("[PROTO] sendMessage: NULL pointer");
         return -1;
     }
 
     // Send the entire message as fixed-size raw bytes
     if (sendAll(sock, msg, sizeof(ProtocolMessage)) < 0) {
-        perror("sendMessage");
+        logDebug("[PROTO] sendMessage failed");
         return -1;
     }
 
@@ -30,13 +31,13 @@ int sendMessage(int sock, ProtocolMessage *msg)
 int receiveMessage(int sock, ProtocolMessage *msg)
 {
     if (!msg) {
-        fprintf(stderr, "receiveMessage: NULL pointer\n");
+        logError("[PROTO] receiveMessage: NULL pointer");
         return -1;
     }
 
     // Receive the entire fixed-size message
     if (recvAll(sock, msg, sizeof(ProtocolMessage)) < 0) {
-        perror("receiveMessage");
+        logDebug("[PROTO] receiveMessage failed");
         return -1;
     }
 
@@ -49,13 +50,13 @@ int receiveMessage(int sock, ProtocolMessage *msg)
 int sendResponse(int sock, ProtocolResponse *res)
 {
     if (!res) {
-        fprintf(stderr, "sendResponse: NULL pointer\n");
+        logError("[PROTO] sendResponse: NULL pointer");
         return -1;
     }
 
     // Send full response structure
     if (sendAll(sock, res, sizeof(ProtocolResponse)) < 0) {
-        perror("sendResponse");
+        logDebug("[PROTO] sendResponse failed");
         return -1;
     }
 
@@ -68,13 +69,13 @@ int sendResponse(int sock, ProtocolResponse *res)
 int receiveResponse(int sock, ProtocolResponse *res)
 {
     if (!res) {
-        fprintf(stderr, "receiveResponse: NULL pointer\n");
+        logError("[PROTO] receiveResponse: NULL pointer");
         return -1;
     }
 
     // Receive full response structure
     if (recvAll(sock, res, sizeof(ProtocolResponse)) < 0) {
-        perror("receiveResponse");
+        logDebug("[PROTO] receiveResponse failed");
         return -1;
     }
 
@@ -0,0 +1,606 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../../include/quota.h"
+#include "../../include/stats.h"
+#include "../../include/log.h"
+
+// Global server root directory
+extern const char *gRootDir;
+
+// ============================================================
+// Shared ledger
+// ============================================================
+typedef struct {
+    pid_t     pid;                    // 0 = free
+    long long reserved;
+} QuotaInflight;
+
+typedef struct {
+    int           inUse;
+    char          name[QUOTA_NAME_SIZE];
+    long long     limit;
+    long long     used;               // -1 = not measured yet
+    long long     reserved;           // Sum of the in-flight reservations
+    uint64_t      changes;            // Bumped by quotaBegin() and quotaEnd()
+    QuotaInflight inflight[QUOTA_INFLIGHT];
+    int           stale;              // Walk QUOTA_DIRTY_DELAY after staleAt
+    uint64_t      staleAt;            // statsNow()
+    time_t        reconciledAt;
+} QuotaUser;
+
+typedef struct {
+    pthread_mutex_t lock;             // Process-shared, robust
+    uint64_t        version;          // Bumped on every ledger change
+    QuotaCounters   counters;
+    QuotaUser       users[QUOTA_USERS];
+} QuotaLedger;
+
+static QuotaLedger *ledger = NULL;
+static char         ledgerPath[PATH_MAX];
+static volatile sig_atomic_t quotaStop = 0;
+
+// A session killed inside the lock leaves it to the next owner; the
+// usage it was booking may be off, so every user is walked again
+static void lockLedger(void)
+{
+    if (pthread_mutex_lock(&ledger->lock) == EOWNERDEAD) {
+        for (int i = 0; i < QUOTA_USERS; i++) {
+            ledger->users[i].stale   = 1;
+            ledger->users[i].staleAt = 0;
+        }
+        pthread_mutex_consistent(&ledger->lock);
+    }
+}
+
+static void unlockLedger(void)
+{
+    pthread_mutex_unlock(&ledger->lock);
+}
+
+// Row of a user name, -1 if it has no limit (lock held)
+static int findUser(const char *name)
+{
+    for (int i = 0; i < QUOTA_USERS; i++)
+        if (ledger->users[i].inUse && strcmp(ledger->users[i].name, name) == 0)
+            return i;
+    return -1;
+}
+
+// User of a home: its first component below the root
+static int userOfHome(const char *homeDir, char *name, size_t size)
+{
+    size_t n = strlen(gRootDir);
+    while (n > 1 && gRootDir[n - 1] == '/')
+        n--;
+    if (strncmp(homeDir, gRootDir, n) != 0 || homeDir[n] != '/')
+        return -1;
+
+    const char *p = homeDir + n + 1;
+    size_t len = strcspn(p, "/");
+    if (len == 0 || len >= size)
+        return -1;
+    memcpy(name, p, len);
+    name[len] = '\0';
+    return 0;
+}
+
+long long quotaParseSize(const char *s)
+{
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    if (end == s || v < 0 || errno)
+        return -1;
+
+    long long mult = 1;
+    switch (*end) {
+    case 'k': case 'K': mult = 1LL << 10; end++; break;
+    case 'm': case 'M': mult = 1LL << 20; end++; break;
+    case 'g': case 'G': mult = 1LL << 30; end++; break;
+    case 't': case 'T': mult = 1LL << 40; end++; break;
+    }
+    if (*end != '\0' || v > LLONG_MAX / mult)
+        return -1;
+    return v * mult;
+}
+
+// ------------------------------------------------------------
+// Saved ledger: "user limit used reconciled" per line
+// ------------------------------------------------------------
+// Root writes there: nobody else may be able to plant a symlink or a
+// file under the ledger's names (create: make the default directory)
+static int checkLedgerDir(int create)
+{
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", ledgerPath);
+    char *slash = strrchr(dir, '/');
+    if (slash)
+        slash[slash == dir] = '\0';
+    else
+        snprintf(dir, sizeof(dir), ".");
+
+    if (create && mkdir(dir, 0700) < 0 && errno != EEXIST)
+        return -1;
+
+    struct stat st;
+    if (lstat(dir, &st) < 0 || !S_ISDIR(st.st_mode) || (st.st_mode & 022) ||
+        (st.st_uid != 0 && st.st_uid != getuid())) {
+        fprintf(stderr, "[QUOTA] '%s' must be a directory only its owner can write\n", dir);
+        return -1;
+    }
+    return 0;
+}
+
+// Written by the quota process as root; returns -1 if the ledger
+// directory is not safe
+static int loadLedger(int createDir)
+{
+    uid_t euid = geteuid();
+    if (getuid() == 0)
+        (void)!seteuid(0);
+    int ok = checkLedgerDir(createDir);
+    int fd = ok == 0 ? open(ledgerPath, O_RDONLY | O_NOFOLLOW | O_CLOEXEC) : -1;
+    if (getuid() == 0)
+        (void)!seteuid(euid);
+    if (ok < 0)
+        return -1;
+
+    FILE *f = fd >= 0 ? fdopen(fd, "r") : NULL;
+    if (!f) {
+        if (fd >= 0)
+            close(fd);
+        return 0;
+    }
+
+    char line[512];
+    int n = 0;
+    while (fgets(line, sizeof(line), f) && n < QUOTA_USERS) {
+        char name[QUOTA_NAME_SIZE];
+        long long limit, used, at;
+        if (line[0] == '#' ||
+            sscanf(line, "%63s %lld %lld %lld", name, &limit, &used, &at) != 4 ||
+            limit < 0)
+            continue;
+
+        QuotaUser *u = &ledger->users[n++];
+        u->inUse = 1;
+        snprintf(u->name, sizeof(u->name), "%s", name);
+        u->limit        = limit;
+        u->used         = used;
+        u->reconciledAt = (time_t)at;
+
+        // Changes after the last save are lost if the server did not
+        // stop cleanly: enforce the saved usage, then walk it again
+        u->stale   = 1;
+        u->staleAt = 0;
+    }
+    fclose(f);
+    return 0;
+}
+
+static int saveLedger(void)
+{
+    QuotaRow rows[QUOTA_USERS];
+    int count = quotaSnapshot(rows, QUOTA_USERS, NULL);
+    if (count < 0)
+        return -1;
+
+    // Unique name, created exclusively (never follows a planted link)
+    char tmp[PATH_MAX + 8];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", ledgerPath);
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    FILE *f = fdopen(fd, "w");
+    if (!f) {
+        close(fd);
+        return -1;
+    }
+    fprintf(f, "# user limit used reconciled\n");
+    for (int i = 0; i < count; i++)
+        fprintf(f, "%s %lld %lld %lld\n", rows[i].name, rows[i].limit,
+                rows[i].used, (long long)rows[i].reconciledAt);
+
+    int rc = (fflush(f) == 0 && fsync(fd) == 0) ? 0 : -1;
+    if (fclose(f) != 0)
+        rc = -1;
+    if (rc == 0 && rename(tmp, ledgerPath) < 0)
+        rc = -1;
+    if (rc < 0)
+        unlink(tmp);
+    return rc;
+}
+
+// ------------------------------------------------------------
+// Setup
+// ------------------------------------------------------------
+int quotaInit(int serverPort)
+{
+    const char *env = getenv("FILESERVER_QUOTA_FILE");
+    if (env && strcmp(env, "off") == 0)
+        return 0;
+    if (env && env[0])
+        snprintf(ledgerPath, sizeof(ledgerPath), "%s", env);
+    else
+        snprintf(ledgerPath, sizeof(ledgerPath), QUOTA_DIR "/%d.quota", serverPort);
+
+    void *p = mmap(NULL, sizeof(QuotaLedger), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("[QUOTA] mmap");
+        return -1;
+    }
+
+    QuotaLedger *l = p;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    int rc = pthread_mutex_init(&l->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (rc != 0) {
+        munmap(p, sizeof(QuotaLedger));
+        return -1;
+    }
+
+    ledger = l;
+    if (loadLedger(!(env && env[0])) < 0) {
+        ledger = NULL;
+        munmap(p, sizeof(QuotaLedger));
+        return -1;
+    }
+    return 1;
+}
+
+// ------------------------------------------------------------
+// Changes
+// ------------------------------------------------------------
+// Forget a session that died inside its bracket (and its reservation)
+static void pruneInflight(QuotaUser *u)
+{
+    for (int i = 0; i < QUOTA_INFLIGHT; i++) {
+        QuotaInflight *f = &u->inflight[i];
+        if (f->pid > 0 && kill(f->pid, 0) < 0 && errno == ESRCH) {
+            u->reserved -= f->reserved;
+            f->pid = 0;
+            f->reserved = 0;
+        }
+    }
+}
+
+int quotaBegin(QuotaChange *c, const char *homeDir, long long growth)
+{
+    c->user = -1;
+    c->slot = -1;
+    if (!ledger)
+        return 0;
+
+    char name[QUOTA_NAME_SIZE];
+    if (userOfHome(homeDir, name, sizeof(name)) < 0)
+        return 0;
+    if (growth < 0)
+        growth = 0;
+
+    lockLedger();
+    int row = findUser(name);
+    if (row < 0) {
+        unlockLedger();
+        return 0;
+    }
+
+    // Not measured yet: nothing to hold the growth against
+    QuotaUser *u = &ledger->users[row];
+    if (growth > 0 && u->used >= 0 && u->used + u->reserved + growth > u->limit) {
+        pruneInflight(u);
+        if (u->used + u->reserved + growth > u->limit) {
+            ledger->counters.rejections++;
+            unlockLedger();
+            return -1;
+        }
+    }
+
+    u->changes++;
+    for (int pass = 0; pass < 2 && c->slot < 0; pass++) {
+        if (pass == 1)
+            pruneInflight(u);
+        for (int i = 0; i < QUOTA_INFLIGHT && c->slot < 0; i++) {
+            if (u->inflight[i].pid == 0) {
+                u->inflight[i].pid      = getpid();
+                u->inflight[i].reserved = growth;
+                u->reserved += growth;
+                c->slot = i;
+            }
+        }
+    }
+    unlockLedger();
+    c->user = row;
+    return 0;
+}
+
+void quotaApply(QuotaChange *c, long long bytes)
+{
+    if (c->user < 0 || bytes == 0)
+        return;
+
+    lockLedger();
+    QuotaUser *u = &ledger->users[c->user];
+    if (u->used >= 0) {
+        u->used += bytes;
+        if (u->used < 0) {
+            u->used    = 0;
+            u->stale   = 1;
+            u->staleAt = statsNow();
+        }
+    }
+    ledger->version++;
+    unlockLedger();
+}
+
+void quotaDrop(QuotaChange *c)
+{
+    if (c->user < 0)
+        return;
+
+    lockLedger();
+    ledger->users[c->user].stale   = 1;
+    ledger->users[c->user].staleAt = statsNow();
+    unlockLedger();
+}
+
+void quotaEnd(QuotaChange *c)
+{
+    if (c->user < 0)
+        return;
+
+    lockLedger();
+    QuotaUser *u = &ledger->users[c->user];
+    if (c->slot >= 0 && u->inflight[c->slot].pid == getpid()) {
+        u->reserved -= u->inflight[c->slot].reserved;
+        u->inflight[c->slot].pid      = 0;
+        u->inflight[c->slot].reserved = 0;
+    } else if (c->slot < 0) {
+        // Not tracked: a walk may have raced the change
+        u->stale   = 1;
+        u->staleAt = statsNow();
+    }
+    u->changes++;
+    ledger->version++;
+    unlockLedger();
+    c->user = -1;
+}
+
+int quotaLimited(const char *homeDir)
+{
+    char name[QUOTA_NAME_SIZE];
+    if (!ledger || userOfHome(homeDir, name, sizeof(name)) < 0)
+        return 0;
+
+    lockLedger();
+    int row = findUser(name);
+    unlockLedger();
+    return row >= 0;
+}
+
+// ------------------------------------------------------------
+// Admin and metrics
+// ------------------------------------------------------------
+int quotaSet(const char *user, long long limit)
+{
+    if (!ledger || !user[0] || strlen(user) >= QUOTA_NAME_SIZE)
+        return -1;
+
+    int rc = 0;
+    lockLedger();
+    int row = findUser(user);
+    if (limit < 0) {
+        // Rows of sessions still inside a bracket stay valid until reused
+        if (row >= 0)
+            ledger->users[row].inUse = 0;
+    } else if (row >= 0) {
+        ledger->users[row].limit = limit;
+    } else {
+        for (int i = 0; i < QUOTA_USERS && row < 0; i++) {
+            QuotaUser *u = &ledger->users[i];
+            int busy = 0;
+            for (int k = 0; k < QUOTA_INFLIGHT; k++)
+                busy |= u->inflight[k].pid > 0 &&
+                        !(kill(u->inflight[k].pid, 0) < 0 && errno == ESRCH);
+            if (u->inUse || busy)
+                continue;
+
+            memset(u, 0, sizeof(*u));
+            u->inUse = 1;
+            snprintf(u->name, sizeof(u->name), "%s", user);
+            u->limit   = limit;
+            u->used    = -1;
+            u->stale   = 1;
+            u->staleAt = 0;
+            row = i;
+        }
+        if (row < 0)
+            rc = -1;
+    }
+    ledger->version++;
+    unlockLedger();
+    return rc;
+}
+
+int quotaSnapshot(QuotaRow *rows, int max, QuotaCounters *counters)
+{
+    if (!ledger)
+        return -1;
+
+    int n = 0;
+    lockLedger();
+    for (int i = 0; i < QUOTA_USERS && n < max; i++) {
+        const QuotaUser *u = &ledger->users[i];
+        if (!u->inUse)
+            continue;
+        snprintf(rows[n].name, sizeof(rows[n].name), "%s", u->name);
+        rows[n].limit        = u->limit;
+        rows[n].used         = u->used;
+        rows[n].reserved     = u->reserved;
+        rows[n].reconciledAt = u->reconciledAt;
+        n++;
+    }
+    if (counters)
+        *counters = ledger->counters;
+    unlockLedger();
+    return n;
+}
+
+// ------------------------------------------------------------
+// Reconciliation (quota process, as root)
+// ------------------------------------------------------------
+// Apparent size of the regular files below dirFd (closed here)
+static long long walkBytes(int dirFd)
+{
+    DIR *d = fdopendir(dirFd);
+    if (!d) {
+        close(dirFd);
+        return 0;
+    }
+
+    long long bytes = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        const char *name = e->d_name;
+
+        // Skip ".", ".." and internal ".lock" files
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            strstr(name, ".lock") != NULL)
+            continue;
+
+        struct stat st;
+        if (fstatat(dirfd(d), name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            continue;
+        if (S_ISREG(st.st_mode)) {
+            bytes += (long long)st.st_size;
+        } else if (S_ISDIR(st.st_mode)) {
+            int sub = openat(dirfd(d), name,
+                             O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (sub >= 0)
+                bytes += walkBytes(sub);
+        }
+    }
+    closedir(d);
+    return bytes;
+}
+
+static void reconcile(int row)
+{
+    char name[QUOTA_NAME_SIZE];
+    uint64_t mark;
+
+    lockLedger();
+    QuotaUser *u = &ledger->users[row];
+    pruneInflight(u);
+    int busy = 0;
+    for (int i = 0; i < QUOTA_INFLIGHT; i++)
+        busy |= u->inflight[i].pid > 0;
+    if (!u->inUse || busy) {
+        unlockLedger();
+        return;
+    }
+    snprintf(name, sizeof(name), "%s", u->name);
+    mark = u->changes;
+    unlockLedger();
+
+    // A deleted home uses nothing
+    char home[PATH_MAX];
+    snprintf(home, sizeof(home), "%s/%s", gRootDir, name);
+    int fd = open(home, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    uint64_t t0 = statsNow();
+    long long bytes = fd >= 0 ? walkBytes(fd) : 0;
+    double ms = (double)(statsNow() - t0) / 1e6;
+
+    lockLedger();
+    if (u->inUse && strcmp(u->name, name) == 0 && u->changes == mark) {
+        long long before = u->used;
+        if (before >= 0)
+            ledger->counters.corrected += (uint64_t)llabs(bytes - before);
+        u->used         = bytes;
+        u->stale        = 0;
+        u->reconciledAt = time(NULL);
+        ledger->counters.reconciles++;
+        ledger->version++;
+        unlockLedger();
+
+        if (before >= 0 && before != bytes)
+            logInfo("[QUOTA] '%s': ledger %lld -> %lld bytes (walked in %.1f ms)",
+                    name, before, bytes, ms);
+        return;
+    }
+    unlockLedger();
+}
+
+static void handleQuotaStop(int sig)
+{
+    (void)sig;
+    quotaStop = 1;
+}
+
+void quotaServe(pid_t parentPid)
+{
+    // CTRL+C goes to the whole group, the main process stops us
+    signal(SIGINT, SIG_IGN);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleQuotaStop;
+    sigaction(SIGTERM, &sa, NULL);
+
+    // Reconciliation reads every user's home
+    if (getuid() == 0 && seteuid(0) != 0)
+        logWarn("[QUOTA] seteuid(0) failed: %s", strerror(errno));
+
+    int interval = QUOTA_RECONCILE;
+    const char *env = getenv("FILESERVER_QUOTA_RECONCILE");
+    if (env && atoi(env) > 0)
+        interval = atoi(env);
+
+    uint64_t saved = (uint64_t)-1;
+    while (!quotaStop && getppid() == parentPid) {
+        time_t   now = time(NULL);
+        uint64_t ns  = statsNow();
+
+        for (int i = 0; i < QUOTA_USERS; i++) {
+            lockLedger();
+            QuotaUser *u = &ledger->users[i];
+            int due = u->inUse &&
+                      ((u->stale && ns - u->staleAt >= (uint64_t)QUOTA_DIRTY_DELAY * 1000000000ULL) ||
+                       now - u->reconciledAt >= interval);
+            unlockLedger();
+            if (due)
+                reconcile(i);
+        }
+
+        lockLedger();
+        uint64_t version = ledger->version;
+        unlockLedger();
+        if (version != saved) {
+            if (saveLedger() == 0)
+                saved = version;
+            else
+                logWarn("[QUOTA] Cannot save '%s': %s", ledgerPath, strerror(errno));
+        }
+
+        sleep(1);
+    }
+
+    saveLedger();
+    _exit(0);
+}
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -12,6 +14,7 @@
 #include <ctype.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <limits.h>
 
 #include "../../include/serverCommands.h"
 #include "../../include/protocol.h"
@@ -19,6 +22,20 @@
 #include "../../include/utils.h"
 #include "../../include/fsOps.h"
 #include "../../include/network.h"
+#include "../../include/payload.h"
+#include "../../include/archive.h"
+#include "../../include/sparse.h"
+#include "../../include/stats.h"
+#include "../../include/log.h"
+#include "../../include/trace.h"
+#include "../../include/capture.h"
+#include "../../include/mdCache.h"
+#include "../../include/watch.h"
+#include "../../include/find.h"
+#include "../../include/du.h"
+#include "../../include/quota.h"
+#include "../../include/fileCache.h"
+#include "../../include/sessionTable.h"
 
 // Global server root directory
 extern const char *gRootDir;
@@ -31,18 +48,22 @@ extern const char *gRootDir;
 // ================================================================
 static inline void debugWhoAmI(const char *where)
 {
-    printf("[WHOAMI] %-20s | ruid=%d euid=%d rgid=%d egid=%d\n",
-           where,
-           getuid(), geteuid(),
-           getgid(), getegid());
-    fflush(stdout);
+    logDebug("[WHOAMI] %-20s | ruid=%d euid=%d rgid=%d egid=%d",
+             where,
+             getuid(), geteuid(),
+             getgid(), getegid());
 }
 
 // ================================================================
 // Helper: send simple response to client
 // ================================================================
+// Last status sent in this process (recorded per command in stats)
+static int lastStatus = STATUS_OK;
+
 static void sendStatus(int clientFd, int status, int dataSize)
 {
+    lastStatus = status;
+
     ProtocolResponse res;
     res.status   = status;
     res.dataSize = dataSize;
@@ -61,6 +82,25 @@ static void sendErrorMsg(int clientFd)
     sendStatus(clientFd, STATUS_ERROR, 0);
 }
 
+// Send STATUS_QUOTA
+static void sendQuotaExceeded(int clientFd)
+{
+    sendStatus(clientFd, STATUS_QUOTA, 0);
+}
+
+// Receive and discard a request body that was refused
+static int discardPayload(int clientFd, int size)
+{
+    char buf[16384];
+    while (size > 0) {
+        int n = size < (int)sizeof(buf) ? size : (int)sizeof(buf);
+        if (recvPayload(clientFd, buf, n) < 0)
+            return -1;
+        size -= n;
+    }
+    return 0;
+}
+
 // ================================================================
 // Session / debug helpers
 // ================================================================
@@ -69,8 +109,7 @@ static void sendErrorMsg(int clientFd)
 static int ensureLoggedIn(int clientFd, Session *session, const char *cmdName)
 {
     if (!session->isLoggedIn) {
-        printf("[%s] ERROR: user not logged in (please login first)\n", cmdName);
-        fflush(stdout);
+        logWarn("[%s] ERROR: user not logged in (please login first)", cmdName);
         sendErrorMsg(clientFd);
         return 0;
     }
@@ -82,27 +121,32 @@ static int ensureLoggedIn(int clientFd, Session *session, const char *cmdName)
 // nicer to see evrything that is happening between server and client
 static void debugCommand(const char *name, ProtocolMessage *msg, Session *s)
 {
-    printf("[%s] cmd=%d, arg1='%s', arg2='%s', arg3='%s', loggedIn=%d\n",
-           name,
-           msg->command,
-           msg->arg1,
-           msg->arg2,
-           msg->arg3,
-           s ? s->isLoggedIn : -1);
-    fflush(stdout);
+    logDebug("[%s] cmd=%d, arg1='%s', arg2='%s', arg3='%s', loggedIn=%d",
+             name,
+             msg->command,
+             msg->arg1,
+             msg->arg2,
+             msg->arg3,
+             s ? s->isLoggedIn : -1);
 }
 
 // ================================================================
 // Privilege helpers: temporary root only when required
 // ================================================================
 
+// In-process harnesses run handlers with their own identity
+int gHandlerTestMode = 0;
+
 // Temporarily elevate effective UID to root
 static int elevateToRoot(uid_t *old_euid)
 {
     *old_euid = geteuid();
 
+    if (gHandlerTestMode)
+        return 0;
+
     if (seteuid(0) != 0) {
-        perror("[PRIV] ERROR: seteuid(0) failed (server not started with sudo)");
+        logError("[PRIV] ERROR: seteuid(0) failed (server not started with sudo): %s", strerror(errno));
         return -1;
     }
     return 0;
@@ -111,8 +155,11 @@ static int elevateToRoot(uid_t *old_euid)
 // Drop root privileges and restore previous effective UID
 static void dropFromRoot(uid_t old_euid)
 {
+    if (gHandlerTestMode)
+        return;
+
     if (seteuid(old_euid) != 0) {
-        perror("[PRIV] ERROR: failed to drop root privileges");
+        logError("[PRIV] ERROR: failed to drop root privileges: %s", strerror(errno));
     }
 }
 
@@ -123,6 +170,10 @@ static int becomeLoggedUser(const char *username)
 {
     uid_t old_euid;
 
+    // Test mode: the session keeps the harness identity
+    if (gHandlerTestMode)
+        return 0;
+
     // Temporarily become root to change identity
     if (elevateToRoot(&old_euid) < 0) {
         return -1;
@@ -141,7 +192,7 @@ static int becomeLoggedUser(const char *username)
     // Set effective group ID
     // From now on process that is representing user on server side is inside csapgroup
     if (setegid(grp->gr_gid) != 0) {
-        perror("[LOGIN] setegid failed");
+        logError("[LOGIN] setegid failed: %s", strerror(errno));
         dropFromRoot(old_euid);
         return -1;
     }
@@ -149,7 +200,7 @@ static int becomeLoggedUser(const char *username)
     // Initialize supplementary groups for user
     // It works without sometimes but there is chance it can fail if we don't init all other gruops of user
     if (initgroups(username, grp->gr_gid) != 0) {
-        perror("[LOGIN] initgroups failed");
+        logError("[LOGIN] initgroups failed: %s", strerror(errno));
         dropFromRoot(old_euid);
         return -1;
     }
@@ -157,7 +208,7 @@ static int becomeLoggedUser(const char *username)
     // Drop privileges to logged-in user
     // So now we are sure that this server-child process has only premission of logged user
     if (seteuid(pwd->pw_uid) != 0) {
-        perror("[LOGIN] seteuid(user) failed");
+        logError("[LOGIN] seteuid(user) failed: %s", strerror(errno));
         dropFromRoot(old_euid);
         return -1;
     }
@@ -168,7 +219,7 @@ static int becomeLoggedUser(const char *username)
 // ================================================================
 // COMMAND DISPATCHER
 // ================================================================
-int processCommand(int clientFd, ProtocolMessage *msg, Session *session)
+static int dispatchCommand(int clientFd, ProtocolMessage *msg, Session *session)
 {
     switch (msg->command)
     {
@@ -205,25 +256,80 @@ int processCommand(int clientFd, ProtocolMessage *msg, Session *session)
         case CMD_DELETE:
             return handleDelete(clientFd, msg, session);
 
+        case CMD_COPY:
+            return handleCopy(clientFd, msg, session);
+
         case CMD_UPLOAD:
             return handleUpload(clientFd, msg, session);
 
         case CMD_DOWNLOAD:
             return handleDownload(clientFd, msg, session);
 
+        case CMD_UPLOAD_TREE:
+            return handleUploadTree(clientFd, msg, session);
+
+        case CMD_DOWNLOAD_TREE:
+            return handleDownloadTree(clientFd, msg, session);
+
+        case CMD_COMPRESS:
+            return handleCompress(clientFd, msg, session);
+
+        case CMD_STATS:
+            return handleStats(clientFd, msg, session);
+
+        case CMD_WATCH:
+            return handleWatch(clientFd, msg, session);
+
+        case CMD_FIND:
+            return handleFind(clientFd, msg, session);
+
+        case CMD_DU:
+            return handleDu(clientFd, msg, session);
+
+        case CMD_STAT_MANY:
+            return handleStatMany(clientFd, msg, session);
+
+        case CMD_BATCH:
+            return handleBatch(clientFd, msg, session);
+
         case CMD_EXIT:
             // Signal server loop to close connection
             return 1;
 
         default:
             // Unknown command
-            printf("[DISPATCH] ERROR: unknown command id %d\n", msg->command);
-            fflush(stdout);
+            logWarn("[DISPATCH] ERROR: unknown command id %d", msg->command);
             sendErrorMsg(clientFd);
             return 0;
     }
 }
 
+// Time every dispatch and record it in the shared statistics
+int processCommand(int clientFd, ProtocolMessage *msg, Session *session)
+{
+    unsigned long long inBefore, outBefore, inAfter, outAfter;
+    getTrafficCounters(&inBefore, &outBefore);
+
+    lastStatus = STATUS_OK;
+    statsCommandStart(msg->command);
+    sessionTableCommandStart(msg->command, msg->arg1);
+    traceRequestStart(msg->command);
+    captureRequestStart(msg->arg1, msg->arg2, msg->arg3, msg->command);
+    uint64_t start = statsNow();
+
+    int rc = dispatchCommand(clientFd, msg, session);
+
+    uint64_t elapsed = statsNow() - start;
+    getTrafficCounters(&inAfter, &outAfter);
+
+    statsRecordCommand(msg->command, lastStatus, elapsed,
+                       inAfter - inBefore, outAfter - outBefore);
+    traceRequestEnd(msg->arg1, lastStatus, inAfter - inBefore, outAfter - outBefore);
+    captureRequestEnd(lastStatus, inAfter - inBefore, outAfter - outBefore);
+    sessionTableCommandEnd(session);
+    return rc;
+}
+
 // ================================================================
 // LOGIN HANDLER
 // ================================================================
@@ -234,14 +340,14 @@ int handleLogin(int clientFd, ProtocolMessage *msg, Session *session)
     // Prevent double login
     // This dosen't mean that you can't login to same user on diff terminal
     if (session->isLoggedIn) {
-        printf("[LOGIN] ERROR: already logged in.\n");
+        logWarn("[LOGIN] ERROR: already logged in.");
         sendErrorMsg(clientFd);
         return 0;
     }
 
     // Username must be provided
     if (msg->arg1[0] == '\0') {
-        printf("[LOGIN] ERROR: missing username.\n");
+        logWarn("[LOGIN] ERROR: missing username.");
         sendErrorMsg(clientFd);
         return 0;
     }
@@ -267,7 +373,7 @@ int handleLogin(int clientFd, ProtocolMessage *msg, Session *session)
     // This should only happen if we delete virtual home directory of user 
     // but we don't delete real system user
     if (!exists) {
-        printf("[LOGIN] ERROR: no such user dir '%s'\n", homePath);
+        logWarn("[LOGIN] ERROR: no such user dir '%s'", homePath);
         sendErrorMsg(clientFd);
         return 0;
     }
@@ -279,7 +385,7 @@ int handleLogin(int clientFd, ProtocolMessage *msg, Session *session)
     // Switch THIS child process to the logged-in user
     // ------------------------------------------------------------
     if (becomeLoggedUser(session->username) < 0) {
-        printf("[LOGIN] ERROR: cannot switch to user '%s'\n", session->username);
+        logWarn("[LOGIN] ERROR: cannot switch to user '%s'", session->username);
 
         // Roll back session state
         session->isLoggedIn    = 0;
@@ -291,8 +397,13 @@ int handleLogin(int clientFd, ProtocolMessage *msg, Session *session)
         return 0;
     }
 
-    printf("[LOGIN] OK user='%s' (euid=%d egid=%d)\n",
-           session->username, (int)geteuid(), (int)getegid());
+    // Directory fds for *at() path walks (plain paths if this fails)
+    if (fsOpenSessionDirs(session) < 0)
+        logWarn("[LOGIN] Cannot open session directories for '%s': %s",
+                session->username, strerror(errno));
+
+    logInfo("[LOGIN] OK user='%s' (euid=%d egid=%d)",
+            session->username, (int)geteuid(), (int)getegid());
 
     sendOk(clientFd, 0);
     return 0;
@@ -414,6 +525,8 @@ int handleCreateUser(int clientFd, ProtocolMessage *msg, Session *session)
     // ------------------------------------------------------------
     // Create virtual home directory
     // ------------------------------------------------------------
+    DuChange du;
+    duChangeBegin(&du, homePath);
     if (!error) {
         if (mkdir(homePath, (mode_t)permissions) < 0) {
             error = 1;
@@ -455,7 +568,10 @@ int handleCreateUser(int clientFd, ProtocolMessage *msg, Session *session)
                 waitpid(pid, NULL, 0);
             }
         }
+    } else {
+        duChangeApply(&du, homePath, 0, 0, 1);
     }
+    duChangeEnd(&du);
 
     // ------------------------------------------------------------
     // Drop root privileges
@@ -467,7 +583,7 @@ int handleCreateUser(int clientFd, ProtocolMessage *msg, Session *session)
         return 0;
     }
 
-    printf("[CREATE_USER] OK '%s' perms=%o\n", username, permissions);
+    logInfo("[CREATE_USER] OK '%s' perms=%o", username, permissions);
     sendOk(clientFd, 0);
     return 0;
 }
@@ -475,6 +591,30 @@ int handleCreateUser(int clientFd, ProtocolMessage *msg, Session *session)
 // ================================================================
 // CREATE FILE OR DIRECTORY
 // ================================================================
+// Create pathArg with permissions; STATUS_OK or STATUS_ERROR
+static int createPath(Session *session, const char *pathArg, int permissions, int isDir)
+{
+    // Resolve absolute filesystem path
+    char fullPath[PATH_SIZE];
+    if (resolvePath(session, pathArg, fullPath) < 0)
+        return STATUS_ERROR;
+
+    // Security check: must be inside user's home directory
+    // (an existing target makes the O_EXCL / mkdir below fail)
+    if (!isInsideHome(session->homeDir, fullPath))
+        return STATUS_ERROR;
+
+    // Create file or directory
+    DuChange du;
+    duChangeBegin(&du, session->homeDir);
+    int rc = fsCreate(session, fullPath, permissions, isDir);
+    if (rc == 0)
+        duChangeApply(&du, fullPath, 0, !isDir, isDir);
+    duChangeEnd(&du);
+
+    return rc < 0 ? STATUS_ERROR : STATUS_OK;
+}
+
 int handleCreate(int clientFd, ProtocolMessage *msg, Session *session)
 {
     debugCommand("CREATE", msg, session);
@@ -501,232 +641,187 @@ int handleCreate(int clientFd, ProtocolMessage *msg, Session *session)
 
     // Must be valid octal value
     if (*endptr != '\0' || perms < 0 || perms > 0777) {
-        printf("[CREATE] invalid permissions: %s\n", permArg);
+        logWarn("[CREATE] invalid permissions: %s", permArg);
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    int permissions = (int)perms;
-
     // ============================================
     // CHECK IF DIRECTORY FLAG IS SET
     // ============================================
     // "-d" means directory, otherwise create file
     int isDir = (strcmp(typeArg, "-d") == 0);
 
-    // Resolve absolute filesystem path
-    char fullPath[PATH_SIZE];
-    if (resolvePath(session, pathArg, fullPath) < 0) {
-        sendErrorMsg(clientFd);
-        return 0;
-    }
-
-    // Security checks:
-    // must be inside user's home directory
-    // target must not already exist
-    if (!isInsideHome(session->homeDir, fullPath) || fileExists(fullPath)) {
-        sendErrorMsg(clientFd);
-        return 0;
-    }
-
-    // Create file or directory
-    if (fsCreate(fullPath, permissions, isDir) < 0) {
-        sendErrorMsg(clientFd);
-        return 0;
-    }
-
-    // Success
-    sendOk(clientFd, 0);
+    sendStatus(clientFd, createPath(session, pathArg, (int)perms, isDir), 0);
     return 0;
 }
 
 // ================================================================
 // CHMOD
 // ================================================================
-int handleChmod(int clientFd, ProtocolMessage *msg, Session *session)
+// Change the permissions of pathArg; *oldMode (if not NULL) gets the
+// previous ones. STATUS_OK or STATUS_ERROR
+static int chmodPath(Session *session, const char *pathArg, int permissions,
+                     mode_t *oldMode)
 {
-    debugCommand("CHMOD", msg, session);
-
-    // User must be logged in
-    if (!ensureLoggedIn(clientFd, session, "CHMOD")) {
-        printf("[CHMOD DEBUG] Not logged in\n");
-        return 0;
-    }
-
-    // Arguments must exist
-    if (msg->arg1[0] == '\0' || msg->arg2[0] == '\0') {
-        printf("[CHMOD DEBUG] Missing arguments\n");
-        sendErrorMsg(clientFd);
-        return 0;
-    }
-
-    // Validate permissions (octal 0–777)
-    char *endptr = NULL;
-    long perms = strtol(msg->arg2, &endptr, 8);
-
-    if (endptr == msg->arg2 || *endptr != '\0' ||
-        perms < 0 || perms > 0777) {
-        printf("[CHMOD DEBUG] Invalid permissions: %s\n", msg->arg2);
-        sendErrorMsg(clientFd);
-        return 0;
-    }
-
-    int permissions = (int)perms;
-    printf("[CHMOD DEBUG] Permissions parsed: %o\n", permissions);
-
     // Resolve full path
     char fullPath[PATH_SIZE];
-    if (resolvePath(session, msg->arg1, fullPath) < 0) {
-        printf("[CHMOD DEBUG] resolvePath failed for: %s\n", msg->arg1);
-        sendErrorMsg(clientFd);
-        return 0;
+    if (resolvePath(session, pathArg, fullPath) < 0) {
+        logDebug("[CHMOD] resolvePath failed for: %s", pathArg);
+        return STATUS_ERROR;
     }
 
-    printf("[CHMOD DEBUG] Resolved path: %s\n", fullPath);
-    printf("[CHMOD DEBUG] Home dir: %s\n", session->homeDir);
+    logDebug("[CHMOD] Resolved path: %s", fullPath);
+    logDebug("[CHMOD] Home dir: %s", session->homeDir);
 
     // Path must be inside user's home directory
     if (!isInsideHome(session->homeDir, fullPath)) {
-        printf("[CHMOD DEBUG] Not inside home: %s\n", fullPath);
-        sendErrorMsg(clientFd);
-        return 0;
+        logDebug("[CHMOD] Not inside home: %s", fullPath);
+        return STATUS_ERROR;
     }
 
-    printf("[CHMOD DEBUG] Inside home: OK\n");
+    logDebug("[CHMOD] Inside home: OK");
 
     // Target must exist
-    if (!fileExists(fullPath)) {
-        printf("[CHMOD DEBUG] File doesn't exist: %s\n", fullPath);
-        sendErrorMsg(clientFd);
-        return 0;
+    struct stat st;
+    if (fsStat(session, fullPath, &st) < 0) {
+        logDebug("[CHMOD] File doesn't exist: %s", fullPath);
+        return STATUS_ERROR;
     }
 
-    printf("[CHMOD DEBUG] File exists: OK\n");
+    logDebug("[CHMOD] File exists: OK");
+    if (oldMode)
+        *oldMode = st.st_mode & 0777;
 
     // Protect server root directory
     if (strcmp(fullPath, gRootDir) == 0) {
-        printf("[CHMOD DEBUG] Cannot modify server root\n");
-        sendErrorMsg(clientFd);
-        return 0;
+        logDebug("[CHMOD] Cannot modify server root");
+        return STATUS_ERROR;
     }
 
-    printf("[CHMOD DEBUG] Not server root: OK\n");
+    logDebug("[CHMOD] Not server root: OK");
 
     // Check if it's a directory
-    struct stat st;
-    if (stat(fullPath, &st) < 0) {
-        printf("[CHMOD DEBUG] stat failed\n");
-        sendErrorMsg(clientFd);
-        return 0;
-    }
-
     int isDirectory = S_ISDIR(st.st_mode);
     
     if (isDirectory) {
         
-        printf("[CHMOD DEBUG] Target is a directory\n");
-        int rc = fsChmod(fullPath, permissions);
-        printf("[CHMOD DEBUG] fsChmod returned: %d\n", rc);
+        logDebug("[CHMOD] Target is a directory");
+        // Who may enter it changes: indexed totals of other users are stale
+        DuChange du;
+        duChangeBegin(&du, session->homeDir);
+        int rc = fsChmod(session, fullPath, permissions);
+        logDebug("[CHMOD] fsChmod returned: %d", rc);
+        if (rc == 0)
+            duChangeDrop(&du);
+        duChangeEnd(&du);
         
         if (rc < 0) {
-            printf("[CHMOD DEBUG] fsChmod failed\n");
-            sendErrorMsg(clientFd);
-            return 0;
+            logDebug("[CHMOD] fsChmod failed");
+            return STATUS_ERROR;
         }
         
-        printf("[CHMOD DEBUG] Directory chmod success\n");
-        sendOk(clientFd, 0);
-        return 0;
+        logDebug("[CHMOD] Directory chmod success");
+        return STATUS_OK;
     }
     
     // Fajl: treba lock
-    printf("[CHMOD DEBUG] Target is a file, locking...\n");
+    logDebug("[CHMOD] Target is a file, locking...");
     
     // Open file to lock it
-    int fd = open(fullPath, O_RDWR);
+    int fd = fsOpen(session, fullPath, O_RDWR, 0);
     if (fd < 0) {
-        printf("[CHMOD DEBUG] Cannot open file for locking\n");
-        sendErrorMsg(clientFd);
-        return 0;
+        logDebug("[CHMOD] Cannot open file for locking");
+        return STATUS_ERROR;
     }
 
     // Acquire exclusive lock
     if (lockFileWrite(fd) < 0) {
-        printf("[CHMOD DEBUG] lockFileWrite failed for: %s\n", fullPath);
+        logDebug("[CHMOD] lockFileWrite failed for: %s", fullPath);
         close(fd);
-        sendErrorMsg(clientFd);
-        return 0;
+        return STATUS_ERROR;
     }
 
-    printf("[CHMOD DEBUG] File locked: OK\n");
+    logDebug("[CHMOD] File locked: OK");
 
     // Perform chmod as logged-in user (no root)
-    printf("[CHMOD DEBUG] Calling fsChmod(%s, %o)\n", fullPath, permissions);
-    int rc = fsChmod(fullPath, permissions);
-    printf("[CHMOD DEBUG] fsChmod returned: %d\n", rc);
+    logDebug("[CHMOD] Calling fsChmod(%s, %o)", fullPath, permissions);
+    int rc = fsChmod(session, fullPath, permissions);
+    logDebug("[CHMOD] fsChmod returned: %d", rc);
 
     // Release lock and close
     unlockFile(fd);
     close(fd);
-    printf("[CHMOD DEBUG] File unlocked\n");
+    logDebug("[CHMOD] File unlocked");
 
     // Check result
     if (rc < 0) {
-        printf("[CHMOD DEBUG] fsChmod failed\n");
-        sendErrorMsg(clientFd);
-        return 0;
+        logDebug("[CHMOD] fsChmod failed");
+        return STATUS_ERROR;
     }
 
     // Success
-    printf("[CHMOD DEBUG] Success! Sending OK to client\n");
-    sendOk(clientFd, 0);
-    return 0;
+    logDebug("[CHMOD] Success");
+    return STATUS_OK;
 }
 
-// ================================================================
-// MOVE (rename / move file or directory)
-// ================================================================
-int handleMove(int clientFd, ProtocolMessage *msg, Session *session)
+int handleChmod(int clientFd, ProtocolMessage *msg, Session *session)
 {
-    debugCommand("MOVE", msg, session);
+    debugCommand("CHMOD", msg, session);
 
     // User must be logged in
-    if (!ensureLoggedIn(clientFd, session, "MOVE"))
+    if (!ensureLoggedIn(clientFd, session, "CHMOD")) {
+        logDebug("[CHMOD] Not logged in");
         return 0;
+    }
 
-    char src[PATH_SIZE], dst[PATH_SIZE];
-
-    // Both source and destination arguments must exist
-    if (!msg->arg1[0] || !msg->arg2[0]) {
+    // Arguments must exist
+    if (msg->arg1[0] == '\0' || msg->arg2[0] == '\0') {
+        logDebug("[CHMOD] Missing arguments");
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    // Resolve absolute paths
-    if (resolvePath(session, msg->arg1, src) < 0 ||
-        resolvePath(session, msg->arg2, dst) < 0) {
+    // Validate permissions (octal 0–777)
+    char *endptr = NULL;
+    long perms = strtol(msg->arg2, &endptr, 8);
+
+    if (endptr == msg->arg2 || *endptr != '\0' ||
+        perms < 0 || perms > 0777) {
+        logDebug("[CHMOD] Invalid permissions: %s", msg->arg2);
         sendErrorMsg(clientFd);
         return 0;
     }
 
+    logDebug("[CHMOD] Permissions parsed: %o", (int)perms);
+
+    sendStatus(clientFd, chmodPath(session, msg->arg1, (int)perms, NULL), 0);
+    return 0;
+}
+
+// ================================================================
+// MOVE (rename / move file or directory)
+// ================================================================
+// Move srcArg to dstArg (which must not exist); STATUS_OK or STATUS_ERROR
+static int movePath(Session *session, const char *srcArg, const char *dstArg)
+{
+    char src[PATH_SIZE], dst[PATH_SIZE];
+
+    // Resolve absolute paths
+    if (resolvePath(session, srcArg, src) < 0 ||
+        resolvePath(session, dstArg, dst) < 0)
+        return STATUS_ERROR;
+
     //    Security checks:
     //    both paths must be inside user's home
     //    source must exist
     //    destination must NOT exist
+    struct stat st_src, st_dst;
     if (!isInsideHome(session->homeDir, src) ||
         !isInsideHome(session->homeDir, dst) ||
-        !fileExists(src) ||
-        fileExists(dst)) {
-        sendErrorMsg(clientFd);
-        return 0;
-    }
-
-    // Check if source is a directory
-    struct stat st_src;
-    if (stat(src, &st_src) < 0) {
-        sendErrorMsg(clientFd);
-        return 0;
-    }
+        fsStat(session, src, &st_src) < 0 ||
+        fsStat(session, dst, &st_dst) == 0)
+        return STATUS_ERROR;
     
     int src_is_file = S_ISREG(st_src.st_mode);
     int fd_src = -1;
@@ -735,20 +830,31 @@ int handleMove(int clientFd, ProtocolMessage *msg, Session *session)
     
     if (src_is_file) {
         // Fail: lock source file
-        fd_src = open(src, O_RDONLY);
+        fd_src = fsOpen(session, src, O_RDONLY, 0);
         if (fd_src >= 0) {
             lockFileWrite(fd_src);
+            fstat(fd_src, &st_src);    // Size under the lock
         }
         
         snprintf(lock_dst_path, sizeof(lock_dst_path), "%s.lock", dst);
-        fd_dst_lock = open(lock_dst_path, O_CREAT | O_RDWR, 0700);
+        fd_dst_lock = fsOpen(session, lock_dst_path, O_CREAT | O_RDWR, 0700);
         if (fd_dst_lock >= 0) {
             lockFileWrite(fd_dst_lock);
         }
     }
 
-    // Perform move / rename
-    int ok = fsMove(src, dst);
+    // Perform move / rename. A moved file is a size delta; indexed
+    // totals below a moved directory would keep their old paths
+    DuChange du;
+    duChangeBegin(&du, session->homeDir);
+    int ok = fsMove(session, src, dst);
+    if (ok == 0 && src_is_file) {
+        duChangeApply(&du, src, -(long long)st_src.st_size, -1, 0);
+        duChangeApply(&du, dst, (long long)st_src.st_size, 1, 0);
+    } else if (ok == 0 && S_ISDIR(st_src.st_mode)) {
+        duChangeDrop(&du);
+    }
+    duChangeEnd(&du);
 
     // Release locks if we locked them
     if (fd_src >= 0) {
@@ -759,17 +865,27 @@ int handleMove(int clientFd, ProtocolMessage *msg, Session *session)
         unlockFile(fd_dst_lock);
         close(fd_dst_lock);
         // Obriši .lock fajl (ne destinaciju!)
-        unlink(lock_dst_path);
+        fsUnlink(session, lock_dst_path);
     }
 
-    // Check result
-    if (ok < 0) {
+    return ok < 0 ? STATUS_ERROR : STATUS_OK;
+}
+
+int handleMove(int clientFd, ProtocolMessage *msg, Session *session)
+{
+    debugCommand("MOVE", msg, session);
+
+    // User must be logged in
+    if (!ensureLoggedIn(clientFd, session, "MOVE"))
+        return 0;
+
+    // Both source and destination arguments must exist
+    if (!msg->arg1[0] || !msg->arg2[0]) {
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    // Success
-    sendOk(clientFd, 0);
+    sendStatus(clientFd, movePath(session, msg->arg1, msg->arg2), 0);
     return 0;
 }
 
@@ -789,13 +905,16 @@ int handleCd(int clientFd, ProtocolMessage *msg, Session *session)
     // No argument: go to home directory
     if (msg->arg1[0] == '\0') {
         // Update session current directory to home
-        strncpy(session->currentDir, session->homeDir, PATH_SIZE);
+        if (fsChdir(session, session->homeDir) < 0) {
+            sendErrorMsg(clientFd);
+            return 0;
+        }
 
         // Send "/" as display path
         char displayPath[PATH_SIZE] = "/";
         sendOk(clientFd, strlen(displayPath));
         if (strlen(displayPath) > 0) {
-            sendAll(clientFd, displayPath, strlen(displayPath));
+            sendPayload(clientFd, displayPath, strlen(displayPath));
         }
         return 0;
     }
@@ -812,16 +931,12 @@ int handleCd(int clientFd, ProtocolMessage *msg, Session *session)
         return 0;
     }
 
-    // Target must exist and be a directory
-    struct stat st;
-    if (stat(fullPath, &st) < 0 || !S_ISDIR(st.st_mode)) {
+    // Target must exist and be a directory; becomes the current directory
+    if (fsChdir(session, fullPath) < 0) {
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    // Update session current directory
-    strncpy(session->currentDir, fullPath, PATH_SIZE);
-
     // Build display path relative to home directory
     char displayPath[PATH_SIZE];
     size_t homeLen = strlen(session->homeDir);
@@ -842,109 +957,142 @@ int handleCd(int clientFd, ProtocolMessage *msg, Session *session)
     // Send OK with new display path
     sendOk(clientFd, strlen(displayPath));
     if (strlen(displayPath) > 0) {
-        sendAll(clientFd, displayPath, strlen(displayPath));
+        sendPayload(clientFd, displayPath, strlen(displayPath));
     }
 
-    printf("[CD] OK -> '%s' (display: '%s')\n", fullPath, displayPath);
+    logDebug("[CD] OK -> '%s' (display: '%s')", fullPath, displayPath);
     return 0;
 }
 
 // ================================================================
-// LIST
+// Helpers: path argument of LIST-like commands and the LIST
+// permission rule
 // ================================================================
-int handleList(int clientFd, ProtocolMessage *msg, Session *session)
-{
-    debugCommand("LIST", msg, session);
-
-    // User must be logged in
-    if (!ensureLoggedIn(clientFd, session, "LIST"))
-        return 0;
-
-    char fullPath[PATH_SIZE];
-    char output[8192];
-    output[0] = '\0';
 
-    // ============================================
-    // Determine directory to list
-    // ============================================
-    if (msg->arg1[0] == '\0') {
+// Empty = current directory, "/..." = from the server root,
+// otherwise relative to the current directory
+static int resolveListPath(Session *session, const char *arg, char *fullPath)
+{
+    if (arg[0] == '\0') {
         // No argument -> current directory
         strncpy(fullPath, session->currentDir, PATH_SIZE);
         fullPath[PATH_SIZE - 1] = '\0';
     }
-    else if (msg->arg1[0] == '/') {
+    else if (arg[0] == '/') {
         // Absolute path inside server root
-        snprintf(fullPath, PATH_SIZE, "%s/%s", gRootDir, msg->arg1 + 1);
+        snprintf(fullPath, PATH_SIZE, "%s/%s", gRootDir, arg + 1);
     }
     else {
         // Relative path resolve against current directory
-        if (resolvePath(session, msg->arg1, fullPath) < 0) {
-            printf("[LIST] ERROR: resolvePath failed for '%s'\n", msg->arg1);
-            sendErrorMsg(clientFd);
-            return 0;
-        }
+        return resolvePath(session, arg, fullPath);
+    }
+    return 0;
+}
+
+// Directory inside the user's own home: OWNER r + x. Outside (other
+// users): all users belong to the same group (csapgroup), GROUP r + x.
+static int mayListDir(const Session *session, const char *fullPath, mode_t mode)
+{
+    if (isInsideHome(session->homeDir, fullPath))
+        return (mode & S_IRUSR) && (mode & S_IXUSR);
+    return (mode & S_IRGRP) && (mode & S_IXGRP);
+}
+
+// ================================================================
+// Helper: directory for LIST / WATCH (empty = current directory),
+// must be readable by the session user. On failure the error is
+// already sent.
+// ================================================================
+static int resolveListableDir(int clientFd, Session *session, const char *arg,
+                              const char *tag, char *fullPath, struct stat *st)
+{
+    // ============================================
+    // Determine directory
+    // ============================================
+    if (resolveListPath(session, arg, fullPath) < 0) {
+        logWarn("[%s] ERROR: resolvePath failed for '%s'", tag, arg);
+        sendErrorMsg(clientFd);
+        return -1;
     }
 
     // ============================================
     // Security check: must stay inside server root
     // ============================================
     if (!isInsideRoot(gRootDir, fullPath)) {
-        printf("[LIST] ERROR: Path outside root: '%s'\n", fullPath);
+        logWarn("[%s] ERROR: Path outside root: '%s'", tag, fullPath);
         sendErrorMsg(clientFd);
-        return 0;
+        return -1;
     }
 
     // ============================================
     // Check if directory exists
     // ============================================
-    struct stat st;
-    if (stat(fullPath, &st) < 0) {
-        printf("[LIST] ERROR: stat failed for '%s': %s\n",
-               fullPath, strerror(errno));
+    if (fsStat(session, fullPath, st) < 0) {
+        logWarn("[%s] ERROR: stat failed for '%s': %s",
+                tag, fullPath, strerror(errno));
         sendErrorMsg(clientFd);
-        return 0;
+        return -1;
     }
 
-    if (!S_ISDIR(st.st_mode)) {
-        printf("[LIST] ERROR: Not a directory: '%s'\n", fullPath);
+    if (!S_ISDIR(st->st_mode)) {
+        logWarn("[%s] ERROR: Not a directory: '%s'", tag, fullPath);
         sendErrorMsg(clientFd);
-        return 0;
+        return -1;
     }
 
-    mode_t mode = st.st_mode;
-
     // ============================================
     // PERMISSION CHECK
     // ============================================
-    // If directory is inside user's own home,
-    // check OWNER permissions (r + x)
-    if (isInsideHome(session->homeDir, fullPath)) {
-        if (!(mode & S_IRUSR) || !(mode & S_IXUSR)) {
-            printf("[LIST] PERMISSION DENIED (owner) for '%s'\n", fullPath);
-            sendErrorMsg(clientFd);
-            return 0;
-        }
+    if (!mayListDir(session, fullPath, st->st_mode)) {
+        logWarn("[%s] PERMISSION DENIED (%s) for '%s'", tag,
+                isInsideHome(session->homeDir, fullPath) ? "owner" : "group", fullPath);
+        sendErrorMsg(clientFd);
+        return -1;
     }
-    else {
-        // Directory is outside user's home (other users)
-        // All users belong to the same group (csapgroup),
-        // so check GROUP permissions (r + x)
-        if (!(mode & S_IRGRP) || !(mode & S_IXGRP)) {
-            printf("[LIST] PERMISSION DENIED (group) for '%s'\n", fullPath);
+
+    return 0;
+}
+
+// ================================================================
+// LIST
+// ================================================================
+int handleList(int clientFd, ProtocolMessage *msg, Session *session)
+{
+    debugCommand("LIST", msg, session);
+
+    // User must be logged in
+    if (!ensureLoggedIn(clientFd, session, "LIST"))
+        return 0;
+
+    char fullPath[PATH_SIZE];
+    char output[8192];
+    output[0] = '\0';
+
+    struct stat st;
+    if (resolveListableDir(clientFd, session, msg->arg1, "LIST", fullPath, &st) < 0)
+        return 0;
+
+    // ============================================
+    // Entries: shared cache, else scan the directory
+    // ============================================
+    char packed[MDCACHE_DATA_SIZE];
+    int  itemCount = 0;
+    int  packedLen = mdCacheLookup(&st, packed, &itemCount);
+
+    if (packedLen < 0) {
+        int dirFd = fsOpen(session, fullPath, O_RDONLY | O_DIRECTORY, 0);
+        packedLen = dirFd >= 0 ? mdCacheScan(dirFd, packed, sizeof(packed), &itemCount) : -1;
+        if (packedLen < 0) {
+            logWarn("[LIST] ERROR: opendir failed for '%s': %s",
+                    fullPath, strerror(errno));
+            if (dirFd >= 0)
+                close(dirFd);
             sendErrorMsg(clientFd);
             return 0;
         }
-    }
+        close(dirFd);
 
-    // ============================================
-    // Open directory
-    // ============================================
-    DIR *dir = opendir(fullPath);
-    if (!dir) {
-        printf("[LIST] ERROR: opendir failed for '%s': %s\n",
-               fullPath, strerror(errno));
-        sendErrorMsg(clientFd);
-        return 0;
+        mdCacheStore(fullPath, &st, packed, packedLen, itemCount);
     }
 
     // Output header
@@ -954,58 +1102,30 @@ int handleList(int clientFd, ProtocolMessage *msg, Session *session)
     strcat(output, " NAME                              PERMISSIONS     SIZE     \n");
     strcat(output, "------------------------------------------------------------\n");
 
-    struct dirent *entry;
-    int itemCount = 0;
-
-    while ((entry = readdir(dir)) != NULL)
-    {
-        // Skip ".", ".." and internal ".lock" files
-        if (!strcmp(entry->d_name, ".") ||
-            !strcmp(entry->d_name, "..") ||
-            strstr(entry->d_name, ".lock") != NULL)
-            continue;
+    for (int off = 0; off < packedLen; ) {
+        const MdEntry *e = (const MdEntry *)(packed + off);
+        off += (int)MDCACHE_ENTRY_SIZE(e->nameLen);
 
-        char entryPath[PATH_SIZE];
-        size_t fp = strlen(fullPath);
-        size_t en = strlen(entry->d_name);
-
-        // Skip too-long paths
-        if (fp + 1 + en + 1 >= PATH_SIZE)
-            continue;
-
-        memcpy(entryPath, fullPath, fp);
-        entryPath[fp] = '/';
-        memcpy(entryPath + fp + 1, entry->d_name, en);
-        entryPath[fp + 1 + en] = '\0';
-
-        // Stat entry
-        if (stat(entryPath, &st) < 0) {
-            continue;
-        }
-
-        int  perms = st.st_mode & 0777;
-        long size  = (long)st.st_size;
-        int  isDir = S_ISDIR(st.st_mode);
+        int  perms = e->mode & 0777;
+        long size  = (long)e->size;
+        int  isDir = S_ISDIR(e->mode);
 
         // Format output line
         char line[512];
         if (isDir) {
             snprintf(line, sizeof(line),
-                     " %-30s [DIR]  %04o      %6ld\n",
-                     entry->d_name, perms, size);
+                     " %-30.*s [DIR]  %04o      %6ld\n",
+                     e->nameLen, (const char *)(e + 1), perms, size);
         } else {
             snprintf(line, sizeof(line),
-                     " %-30s [FILE] %04o      %6ld\n",
-                     entry->d_name, perms, size);
+                     " %-30.*s [FILE] %04o      %6ld\n",
+                     e->nameLen, (const char *)(e + 1), perms, size);
         }
 
         strncat(output, line,
                 sizeof(output) - strlen(output) - 1);
-        itemCount++;
     }
 
-    closedir(dir);
-
     // Output footer
     strcat(output, "------------------------------------------------------------\n");
 
@@ -1017,18 +1137,484 @@ int handleList(int clientFd, ProtocolMessage *msg, Session *session)
     strcat(output, "============================================================\n");
 
     // Debug: print size of response
-    printf("[LIST] OK: Sending %ld bytes for path '%s'\n",
-           strlen(output), fullPath);
+    logDebug("[LIST] OK: Sending %ld bytes for path '%s'",
+             strlen(output), fullPath);
 
     // Send response
     sendOk(clientFd, strlen(output));
     if (strlen(output) > 0) {
-        sendAll(clientFd, output, strlen(output));
+        sendPayload(clientFd, output, strlen(output));
+    }
+
+    return 0;
+}
+
+// ================================================================
+// WATCH
+// ================================================================
+int handleWatch(int clientFd, ProtocolMessage *msg, Session *session)
+{
+    debugCommand("WATCH", msg, session);
+
+    // User must be logged in
+    if (!ensureLoggedIn(clientFd, session, "WATCH"))
+        return 0;
+
+    int recursive = strcmp(msg->arg2, "-r") == 0;
+    if (msg->arg2[0] && !recursive) {
+        logWarn("[WATCH] ERROR: unknown option '%s'", msg->arg2);
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+
+    char fullPath[PATH_SIZE];
+    struct stat st;
+    if (resolveListableDir(clientFd, session, msg->arg1, "WATCH", fullPath, &st) < 0)
+        return 0;
+
+    // Watches are added as the session user: the kernel checks read
+    // permission on every directory of the tree
+    int dirFd = fsOpen(session, fullPath, O_RDONLY | O_DIRECTORY, 0);
+    Watch *w = dirFd >= 0 ? watchOpen(dirFd, recursive) : NULL;
+    if (!w) {
+        logWarn("[WATCH] ERROR: cannot watch '%s': %s", fullPath,
+                errno == E2BIG ? "too many directories" : strerror(errno));
+        if (dirFd >= 0)
+            close(dirFd);
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+    close(dirFd);
+
+    // Event batches follow the OK, see watch.h
+    sendOk(clientFd, 0);
+
+    WatchStats stats;
+    int rc = watchStream(w, clientFd, &stats);
+    watchClose(w);
+
+    logInfo("[WATCH] '%s'%s: %llu event(s) in %llu batch(es), %llu overflow(s), %d dir(s)",
+            fullPath, recursive ? " (recursive)" : "", stats.events, stats.batches,
+            stats.overflows, stats.dirs);
+    return rc;
+}
+
+// ================================================================
+// FIND
+// ================================================================
+int handleFind(int clientFd, ProtocolMessage *msg, Session *session)
+{
+    debugCommand("FIND", msg, session);
+
+    // User must be logged in
+    if (!ensureLoggedIn(clientFd, session, "FIND"))
+        return 0;
+
+    FindQuery query;
+    if (findParseQuery(msg->arg2, msg->arg3, &query) < 0) {
+        logWarn("[FIND] ERROR: bad filters '%s' / '%s'", msg->arg2, msg->arg3);
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+
+    char fullPath[PATH_SIZE];
+    struct stat st;
+    if (resolveListableDir(clientFd, session, msg->arg1, "FIND", fullPath, &st) < 0)
+        return 0;
+
+    int dirFd = fsOpen(session, fullPath, O_RDONLY | O_DIRECTORY, 0);
+    if (dirFd < 0) {
+        logWarn("[FIND] ERROR: open failed for '%s': %s", fullPath, strerror(errno));
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+
+    // Matches are streamed as they are found, see find.h
+    FindStats stats;
+    uint64_t start = statsNow();
+    int rc = findRun(dirFd, fullPath, session->homeDir, &query, clientFd, &stats);
+    close(dirFd);
+
+    if (rc < 0) {
+        logWarn("[FIND] ERROR: cannot start workers for '%s'", fullPath);
+        sendErrorMsg(clientFd);
+        return 0;
     }
 
+    logInfo("[FIND] '%s' '%s': %llu match(es) in %llu dir(s), %llu entries, "
+            "%llu skipped, %d worker(s), %.1f ms",
+            fullPath, msg->arg2, stats.matches, stats.dirs, stats.entries,
+            stats.skipped, stats.workers, (statsNow() - start) / 1e6);
+    return rc;
+}
+
+// ================================================================
+// DU (disk usage per subdirectory)
+// ================================================================
+int handleDu(int clientFd, ProtocolMessage *msg, Session *session)
+{
+    debugCommand("DU", msg, session);
+
+    // User must be logged in
+    if (!ensureLoggedIn(clientFd, session, "DU"))
+        return 0;
+
+    char fullPath[PATH_SIZE];
+    struct stat st;
+    if (resolveListableDir(clientFd, session, msg->arg1, "DU", fullPath, &st) < 0)
+        return 0;
+
+    int dirFd = fsOpen(session, fullPath, O_RDONLY | O_DIRECTORY, 0);
+    if (dirFd < 0) {
+        logWarn("[DU] ERROR: open failed for '%s': %s", fullPath, strerror(errno));
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+
+    // Subdirectory totals from the index, the rest walked
+    DuTotals total;
+    DuRow   *rows = NULL;
+    int      count = 0;
+    DuStats  stats;
+    uint64_t start = statsNow();
+    int rc = duQuery(dirFd, fullPath, session->homeDir, &total, &rows, &count, &stats);
+    close(dirFd);
+
+    if (rc < 0) {
+        logWarn("[DU] ERROR: cannot read '%s': %s", fullPath, strerror(errno));
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+
+    char output[8192];
+    int len = duFormat(&total, rows, count, 40, output, sizeof(output));
+    free(rows);
+
+    logInfo("[DU] '%s': %d/%d subdir(s) from the index, %llu dir(s) walked "
+            "with %d worker(s), %.1f ms",
+            fullPath, stats.hits, stats.rows, stats.walked, stats.workers,
+            (statsNow() - start) / 1e6);
+
+    sendOk(clientFd, len);
+    if (len > 0)
+        sendPayload(clientFd, output, len);
     return 0;
 }
 
+// ================================================================
+// STAT_MANY
+// ================================================================
+// Directories of the listed paths, opened once per request
+#define STAT_MANY_DIRS 8
+
+typedef struct {
+    char     path[PATH_SIZE];
+    int      fd;                    // O_PATH, -1 = error
+    int      error;                 // errno for every path below it
+    uint64_t lastUsed;
+} StatDir;
+
+static StatDir *statDirFor(Session *session, StatDir *dirs, int *opened,
+                           const char *dirPath, uint64_t tick)
+{
+    StatDir *victim = &dirs[0];
+    for (int i = 0; i < STAT_MANY_DIRS; i++) {
+        if (dirs[i].lastUsed && strcmp(dirs[i].path, dirPath) == 0) {
+            dirs[i].lastUsed = tick;
+            return &dirs[i];
+        }
+        if (dirs[i].lastUsed < victim->lastUsed)
+            victim = &dirs[i];
+    }
+
+    if (victim->fd >= 0)
+        close(victim->fd);
+    snprintf(victim->path, sizeof(victim->path), "%s", dirPath);
+    victim->lastUsed = tick;
+    victim->error    = 0;
+    victim->fd       = fsOpen(session, dirPath, O_PATH | O_DIRECTORY, 0);
+    (*opened)++;
+
+    struct stat st;
+    if (victim->fd < 0 || fstat(victim->fd, &st) < 0)
+        victim->error = errno;
+    else if (!mayListDir(session, dirPath, st.st_mode))
+        victim->error = EACCES;
+
+    if (victim->error && victim->fd >= 0) {
+        close(victim->fd);
+        victim->fd = -1;
+    }
+    return victim;
+}
+
+// One path: its directory must be listable, the entry itself is
+// stat'ed without following a symbolic link
+static void statOne(Session *session, StatDir *dirs, int *opened, uint64_t tick,
+                    const char *arg, StatRecord *rec)
+{
+    char fullPath[PATH_SIZE];
+    memset(rec, 0, sizeof(*rec));
+
+    if (arg[0] == '\0' || resolveListPath(session, arg, fullPath) < 0) {
+        rec->error = EINVAL;
+        return;
+    }
+    if (!isInsideRoot(gRootDir, fullPath)) {
+        rec->error = EACCES;
+        return;
+    }
+
+    // Split into directory and name; the root is its own directory
+    size_t len = strlen(fullPath);
+    while (len > 1 && fullPath[len - 1] == '/')
+        fullPath[--len] = '\0';
+
+    char name[PATH_SIZE] = ".";
+    if (strcmp(fullPath, gRootDir) != 0) {
+        char *slash = strrchr(fullPath, '/');
+        snprintf(name, sizeof(name), "%s", slash + 1);
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            rec->error = EINVAL;
+            return;
+        }
+        slash[slash == fullPath] = '\0';   // "/name": directory is "/"
+    }
+
+    StatDir *dir = statDirFor(session, dirs, opened, fullPath, tick);
+    struct stat st;
+    if (dir->error) {
+        rec->error = dir->error;
+    } else if (fstatat(dir->fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+        rec->error = errno;
+    } else {
+        rec->mode      = (uint32_t)st.st_mode;
+        rec->size      = (int64_t)st.st_size;
+        rec->mtimeSec  = (int64_t)st.st_mtim.tv_sec;
+        rec->mtimeNsec = (int32_t)st.st_mtim.tv_nsec;
+        rec->uid       = (uint32_t)st.st_uid;
+        rec->gid       = (uint32_t)st.st_gid;
+    }
+}
+
+int handleStatMany(int clientFd, ProtocolMessage *msg, Session *session)
+{
+    debugCommand("STAT_MANY", msg, session);
+
+    // The path list follows the message: read it before any check so
+    // the connection stays in step. A bad size cannot be skipped.
+    int size = 0;
+    if (recvAll(clientFd, &size, sizeof(int)) < 0)
+        return 1;
+    if (size < 0 || size > STAT_MANY_MAX_BODY) {
+        logWarn("[STAT_MANY] ERROR: bad body size %d", size);
+        sendErrorMsg(clientFd);
+        return 1;
+    }
+
+    char *body = malloc((size_t)size + 1);
+    if (!body) {
+        discardPayload(clientFd, size);
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+    if (size > 0 && recvPayload(clientFd, body, size) < 0) {
+        free(body);
+        return 1;
+    }
+    body[size] = '\0';
+
+    // User must be logged in
+    if (!ensureLoggedIn(clientFd, session, "STAT_MANY")) {
+        free(body);
+        return 0;
+    }
+
+    // Paths are separated by '\0', the last one may end the body
+    int count = 0;
+    for (int off = 0; off < size; off += (int)strlen(body + off) + 1)
+        count++;
+    if (count > STAT_MANY_MAX_PATHS) {
+        logWarn("[STAT_MANY] ERROR: %d paths (max %d)", count, STAT_MANY_MAX_PATHS);
+        free(body);
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+
+    StatRecord *records = malloc(sizeof(StatRecord) * (count ? count : 1));
+    if (!records) {
+        free(body);
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+
+    StatDir dirs[STAT_MANY_DIRS];
+    for (int i = 0; i < STAT_MANY_DIRS; i++) {
+        dirs[i].fd       = -1;
+        dirs[i].lastUsed = 0;
+    }
+
+    int i = 0, failed = 0, opened = 0;
+    for (int off = 0; off < size; off += (int)strlen(body + off) + 1, i++) {
+        statOne(session, dirs, &opened, (uint64_t)i + 1, body + off, &records[i]);
+        failed += records[i].error != 0;
+    }
+
+    for (int k = 0; k < STAT_MANY_DIRS; k++)
+        if (dirs[k].fd >= 0)
+            close(dirs[k].fd);
+    free(body);
+
+    logDebug("[STAT_MANY] %d path(s), %d error(s), %d dir(s) opened",
+             count, failed, opened);
+
+    int bytes = count * (int)sizeof(StatRecord);
+    sendOk(clientFd, bytes);
+    if (bytes > 0)
+        sendPayload(clientFd, records, bytes);
+    free(records);
+    return 0;
+}
+
+// ================================================================
+// Helpers for WRITE / UPLOAD: open (creating the file if needed) and
+// report the change to the disk usage index, the quota ledger and the
+// hot file cache
+// ================================================================
+// access: O_WRONLY, or O_RDWR to read what is about to be overwritten.
+// Returns the fd write-locked, *created = 1 if this call created the
+// file (set even on failure). The lock is only kept once fullPath still
+// names the locked file: UPLOAD renames a new file over the path while
+// it holds the lock on the old one, and a writer that waited for that
+// lock must not write into the replaced file.
+static int openForWrite(Session *session, const char *fullPath, const char *homeDir,
+                        int access, int *created)
+{
+    *created = 0;
+
+    for (int tries = 0; tries < 4; tries++) {
+        DuChange du;
+        duChangeBegin(&du, homeDir);
+        int fd = fsOpen(session, fullPath, access | O_CREAT | O_EXCL, 0700);
+        if (fd >= 0) {
+            duChangeApply(&du, fullPath, 0, 1, 0);
+            *created = 1;
+        } else if (errno == EEXIST) {
+            fd = fsOpen(session, fullPath, access | O_NONBLOCK, 0);
+        }
+        duChangeEnd(&du);
+
+        if (fd < 0)
+            return -1;
+        if (lockFileWrite(fd) < 0) {
+            close(fd);
+            return -1;
+        }
+
+        struct stat locked, now;
+        if (fstat(fd, &locked) == 0 && fsStat(session, fullPath, &now) == 0 &&
+            locked.st_dev == now.st_dev && locked.st_ino == now.st_ino)
+            return fd;
+
+        // Replaced (or removed) while we waited: start over
+        unlockFile(fd);
+        close(fd);
+    }
+
+    errno = EAGAIN;
+    return -1;
+}
+
+static long long fileSizeOf(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 ? (long long)st.st_size : -1;
+}
+
+static void noteResize(DuChange *du, QuotaChange *q, const char *fullPath,
+                       int fd, long long before)
+{
+    struct stat st;
+    if (fstat(fd, &st) == 0)
+        fileCacheInvalidate(&st);
+
+    long long after = fileSizeOf(fd);
+    if (before < 0 || after < 0) {
+        duChangeDrop(du);
+        quotaDrop(q);
+    } else {
+        duChangeApply(du, fullPath, after - before, 0, 0);
+        quotaApply(q, after - before);
+    }
+    duChangeEnd(du);
+}
+
+// Largest upload accepted (FILESERVER_MAX_UPLOAD, K / M / G / T)
+static long long maxUploadSize(void)
+{
+    static long long maxSize = -1;
+
+    if (maxSize < 0) {
+        const char *env = getenv("FILESERVER_MAX_UPLOAD");
+        maxSize = (env && env[0]) ? quotaParseSize(env) : -1;
+        if (maxSize <= 0)
+            maxSize = MAX_UPLOAD_SIZE;
+    }
+    return maxSize;
+}
+
+// ================================================================
+// Helpers for READ / DOWNLOAD: the hot file cache
+// ================================================================
+// Look the file up by a fresh stat of its path. Only files the session
+// owns and may read are served without opening them; the others always
+// take the normal path.
+static int cachedFile(Session *session, const char *fullPath, long long offset,
+                      char **data, long long *len, char *validator, int *wanted)
+{
+    struct stat st;
+    *wanted = 0;
+    if (!fileCacheEnabled() ||
+        fsStat(session, fullPath, &st) < 0 || !S_ISREG(st.st_mode) ||
+        st.st_uid != geteuid() || !(st.st_mode & S_IRUSR))
+        return -1;
+    return fileCacheLookup(&st, offset, data, len, validator, wanted);
+}
+
+// Large READ sent from a mapping of the locked file (run guarded:
+// touching the mapping faults if someone else truncates the file).
+// Nothing that takes a lock may run here: a fault jumps out of it.
+typedef struct {
+    int         clientFd;
+    const char *data;
+    int         len;
+    char       *copy;               // Also copied here to fill the cache
+} MappedRead;
+
+static int sendMappedRead(void *ctx)
+{
+    MappedRead *m = (MappedRead *)ctx;
+    if (sendPayload(m->clientFd, m->data, m->len) < 0)
+        return -1;
+    if (m->copy)
+        memcpy(m->copy, m->data, m->len);
+    return 0;
+}
+
+// Whole content of a file without holes (to be stored), NULL otherwise
+static char *readWholeFile(int fd, const struct stat *st)
+{
+    if (!sparseIsDense(fd, (long long)st->st_size))
+        return NULL;
+
+    char *data = malloc(st->st_size > 0 ? (size_t)st->st_size : 1);
+    if (data && fsReadFile(fd, data, (int)st->st_size, 0) != (int)st->st_size) {
+        free(data);
+        data = NULL;
+    }
+    return data;
+}
+
 // ================================================================
 // READ
 // ================================================================
@@ -1054,11 +1640,8 @@ int handleRead(int clientFd, ProtocolMessage *msg, Session *session)
         return 0;
     }
 
-    // Security checks:
-    // file must be inside user's home directory
-    // file must exist
-    if (!isInsideHome(session->homeDir, fullPath) ||
-        !fileExists(fullPath)) {
+    // Security check: file must be inside user's home directory
+    if (!isInsideHome(session->homeDir, fullPath)) {
         sendErrorMsg(clientFd);
         return 0;
     }
@@ -1070,17 +1653,41 @@ int handleRead(int clientFd, ProtocolMessage *msg, Session *session)
         if (offset < 0) offset = 0;
     }
 
-    // Open file for reading
-    int fd = open(fullPath, O_RDONLY);
+    // Hot file: served from the shared cache, the file is not opened
+    char validator[VALIDATOR_SIZE] = "";
+    char *cached = NULL;
+    long long cachedLen = 0;
+    int wanted = 0;
+    if (cachedFile(session, fullPath, offset, &cached, &cachedLen, validator, &wanted) == 0) {
+        if (msg->arg3[0] != '\0' && fsValidatorEqual(msg->arg3, validator)) {
+            free(cached);
+            sendStatus(clientFd, STATUS_NOT_MODIFIED, 0);
+            logDebug("[READ] Not modified: '%s' (cached)", fullPath);
+            return 0;
+        }
+
+        sendOk(clientFd, (int)cachedLen);
+        sendAll(clientFd, validator, VALIDATOR_SIZE);
+        if (cachedLen > 0)
+            sendPayload(clientFd, cached, (int)cachedLen);
+        free(cached);
+
+        logDebug("[READ] %lld bytes from '%s' (offset=%d, cached)",
+                 cachedLen, fullPath, offset);
+        return 0;
+    }
+
+    // Open file for reading (fails if it does not exist; never blocks on a FIFO)
+    int fd = fsOpen(session, fullPath, O_RDONLY | O_NONBLOCK, 0);
     if (fd < 0) {
-        printf("[READ] Cannot open file '%s'\n", fullPath);
+        logWarn("[READ] Cannot open file '%s'", fullPath);
         sendErrorMsg(clientFd);
         return 0;
     }
 
     // Acquire shared lock for reading
     if (lockFileRead(fd) < 0) {
-        printf("[READ] Cannot lock file '%s' for reading\n", fullPath);
+        logWarn("[READ] Cannot lock file '%s' for reading", fullPath);
         close(fd);
         sendErrorMsg(clientFd);
         return 0;
@@ -1088,13 +1695,49 @@ int handleRead(int clientFd, ProtocolMessage *msg, Session *session)
 
     // Check file type and size
     struct stat st;
-    if (stat(fullPath, &st) < 0 || !S_ISREG(st.st_mode)) {
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
         unlockFile(fd);
         close(fd);
         sendErrorMsg(clientFd);
         return 0;
     }
 
+    // A hot file read whole also fills the cache
+    int store = wanted && offset == 0 && sparseIsDense(fd, (long long)st.st_size);
+
+    // Validator covers the whole file, not only the requested part.
+    // Hashing reads all of it, so it is only done for a conditional
+    // read whose size and mtime still match (like DOWNLOAD) and for a
+    // file going into the cache; otherwise the validator carries size
+    // and mtime only (hash part zero). Such a weak validator sent back
+    // matches on size and mtime, without hashing.
+    fsFormatValidator(&st, 0, validator, sizeof(validator));
+    int conditional = msg->arg3[0] != '\0' && fsValidatorMatchesStat(msg->arg3, &st);
+    if (conditional && fsValidatorIsWeak(msg->arg3)) {
+        unlockFile(fd);
+        close(fd);
+        sendStatus(clientFd, STATUS_NOT_MODIFIED, 0);
+        logDebug("[READ] Not modified: '%s' (size and mtime)", fullPath);
+        return 0;
+    }
+    if (conditional || store) {
+        if (fsFileValidator(fd, &st, validator, sizeof(validator)) < 0) {
+            unlockFile(fd);
+            close(fd);
+            sendErrorMsg(clientFd);
+            return 0;
+        }
+
+        // Conditional read: client already has this version
+        if (conditional && strcmp(msg->arg3, validator) == 0) {
+            unlockFile(fd);
+            close(fd);
+            sendStatus(clientFd, STATUS_NOT_MODIFIED, 0);
+            logDebug("[READ] Not modified: '%s'", fullPath);
+            return 0;
+        }
+    }
+
     int fileSize = (int)st.st_size;
 
     // Clamp offset to file size
@@ -1103,6 +1746,40 @@ int handleRead(int clientFd, ProtocolMessage *msg, Session *session)
 
     int toRead = fileSize - offset;
 
+    // Large reads are sent straight from a mapping, still under the
+    // shared lock: no heap buffer and no copy, the pages are the page
+    // cache's and shared with every session reading the file
+    if (toRead >= MAP_READ_MIN) {
+        FileMap map;
+        MappedRead mr = { clientFd, mapFileRange(fd, offset, toRead, &map), toRead,
+                          store ? malloc(toRead) : NULL };
+        if (mr.data) {
+            sendOk(clientFd, toRead);
+            sendAll(clientFd, validator, VALIDATOR_SIZE);
+            int rc = runMapGuarded(sendMappedRead, &mr);
+
+            // Stored from the copy once the guard is off, still locked
+            if (rc == 0 && mr.copy)
+                fileCacheStore(&st, mr.copy, validator);
+            free(mr.copy);
+
+            unmapFileRange(&map);
+            unlockFile(fd);
+            close(fd);
+
+            // The reply is cut short: the stream cannot be resumed
+            if (rc < 0) {
+                logWarn("[READ] Sending '%s' failed, closing the connection", fullPath);
+                return 1;
+            }
+
+            logDebug("[READ] %d bytes from '%s' (offset=%d, mapped)",
+                     toRead, fullPath, offset);
+            return 0;
+        }
+        // Cannot be mapped: read into memory below
+    }
+
     char *buffer = NULL;
     int   readBytes = 0;
 
@@ -1116,7 +1793,7 @@ int handleRead(int clientFd, ProtocolMessage *msg, Session *session)
             return 0;
         }
 
-        readBytes = fsReadFile(fullPath, buffer, toRead, offset);
+        readBytes = fsReadFile(fd, buffer, toRead, offset);
         if (readBytes < 0) {
             free(buffer);
             unlockFile(fd);
@@ -1126,21 +1803,27 @@ int handleRead(int clientFd, ProtocolMessage *msg, Session *session)
         }
     }
 
+    // A hot file read whole is stored while still locked: no writer
+    // can change it between the read and the store
+    if (store && readBytes == fileSize)
+        fileCacheStore(&st, buffer, validator);
+
     // Release file lock and close
     unlockFile(fd);
     close(fd);
 
-    // Send OK with number of bytes read
+    // Send OK with number of bytes read, then the validator
     sendOk(clientFd, readBytes);
+    sendAll(clientFd, validator, VALIDATOR_SIZE);
 
     // Send file data
     if (readBytes > 0) {
-        sendAll(clientFd, buffer, readBytes);
+        sendPayload(clientFd, buffer, readBytes);
         free(buffer);
     }
 
-    printf("[READ] %d bytes from '%s' (offset=%d)\n",
-           readBytes, fullPath, offset);
+    logDebug("[READ] %d bytes from '%s' (offset=%d)",
+             readBytes, fullPath, offset);
     return 0;
 }
 
@@ -1182,18 +1865,11 @@ int handleWrite(int clientFd, ProtocolMessage *msg, Session *session)
         if (offset < 0) offset = 0;
     }
 
-    // Open file for writing (create if needed)
-    int fd = open(fullPath, O_WRONLY | O_CREAT, 0700);
+    // Open file for writing (create if needed), with an exclusive lock
+    int created;
+    int fd = openForWrite(session, fullPath, session->homeDir, O_WRONLY, &created);
     if (fd < 0) {
-        printf("[WRITE] Cannot open/create file '%s'\n", fullPath);
-        sendErrorMsg(clientFd);
-        return 0;
-    }
-
-    // Acquire exclusive lock for writing
-    if (lockFileWrite(fd) < 0) {
-        printf("[WRITE] Cannot lock file '%s' for writing\n", fullPath);
-        close(fd);
+        logWarn("[WRITE] Cannot open/create and lock file '%s'", fullPath);
         sendErrorMsg(clientFd);
         return 0;
     }
@@ -1210,220 +1886,1089 @@ int handleWrite(int clientFd, ProtocolMessage *msg, Session *session)
         return 0;
     }
 
-    char *buffer = NULL;
+    // Growth past the end of the file must fit the quota; a refused
+    // body is read and thrown away to keep the connection in step
+    long long before = fileSizeOf(fd);
+    QuotaChange quota;
+    if (quotaBegin(&quota, session->homeDir, (long long)offset + size - before) < 0) {
+        logWarn("[WRITE] Quota exceeded: %d bytes at %d -> '%s'", size, offset, fullPath);
+        unlockFile(fd);
+        close(fd);
+        discardPayload(clientFd, size);
+        sendQuotaExceeded(clientFd);
+        return 0;
+    }
+
+    char *buffer = NULL;
+
+    // Receive data buffer (if size > 0)
+    if (size > 0) {
+        buffer = malloc(size);
+        if (!buffer) {
+            quotaEnd(&quota);
+            unlockFile(fd);
+            close(fd);
+            sendErrorMsg(clientFd);
+            return 0;
+        }
+
+        if (recvPayload(clientFd, buffer, size) < 0) {
+            quotaEnd(&quota);
+            free(buffer);
+            unlockFile(fd);
+            close(fd);
+            sendErrorMsg(clientFd);
+            return 0;
+        }
+    }
+
+    // Write to file
+    DuChange du;
+    duChangeBegin(&du, session->homeDir);
+    int written = fsWriteFile(fd, buffer, size, offset);
+    noteResize(&du, &quota, fullPath, fd, before);
+    quotaEnd(&quota);
+
+    if (buffer)
+        free(buffer);
+
+    // Release lock and close
+    unlockFile(fd);
+    close(fd);
+
+    // Check result
+    if (written < 0) {
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+
+    // Send final OK with number of bytes written
+    sendOk(clientFd, written);
+    logDebug("[WRITE] %d bytes -> '%s' (offset=%d)",
+             written, fullPath, offset);
+    return 0;
+}
+
+// ================================================================
+// DELETE
+// ================================================================
+// Delete pathArg (directories recursively); STATUS_OK or STATUS_ERROR
+static int deletePath(Session *session, const char *pathArg)
+{
+    char fullPath[PATH_SIZE];
+
+    // Resolve absolute path
+    if (resolvePath(session, pathArg, fullPath) < 0)
+        return STATUS_ERROR;
+
+    // Target must be inside user's home directory and must exist
+    struct stat st;
+    if (!isInsideHome(session->homeDir, fullPath) ||
+        fsStat(session, fullPath, &st) < 0)
+        return STATUS_ERROR;
+
+    int isFile = S_ISREG(st.st_mode);
+    int fd = -1;
+
+    // If it's a file, lock it before deletion
+    if (isFile) {
+        fd = fsOpen(session, fullPath, O_RDWR, 0);
+        if (fd >= 0) {
+            if (lockFileWrite(fd) < 0) {
+                close(fd);
+                return STATUS_ERROR;
+            }
+            fstat(fd, &st);    // Size under the lock
+        }
+    }
+
+    // Indexed totals of a directory tell what it held. The index only
+    // takes the delta of a directory without subdirectories: deeper
+    // trees may leave entries a reused inode would hit.
+    DuTotals gone;
+    int indexed = S_ISDIR(st.st_mode) &&
+                  duLookup(fullPath, &st, &gone) == 0 && !gone.partial;
+    int known = indexed && gone.dirs == 0;
+
+    // 7) Delete file or directory recursively
+    DuChange du;
+    QuotaChange quota;
+    duChangeBegin(&du, session->homeDir);
+    quotaBegin(&quota, session->homeDir, 0);
+    int ok = fsRemove(session, fullPath);
+    if (ok == 0 && isFile) {
+        fileCacheInvalidate(&st);
+        duChangeApply(&du, fullPath, -(long long)st.st_size, -1, 0);
+    } else if (ok == 0 && known) {
+        duChangeApply(&du, fullPath, -gone.bytes, -gone.files, -1);
+        duChangeForget(&du, fullPath);
+    } else if (S_ISDIR(st.st_mode))
+        duChangeDrop(&du);
+
+    if (ok == 0 && isFile)
+        quotaApply(&quota, -(long long)st.st_size);
+    else if (ok == 0 && indexed)
+        quotaApply(&quota, -gone.bytes);
+    else if (S_ISDIR(st.st_mode))
+        quotaDrop(&quota);
+    duChangeEnd(&du);
+    quotaEnd(&quota);
+
+    // Release lock if we locked it
+    if (fd >= 0) {
+        unlockFile(fd);
+        close(fd);
+    }
+
+    return ok < 0 ? STATUS_ERROR : STATUS_OK;
+}
+
+int handleDelete(int clientFd, ProtocolMessage *msg, Session *session)
+{
+    debugCommand("DELETE", msg, session);
+
+    // User must be logged in
+    if (!ensureLoggedIn(clientFd, session, "DELETE"))
+        return 0;
+
+    // Path argument must exist
+    if (msg->arg1[0] == '\0') {
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+
+    sendStatus(clientFd, deletePath(session, msg->arg1), 0);
+    return 0;
+}
+
+// ================================================================
+// BATCH
+// ================================================================
+// What it takes to undo one operation (all-or-nothing batches)
+typedef struct {
+    int    op;                      // BATCH_*, 0 = nothing to undo
+    char   path[ARG_SIZE];
+    char   target[ARG_SIZE];        // MOVE: destination, DELETE: moved aside to
+    mode_t mode;                    // CHMOD: previous permissions
+    int    created;                 // WRITE: the file did not exist
+    int    offset;                  // WRITE: previous bytes of the range
+    int    length;
+    char  *data;
+    long long size;                 // WRITE: previous file size
+} BatchUndo;
+
+// Parsed operation, pointing into the request body
+typedef struct {
+    BatchOp     hdr;
+    const char *path;               // Not NUL-terminated (hdr lengths)
+    const char *target;
+    const char *data;
+} BatchEntry;
+
+// Split and check the whole body before anything runs; count of
+// operations, -1 if malformed (*entries malloc'ed, caller frees)
+static int parseBatch(const char *body, int size, BatchEntry **entries)
+{
+    int count = 0, max = 0;
+    BatchEntry *list = NULL;
+
+    for (int off = 0; off < size; ) {
+        BatchOp hdr;
+        if (size - off < (int)sizeof(hdr))
+            goto bad;
+        memcpy(&hdr, body + off, sizeof(hdr));
+        off += sizeof(hdr);
+
+        int isMove  = hdr.op == BATCH_MOVE;
+        int isWrite = hdr.op == BATCH_WRITE;
+        int hasMode = hdr.op == BATCH_CREATE || hdr.op == BATCH_MKDIR ||
+                      hdr.op == BATCH_CHMOD;
+        if (hdr.op < BATCH_CREATE || hdr.op > BATCH_WRITE ||
+            hdr.pathLen < 1 || hdr.pathLen >= ARG_SIZE ||
+            (isMove ? hdr.targetLen < 1 || hdr.targetLen >= ARG_SIZE : hdr.targetLen != 0) ||
+            (isWrite ? hdr.dataLen > BATCH_MAX_WRITE || hdr.offset < 0 : hdr.dataLen != 0) ||
+            (hasMode && (hdr.mode < 0 || hdr.mode > 0777)))
+            goto bad;
+        if ((long long)size - off < (long long)hdr.pathLen + hdr.targetLen + hdr.dataLen)
+            goto bad;
+
+        if (count == BATCH_MAX_OPS)
+            goto bad;
+        if (count == max) {
+            max = max ? max * 2 : 64;
+            BatchEntry *grown = realloc(list, sizeof(BatchEntry) * max);
+            if (!grown)
+                goto bad;
+            list = grown;
+        }
+
+        BatchEntry *e = &list[count++];
+        e->hdr    = hdr;
+        e->path   = body + off;
+        e->target = e->path + hdr.pathLen;
+        e->data   = e->target + hdr.targetLen;
+        off += hdr.pathLen + hdr.targetLen + hdr.dataLen;
+
+        // A NUL inside a path would make it name something else
+        if (memchr(e->path, '\0', hdr.pathLen + hdr.targetLen))
+            goto bad;
+    }
+
+    *entries = list;
+    return count;
+
+bad:
+    free(list);
+    return -1;
+}
+
+// Write a small buffer into pathArg (created if needed), same rules as
+// WRITE. With undo, the bytes it overwrites are kept; undo->op is set
+// as soon as there is something to revert, even if the write then fails.
+static int writeSmall(Session *session, const char *pathArg, int offset,
+                      const char *data, int size, int *written, BatchUndo *undo)
+{
+    char fullPath[PATH_SIZE];
+    if (resolvePath(session, pathArg, fullPath) < 0 ||
+        !isInsideHome(session->homeDir, fullPath))
+        return STATUS_ERROR;
+
+    struct stat st;
+    int existed = fsStat(session, fullPath, &st) == 0;
+    if (existed && !S_ISREG(st.st_mode))
+        return STATUS_ERROR;
+
+    // A write at offset 0 replaces the whole file (fsWriteFile
+    // truncates it): then all of the old content is kept, else only
+    // the bytes about to be overwritten
+    long long before = existed ? (long long)st.st_size : 0;
+    long long keep = offset == 0 ? before
+                   : before > offset ? (before - offset < size ? before - offset : size) : 0;
+
+    // Refused before the file is created or touched
+    if (undo && keep > BATCH_MAX_UNDO)
+        return STATUS_ERROR;
+
+    QuotaChange quota;
+    if (quotaBegin(&quota, session->homeDir, (long long)offset + size - before) < 0)
+        return STATUS_QUOTA;
+
+    // A file this call created is undone by deleting it
+    int created;
+    int fd = openForWrite(session, fullPath, session->homeDir,
+                          undo ? O_RDWR : O_WRONLY, &created);
+    if (undo && created) {
+        undo->op      = BATCH_WRITE;
+        undo->created = 1;
+    }
+    if (fd < 0) {
+        quotaEnd(&quota);
+        return STATUS_ERROR;
+    }
+
+    // Measured again under the lock
+    before = fileSizeOf(fd);
+    keep = offset == 0 ? before
+         : before > offset ? (before - offset < size ? before - offset : size) : 0;
+
+    if (undo && !created) {
+        undo->offset = offset;
+        undo->size   = before;
+        undo->length = keep <= BATCH_MAX_UNDO ? (int)keep : 0;
+        undo->data   = undo->length > 0 ? malloc(undo->length) : NULL;
+        if (before < 0 || keep > BATCH_MAX_UNDO ||
+            (undo->length > 0 &&
+             (!undo->data || pread(fd, undo->data, undo->length, offset) != undo->length))) {
+            quotaEnd(&quota);
+            unlockFile(fd);
+            close(fd);
+            return STATUS_ERROR;
+        }
+        undo->op = BATCH_WRITE;
+    }
+
+    DuChange du;
+    duChangeBegin(&du, session->homeDir);
+    *written = fsWriteFile(fd, data, size, offset);
+    noteResize(&du, &quota, fullPath, fd, before);
+    quotaEnd(&quota);
+
+    unlockFile(fd);
+    close(fd);
+    return *written < 0 ? STATUS_ERROR : STATUS_OK;
+}
+
+// Put back the bytes and the size a writeSmall() changed
+static int restoreWrite(Session *session, const BatchUndo *undo)
+{
+    if (undo->created)
+        return deletePath(session, undo->path);
+
+    char fullPath[PATH_SIZE];
+    if (resolvePath(session, undo->path, fullPath) < 0)
+        return STATUS_ERROR;
+
+    int fd = fsOpen(session, fullPath, O_WRONLY, 0);
+    if (fd < 0)
+        return STATUS_ERROR;
+    if (lockFileWrite(fd) < 0) {
+        close(fd);
+        return STATUS_ERROR;
+    }
+
+    long long before = fileSizeOf(fd);
+    DuChange du;
+    QuotaChange quota;
+    duChangeBegin(&du, session->homeDir);
+    quotaBegin(&quota, session->homeDir, 0);
+    int rc = 0;
+    if (undo->length > 0)
+        rc = fsWriteFile(fd, undo->data, undo->length, undo->offset) == undo->length ? 0 : -1;
+    if (rc == 0)
+        rc = ftruncate(fd, (off_t)undo->size);
+    noteResize(&du, &quota, fullPath, fd, before);
+    quotaEnd(&quota);
+
+    unlockFile(fd);
+    close(fd);
+    return rc < 0 ? STATUS_ERROR : STATUS_OK;
+}
+
+// Delete in an all-or-nothing batch: move the target aside (same
+// directory, so the totals of the home do not change) until commit
+static int deleteAside(Session *session, const char *pathArg, int index, BatchUndo *undo)
+{
+    char fullPath[PATH_SIZE];
+    if (resolvePath(session, pathArg, fullPath) < 0 ||
+        !isInsideHome(session->homeDir, fullPath) ||
+        strcmp(fullPath, session->homeDir) == 0)
+        return STATUS_ERROR;
+
+    // Absolute argument ("/alice/a/b") of the resolved path
+    const char *rel = fullPath + strlen(gRootDir);
+    if (snprintf(undo->path, ARG_SIZE, "%s", rel) >= ARG_SIZE ||
+        snprintf(undo->target, ARG_SIZE, "%s.batch-%d-%d",
+                 rel, (int)getpid(), index) >= ARG_SIZE)
+        return STATUS_ERROR;
+
+    return movePath(session, undo->path, undo->target);
+}
+
+static int undoOp(Session *session, const BatchUndo *undo)
+{
+    switch (undo->op) {
+        case BATCH_CREATE:
+        case BATCH_MKDIR:   return deletePath(session, undo->path);
+        case BATCH_CHMOD:   return chmodPath(session, undo->path, (int)undo->mode, NULL);
+        case BATCH_MOVE:
+        case BATCH_DELETE:  return movePath(session, undo->target, undo->path);
+        case BATCH_WRITE:   return restoreWrite(session, undo);
+    }
+    return STATUS_OK;
+}
+
+// Run one operation; undo (all-or-nothing only) records how to revert it
+static int runOp(Session *session, const BatchEntry *e, int index,
+                 BatchResult *result, BatchUndo *undo)
+{
+    const BatchOp *op = &e->hdr;
+    int written = 0, status = STATUS_ERROR;
+
+    char path[ARG_SIZE], target[ARG_SIZE];
+    snprintf(path, sizeof(path), "%.*s", (int)op->pathLen, e->path);
+    snprintf(target, sizeof(target), "%.*s", (int)op->targetLen, e->target);
+
+    switch (op->op) {
+        case BATCH_CREATE:
+        case BATCH_MKDIR:
+            status = createPath(session, path, op->mode, op->op == BATCH_MKDIR);
+            break;
+        case BATCH_CHMOD:
+            status = chmodPath(session, path, op->mode, undo ? &undo->mode : NULL);
+            break;
+        case BATCH_MOVE:
+            status = movePath(session, path, target);
+            break;
+        case BATCH_DELETE:
+            status = undo ? deleteAside(session, path, index, undo)
+                          : deletePath(session, path);
+            break;
+        case BATCH_WRITE:
+            status = writeSmall(session, path, op->offset, e->data,
+                                (int)op->dataLen, &written, undo);
+            break;
+    }
+
+    result->status = status;
+    result->value  = written;
+
+    // A failed WRITE may have left something to undo (undo->op set)
+    if (undo && (status == STATUS_OK || undo->op)) {
+        undo->op = op->op;
+        if (op->op != BATCH_DELETE) {
+            memcpy(undo->path, path, sizeof(path));
+            memcpy(undo->target, target, sizeof(target));
+        }
+    }
+    return status;
+}
+
+int handleBatch(int clientFd, ProtocolMessage *msg, Session *session)
+{
+    debugCommand("BATCH", msg, session);
+
+    // The operations follow the message: read them before any check
+    // so the connection stays in step. A bad size cannot be skipped.
+    int size = 0;
+    if (recvAll(clientFd, &size, sizeof(int)) < 0)
+        return 1;
+    if (size < 0 || size > BATCH_MAX_BODY) {
+        logWarn("[BATCH] ERROR: bad body size %d", size);
+        sendErrorMsg(clientFd);
+        return 1;
+    }
+
+    char *body = malloc(size > 0 ? (size_t)size : 1);
+    if (!body) {
+        discardPayload(clientFd, size);
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+    if (size > 0 && recvPayload(clientFd, body, size) < 0) {
+        free(body);
+        return 1;
+    }
+
+    // User must be logged in
+    if (!ensureLoggedIn(clientFd, session, "BATCH")) {
+        free(body);
+        return 0;
+    }
+
+    int stop   = strcmp(msg->arg1, "-s") == 0;
+    int atomic = strcmp(msg->arg1, "-a") == 0;
+    if (msg->arg1[0] && !stop && !atomic) {
+        free(body);
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+
+    BatchEntry *entries = NULL;
+    int count = parseBatch(body, size, &entries);
+    BatchResult *results = count > 0 ? malloc(sizeof(BatchResult) * count) : NULL;
+    BatchUndo   *undos   = count > 0 && atomic ? calloc(count, sizeof(BatchUndo)) : NULL;
+    if (count < 0 || (count > 0 && (!results || (atomic && !undos)))) {
+        logWarn("[BATCH] ERROR: malformed or too large operation list (%d bytes)", size);
+        free(entries);
+        free(results);
+        free(undos);
+        free(body);
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+
+    int ran = 0, failed = 0;
+    for (; ran < count; ran++) {
+        int status = runOp(session, &entries[ran], ran, &results[ran],
+                           atomic ? &undos[ran] : NULL);
+        if (status != STATUS_OK) {
+            failed++;
+            if (stop || atomic) {
+                ran++;
+                break;
+            }
+        }
+    }
+    for (int i = ran; i < count; i++) {
+        results[i].status = BATCH_SKIPPED;
+        results[i].value  = 0;
+    }
+
+    // All-or-nothing: undo what ran in reverse order (the failed
+    // operation too, it keeps its status), or drop what the deletes
+    // moved aside
+    int undone = 0, stuck = 0;
+    for (int i = ran - 1; atomic && i >= 0; i--) {
+        BatchUndo *undo = &undos[i];
+        if (failed && undo->op) {
+            if (undoOp(session, undo) == STATUS_OK) {
+                if (results[i].status == STATUS_OK)
+                    results[i].status = BATCH_UNDONE;
+                undone++;
+            } else {
+                logWarn("[BATCH] Could not undo operation %d (%s)", i, undo->path);
+                stuck++;
+            }
+        } else if (!failed && undo->op == BATCH_DELETE) {
+            deletePath(session, undo->target);
+        }
+        free(undo->data);
+    }
+
+    logDebug("[BATCH] %d operation(s), %d ran, %d failed, %d undone, %d not undone",
+             count, ran, failed, undone, stuck);
+
+    int bytes = count * (int)sizeof(BatchResult);
+    sendOk(clientFd, bytes);
+    if (bytes > 0)
+        sendPayload(clientFd, results, bytes);
+
+    free(entries);
+    free(results);
+    free(undos);
+    free(body);
+    return 0;
+}
+
+// ================================================================
+// COPY helpers
+// ================================================================
+
+// Copy one regular file (names relative to the two directory fds).
+// Source gets a shared lock, the new destination an exclusive lock,
+// so readers and writers see the same locking as read/write/move.
+static int copyFileLocked(int srcDir, const char *srcName, int dstDir, const char *dstName)
+{
+    int fdSrc = openat(srcDir, srcName, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (fdSrc < 0)
+        return -1;
+
+    if (lockFileRead(fdSrc) < 0) {
+        close(fdSrc);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fdSrc, &st) < 0 || !S_ISREG(st.st_mode)) {
+        unlockFile(fdSrc);
+        close(fdSrc);
+        return -1;
+    }
+
+    // Destination must not exist (O_EXCL), same mode as source
+    int fdDst = openat(dstDir, dstName, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                       st.st_mode & 0777);
+    if (fdDst < 0) {
+        unlockFile(fdSrc);
+        close(fdSrc);
+        return -1;
+    }
+
+    int rc = lockFileWrite(fdDst);
+    if (rc == 0) {
+        uint64_t t = traceBegin();
+        rc = fsCopyData(fdSrc, fdDst, (long long)st.st_size);
+        traceEnd(t, "fsCopyData", dstName, (long long)st.st_size);
+    }
+
+    unlockFile(fdDst);
+    close(fdDst);
+    unlockFile(fdSrc);
+    close(fdSrc);
+
+    // Do not leave half-copied files behind
+    if (rc < 0)
+        unlinkat(dstDir, dstName, 0);
+
+    return rc;
+}
+
+// Copy file or directory tree. Returns number of files copied, -1 on error.
+// Walks with directory fds: one path component per syscall, no symlinks.
+static int copyTree(int srcDir, const char *srcName, int dstDir, const char *dstName)
+{
+    struct stat st;
+    if (fstatat(srcDir, srcName, &st, AT_SYMLINK_NOFOLLOW) < 0)
+        return -1;
+
+    if (S_ISREG(st.st_mode))
+        return (copyFileLocked(srcDir, srcName, dstDir, dstName) == 0) ? 1 : -1;
+
+    // Symlinks, devices, ... are never copied
+    if (!S_ISDIR(st.st_mode))
+        return 0;
+
+    if (mkdirat(dstDir, dstName, st.st_mode & 0777) < 0)
+        return -1;
+
+    int fdSrc = openat(srcDir, srcName, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    int fdDst = openat(dstDir, dstName, O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR *dir  = fdSrc >= 0 ? fdopendir(fdSrc) : NULL;
+
+    if (!dir || fdDst < 0) {
+        if (dir)
+            closedir(dir);
+        else if (fdSrc >= 0)
+            close(fdSrc);
+        if (fdDst >= 0)
+            close(fdDst);
+        return -1;
+    }
+
+    struct dirent *entry;
+    int copied = 0;
+
+    while ((entry = readdir(dir)) != NULL) {
+        // Skip ".", ".." and internal ".lock" files
+        if (!strcmp(entry->d_name, ".") ||
+            !strcmp(entry->d_name, "..") ||
+            strstr(entry->d_name, ".lock") != NULL)
+            continue;
+
+        int n = copyTree(fdSrc, entry->d_name, fdDst, entry->d_name);
+        if (n < 0) {
+            copied = -1;
+            break;
+        }
+        copied += n;
+    }
+
+    closedir(dir);
+    close(fdDst);
+    return copied;
+}
+
+// ================================================================
+// COPY (file or directory, done entirely on the server)
+// ================================================================
+int handleCopy(int clientFd, ProtocolMessage *msg, Session *session)
+{
+    debugCommand("COPY", msg, session);
+
+    // User must be logged in
+    if (!ensureLoggedIn(clientFd, session, "COPY"))
+        return 0;
+
+    char src[PATH_SIZE], dst[PATH_SIZE];
+
+    // Both source and destination arguments must exist
+    if (!msg->arg1[0] || !msg->arg2[0]) {
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+
+    // Resolve absolute paths
+    if (resolvePath(session, msg->arg1, src) < 0 ||
+        resolvePath(session, msg->arg2, dst) < 0) {
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+
+    //    Security checks (same as move):
+    //    both paths must be inside user's home
+    //    source must exist
+    //    destination must NOT exist
+    //    a directory cannot be copied into itself
+    struct stat st, srcSt;
+    if (!isInsideHome(session->homeDir, src) ||
+        !isInsideHome(session->homeDir, dst) ||
+        fsStat(session, src, &srcSt) < 0 ||
+        fsStat(session, dst, &st) == 0 ||
+        isInsideHome(src, dst)) {
+        sendErrorMsg(clientFd);
+        return 0;
+    }
 
-    // Receive data buffer (if size > 0)
-    if (size > 0) {
-        buffer = malloc(size);
-        if (!buffer) {
-            unlockFile(fd);
-            close(fd);
+    // The copy must fit the quota: a tree is measured with du first
+    // (only for users with a limit)
+    long long growth = S_ISREG(srcSt.st_mode) ? (long long)srcSt.st_size : 0;
+    if (S_ISDIR(srcSt.st_mode) && quotaLimited(session->homeDir)) {
+        int fd = fsOpen(session, src, O_RDONLY | O_DIRECTORY, 0);
+        DuTotals total;
+        DuRow *rows = NULL;
+        int count;
+        DuStats duStats;
+        if (fd < 0 || duQuery(fd, src, session->homeDir, &total, &rows, &count, &duStats) < 0) {
+            if (fd >= 0)
+                close(fd);
             sendErrorMsg(clientFd);
             return 0;
         }
+        close(fd);
+        free(rows);
+        growth = total.bytes;
+    }
 
-        if (recvAll(clientFd, buffer, size) < 0) {
-            free(buffer);
-            unlockFile(fd);
-            close(fd);
-            sendErrorMsg(clientFd);
-            return 0;
-        }
+    QuotaChange quota;
+    if (quotaBegin(&quota, session->homeDir, growth) < 0) {
+        logWarn("[COPY] Quota exceeded: %lld bytes '%s' -> '%s'", growth, src, dst);
+        sendQuotaExceeded(clientFd);
+        return 0;
     }
 
-    // Write to file
-    int written = fsWriteFile(fullPath, buffer, size, offset);
+    char srcName[NAME_MAX + 1], dstName[NAME_MAX + 1];
+    int srcDir = fsOpenParent(session, src, srcName, sizeof(srcName));
+    int dstDir = fsOpenParent(session, dst, dstName, sizeof(dstName));
 
-    if (buffer)
-        free(buffer);
+    DuChange du;
+    duChangeBegin(&du, session->homeDir);
 
-    // Release lock and close
-    unlockFile(fd);
-    close(fd);
+    int copied = -1;
+    if ((srcDir >= 0 || srcDir == AT_FDCWD) && (dstDir >= 0 || dstDir == AT_FDCWD))
+        copied = copyTree(srcDir, srcName, dstDir, dstName);
 
-    // Check result
-    if (written < 0) {
+    fsCloseParent(session, srcDir);
+    fsCloseParent(session, dstDir);
+
+    // All or nothing: remove partial copy
+    if (copied < 0) {
+        if (fsStat(session, dst, &st) == 0)
+            fsRemove(session, dst);
+        duChangeEnd(&du);
+        quotaEnd(&quota);
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    // Send final OK with number of bytes written
-    sendOk(clientFd, written);
-    printf("[WRITE] %d bytes -> '%s' (offset=%d)\n",
-           written, fullPath, offset);
+    // A copied file is a size delta, a copied tree is walked again
+    // (its measured size is booked until then)
+    if (fsStat(session, dst, &st) == 0 && S_ISREG(st.st_mode)) {
+        duChangeApply(&du, dst, (long long)st.st_size, 1, 0);
+        quotaApply(&quota, (long long)st.st_size);
+    } else {
+        duChangeDrop(&du);
+        quotaApply(&quota, growth);
+        quotaDrop(&quota);
+    }
+    duChangeEnd(&du);
+    quotaEnd(&quota);
+
+    logInfo("[COPY] OK '%s' -> '%s' (%d file(s))", src, dst, copied);
+    sendOk(clientFd, copied);
     return 0;
 }
 
 // ================================================================
-// DELETE
+// UPLOAD
 // ================================================================
-int handleDelete(int clientFd, ProtocolMessage *msg, Session *session)
+int handleUpload(int clientFd, ProtocolMessage *msg, Session *session)
 {
-    debugCommand("DELETE", msg, session);
+    debugCommand("UPLOAD", msg, session);
 
     // User must be logged in
-    if (!ensureLoggedIn(clientFd, session, "DELETE"))
+    if (!ensureLoggedIn(clientFd, session, "UPLOAD"))
         return 0;
 
-    // Path argument must exist
-    if (msg->arg1[0] == '\0') {
+    char fullPath[PATH_SIZE];
+
+    // Validate arguments
+    if (!msg->arg1[0]) {
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    char fullPath[PATH_SIZE];
-
     // Resolve absolute path
     if (resolvePath(session, msg->arg1, fullPath) < 0) {
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    // Target must be inside user's home directory and must exist
-    if (!isInsideHome(session->homeDir, fullPath) ||
-        !fileExists(fullPath)) {
+    // Target must be inside user's home directory
+    if (!isInsideHome(session->homeDir, fullPath)) {
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    // Check if it's a regular file or directory
+    // Declared file size (arg2): the upload replaces the file, so it
+    // must fit the quota in place of the current one. Checked before
+    // anything is received; users with a limit must declare it.
+    long long declared = -1;
+    if (msg->arg2[0]) {
+        char *end;
+        declared = strtoll(msg->arg2, &end, 10);
+        if (*end != '\0' || declared < 0) {
+            sendErrorMsg(clientFd);
+            return 0;
+        }
+    }
+
     struct stat st;
-    if (stat(fullPath, &st) < 0) {
+    int exists = fsStat(session, fullPath, &st) == 0;
+    if (exists && !S_ISREG(st.st_mode)) {
         sendErrorMsg(clientFd);
         return 0;
     }
+    long long current = exists ? (long long)st.st_size : 0;
 
-    int isFile = S_ISREG(st.st_mode);
-    int fd = -1;
+    QuotaChange quota;
+    if ((declared < 0 && quotaLimited(session->homeDir)) ||
+        quotaBegin(&quota, session->homeDir, declared - current) < 0) {
+        logWarn("[UPLOAD] Quota exceeded: %s bytes -> '%s'",
+                declared < 0 ? "undeclared" : msg->arg2, fullPath);
+        sendQuotaExceeded(clientFd);
+        return 0;
+    }
 
-    // If it's a file, lock it before deletion
-    if (isFile) {
-        fd = open(fullPath, O_RDWR);
+    // Received into a new "<path>.tmp-<pid>-<tag>" next to the target
+    // and renamed over it once complete: a broken or refused upload
+    // leaves the current file as it was (readers see the old or the new
+    // content). Only the name created here is ever unlinked.
+    char tmpPath[PATH_SIZE];
+    int fd = fsCreateTemp(session, fullPath, tmpPath, sizeof(tmpPath), 0700);
+    if (fd < 0 || (exists && fchmod(fd, st.st_mode & 07777) < 0)) {
+        logWarn("[UPLOAD] Cannot create a temporary file for '%s'", fullPath);
         if (fd >= 0) {
-            if (lockFileWrite(fd) < 0) {
-                close(fd);
-                sendErrorMsg(clientFd);
-                return 0;
-            }
+            close(fd);
+            fsUnlink(session, tmpPath);
         }
+        quotaEnd(&quota);
+        sendErrorMsg(clientFd);
+        return 0;
     }
 
-    // 7) Delete file or directory recursively
-    int ok = removeRecursive(fullPath);
+    // Acknowledge client and request file data
+    sendOk(clientFd, 0);
 
-    // Release lock if we locked it
-    if (fd >= 0) {
-        unlockFile(fd);
-        close(fd);
+    // Receive data extents straight into the file, holes stay holes.
+    // The declared size is binding: a stream announcing another size
+    // (beyond the quota reserved for it) is drained, nothing is written
+    SparseStats stats;
+    uint64_t t = traceBegin();
+    int rc = sparseReceiveFile(clientFd, fd, declared, maxUploadSize(), &stats);
+    traceEnd(t, "sparseReceiveFile", fullPath, stats.dataBytes);
+
+    if (rc > 0 && declared >= 0 && stats.fileSize != declared)
+        logWarn("[UPLOAD] '%s': stream of %lld bytes, %lld declared",
+                fullPath, stats.fileSize, declared);
+    long long after = fileSizeOf(fd);
+    close(fd);
+
+    // The old file is write-locked across the rename: a WRITE in
+    // progress finishes first, one waiting for the lock finds the new
+    // file (openForWrite checks the path still names what it locked)
+    if (rc == 0) {
+        int oldFd = exists ? fsOpen(session, fullPath, O_WRONLY | O_NONBLOCK, 0) : -1;
+        if (oldFd >= 0 && lockFileWrite(oldFd) < 0) {
+            close(oldFd);
+            oldFd = -1;
+        }
+
+        // Size of what is actually replaced, under its lock
+        struct stat oldSt;
+        if (oldFd >= 0 && fstat(oldFd, &oldSt) == 0) {
+            st = oldSt;
+            current = (long long)oldSt.st_size;
+        }
+
+        if (fsReplace(session, tmpPath, fullPath) < 0) {
+            logWarn("[UPLOAD] Cannot replace '%s': %s", fullPath, strerror(errno));
+            rc = 1;
+        }
+
+        if (oldFd >= 0) {
+            unlockFile(oldFd);
+            close(oldFd);
+        }
     }
 
     // Check result
-    if (ok < 0) {
+    if (rc != 0) {
+        fsUnlink(session, tmpPath);
+        quotaEnd(&quota);
+        if (rc < 0) {
+            logWarn("[UPLOAD] Stream of '%s' broken, closing the connection", fullPath);
+            return 1;
+        }
+        logWarn("[UPLOAD] Failed to receive '%s'", fullPath);
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    // Success
-    sendOk(clientFd, 0);
+    // The old content is gone: drop it from the cache, book the change
+    if (exists)
+        fileCacheInvalidate(&st);
+    DuChange du;
+    duChangeBegin(&du, session->homeDir);
+    duChangeApply(&du, fullPath, after - current, exists ? 0 : 1, 0);
+    duChangeEnd(&du);
+    quotaApply(&quota, after - current);
+    quotaEnd(&quota);
+
+    logInfo("[UPLOAD] '%s': %lld bytes, %lld data, %lld in holes",
+            fullPath, stats.fileSize, stats.dataBytes, stats.fileSize - stats.dataBytes);
+
+    // Send final OK with number of data bytes written
+    sendOk(clientFd, stats.dataBytes > INT_MAX ? INT_MAX : (int)stats.dataBytes);
     return 0;
 }
+
 // ================================================================
-// UPLOAD
+// DOWNLOAD
 // ================================================================
-int handleUpload(int clientFd, ProtocolMessage *msg, Session *session)
+int handleDownload(int clientFd, ProtocolMessage *msg, Session *session)
 {
-    debugCommand("UPLOAD", msg, session);
+    debugCommand("DOWNLOAD", msg, session);
 
     // User must be logged in
-    if (!ensureLoggedIn(clientFd, session, "UPLOAD"))
+    if (!ensureLoggedIn(clientFd, session, "DOWNLOAD"))
         return 0;
 
     char fullPath[PATH_SIZE];
-    int size = atoi(msg->arg2);
 
-    // Validate arguments
-    if (!msg->arg1[0] || size < 0) {
+    // Validate and resolve path
+    if (!msg->arg1[0] ||
+        resolvePath(session, msg->arg1, fullPath) < 0) {
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    // Resolve absolute path
-    if (resolvePath(session, msg->arg1, fullPath) < 0) {
+    // Target must be inside user's home directory
+    if (!isInsideHome(session->homeDir, fullPath)) {
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    // Target must be inside user's home directory
-    if (!isInsideHome(session->homeDir, fullPath)) {
-        sendErrorMsg(clientFd);
+    // Hot file: streamed from the shared cache, the file is not opened
+    char validator[VALIDATOR_SIZE] = "";
+    char *cached = NULL;
+    long long cachedLen = 0;
+    int wanted = 0;
+    if (cachedFile(session, fullPath, 0, &cached, &cachedLen, validator, &wanted) == 0) {
+        if (msg->arg3[0] != '\0' && fsValidatorEqual(msg->arg3, validator)) {
+            free(cached);
+            sendStatus(clientFd, STATUS_NOT_MODIFIED, 0);
+            logDebug("[DOWNLOAD] Not modified: '%s' (cached)", fullPath);
+            return 0;
+        }
+
+        sendOk(clientFd, cachedLen > INT_MAX ? INT_MAX : (int)cachedLen);
+        SparseStats stats;
+        int rc = sparseSendBuffer(clientFd, cached, cachedLen, &stats);
+        free(cached);
+        if (rc < 0) {
+            logWarn("[DOWNLOAD] Sending '%s' failed, closing the connection", fullPath);
+            return 1;
+        }
+        sendAll(clientFd, validator, VALIDATOR_SIZE);
+
+        logInfo("[DOWNLOAD] '%s': %lld bytes (cached)", fullPath, cachedLen);
         return 0;
     }
 
-    // Open file for writing (create if needed)
-    int fd = open(fullPath, O_WRONLY | O_CREAT, 0700);
+    // Open file for reading (never blocks on a FIFO, type checked below)
+    int fd = fsOpen(session, fullPath, O_RDONLY | O_NONBLOCK, 0);
     if (fd < 0) {
-        printf("[UPLOAD] Cannot open/create file '%s'\n", fullPath);
+        logWarn("[DOWNLOAD] Cannot open file '%s'", fullPath);
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    // Acquire exclusive lock for writing
-    if (lockFileWrite(fd) < 0) {
-        printf("[UPLOAD] Cannot lock file '%s' for writing\n", fullPath);
+    // Acquire shared lock for reading
+    if (lockFileRead(fd) < 0) {
+        logWarn("[DOWNLOAD] Cannot lock file '%s' for reading", fullPath);
         close(fd);
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    // Acknowledge client and request file data
-    sendOk(clientFd, 0);
-
-    // Receive file content
-    char *buffer = malloc(size);
-    if (!buffer) {
+    // Must be a regular file; size and mtime as seen under the lock
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
         unlockFile(fd);
         close(fd);
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    if (recvAll(clientFd, buffer, size) < 0) {
-        free(buffer);
+    // Conditional download (arg3 = if-none-match):
+    // hash the content only if size and mtime still match (a weak
+    // validator from READ needs nothing more)
+    if (msg->arg3[0] != '\0' && fsValidatorMatchesStat(msg->arg3, &st)) {
+        if (fsValidatorIsWeak(msg->arg3) ||
+            (fsFileValidator(fd, &st, validator, sizeof(validator)) == 0 &&
+             strcmp(msg->arg3, validator) == 0)) {
+            unlockFile(fd);
+            close(fd);
+            sendStatus(clientFd, STATUS_NOT_MODIFIED, 0);
+            logDebug("[DOWNLOAD] Not modified: '%s'", fullPath);
+            return 0;
+        }
+    }
+
+    // Stream data extents (file size travels inside the stream)
+    sendOk(clientFd, st.st_size > INT_MAX ? INT_MAX : (int)st.st_size);
+
+    // A hot file is read whole to be stored, and sent from memory
+    char *whole = wanted ? readWholeFile(fd, &st) : NULL;
+
+    SparseStats stats;
+    uint64_t t = traceBegin();
+    int rc = whole ? sparseSendBuffer(clientFd, whole, (long long)st.st_size, &stats)
+                   : sparseSendFile(clientFd, fd, (long long)st.st_size, &stats);
+    traceEnd(t, "sparseSendFile", fullPath, stats.dataBytes);
+
+    // The stream is cut (connection error, or the file was truncated
+    // behind our back while mapped): the client cannot find the next
+    // reply any more
+    if (rc == -2) {
+        free(whole);
         unlockFile(fd);
         close(fd);
-        sendErrorMsg(clientFd);
-        return 0;
+        logWarn("[DOWNLOAD] Sending '%s' failed, closing the connection", fullPath);
+        return 1;
     }
 
-    // Write received data to file (overwrite)
-    int written = fsWriteFile(fullPath, buffer, size, 0);
+    // Validator from the data we just sent (no second pass),
+    // empty if the file could not be read completely
+    memset(validator, 0, sizeof(validator));
+    if (rc == 0)
+        fsFormatValidator(&st, stats.hash, validator, sizeof(validator));
+
+    // Stored while still locked, like READ
+    if (whole && rc == 0)
+        fileCacheStore(&st, whole, validator);
+    free(whole);
 
-    free(buffer);
-    
     // Release lock and close
     unlockFile(fd);
     close(fd);
 
-    // Check result
-    if (written < 0) {
-        sendErrorMsg(clientFd);
-        return 0;
-    }
+    sendAll(clientFd, validator, VALIDATOR_SIZE);
 
-    // Send final OK with number of bytes written
-    sendOk(clientFd, written);
+    logInfo("[DOWNLOAD] '%s': %lld bytes, %lld data, %lld in holes",
+            fullPath, stats.fileSize, stats.dataBytes, stats.fileSize - stats.dataBytes);
+    return 0;
+}
+
+// Server side of the archive stream uses the normal fcntl locks
+static const ArchiveHooks serverArchiveHooks = {
+    lockFileRead, lockFileWrite, unlockFile, NULL, NULL, NULL
+};
+
+// Every file of an uploaded tree is its own quota bracket: its size is
+// reserved before it is written, its measured change booked after
+typedef struct {
+    const char *homeDir;
+    QuotaChange quota;
+    int         refused;             // Files over the limit
+} TreeQuota;
+
+static int treeFileBegin(void *ctx, long long size)
+{
+    TreeQuota *q = (TreeQuota *)ctx;
+    if (quotaBegin(&q->quota, q->homeDir, size) < 0) {
+        q->refused++;
+        return -1;
+    }
     return 0;
 }
 
+static void treeFileEnd(void *ctx, long long delta)
+{
+    TreeQuota *q = (TreeQuota *)ctx;
+    quotaApply(&q->quota, delta);
+    quotaEnd(&q->quota);
+}
+
 // ================================================================
-// DOWNLOAD
+// UPLOAD TREE (directory as one streamed archive)
 // ================================================================
-int handleDownload(int clientFd, ProtocolMessage *msg, Session *session)
+int handleUploadTree(int clientFd, ProtocolMessage *msg, Session *session)
 {
-    debugCommand("DOWNLOAD", msg, session);
+    debugCommand("UPLOAD_TREE", msg, session);
 
     // User must be logged in
-    if (!ensureLoggedIn(clientFd, session, "DOWNLOAD"))
+    if (!ensureLoggedIn(clientFd, session, "UPLOAD_TREE"))
         return 0;
 
     char fullPath[PATH_SIZE];
@@ -1441,58 +2986,119 @@ int handleDownload(int clientFd, ProtocolMessage *msg, Session *session)
         return 0;
     }
 
-    // Target must be a regular file
-    struct stat st;
-    if (stat(fullPath, &st) < 0 || !S_ISREG(st.st_mode)) {
-        sendErrorMsg(clientFd);
+    // The size of the tree is not known up front: it is refused here
+    // only if the home is already full, each file is checked on arrival
+    QuotaChange quota;
+    if (quotaBegin(&quota, session->homeDir, 1) < 0) {
+        logWarn("[UPLOAD_TREE] Quota exceeded -> '%s'", fullPath);
+        sendQuotaExceeded(clientFd);
         return 0;
     }
+    quotaEnd(&quota);
 
-    int size = (int)st.st_size;
+    // Target directory is created if missing, existing files are overwritten.
+    // The home's indexed totals are walked again afterwards
+    DuChange du;
+    duChangeBegin(&du, session->homeDir);
+    duChangeDrop(&du);
 
-    // Open file for reading
-    int fd = open(fullPath, O_RDONLY);
-    if (fd < 0) {
-        printf("[DOWNLOAD] Cannot open file '%s'\n", fullPath);
+    struct stat st;
+    if (fsStat(session, fullPath, &st) == 0) {
+        if (!S_ISDIR(st.st_mode)) {
+            duChangeEnd(&du);
+            sendErrorMsg(clientFd);
+            return 0;
+        }
+    } else if (fsCreate(session, fullPath, 0700, 1) < 0) {
+        logWarn("[UPLOAD_TREE] Cannot create directory '%s'", fullPath);
+        duChangeEnd(&du);
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    // Acquire shared lock for reading
-    if (lockFileRead(fd) < 0) {
-        printf("[DOWNLOAD] Cannot lock file '%s' for reading\n", fullPath);
-        close(fd);
+    // Acknowledge client and request the archive stream
+    sendOk(clientFd, 0);
+
+    ArchiveStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    TreeQuota tq = { session->homeDir, { -1, -1 }, 0 };
+    ArchiveHooks hooks = serverArchiveHooks;
+    hooks.fileBegin = treeFileBegin;
+    hooks.fileEnd   = treeFileEnd;
+    hooks.ctx       = &tq;
+
+    uint64_t t = traceBegin();
+    int rc = archiveReceiveTree(clientFd, fullPath, &hooks, &stats);
+    traceEnd(t, "archiveReceiveTree", fullPath, stats.bytes);
+    duChangeEnd(&du);
+
+    // The rest of the stream cannot be found: no reply, close instead
+    if (rc < 0) {
+        logWarn("[UPLOAD_TREE] Archive stream broken for '%s', closing the connection",
+                fullPath);
+        return 1;
+    }
+
+    logInfo("[UPLOAD_TREE] '%s': %lld file(s), %lld dir(s), %lld bytes, %d error(s)",
+            fullPath, stats.files, stats.dirs, stats.bytes, stats.errors);
+    if (tq.refused > 0)
+        logWarn("[UPLOAD_TREE] Quota exceeded: %d file(s) refused -> '%s'",
+                tq.refused, fullPath);
+
+    // Final status with number of files written
+    int status = tq.refused ? STATUS_QUOTA : stats.errors ? STATUS_ERROR : STATUS_OK;
+    sendStatus(clientFd, status, (int)stats.files);
+    return 0;
+}
+
+// ================================================================
+// DOWNLOAD TREE (directory as one streamed archive)
+// ================================================================
+int handleDownloadTree(int clientFd, ProtocolMessage *msg, Session *session)
+{
+    debugCommand("DOWNLOAD_TREE", msg, session);
+
+    // User must be logged in
+    if (!ensureLoggedIn(clientFd, session, "DOWNLOAD_TREE"))
+        return 0;
+
+    char fullPath[PATH_SIZE];
+
+    // Validate and resolve path
+    if (!msg->arg1[0] ||
+        resolvePath(session, msg->arg1, fullPath) < 0) {
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    // Allocate buffer and read file
-    char *buffer = malloc(size);
-    if (!buffer) {
-        unlockFile(fd);
-        close(fd);
+    // Target must be a directory inside user's home directory
+    struct stat st;
+    if (!isInsideHome(session->homeDir, fullPath) ||
+        fsStat(session, fullPath, &st) < 0 || !S_ISDIR(st.st_mode)) {
         sendErrorMsg(clientFd);
         return 0;
     }
 
-    int readBytes = fsReadFile(fullPath, buffer, size, 0);
+    // Archive follows the OK, the END entry carries our error count
+    sendOk(clientFd, 0);
 
-    // Release lock and close
-    unlockFile(fd);
-    close(fd);
+    ArchiveStats stats;
+    memset(&stats, 0, sizeof(stats));
 
-    // Check read result
-    if (readBytes < 0) {
-        free(buffer);
-        sendErrorMsg(clientFd);
-        return 0;
-    }
+    uint64_t t = traceBegin();
+    int rc = archiveSendTree(clientFd, fullPath, &serverArchiveHooks, &stats);
+    traceEnd(t, "archiveSendTree", fullPath, stats.bytes);
 
-    // Send file size and content to client
-    sendOk(clientFd, readBytes);
-    sendAll(clientFd, buffer, readBytes);
+    // The stream is cut short: the client cannot find the next reply
+    if (rc < 0) {
+        logWarn("[DOWNLOAD_TREE] Connection lost while sending '%s', closing the connection",
+                fullPath);
+        return 1;
+    }
 
-    free(buffer);
+    logInfo("[DOWNLOAD_TREE] '%s': %lld file(s), %lld dir(s), %lld bytes, %d error(s)",
+            fullPath, stats.files, stats.dirs, stats.bytes, stats.errors);
     return 0;
 }
 
@@ -1505,7 +3111,7 @@ int handleDeleteUser(int clientFd, ProtocolMessage *msg, Session *session)
 
     // User must NOT be logged in
     if (session->isLoggedIn) {
-        printf("[DELETE_USER] ERROR: must NOT be logged in\n");
+        logWarn("[DELETE_USER] ERROR: must NOT be logged in");
         sendErrorMsg(clientFd);
         return 0;
     }
@@ -1551,6 +3157,11 @@ int handleDeleteUser(int clientFd, ProtocolMessage *msg, Session *session)
 
     int error = 0;
 
+    // The home goes away: its totals (and the root's) are walked again
+    DuChange du;
+    duChangeBegin(&du, homePath);
+    duChangeDrop(&du);
+
     // ============================================================
     // Delete system user
     // ============================================================
@@ -1589,6 +3200,12 @@ int handleDeleteUser(int clientFd, ProtocolMessage *msg, Session *session)
         }
     }
 
+    duChangeEnd(&du);
+
+    // The limit goes with the user
+    if (!error)
+        quotaSet(target, -1);
+
     // Drop root privileges
     dropFromRoot(old_euid);
 
@@ -1598,7 +3215,59 @@ int handleDeleteUser(int clientFd, ProtocolMessage *msg, Session *session)
         return 0;
     }
 
-    printf("[DELETE_USER] '%s' deleted successfully\n", target);
+    logInfo("[DELETE_USER] '%s' deleted successfully", target);
+    sendOk(clientFd, 0);
+    return 0;
+}
+
+// ================================================================
+// COMPRESS (negotiate payload compression for this connection)
+// ================================================================
+int handleCompress(int clientFd, ProtocolMessage *msg, Session *session)
+{
+    debugCommand("COMPRESS", msg, session);
+
+    // Only the in-tree codec is supported
+    if (strcmp(msg->arg1, PAYLOAD_CODEC_LZ) != 0) {
+        logWarn("[COMPRESS] ERROR: unsupported codec '%s'", msg->arg1);
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+
+    // Reply is sent raw and carries no data, compression starts with
+    // the next payload
     sendOk(clientFd, 0);
+    setPayloadCompression(clientFd, 1);
+
+    logInfo("[COMPRESS] OK codec='%s'", msg->arg1);
+    return 0;
+}
+
+// ================================================================
+// STATS (latency histograms and traffic of all sessions)
+// ================================================================
+int handleStats(int clientFd, ProtocolMessage *msg, Session *session)
+{
+    debugCommand("STATS", msg, session);
+
+    // User must be logged in
+    if (!ensureLoggedIn(clientFd, session, "STATS"))
+        return 0;
+
+    // arg1: "" = latency table, "locks" = lock contention
+    char report[16384];
+    int len;
+
+    if (msg->arg1[0] == '\0') {
+        len = statsFormat(report, sizeof(report));
+    } else if (strcmp(msg->arg1, "locks") == 0) {
+        len = statsFormatLocks(report, sizeof(report), STATS_LOCK_TOP);
+    } else {
+        sendErrorMsg(clientFd);
+        return 0;
+    }
+
+    sendOk(clientFd, len);
+    sendPayload(clientFd, report, len);
     return 0;
-}
\ No newline at end of file
+}
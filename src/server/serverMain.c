@@ -16,6 +16,17 @@
 #include "../../include/protocol.h"
 #include "../../include/serverCommands.h"
 #include "../../include/session.h"
+#include "../../include/stats.h"
+#include "../../include/log.h"
+#include "../../include/metrics.h"
+#include "../../include/trace.h"
+#include "../../include/capture.h"
+#include "../../include/sessionTable.h"
+#include "../../include/admin.h"
+#include "../../include/mdCache.h"
+#include "../../include/du.h"
+#include "../../include/quota.h"
+#include "../../include/fileCache.h"
 
 // Global root directory, used by other modules (fsOps, session, ...)
 const char *gRootDir = NULL;
@@ -25,19 +36,57 @@ const char *gRootDir = NULL;
 // ---------------------------------------------
 #define MAX_CHILDREN 1024
 #define STATUS_FORCE_LOGOUT 99
+#define SESSION_POLL_MS 1000    // Idle sessions re-check drain / shutdown
 
 static pid_t children[MAX_CHILDREN];
 static int   childCount = 0;
 
 static volatile sig_atomic_t shutdownRequested = 0;
 
+// ------------------------------------------------------------
+// Session children bookkeeping (free slots are 0).
+// SIGCHLD is blocked while the main loop adds a child.
+// ------------------------------------------------------------
+static void trackChild(pid_t pid)
+{
+    for (int i = 0; i < childCount; i++) {
+        if (children[i] == 0) {
+            children[i] = pid;
+            return;
+        }
+    }
+    if (childCount < MAX_CHILDREN)
+        children[childCount++] = pid;
+}
+
+static int untrackChild(pid_t pid)
+{
+    for (int i = 0; i < childCount; i++) {
+        if (children[i] == pid) {
+            children[i] = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
 // ------------------------------------------------------------
 // SIGCHLD handler — reap zombie processes
 // ------------------------------------------------------------
 static void handleChildSignal(int sig)
 {
     (void)sig;
-    while (waitpid(-1, NULL, WNOHANG) > 0) {}
+    int savedErrno = errno;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+        if (untrackChild(pid)) {
+            statsSessionEnded();
+            sessionTableRelease(pid);
+        }
+    }
+
+    errno = savedErrno;
 }
 
 // ------------------------------------------------------------
@@ -122,6 +171,25 @@ static int ensureCsapGroupExists(void)
     }
 }
 
+// ------------------------------------------------------------
+// Client address as "ip:port"
+// ------------------------------------------------------------
+static const char *peerName(int fd)
+{
+    static char name[64];
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    if (getpeername(fd, (struct sockaddr *)&addr, &len) < 0 ||
+        addr.sin_family != AF_INET ||
+        !inet_ntop(AF_INET, &addr.sin_addr, name, sizeof(name)))
+        return "?";
+
+    size_t used = strlen(name);
+    snprintf(name + used, sizeof(name) - used, ":%d", ntohs(addr.sin_port));
+    return name;
+}
+
 // ------------------------------------------------------------
 // Server banner
 // ------------------------------------------------------------
@@ -144,7 +212,9 @@ static void runConsoleWatcher(pid_t parentPid)
 {
     char line[256];
 
-    printf("[CONSOLE] Type 'exit' or CTRL+C to stop the server.\n");
+    printf("[CONSOLE] Type 'exit' or CTRL+C to stop the server, 'stats' for statistics,\n"
+           "          'locks' for lock contention,\n"
+           "          'loglevel <error|warn|info|debug>' to change log verbosity.\n");
     fflush(stdout);
 
     while (fgets(line, sizeof(line), stdin) != NULL) {
@@ -159,6 +229,34 @@ static void runConsoleWatcher(pid_t parentPid)
             kill(parentPid, SIGTERM);
             break;
         }
+
+        if (strncmp(line, "loglevel ", 9) == 0) {
+            int level = logParseLevel(line + 9);
+            if (level < 0) {
+                printf("[CONSOLE] Unknown log level '%s'\n", line + 9);
+            } else {
+                logSetLevel(level);
+                printf("[CONSOLE] Log level set to %s\n", logLevelName(level));
+                if (level > LOG_COMPILE_LEVEL)
+                    printf("[CONSOLE] %s messages are compiled out of this build\n",
+                           logLevelName(level));
+            }
+            fflush(stdout);
+        }
+
+        if (strcmp(line, "stats") == 0) {
+            char report[8192];
+            statsFormat(report, sizeof(report));
+            fputs(report, stdout);
+            fflush(stdout);
+        }
+
+        if (strcmp(line, "locks") == 0) {
+            char report[16384];
+            statsFormatLocks(report, sizeof(report), STATS_LOCK_TOP);
+            fputs(report, stdout);
+            fflush(stdout);
+        }
     }
 
     _exit(0);
@@ -344,6 +442,90 @@ int main(int argc, char *argv[])
     // Print server banner
     printBanner(rootDir, ip, port);
 
+    // Log rings and the drain process (the only writer of the log file)
+    if (logInit() < 0 || logStartDrain() < 0)
+        printf("[WARNING] Asynchronous logging disabled, logging to stdout\n");
+
+    // Shared statistics segment, inherited by every process forked below
+    if (statsInit() < 0)
+        printf("[WARNING] Statistics disabled\n");
+
+    // Live session table for the admin socket
+    if (sessionTableInit() < 0)
+        printf("[WARNING] Session table disabled\n");
+
+    // Optional request tracing (FILESERVER_TRACE_DIR)
+    traceInit();
+
+    // Optional traffic capture for the replay tool (FILESERVER_CAPTURE_DIR)
+    captureInit();
+
+    // -----------------------------------------------------
+    // Directory metadata cache and its inotify watcher process
+    // -----------------------------------------------------
+    pid_t mdCachePid = -1;
+    int mdCacheOn = mdCacheInit();
+    if (mdCacheOn < 0)
+        printf("[WARNING] Directory metadata cache disabled\n");
+    if (mdCacheOn > 0) {
+        mdCachePid = fork();
+        if (mdCachePid == 0) {
+            close(serverFd);
+            mdCacheServe(getppid());
+        }
+    }
+
+    // Disk usage index, kept up to date by the handlers
+    if (duIndexInit() < 0)
+        printf("[WARNING] Disk usage index disabled\n");
+
+    // Hot file cache, filled and invalidated by the handlers
+    if (fileCacheInit() < 0)
+        printf("[WARNING] File cache disabled\n");
+
+    // -----------------------------------------------------
+    // Quota ledger and its reconciliation process
+    // -----------------------------------------------------
+    pid_t quotaPid = -1;
+    int quotaOn = quotaInit(port);
+    if (quotaOn < 0)
+        printf("[WARNING] Quotas disabled\n");
+    if (quotaOn > 0) {
+        quotaPid = fork();
+        if (quotaPid == 0) {
+            close(serverFd);
+            quotaServe(getppid());
+        }
+    }
+
+    // -----------------------------------------------------
+    // Metrics endpoint process
+    // -----------------------------------------------------
+    pid_t metricsPid = -1;
+    int metricsFd = metricsOpen(port);
+    if (metricsFd >= 0) {
+        metricsPid = fork();
+        if (metricsPid == 0) {
+            close(serverFd);
+            metricsServe(metricsFd, getppid());
+        }
+        close(metricsFd);
+    }
+
+    // -----------------------------------------------------
+    // Admin control socket process
+    // -----------------------------------------------------
+    pid_t adminPid = -1;
+    int adminFd = adminOpen(port);
+    if (adminFd >= 0) {
+        adminPid = fork();
+        if (adminPid == 0) {
+            close(serverFd);
+            adminServe(adminFd, getppid());
+        }
+        close(adminFd);
+    }
+
     // -----------------------------------------------------
     // Console watcher process
     // -----------------------------------------------------
@@ -352,6 +534,10 @@ int main(int argc, char *argv[])
         runConsoleWatcher(getppid());
     }
 
+    sigset_t chldMask, oldMask;
+    sigemptyset(&chldMask);
+    sigaddset(&chldMask, SIGCHLD);
+
     // =====================================================
     // POLL-BASED ACCEPT LOOP
     // =====================================================
@@ -368,7 +554,7 @@ int main(int argc, char *argv[])
         if (pollRet < 0) {
             if (errno == EINTR)
                 continue; // Interrupted by signal
-            perror("poll");
+            logError("[SERVER] poll: %s", strerror(errno));
             break;
         }
 
@@ -390,23 +576,44 @@ int main(int argc, char *argv[])
             if (clientFd < 0) {
                 if (errno == EINTR)
                     continue;
-                perror("acceptClient");
+                logWarn("[SERVER] acceptClient: %s", strerror(errno));
                 continue;
             }
 
+            // A child that exits at once must not be reaped before it is tracked
+            sigprocmask(SIG_BLOCK, &chldMask, &oldMask);
+
+            uint64_t forkStart = statsNow();
             pid_t pid = fork();
 
             if (pid == 0) {
                 // Child: handle client
+                sigprocmask(SIG_SETMASK, &oldMask, NULL);
                 close(serverFd);
 
+                // Before login switches the effective uid
+                traceSessionStart();
+                captureSessionStart();
+                sessionTableJoin(peerName(clientFd));
+
                 Session session;
                 initSession(&session);
 
                 ProtocolMessage msg;
                 while (1) {
+                    // Drain (admin socket) or shutdown: close between commands
+                    if (shutdownRequested || sessionTableDraining()) {
+                        logInfo("[SESSION] Closing session (%s)",
+                                shutdownRequested ? "shutdown" : "drained by admin");
+                        break;
+                    }
+
+                    struct pollfd cpfd = { clientFd, POLLIN, 0 };
+                    if (poll(&cpfd, 1, SESSION_POLL_MS) <= 0)
+                        continue;
+
                     if (receiveMessage(clientFd, &msg) < 0) {
-                        printf("[INFO] Client disconnected.\n");
+                        logInfo("[SESSION] Client disconnected");
                         break;
                     }
 
@@ -416,7 +623,9 @@ int main(int argc, char *argv[])
                         break;
                     }
 
-                    processCommand(clientFd, &msg, &session);
+                    // Non-zero: the handler ended the connection (watch)
+                    if (processCommand(clientFd, &msg, &session))
+                        break;
                 }
 
                 close(clientFd);
@@ -424,8 +633,13 @@ int main(int argc, char *argv[])
             }
 
             // Parent: track child and close client FD
-            if (childCount < MAX_CHILDREN)
-                children[childCount++] = pid;
+            if (pid > 0) {
+                statsSessionStarted(statsNow() - forkStart);
+                trackChild(pid);
+            } else {
+                logError("[SERVER] fork: %s", strerror(errno));
+            }
+            sigprocmask(SIG_SETMASK, &oldMask, NULL);
 
             close(clientFd);
         }
@@ -435,6 +649,14 @@ int main(int argc, char *argv[])
     printf("\n[SHUTDOWN] Server shutting down...\n");
     close(serverFd);
     kill(consolePid, SIGKILL);
+    if (metricsPid > 0)
+        kill(metricsPid, SIGTERM);
+    if (adminPid > 0)
+        kill(adminPid, SIGTERM);
+    if (mdCachePid > 0)
+        kill(mdCachePid, SIGTERM);
+    if (quotaPid > 0)
+        kill(quotaPid, SIGTERM);
 
     // Terminate all active client handlers
     for (int i = 0; i < childCount; i++) {
@@ -443,7 +665,14 @@ int main(int argc, char *argv[])
         }
     }
 
-    // Wait for all children to exit
+    // Wait for client handlers, then let the drain flush their last records
+    for (int i = 0; i < childCount; i++) {
+        if (children[i] > 0)
+            waitpid(children[i], NULL, 0);
+    }
+    logShutdown();
+
+    // Wait for all remaining children to exit
     while (waitpid(-1, NULL, 0) > 0) {}
 
     printf("[SHUTDOWN] All client handlers terminated.\n");
@@ -12,6 +12,9 @@ void initSession(Session *s)
     s->username[0]   = '\0';
     s->homeDir[0]    = '\0';
     s->currentDir[0] = '\0';
+    s->rootFd = -1;
+    s->homeFd = -1;
+    s->cwdFd  = -1;
 }
 
 // ------------------------------------------------------------
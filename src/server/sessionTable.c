@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../../include/sessionTable.h"
+#include "../../include/stats.h"
+
+// Global root directory (cwd is shown relative to it)
+extern const char *gRootDir;
+
+static SessionSlot *table  = NULL;        // NULL = table disabled
+static SessionSlot *mySlot = NULL;        // Slot of this session process
+
+// ------------------------------------------------------------
+// Create shared table, inherited by every fork()
+// ------------------------------------------------------------
+int sessionTableInit(void)
+{
+    void *p = mmap(NULL, sizeof(SessionSlot) * SESSION_TABLE_SLOTS,
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("[SESSIONS] mmap");
+        return -1;
+    }
+
+    memset(p, 0, sizeof(SessionSlot) * SESSION_TABLE_SLOTS);
+    table = (SessionSlot *)p;
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Sequence counter around text field updates (single writer)
+// ------------------------------------------------------------
+static void beginWrite(SessionSlot *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void endWrite(SessionSlot *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+// ============================================================
+// SESSION PROCESS
+// ============================================================
+void sessionTableJoin(const char *peer)
+{
+    if (!table)
+        return;
+
+    pid_t self = getpid();
+
+    for (int i = 0; i < SESSION_TABLE_SLOTS; i++) {
+        pid_t expected = 0;
+        if (!__atomic_compare_exchange_n(&table[i].pid, &expected, self, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            continue;
+
+        SessionSlot *s = &table[i];
+        uint64_t now = statsNow();
+
+        beginWrite(s);
+        snprintf(s->peer, sizeof(s->peer), "%s", peer ? peer : "?");
+        s->user[0] = '\0';
+        s->cwd[0]  = '\0';
+        s->arg[0]  = '\0';
+        s->command        = -1;
+        s->drain          = 0;
+        s->startNs        = now;
+        s->commandStartNs = 0;
+        s->lastActiveNs   = now;
+        s->commandBase    = 0;
+        s->commands       = 0;
+        s->bytesIn        = 0;
+        s->bytesOut       = 0;
+        endWrite(s);
+
+        mySlot = s;
+        return;
+    }
+}
+
+void sessionTableCommandStart(int command, const char *arg)
+{
+    SessionSlot *s = mySlot;
+    if (!s)
+        return;
+
+    beginWrite(s);
+    snprintf(s->arg, sizeof(s->arg), "%s", arg ? arg : "");
+    s->commandStartNs = statsNow();
+    s->commandBase    = s->bytesIn + s->bytesOut;
+    s->command        = command;
+    endWrite(s);
+}
+
+void sessionTableCommandEnd(const Session *session)
+{
+    SessionSlot *s = mySlot;
+    if (!s)
+        return;
+
+    beginWrite(s);
+    if (session->isLoggedIn) {
+        size_t rootLen = strlen(gRootDir);
+        const char *rel = session->currentDir;
+        if (strncmp(rel, gRootDir, rootLen) == 0)
+            rel += rootLen;
+
+        snprintf(s->user, sizeof(s->user), "%s", session->username);
+        snprintf(s->cwd, sizeof(s->cwd), "%.*s", (int)sizeof(s->cwd) - 1, rel[0] ? rel : "/");
+    } else {
+        s->user[0] = '\0';
+        s->cwd[0]  = '\0';
+    }
+    s->command      = -1;
+    s->lastActiveNs = statsNow();
+    s->commands++;
+    endWrite(s);
+}
+
+// Called for every send/recv: two plain stores, no sequence bump
+void sessionTableTraffic(unsigned long long bytesIn, unsigned long long bytesOut)
+{
+    SessionSlot *s = mySlot;
+    if (!s)
+        return;
+
+    __atomic_store_n(&s->bytesIn, bytesIn, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->bytesOut, bytesOut, __ATOMIC_RELAXED);
+}
+
+int sessionTableDraining(void)
+{
+    return mySlot && __atomic_load_n(&mySlot->drain, __ATOMIC_RELAXED);
+}
+
+// ============================================================
+// MAIN PROCESS
+// ============================================================
+void sessionTableRelease(pid_t pid)
+{
+    if (!table || pid <= 0)
+        return;
+
+    for (int i = 0; i < SESSION_TABLE_SLOTS; i++) {
+        if (__atomic_load_n(&table[i].pid, __ATOMIC_RELAXED) == pid) {
+            __atomic_store_n(&table[i].pid, 0, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+}
+
+// ============================================================
+// READERS
+// ============================================================
+int sessionTableSnapshot(SessionSlot *out, int max)
+{
+    int count = 0;
+
+    if (!table)
+        return 0;
+
+    for (int i = 0; i < SESSION_TABLE_SLOTS && count < max; i++) {
+        SessionSlot *s = &table[i];
+
+        for (int attempt = 0; attempt < 100; attempt++) {
+            uint32_t before = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+            if (before & 1) {
+                usleep(10);
+                continue;
+            }
+
+            memcpy(&out[count], s, sizeof(SessionSlot));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+            if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != before)
+                continue;
+
+            // Counters change without the sequence, read them last
+            out[count].bytesIn  = __atomic_load_n(&s->bytesIn, __ATOMIC_RELAXED);
+            out[count].bytesOut = __atomic_load_n(&s->bytesOut, __ATOMIC_RELAXED);
+
+            if (out[count].pid != 0)
+                count++;
+            break;
+        }
+    }
+
+    return count;
+}
+
+int sessionTableHas(pid_t pid)
+{
+    if (!table || pid <= 0)
+        return 0;
+
+    for (int i = 0; i < SESSION_TABLE_SLOTS; i++) {
+        if (__atomic_load_n(&table[i].pid, __ATOMIC_RELAXED) == pid)
+            return 1;
+    }
+    return 0;
+}
+
+int sessionTableDrain(pid_t pid)
+{
+    if (!table || pid <= 0)
+        return -1;
+
+    for (int i = 0; i < SESSION_TABLE_SLOTS; i++) {
+        if (__atomic_load_n(&table[i].pid, __ATOMIC_RELAXED) == pid) {
+            __atomic_store_n(&table[i].drain, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+    return -1;
+}
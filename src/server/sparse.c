@@ -0,0 +1,397 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "../../include/sparse.h"
+#include "../../include/payload.h"
+#include "../../include/utils.h"
+
+// Called for every non-zero run of data
+typedef int (*ExtentFn)(void *ctx, long long offset, const char *data, int len);
+
+// ------------------------------------------------------------
+// All bytes zero? (compare the block against itself shifted by one)
+// ------------------------------------------------------------
+static int isZeroBlock(const char *p, int n)
+{
+    return p[0] == 0 && memcmp(p, p + 1, n - 1) == 0;
+}
+
+// ------------------------------------------------------------
+// Split one buffer of file data into non-zero runs
+// ------------------------------------------------------------
+static int emitRuns(const char *buf, int len, long long offset,
+                    ExtentFn fn, void *ctx)
+{
+    int runStart = -1;
+
+    for (int i = 0; i < len; i += SPARSE_ZERO_BLOCK) {
+        int n = (len - i < SPARSE_ZERO_BLOCK) ? len - i : SPARSE_ZERO_BLOCK;
+        int zero = isZeroBlock(buf + i, n);
+
+        if (!zero && runStart < 0)
+            runStart = i;
+
+        if (zero && runStart >= 0) {
+            if (fn(ctx, offset + runStart, buf + runStart, i - runStart) < 0)
+                return -1;
+            runStart = -1;
+        }
+    }
+
+    if (runStart >= 0 &&
+        fn(ctx, offset + runStart, buf + runStart, len - runStart) < 0)
+        return -1;
+
+    return 0;
+}
+
+// ------------------------------------------------------------
+// Walk the data extents of fd in [0, size)
+// Large files are read through a sliding mapping (no copy into a
+// buffer); small ones, or files that cannot be mapped, with pread
+// ------------------------------------------------------------
+typedef struct {
+    int         fd;
+    long long   size;
+    ExtentFn    fn;
+    void       *ctx;
+    int         mapped;         // Still trying mappings
+    FileMap     map;
+    const char *mapData;        // File data at mapStart
+    long long   mapStart;
+    long long   mapEnd;
+    char       *buf;            // pread buffer
+} ExtentWalk;
+
+// Up to want bytes of the file at off (*got of them), NULL on error
+static const char *readPiece(ExtentWalk *w, long long off, int want, int *got)
+{
+    if (w->mapped && (off < w->mapStart || off + want > w->mapEnd)) {
+        unmapFileRange(&w->map);
+        long long len = (w->size - off < MAP_WINDOW) ? w->size - off : MAP_WINDOW;
+        w->mapData  = mapFileRange(w->fd, off, len, &w->map);
+        w->mapStart = off;
+        w->mapEnd   = off + len;
+        if (!w->mapData)
+            w->mapped = 0;
+    }
+    if (w->mapped) {
+        *got = want;
+        return w->mapData + (off - w->mapStart);
+    }
+
+    if (!w->buf && !(w->buf = malloc(SPARSE_IO_SIZE)))
+        return NULL;
+
+    ssize_t r;
+    do {
+        r = pread(w->fd, w->buf, want, off);
+    } while (r < 0 && errno == EINTR);
+
+    if (r <= 0)
+        return NULL;
+    *got = (int)r;
+    return w->buf;
+}
+
+static int walkExtents(void *arg)
+{
+    ExtentWalk *w = (ExtentWalk *)arg;
+    long long pos = 0;
+
+    while (pos < w->size) {
+        long long dataStart = lseek(w->fd, pos, SEEK_DATA);
+        long long dataEnd;
+
+        if (dataStart < 0) {
+            // Only a hole is left
+            if (errno == ENXIO)
+                break;
+
+            // Filesystem without hole support: everything is data
+            if (errno != EINVAL && errno != EOPNOTSUPP)
+                return -1;
+            dataStart = pos;
+            dataEnd   = w->size;
+        } else {
+            dataEnd = lseek(w->fd, dataStart, SEEK_HOLE);
+            if (dataEnd < 0)
+                dataEnd = w->size;
+        }
+
+        if (dataStart >= w->size)
+            break;
+        if (dataEnd > w->size)
+            dataEnd = w->size;
+
+        long long off = dataStart;
+        while (off < dataEnd) {
+            long long left = dataEnd - off;
+            int want = (left < SPARSE_IO_SIZE) ? (int)left : SPARSE_IO_SIZE;
+            int got;
+
+            const char *data = readPiece(w, off, want, &got);
+            if (!data || emitRuns(data, got, off, w->fn, w->ctx) < 0)
+                return -1;
+            off += got;
+        }
+
+        pos = dataEnd;
+    }
+
+    return 0;
+}
+
+static int forEachExtent(int fd, long long size, ExtentFn fn, void *ctx)
+{
+    ExtentWalk w;
+    memset(&w, 0, sizeof(w));
+    w.fd     = fd;
+    w.size   = size;
+    w.fn     = fn;
+    w.ctx    = ctx;
+    w.mapped = size >= MAP_READ_MIN;
+
+    // A file truncated behind our back ends the walk like a read error
+    int rc = w.mapped ? runMapGuarded(walkExtents, &w) : walkExtents(&w);
+
+    unmapFileRange(&w.map);
+    free(w.buf);
+    return rc;
+}
+
+// ------------------------------------------------------------
+// Same walk over data in memory (a file without holes: one extent
+// from 0, read in SPARSE_IO_SIZE pieces)
+// ------------------------------------------------------------
+static int forEachChunk(const char *data, long long size, ExtentFn fn, void *ctx)
+{
+    for (long long off = 0; off < size; off += SPARSE_IO_SIZE) {
+        int n = (size - off < SPARSE_IO_SIZE) ? (int)(size - off) : SPARSE_IO_SIZE;
+        if (emitRuns(data + off, n, off, fn, ctx) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int sparseIsDense(int fd, long long size)
+{
+    if (size <= 0)
+        return 1;
+
+    long long dataStart = lseek(fd, 0, SEEK_DATA);
+    if (dataStart < 0)
+        return errno == EINVAL || errno == EOPNOTSUPP;   // No hole support
+
+    return dataStart == 0 && lseek(fd, 0, SEEK_HOLE) >= size;
+}
+
+// ============================================================
+// HASH
+// ============================================================
+static unsigned long long hashExtent(unsigned long long h, long long offset,
+                                     const char *data, int len)
+{
+    h = hashBytes(h, &offset, sizeof(offset));
+    return hashBytes(h, data, len);
+}
+
+static int hashFn(void *ctx, long long offset, const char *data, int len)
+{
+    unsigned long long *h = (unsigned long long *)ctx;
+    *h = hashExtent(*h, offset, data, len);
+    return 0;
+}
+
+int sparseHashFile(int fd, long long size, unsigned long long *hash)
+{
+    *hash = HASH_SEED;
+    return forEachExtent(fd, size, hashFn, hash);
+}
+
+// ============================================================
+// SEND
+// ============================================================
+typedef struct {
+    int          sock;
+    SparseStats *stats;
+    int          cut;           // Stream left incomplete
+} SendCtx;
+
+static int sendFn(void *ctx, long long offset, const char *data, int len)
+{
+    SendCtx *c = (SendCtx *)ctx;
+
+    SparseExtent ext;
+    ext.offset = offset;
+    ext.length = len;
+
+    // Cut until the whole extent is out: a fault reading mapped data
+    // jumps out of here halfway through it
+    c->cut = 1;
+    if (sendPayload(c->sock, &ext, sizeof(ext)) < 0 ||
+        sendPayload(c->sock, data, len) < 0)
+        return -1;
+    c->cut = 0;
+
+    c->stats->dataBytes += len;
+    c->stats->hash = hashExtent(c->stats->hash, offset, data, len);
+    return 0;
+}
+
+int sparseSendFile(int sock, int fd, long long size, SparseStats *stats)
+{
+    SendCtx ctx = { sock, stats, 0 };
+
+    stats->fileSize  = size;
+    stats->dataBytes = 0;
+    stats->hash      = HASH_SEED;
+
+    if (sendPayload(sock, &size, sizeof(size)) < 0)
+        return -1;
+
+    // A read error still has to end the stream cleanly
+    int rc = forEachExtent(fd, size, sendFn, &ctx);
+    if (ctx.cut)
+        return -2;
+
+    SparseExtent end;
+    end.offset = size;
+    end.length = 0;
+
+    if (sendPayload(sock, &end, sizeof(end)) < 0)
+        return -1;
+
+    return rc;
+}
+
+int sparseSendBuffer(int sock, const char *data, long long size, SparseStats *stats)
+{
+    SendCtx ctx = { sock, stats, 0 };
+
+    stats->fileSize  = size;
+    stats->dataBytes = 0;
+    stats->hash      = HASH_SEED;
+
+    SparseExtent end;
+    end.offset = size;
+    end.length = 0;
+
+    // Nothing to read here: any failure is a connection error
+    if (sendPayload(sock, &size, sizeof(size)) < 0 ||
+        forEachChunk(data, size, sendFn, &ctx) < 0 || ctx.cut ||
+        sendPayload(sock, &end, sizeof(end)) < 0)
+        return -2;
+    return 0;
+}
+
+// ============================================================
+// RECEIVE
+// ============================================================
+static int pwriteAll(int fd, const char *data, int len, long long offset)
+{
+    int done = 0;
+
+    while (done < len) {
+        ssize_t w = pwrite(fd, data + done, len - done, offset + done);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += (int)w;
+    }
+    return 0;
+}
+
+int sparseReceiveFile(int sock, int fd, long long expected, long long maxSize,
+                      SparseStats *stats)
+{
+    long long fileSize;
+
+    stats->fileSize  = 0;
+    stats->dataBytes = 0;
+    stats->hash      = HASH_SEED;
+
+    if (recvPayload(sock, &fileSize, sizeof(fileSize)) < 0)
+        return -1;
+
+    if (fileSize < 0) {
+        fprintf(stderr, "sparse: invalid file size %lld\n", fileSize);
+        return -1;
+    }
+
+    char *buf = malloc(SPARSE_IO_SIZE);
+    if (!buf)
+        return -1;
+
+    // Too large or not the size announced before: drained below, the
+    // file is left alone
+    int failed = fileSize > maxSize || (expected >= 0 && fileSize != expected);
+    if (failed)
+        fprintf(stderr, "sparse: file size %lld refused (expected %lld, limit %lld)\n",
+                fileSize, expected, maxSize);
+    stats->fileSize = fileSize;
+
+    // Start from an empty file: everything not written stays a hole
+    if (!failed && ftruncate(fd, 0) < 0)
+        failed = 1;
+    int rc = 0;
+
+    while (1) {
+        SparseExtent ext;
+        if (recvPayload(sock, &ext, sizeof(ext)) < 0) {
+            rc = -1;
+            break;
+        }
+
+        if (ext.length == 0)
+            break;
+
+        if (ext.offset < 0 || ext.length < 0 || ext.offset > fileSize - ext.length) {
+            fprintf(stderr, "sparse: corrupt extent %lld+%lld\n", ext.offset, ext.length);
+            rc = -1;
+            break;
+        }
+
+        long long off  = ext.offset;
+        long long left = ext.length;
+
+        while (left > 0) {
+            int n = (left < SPARSE_IO_SIZE) ? (int)left : SPARSE_IO_SIZE;
+
+            if (recvPayload(sock, buf, n) < 0) {
+                rc = -1;
+                break;
+            }
+
+            // Keep draining after a write error to stay in sync
+            if (!failed && pwriteAll(fd, buf, n, off) < 0)
+                failed = 1;
+
+            off  += n;
+            left -= n;
+        }
+
+        if (rc < 0)
+            break;
+
+        stats->dataBytes += ext.length;
+    }
+
+    free(buf);
+
+    if (rc < 0)
+        return -1;
+
+    // Trailing hole
+    if (!failed && ftruncate(fd, fileSize) < 0)
+        failed = 1;
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "../../include/stats.h"
+#include "../../include/protocol.h"
+#include "../../include/utils.h"
+
+// Shared segment (NULL = statistics disabled)
+static ServerStats *gStats = NULL;
+
+// Command this process is handling
+static int currentCommand = STATS_MAX_COMMANDS - 1;
+
+// ------------------------------------------------------------
+// Create shared segment, inherited by every fork()
+// ------------------------------------------------------------
+int statsInit(void)
+{
+    void *p = mmap(NULL, sizeof(ServerStats), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("[STATS] mmap");
+        return -1;
+    }
+
+    memset(p, 0, sizeof(ServerStats));
+    gStats = (ServerStats *)p;
+    gStats->startTime = (uint64_t)time(NULL);
+    return 0;
+}
+
+uint64_t statsNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// ------------------------------------------------------------
+// Histogram bucket mapping
+// Values below 16 map 1:1, above that the top 5 significant bits
+// select the bucket: index = (shift + 1) * 16 + (v >> shift) - 16
+// ------------------------------------------------------------
+static int bucketIndex(uint64_t v)
+{
+    if (v < STATS_SUB_COUNT)
+        return (int)v;
+
+    int exp = 63 - __builtin_clzll(v);
+    if (exp > STATS_MAX_EXP) {
+        exp = STATS_MAX_EXP;
+        v   = (1ull << (STATS_MAX_EXP + 1)) - 1;
+    }
+
+    int shift = exp - STATS_SUB_BITS;
+    return (shift + 1) * STATS_SUB_COUNT + (int)(v >> shift) - STATS_SUB_COUNT;
+}
+
+// Highest value that still maps to bucket idx
+static uint64_t bucketUpperValue(int idx)
+{
+    if (idx < STATS_SUB_COUNT)
+        return (uint64_t)idx;
+
+    int shift = idx / STATS_SUB_COUNT - 1;
+    int sub   = idx % STATS_SUB_COUNT;
+    return ((uint64_t)(STATS_SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+// ------------------------------------------------------------
+// Add one value to a histogram
+// ------------------------------------------------------------
+static void histRecord(StatsHistogram *h, uint64_t v)
+{
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[bucketIndex(v)], 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (v > max &&
+           !__atomic_compare_exchange_n(&h->max, &max, v, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+static int isTransferCommand(int command)
+{
+    return command == CMD_UPLOAD      || command == CMD_DOWNLOAD ||
+           command == CMD_UPLOAD_TREE || command == CMD_DOWNLOAD_TREE;
+}
+
+// ------------------------------------------------------------
+// Record one command
+// ------------------------------------------------------------
+void statsRecordCommand(int command, int status, uint64_t elapsedNs,
+                        uint64_t bytesIn, uint64_t bytesOut)
+{
+    if (!gStats)
+        return;
+
+    if (command < 0 || command >= STATS_MAX_COMMANDS)
+        command = STATS_MAX_COMMANDS - 1;
+
+    CommandStats *c = &gStats->commands[command];
+
+    int slot = (status >= 0 && status < STATS_STATUSES - 1) ? status : STATS_STATUSES - 1;
+
+    __atomic_fetch_add(&c->count, 1, __ATOMIC_RELAXED);
+    if (status != STATUS_OK)
+        __atomic_fetch_add(&c->errors, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->statuses[slot], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->bytesIn, bytesIn, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->bytesOut, bytesOut, __ATOMIC_RELAXED);
+    histRecord(&c->latency, elapsedNs);
+
+    // Throughput of successful transfers (headers included, they are tiny)
+    uint64_t bytes = bytesIn + bytesOut;
+    if (isTransferCommand(command) && status == STATUS_OK &&
+        elapsedNs > 0 && bytes >= STATS_MIN_TRANSFER)
+        histRecord(&c->throughput,
+                   (uint64_t)((double)bytes * 1000000000.0 / (double)elapsedNs));
+}
+
+// ------------------------------------------------------------
+// Sessions, fork and lock wait
+// ------------------------------------------------------------
+void statsSessionStarted(uint64_t forkNs)
+{
+    if (!gStats)
+        return;
+
+    __atomic_fetch_add(&gStats->activeSessions, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&gStats->sessionsTotal, 1, __ATOMIC_RELAXED);
+    histRecord(&gStats->forkLatency, forkNs);
+}
+
+void statsSessionEnded(void)
+{
+    if (gStats)
+        __atomic_fetch_sub(&gStats->activeSessions, 1, __ATOMIC_RELAXED);
+}
+
+void statsCommandStart(int command)
+{
+    currentCommand = (command >= 0 && command < STATS_MAX_COMMANDS)
+                   ? command : STATS_MAX_COMMANDS - 1;
+}
+
+void statsRecordLockWait(int kind, uint64_t waitNs)
+{
+    if (gStats && (kind == STATS_LOCK_READ || kind == STATS_LOCK_WRITE))
+        histRecord(&gStats->lockWait[kind], waitNs);
+}
+
+// Find or claim the slot for a path (NULL when the table is full)
+static LockPathStats *lockPathSlot(const char *path)
+{
+    uint64_t key = hashBytes(HASH_SEED, path, (long)strlen(path));
+    if (key == 0)
+        key = 1;
+
+    for (int i = 0; i < STATS_LOCK_PATHS; i++) {
+        LockPathStats *e = &gStats->lockPaths[(key + i) % STATS_LOCK_PATHS];
+
+        uint64_t cur = __atomic_load_n(&e->key, __ATOMIC_ACQUIRE);
+        if (cur == key)
+            return e;
+
+        if (cur == 0) {
+            uint64_t expected = 0;
+            if (__atomic_compare_exchange_n(&e->key, &expected, key, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                snprintf(e->path, sizeof(e->path), "%s", path);
+                __atomic_store_n(&e->ready, 1, __ATOMIC_RELEASE);
+                return e;
+            }
+            if (expected == key)
+                return e;
+        }
+    }
+    return NULL;
+}
+
+void statsRecordLockContention(int kind, const char *path, uint64_t waitNs,
+                               int heldByWriter)
+{
+    if (!gStats || (kind != STATS_LOCK_READ && kind != STATS_LOCK_WRITE))
+        return;
+
+    __atomic_fetch_add(&gStats->lockContended[kind], 1, __ATOMIC_RELAXED);
+
+    CommandStats *c = &gStats->commands[currentCommand];
+    __atomic_fetch_add(&c->lockWaits, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->lockWaitNs, waitNs, __ATOMIC_RELAXED);
+
+    LockPathStats *e = lockPathSlot(path ? path : "?");
+    if (!e) {
+        __atomic_fetch_add(&gStats->lockPathsFull, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_fetch_add(&e->waits[kind], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&e->waitNs[kind], waitNs, __ATOMIC_RELAXED);
+    if (heldByWriter)
+        __atomic_fetch_add(&e->heldByWriter, 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&e->maxNs, __ATOMIC_RELAXED);
+    while (waitNs > max &&
+           !__atomic_compare_exchange_n(&e->maxNs, &max, waitNs, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+const ServerStats *statsShared(void)
+{
+    return gStats;
+}
+
+// Only safe while nobody records (bench, between runs)
+void statsReset(void)
+{
+    if (!gStats)
+        return;
+
+    uint64_t startTime = gStats->startTime;
+    memset(gStats, 0, sizeof(ServerStats));
+    gStats->startTime = startTime;
+}
+
+// ------------------------------------------------------------
+// Command names for reports
+// ------------------------------------------------------------
+const char *statsCommandName(int command)
+{
+    switch (command) {
+        case CMD_EXIT:          return "exit";
+        case CMD_LOGIN:         return "login";
+        case CMD_CREATE_USER:   return "create_user";
+        case CMD_CD:            return "cd";
+        case CMD_LIST:          return "list";
+        case CMD_CREATE:        return "create";
+        case CMD_CHMOD:         return "chmod";
+        case CMD_MOVE:          return "move";
+        case CMD_DELETE:        return "delete";
+        case CMD_READ:          return "read";
+        case CMD_WRITE:         return "write";
+        case CMD_UPLOAD:        return "upload";
+        case CMD_DOWNLOAD:      return "download";
+        case CMD_DELETE_USER:   return "delete_user";
+        case CMD_COMPRESS:      return "compress";
+        case CMD_COPY:          return "copy";
+        case CMD_UPLOAD_TREE:   return "upload_tree";
+        case CMD_DOWNLOAD_TREE: return "download_tree";
+        case CMD_STATS:         return "stats";
+        case CMD_WATCH:         return "watch";
+        case CMD_FIND:          return "find";
+        case CMD_DU:            return "du";
+        case CMD_STAT_MANY:     return "stat_many";
+        case CMD_BATCH:         return "batch";
+        default:                return "other";
+    }
+}
+
+// Percentile from a snapshot of the buckets (p in 0..100)
+static uint64_t percentile(const uint64_t *buckets, uint64_t total, double p)
+{
+    uint64_t rank = (uint64_t)(total * p / 100.0 + 0.5);
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank)
+            return bucketUpperValue(i);
+    }
+    return bucketUpperValue(STATS_BUCKETS - 1);
+}
+
+// Snapshot of the buckets, returns the number of samples in it
+static uint64_t histSnapshot(const StatsHistogram *h, uint64_t *snap)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        snap[i] = __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+        total  += snap[i];
+    }
+    return total;
+}
+
+static double histAverage(const StatsHistogram *h)
+{
+    uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    if (count == 0)
+        return 0.0;
+    return (double)__atomic_load_n(&h->sum, __ATOMIC_RELAXED) / (double)count;
+}
+
+uint64_t statsPercentile(const StatsHistogram *h, double p)
+{
+    uint64_t snap[STATS_BUCKETS];
+    uint64_t total = histSnapshot(h, snap);
+    if (total == 0)
+        return 0;
+
+    // Bucket upper bounds never exceed the real maximum
+    uint64_t v   = percentile(snap, total, p);
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    return (v > max) ? max : v;
+}
+
+// ------------------------------------------------------------
+// Text report
+// ------------------------------------------------------------
+int statsFormat(char *buf, int size)
+{
+    int len = 0;
+
+#define APPEND(...) \
+    do { \
+        if (len < size) \
+            len += snprintf(buf + len, size - len, __VA_ARGS__); \
+    } while (0)
+
+    if (size <= 0)
+        return 0;
+    buf[0] = '\0';
+
+    if (!gStats) {
+        APPEND("Statistics are not available\n");
+        return len < size ? len : size - 1;
+    }
+
+    APPEND("Uptime: %llus   (latency in microseconds)\n",
+           (unsigned long long)((uint64_t)time(NULL) - gStats->startTime));
+    APPEND("%-14s %9s %7s %9s %9s %9s %9s %9s %12s %12s\n",
+           "COMMAND", "COUNT", "ERRORS", "AVG", "P50", "P90", "P99", "MAX",
+           "BYTES_IN", "BYTES_OUT");
+
+    for (int cmd = 0; cmd < STATS_MAX_COMMANDS; cmd++) {
+        CommandStats *c = &gStats->commands[cmd];
+
+        uint64_t count = __atomic_load_n(&c->count, __ATOMIC_RELAXED);
+        if (count == 0)
+            continue;
+
+        uint64_t maxNs = __atomic_load_n(&c->latency.max, __ATOMIC_RELAXED);
+        uint64_t p50   = statsPercentile(&c->latency, 50.0);
+        uint64_t p90   = statsPercentile(&c->latency, 90.0);
+        uint64_t p99   = statsPercentile(&c->latency, 99.0);
+
+        APPEND("%-14s %9llu %7llu %9.1f %9.1f %9.1f %9.1f %9.1f %12llu %12llu\n",
+               statsCommandName(cmd),
+               (unsigned long long)count,
+               (unsigned long long)__atomic_load_n(&c->errors, __ATOMIC_RELAXED),
+               histAverage(&c->latency) / 1000.0,
+               p50 / 1000.0,
+               p90 / 1000.0,
+               p99 / 1000.0,
+               maxNs / 1000.0,
+               (unsigned long long)__atomic_load_n(&c->bytesIn, __ATOMIC_RELAXED),
+               (unsigned long long)__atomic_load_n(&c->bytesOut, __ATOMIC_RELAXED));
+    }
+
+    APPEND("\nSessions: %lld active, %llu total   fork: avg %.1f p99 %.1f max %.1f\n",
+           (long long)__atomic_load_n(&gStats->activeSessions, __ATOMIC_RELAXED),
+           (unsigned long long)__atomic_load_n(&gStats->sessionsTotal, __ATOMIC_RELAXED),
+           histAverage(&gStats->forkLatency) / 1000.0,
+           statsPercentile(&gStats->forkLatency, 99.0) / 1000.0,
+           __atomic_load_n(&gStats->forkLatency.max, __ATOMIC_RELAXED) / 1000.0);
+
+    for (int kind = STATS_LOCK_READ; kind <= STATS_LOCK_WRITE; kind++) {
+        const StatsHistogram *h = &gStats->lockWait[kind];
+        APPEND("Lock wait (%s): %llu locks   avg %.1f p99 %.1f max %.1f\n",
+               kind == STATS_LOCK_READ ? "read" : "write",
+               (unsigned long long)__atomic_load_n(&h->count, __ATOMIC_RELAXED),
+               histAverage(h) / 1000.0,
+               statsPercentile(h, 99.0) / 1000.0,
+               __atomic_load_n(&h->max, __ATOMIC_RELAXED) / 1000.0);
+    }
+
+#undef APPEND
+
+    return len < size ? len : size - 1;
+}
+
+// ------------------------------------------------------------
+// Lock contention report
+// ------------------------------------------------------------
+typedef struct {
+    const LockPathStats *entry;
+    uint64_t             totalNs;
+} LockRank;
+
+static int byTotalDesc(const void *a, const void *b)
+{
+    uint64_t x = ((const LockRank *)a)->totalNs;
+    uint64_t y = ((const LockRank *)b)->totalNs;
+    return (x < y) - (x > y);
+}
+
+int statsFormatLocks(char *buf, int size, int top)
+{
+    int len = 0;
+
+#define APPEND(...) \
+    do { \
+        if (len < size) \
+            len += snprintf(buf + len, size - len, __VA_ARGS__); \
+    } while (0)
+
+    if (size <= 0)
+        return 0;
+    buf[0] = '\0';
+
+    if (!gStats) {
+        APPEND("Statistics are not available\n");
+        return len < size ? len : size - 1;
+    }
+
+    APPEND("Contended locks: %llu read, %llu write   (wait in milliseconds)\n",
+           (unsigned long long)__atomic_load_n(&gStats->lockContended[STATS_LOCK_READ], __ATOMIC_RELAXED),
+           (unsigned long long)__atomic_load_n(&gStats->lockContended[STATS_LOCK_WRITE], __ATOMIC_RELAXED));
+
+    // Per command
+    APPEND("\n%-14s %9s %12s %12s\n", "COMMAND", "WAITS", "TOTAL_WAIT", "AVG_WAIT");
+    for (int cmd = 0; cmd < STATS_MAX_COMMANDS; cmd++) {
+        const CommandStats *c = &gStats->commands[cmd];
+        uint64_t waits = __atomic_load_n(&c->lockWaits, __ATOMIC_RELAXED);
+        if (waits == 0)
+            continue;
+
+        uint64_t ns = __atomic_load_n(&c->lockWaitNs, __ATOMIC_RELAXED);
+        APPEND("%-14s %9llu %12.1f %12.2f\n", statsCommandName(cmd),
+               (unsigned long long)waits, ns / 1e6, ns / 1e6 / waits);
+    }
+
+    // Top-N paths by total wait
+    LockRank ranks[STATS_LOCK_PATHS];
+    int count = 0;
+
+    for (int i = 0; i < STATS_LOCK_PATHS; i++) {
+        const LockPathStats *e = &gStats->lockPaths[i];
+        if (!__atomic_load_n(&e->ready, __ATOMIC_ACQUIRE))
+            continue;
+
+        ranks[count].entry   = e;
+        ranks[count].totalNs = __atomic_load_n(&e->waitNs[STATS_LOCK_READ], __ATOMIC_RELAXED) +
+                               __atomic_load_n(&e->waitNs[STATS_LOCK_WRITE], __ATOMIC_RELAXED);
+        count++;
+    }
+
+    qsort(ranks, count, sizeof(ranks[0]), byTotalDesc);
+    if (top > 0 && count > top)
+        count = top;
+
+    APPEND("\n%8s %8s %10s %10s %10s %9s  %s\n",
+           "R_WAITS", "W_WAITS", "R_WAIT", "W_WAIT", "MAX", "BEHIND_W", "PATH");
+    for (int i = 0; i < count; i++) {
+        const LockPathStats *e = ranks[i].entry;
+        APPEND("%8llu %8llu %10.1f %10.1f %10.1f %9llu  %s\n",
+               (unsigned long long)__atomic_load_n(&e->waits[STATS_LOCK_READ], __ATOMIC_RELAXED),
+               (unsigned long long)__atomic_load_n(&e->waits[STATS_LOCK_WRITE], __ATOMIC_RELAXED),
+               __atomic_load_n(&e->waitNs[STATS_LOCK_READ], __ATOMIC_RELAXED) / 1e6,
+               __atomic_load_n(&e->waitNs[STATS_LOCK_WRITE], __ATOMIC_RELAXED) / 1e6,
+               __atomic_load_n(&e->maxNs, __ATOMIC_RELAXED) / 1e6,
+               (unsigned long long)__atomic_load_n(&e->heldByWriter, __ATOMIC_RELAXED),
+               e->path);
+    }
+
+    uint64_t full = __atomic_load_n(&gStats->lockPathsFull, __ATOMIC_RELAXED);
+    if (full > 0)
+        APPEND("(%llu contended acquisition(s) on untracked paths, table full)\n",
+               (unsigned long long)full);
+
+#undef APPEND
+
+    return len < size ? len : size - 1;
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "../../include/trace.h"
+#include "../../include/stats.h"
+#include "../../include/log.h"
+
+#define TRACE_BUF_SIZE   (1024 * 1024)   // Events of one request
+#define TRACE_EVENT_MAX  1024            // Room reserved per event
+#define TRACE_DETAIL_MAX 256             // Longest detail string kept
+#define TRACE_PATH_SIZE  4096
+
+int gTraceActive = 0;
+
+// Configuration (main process, inherited)
+static int    traceEnabled = 0;
+static double traceSample  = 1.0;
+static char   traceDir[TRACE_PATH_SIZE];
+
+// Per session process
+static int      traceFd   = -1;
+static off_t    tailPos   = 0;           // Where the closing "]" starts
+static char    *buf       = NULL;
+static int      bufLen    = 0;
+static int      dropped   = 0;
+static int      reqCommand = 0;
+static uint64_t reqStart  = 0;
+
+// ------------------------------------------------------------
+// Setup
+// ------------------------------------------------------------
+void traceInit(void)
+{
+    const char *dir = getenv("FILESERVER_TRACE_DIR");
+    if (!dir || !dir[0])
+        return;
+
+    const char *sample = getenv("FILESERVER_TRACE_SAMPLE");
+    if (sample && sample[0]) {
+        traceSample = atof(sample);
+        if (traceSample <= 0.0)
+            return;
+    }
+
+    snprintf(traceDir, sizeof(traceDir), "%s", dir);
+    traceEnabled = 1;
+
+    printf("[TRACE] Tracing %.4g of requests into %s/trace-<pid>.json\n",
+           traceSample > 1.0 ? 1.0 : traceSample, traceDir);
+}
+
+uint64_t traceClock(void)
+{
+    return statsNow();
+}
+
+void traceSessionStart(void)
+{
+    if (!traceEnabled)
+        return;
+
+    char path[TRACE_PATH_SIZE + 32];
+    snprintf(path, sizeof(path), "%s/trace-%d.json", traceDir, (int)getpid());
+
+    buf = malloc(TRACE_BUF_SIZE);
+    traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+
+    if (!buf || traceFd < 0) {
+        logWarn("[TRACE] Cannot create '%s', tracing off for this session", path);
+        free(buf);
+        buf = NULL;
+        if (traceFd >= 0)
+            close(traceFd);
+        traceFd = -1;
+        return;
+    }
+
+    // Process name row in the viewer, then an always-valid closing bracket
+    char head[256];
+    int n = snprintf(head, sizeof(head),
+                     "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                     "\"args\":{\"name\":\"session %d\"}}",
+                     (int)getpid(), (int)getpid(), (int)getpid());
+
+    if (pwrite(traceFd, head, n, 0) != n || pwrite(traceFd, "\n]\n", 3, n) != 3) {
+        close(traceFd);
+        traceFd = -1;
+        return;
+    }
+    tailPos = n;
+
+    srand48((long)getpid() ^ (long)time(NULL));
+}
+
+// ------------------------------------------------------------
+// Event buffer
+// ------------------------------------------------------------
+static void appendEscaped(const char *s)
+{
+    const char *end = s + strnlen(s, TRACE_DETAIL_MAX);
+
+    for (; s < end && bufLen < TRACE_BUF_SIZE - 8; s++) {
+        unsigned char c = (unsigned char)*s;
+
+        if (c == '"' || c == '\\') {
+            buf[bufLen++] = '\\';
+            buf[bufLen++] = (char)c;
+        } else if (c < 0x20) {
+            bufLen += snprintf(buf + bufLen, 8, "\\u%04x", c);
+        } else {
+            buf[bufLen++] = (char)c;
+        }
+    }
+}
+
+static void appendf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void appendf(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + bufLen, TRACE_BUF_SIZE - bufLen, fmt, ap);
+    va_end(ap);
+
+    if (n > 0)
+        bufLen += (n < TRACE_BUF_SIZE - bufLen) ? n : TRACE_BUF_SIZE - bufLen - 1;
+}
+
+// Complete event ("ph":"X"), args object left open
+static void appendEvent(const char *name, const char *cat, uint64_t start, uint64_t end)
+{
+    int pid = (int)getpid();
+
+    appendf(",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":%d,\"tid\":%d,\"args\":{",
+            name, cat, start / 1000.0, (end - start) / 1000.0, pid, pid);
+}
+
+void traceSpan(uint64_t start, const char *name, const char *detail, long long bytes)
+{
+    if (!gTraceActive)
+        return;
+
+    uint64_t end = traceClock();
+
+    if (bufLen > TRACE_BUF_SIZE - TRACE_EVENT_MAX) {
+        dropped++;
+        return;
+    }
+
+    appendEvent(name, "phase", start, end);
+
+    const char *sep = "";
+    if (detail) {
+        appendf("\"detail\":\"");
+        appendEscaped(detail);
+        appendf("\"");
+        sep = ",";
+    }
+    if (bytes >= 0)
+        appendf("%s\"bytes\":%lld", sep, bytes);
+    appendf("}}");
+}
+
+// ------------------------------------------------------------
+// Request boundaries
+// ------------------------------------------------------------
+void traceRequestStart(int command)
+{
+    if (traceFd < 0)
+        return;
+
+    if (traceSample < 1.0 && drand48() >= traceSample)
+        return;
+
+    gTraceActive = 1;
+    reqCommand   = command;
+    reqStart     = traceClock();
+    bufLen       = 0;
+    dropped      = 0;
+}
+
+void traceRequestEnd(const char *arg, int status,
+                     unsigned long long bytesIn, unsigned long long bytesOut)
+{
+    if (!gTraceActive)
+        return;
+
+    gTraceActive = 0;
+
+    // Room for this event was kept free by traceSpan()
+    appendEvent(statsCommandName(reqCommand), "request", reqStart, traceClock());
+    appendf("\"arg\":\"");
+    appendEscaped(arg ? arg : "");
+    appendf("\",\"status\":%d,\"bytes_in\":%llu,\"bytes_out\":%llu,\"dropped_spans\":%d}}",
+            status, bytesIn, bytesOut, dropped);
+    appendf("\n]\n");
+
+    // Overwrite the previous closing bracket
+    if (pwrite(traceFd, buf, bufLen, tailPos) == bufLen)
+        tailPos += bufLen - 3;
+}
@@ -5,6 +5,9 @@
 #include <unistd.h>
 #include <dirent.h>   // for opendir / readdir
 #include <unistd.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <sys/mman.h>
 
 #include "../../include/utils.h"
 #include "../../include/session.h"
@@ -55,6 +58,20 @@ int generateId()
     return rand() % 1000000;
 }
 
+// ------------------------------------------------------------
+// FNV-1a over a buffer (start with HASH_SEED)
+// ------------------------------------------------------------
+unsigned long long hashBytes(unsigned long long h, const void *data, long len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+
+    for (long i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
 // ------------------------------------------------------------
 // Check whether a file or directory exists
 // ------------------------------------------------------------
@@ -123,3 +140,72 @@ int removeRecursive(const char *path)
 
     return 0;
 }
+
+// =======================================================
+//   File mappings
+// =======================================================
+const char *mapFileRange(int fd, long long offset, long long len, FileMap *map)
+{
+    map->base   = NULL;
+    map->length = 0;
+    if (len <= 0)
+        return NULL;
+
+    // Mappings start on a page boundary
+    long long start = offset & ~((long long)sysconf(_SC_PAGESIZE) - 1);
+    size_t length = (size_t)(offset - start + len);
+
+    void *p = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, (off_t)start);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    // Pages behind the reader can go early, the ones ahead are read now
+    madvise(p, length, MADV_SEQUENTIAL);
+    madvise(p, length, MADV_WILLNEED);
+
+    map->base   = p;
+    map->length = length;
+    return (const char *)p + (offset - start);
+}
+
+void unmapFileRange(FileMap *map)
+{
+    if (map->base)
+        munmap(map->base, map->length);
+    map->base   = NULL;
+    map->length = 0;
+}
+
+// SIGBUS is delivered to the faulting thread: the jump target is per thread
+static __thread sigjmp_buf mapFault;
+static __thread volatile sig_atomic_t mapGuarded = 0;
+
+static void onMapFault(int sig)
+{
+    if (mapGuarded)
+        siglongjmp(mapFault, 1);
+
+    // Not ours: fault again with the default action
+    signal(sig, SIG_DFL);
+}
+
+int runMapGuarded(int (*fn)(void *ctx), void *ctx)
+{
+    static int installed = 0;
+    if (!installed) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = onMapFault;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGBUS, &sa, NULL);
+        installed = 1;
+    }
+
+    volatile int rc = -1;
+    if (sigsetjmp(mapFault, 1) == 0) {
+        mapGuarded = 1;
+        rc = fn(ctx);
+    }
+    mapGuarded = 0;
+    return rc;
+}
@@ -0,0 +1,547 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "../../include/watch.h"
+#include "../../include/protocol.h"
+#include "../../include/payload.h"
+#include "../../include/sessionTable.h"
+#include "../../include/stats.h"
+
+#define WATCH_EVENTS  (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB |    \
+                       IN_MOVED_FROM | IN_MOVED_TO |                      \
+                       IN_DELETE_SELF | IN_MOVE_SELF |                    \
+                       IN_ONLYDIR | IN_EXCL_UNLINK)
+
+enum { EV_CREATE, EV_MODIFY, EV_ATTRIB, EV_DELETE, EV_MOVE };
+
+static const char *eventNames[] = { "CREATE", "MODIFY", "ATTRIB", "DELETE", "MOVE" };
+
+typedef struct {
+    int   wd;
+    char *path;                       // Relative to the watched directory, "" = top
+} WatchDir;
+
+typedef struct {
+    int   type;                       // EV_*
+    char *path;
+    char *to;                         // EV_MOVE only
+} WatchEvent;
+
+struct Watch {
+    int        fd;                    // inotify instance
+    int        topFd;                 // Watched directory
+    int        recursive;
+    WatchDir  *dirs;
+    int        dirCount;
+    WatchEvent queue[WATCH_QUEUE_MAX];
+    int        queued;
+    int        overflow;              // Events lost since the last batch
+    int        gone;                  // Watched directory deleted / moved
+};
+
+// ------------------------------------------------------------
+// Watched directories
+// ------------------------------------------------------------
+static WatchDir *findDir(Watch *w, int wd)
+{
+    for (int i = 0; i < w->dirCount; i++)
+        if (w->dirs[i].wd == wd)
+            return &w->dirs[i];
+    return NULL;
+}
+
+static char *joinPath(const char *dir, const char *name, int isDir)
+{
+    size_t n = strlen(dir) + strlen(name) + 3;
+    char *p = malloc(n);
+    if (p)
+        snprintf(p, n, "%s%s%s%s", dir, dir[0] ? "/" : "", name, isDir ? "/" : "");
+    return p;
+}
+
+static int isLockName(const char *name)
+{
+    return strstr(name, ".lock") != NULL;
+}
+
+static void queueEvent(Watch *w, int type, char *path, char *to);
+
+// Watch through the descriptor: the inode we opened, no path walk
+static int addDir(Watch *w, int fd, const char *rel)
+{
+    if (w->dirCount >= WATCH_MAX_DIRS) {
+        errno = E2BIG;
+        return -1;
+    }
+
+    char proc[64];
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+    int wd = inotify_add_watch(w->fd, proc, WATCH_EVENTS);
+    if (wd < 0)
+        return -1;
+
+    // Same inode again (kernel returns the existing watch)
+    WatchDir *d = findDir(w, wd);
+    if (d)
+        return 0;
+
+    char *copy = strdup(rel);
+    if (!copy) {
+        inotify_rm_watch(w->fd, wd);
+        return -1;
+    }
+
+    w->dirs[w->dirCount].wd   = wd;
+    w->dirs[w->dirCount].path = copy;
+    w->dirCount++;
+    return 0;
+}
+
+// Watch fd and everything below it. A directory that appeared while
+// we were watching may already have entries: report them as created.
+static int addTree(Watch *w, int fd, const char *rel, int report)
+{
+    if (addDir(w, fd, rel) < 0)
+        return -1;
+
+    if (!w->recursive && !report)
+        return 0;
+
+    int dup = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    DIR *dir = dup >= 0 ? fdopendir(dup) : NULL;
+    if (!dir) {
+        if (dup >= 0)
+            close(dup);
+        return 0;
+    }
+
+    int rc = 0;
+    struct dirent *entry;
+    while (rc == 0 && (entry = readdir(dir)) != NULL) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..") ||
+            isLockName(entry->d_name))
+            continue;
+
+        int isDir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            isDir = fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                    S_ISDIR(st.st_mode);
+        }
+
+        if (report)
+            queueEvent(w, EV_CREATE, joinPath(rel, entry->d_name, isDir), NULL);
+
+        if (!isDir || !w->recursive)
+            continue;
+
+        // Unreadable subdirectories are simply not watched
+        int sub = openat(fd, entry->d_name,
+                         O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (sub < 0)
+            continue;
+
+        char *subRel = joinPath(rel, entry->d_name, 0);
+        if (subRel)
+            rc = addTree(w, sub, subRel, report);
+        free(subRel);
+        close(sub);
+    }
+
+    closedir(dir);
+    return rc;
+}
+
+static int underPath(const char *path, const char *dir, size_t dirLen)
+{
+    return strncmp(path, dir, dirLen) == 0 && (path[dirLen] == '\0' || path[dirLen] == '/');
+}
+
+// Directory moved out of the tree: stop watching its subtree
+static void removeTree(Watch *w, const char *rel)
+{
+    size_t len = strlen(rel);
+
+    for (int i = 0; i < w->dirCount; ) {
+        if (w->dirs[i].path[0] && underPath(w->dirs[i].path, rel, len)) {
+            inotify_rm_watch(w->fd, w->dirs[i].wd);
+            free(w->dirs[i].path);
+            w->dirs[i] = w->dirs[--w->dirCount];
+            continue;
+        }
+        i++;
+    }
+}
+
+// Directory renamed inside the tree: its watches stay, paths change
+static void renameTree(Watch *w, const char *from, const char *to)
+{
+    size_t len = strlen(from);
+
+    for (int i = 0; i < w->dirCount; i++) {
+        if (!w->dirs[i].path[0] || !underPath(w->dirs[i].path, from, len))
+            continue;
+
+        const char *rest = w->dirs[i].path + len;       // "" or "/sub..."
+        size_t n = strlen(to) + strlen(rest) + 1;
+        char *p = malloc(n);
+        if (!p)
+            continue;
+
+        snprintf(p, n, "%s%s", to, rest);
+        free(w->dirs[i].path);
+        w->dirs[i].path = p;
+    }
+}
+
+// ------------------------------------------------------------
+// Coalescing queue
+// ------------------------------------------------------------
+static void dropQueued(Watch *w, int i)
+{
+    free(w->queue[i].path);
+    free(w->queue[i].to);
+    memmove(&w->queue[i], &w->queue[i + 1], sizeof(WatchEvent) * (w->queued - i - 1));
+    w->queued--;
+}
+
+// Takes ownership of path / to
+static void queueEvent(Watch *w, int type, char *path, char *to)
+{
+    if (!path || (type == EV_MOVE && !to)) {
+        w->overflow = 1;
+        free(path);
+        free(to);
+        return;
+    }
+
+    if (type == EV_MODIFY || type == EV_ATTRIB) {
+        // Implied by a pending create, or already pending
+        for (int i = 0; i < w->queued; i++) {
+            WatchEvent *e = &w->queue[i];
+            if (strcmp(e->path, path) == 0 && (e->type == EV_CREATE || e->type == type)) {
+                free(path);
+                return;
+            }
+        }
+    }
+
+    if (type == EV_DELETE) {
+        // Changes to the deleted entry are moot; created and deleted
+        // within one batch, nobody needs to hear about it
+        int created = 0;
+        for (int i = w->queued - 1; i >= 0; i--) {
+            WatchEvent *e = &w->queue[i];
+            if (e->type == EV_MOVE || strcmp(e->path, path) != 0)
+                continue;
+            if (e->type == EV_DELETE)
+                break;
+            created |= e->type == EV_CREATE;
+            dropQueued(w, i);
+        }
+        if (created) {
+            free(path);
+            return;
+        }
+    }
+
+    if (w->queued == WATCH_QUEUE_MAX) {
+        w->overflow = 1;
+        free(path);
+        free(to);
+        return;
+    }
+
+    w->queue[w->queued].type = type;
+    w->queue[w->queued].path = path;
+    w->queue[w->queued].to   = to;
+    w->queued++;
+}
+
+// ------------------------------------------------------------
+// inotify events
+// ------------------------------------------------------------
+// Open a watched directory by its relative path, one component at a
+// time without following symlinks
+static int openRel(Watch *w, const char *rel)
+{
+    int fd = fcntl(w->topFd, F_DUPFD_CLOEXEC, 0);
+    char part[256];
+
+    while (fd >= 0 && *rel) {
+        size_t n = strcspn(rel, "/");
+        if (n >= sizeof(part)) {
+            close(fd);
+            return -1;
+        }
+        memcpy(part, rel, n);
+        part[n] = '\0';
+        rel += n + (rel[n] == '/');
+
+        int next = openat(fd, part, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        close(fd);
+        fd = next;
+    }
+    return fd;
+}
+
+// Entry that was moved out of the tree (move-from without a move-to)
+static void movedOut(Watch *w, char *path, char *rel)
+{
+    if (rel && w->recursive)
+        removeTree(w, rel);
+    queueEvent(w, EV_DELETE, path, NULL);
+    free(rel);
+}
+
+static void handleEvents(Watch *w)
+{
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    ssize_t n;
+    while ((n = read(w->fd, buf, sizeof(buf))) > 0) {
+        // A rename is two consecutive events sharing a cookie
+        char    *fromPath   = NULL;
+        char    *fromRel    = NULL;
+        uint32_t fromCookie = 0;
+
+        for (char *p = buf; p < buf + n; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            p += sizeof(*ev) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                w->overflow = 1;
+                continue;
+            }
+
+            WatchDir *d = findDir(w, ev->wd);
+            if (!d)
+                continue;
+
+            if (ev->mask & IN_IGNORED) {
+                // Watch gone (directory deleted): forget it
+                free(d->path);
+                *d = w->dirs[--w->dirCount];
+                continue;
+            }
+
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                // Subdirectories are reported by their parent
+                if (!d->path[0])
+                    w->gone = 1;
+                continue;
+            }
+
+            if (ev->len == 0 || isLockName(ev->name))
+                continue;
+
+            int   isDir = (ev->mask & IN_ISDIR) != 0;
+            char *path  = joinPath(d->path, ev->name, isDir);
+            char *rel   = isDir ? joinPath(d->path, ev->name, 0) : NULL;
+
+            if (fromPath && !((ev->mask & IN_MOVED_TO) && ev->cookie == fromCookie)) {
+                movedOut(w, fromPath, fromRel);
+                fromPath = fromRel = NULL;
+            }
+
+            if (ev->mask & IN_MOVED_FROM) {
+                fromPath   = path;
+                fromRel    = rel;
+                fromCookie = ev->cookie;
+                continue;
+            }
+
+            if ((ev->mask & IN_MOVED_TO) && fromPath) {
+                if (rel && fromRel && w->recursive)
+                    renameTree(w, fromRel, rel);
+                queueEvent(w, EV_MOVE, fromPath, path);
+                free(fromRel);
+                fromPath = fromRel = NULL;
+            }
+            else if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                queueEvent(w, EV_CREATE, path, NULL);
+
+                // New directory: watch it, report what is already inside
+                int sub = rel && w->recursive ? openRel(w, rel) : -1;
+                if (sub >= 0) {
+                    if (addTree(w, sub, rel, 1) < 0)
+                        w->overflow = 1;
+                    close(sub);
+                }
+            }
+            else if (ev->mask & IN_DELETE)
+                queueEvent(w, EV_DELETE, path, NULL);
+            else if (ev->mask & IN_MODIFY)
+                queueEvent(w, EV_MODIFY, path, NULL);
+            else if (ev->mask & IN_ATTRIB)
+                queueEvent(w, EV_ATTRIB, path, NULL);
+            else
+                free(path);
+
+            free(rel);
+        }
+
+        if (fromPath)
+            movedOut(w, fromPath, fromRel);
+    }
+}
+
+// ------------------------------------------------------------
+// Batches
+// ------------------------------------------------------------
+static int sendBatch(Watch *w, int clientFd, WatchStats *stats)
+{
+    size_t size = w->overflow ? sizeof("OVERFLOW\n") : 1;
+    for (int i = 0; i < w->queued; i++)
+        size += strlen(w->queue[i].path) + (w->queue[i].to ? strlen(w->queue[i].to) + 4 : 0) + 10;
+
+    char *text = malloc(size);
+    if (!text)
+        return -1;
+
+    int len = 0;
+    for (int i = 0; i < w->queued; i++) {
+        WatchEvent *e = &w->queue[i];
+        if (e->type == EV_MOVE)
+            len += snprintf(text + len, size - len, "%s %s -> %s\n",
+                            eventNames[e->type], e->path, e->to);
+        else
+            len += snprintf(text + len, size - len, "%s %s\n", eventNames[e->type], e->path);
+    }
+    if (w->overflow) {
+        len += snprintf(text + len, size - len, "OVERFLOW\n");
+        stats->overflows++;
+    }
+
+    stats->events += w->queued + (w->overflow ? 1 : 0);
+    stats->batches++;
+
+    while (w->queued > 0)
+        dropQueued(w, w->queued - 1);
+    w->overflow = 0;
+
+    ProtocolResponse res = { STATUS_OK, len };
+    int rc = (sendResponse(clientFd, &res) < 0 || sendPayload(clientFd, text, len) < 0) ? -1 : 0;
+
+    free(text);
+    return rc;
+}
+
+// ------------------------------------------------------------
+// Public
+// ------------------------------------------------------------
+Watch *watchOpen(int dirFd, int recursive)
+{
+    Watch *w = calloc(1, sizeof(Watch));
+    if (!w)
+        return NULL;
+
+    w->recursive = recursive;
+    w->fd    = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    w->topFd = fcntl(dirFd, F_DUPFD_CLOEXEC, 0);
+    w->dirs  = malloc(sizeof(WatchDir) * WATCH_MAX_DIRS);
+
+    if (w->fd < 0 || w->topFd < 0 || !w->dirs || addTree(w, dirFd, "", 0) < 0) {
+        int saved = errno;
+        watchClose(w);
+        errno = saved;
+        return NULL;
+    }
+
+    return w;
+}
+
+int watchStream(Watch *w, int clientFd, WatchStats *stats)
+{
+    struct pollfd pfds[2] = {
+        { clientFd, POLLIN, 0 },
+        { w->fd,    POLLIN, 0 },
+    };
+
+    memset(stats, 0, sizeof(*stats));
+
+    int closeConnection = 0;
+    uint64_t deadline = 0;
+
+    for (;;) {
+        int timeout = 1000;
+        if (w->queued || w->overflow) {
+            uint64_t now = statsNow();
+            timeout = now >= deadline ? 0 : (int)((deadline - now) / 1000000) + 1;
+        }
+
+        int r = poll(pfds, 2, timeout);
+        if (r < 0)
+            break;                        // Signal (shutdown) or error
+
+        // Any message from the client ends the watch
+        if (pfds[0].revents) {
+            ProtocolMessage msg;
+            if (receiveMessage(clientFd, &msg) < 0)
+                return 1;
+            closeConnection = msg.command == CMD_EXIT;
+            break;
+        }
+
+        if (pfds[1].revents & POLLIN) {
+            int wasEmpty = !w->queued && !w->overflow;
+            handleEvents(w);
+            if (wasEmpty)
+                deadline = statsNow() + (uint64_t)WATCH_COALESCE_MS * 1000000;
+        }
+
+        if ((w->queued || w->overflow) && statsNow() >= deadline &&
+            sendBatch(w, clientFd, stats) < 0)
+            return 1;
+
+        // Our own descriptor keeps a removed directory from raising
+        // IN_DELETE_SELF: a link count of 0 says the same
+        struct stat st;
+        if (!w->gone && fstat(w->topFd, &st) == 0 && st.st_nlink == 0)
+            w->gone = 1;
+
+        if (w->gone || (r == 0 && sessionTableDraining()))
+            break;
+    }
+
+    // Whatever is pending, then the end of the stream
+    if ((w->queued || w->overflow) && sendBatch(w, clientFd, stats) < 0)
+        return 1;
+
+    stats->dirs = w->dirCount;
+
+    ProtocolResponse end = { STATUS_OK, 0 };
+    if (sendResponse(clientFd, &end) < 0)
+        return 1;
+
+    return closeConnection;
+}
+
+void watchClose(Watch *w)
+{
+    if (!w)
+        return;
+
+    for (int i = 0; i < w->queued; i++) {
+        free(w->queue[i].path);
+        free(w->queue[i].to);
+    }
+    for (int i = 0; i < w->dirCount; i++)
+        free(w->dirs[i].path);
+    free(w->dirs);
+
+    if (w->fd >= 0)
+        close(w->fd);
+    if (w->topFd >= 0)
+        close(w->topFd);
+    free(w);
+}